@@ -0,0 +1,104 @@
+#include "aspen.h"
+#include "kernels.h"
+
+// Activation microbenchmark: elements per second of naive_activate and of the vectorized ACTIVATE on an L1/L2 resident 
+// buffer, and the max error of both against a double precision reference over [-20, 20].
+// The error is absolute where |reference| < 1 and relative elsewhere.
+
+static double reference_activate (double x, LAYER_ACT activation)
+{
+    switch (activation)
+    {
+    case RELU:
+        return x > 0 ? x : 0;
+    case LEAKY_RELU:
+        return x > 0 ? x : 0.1 * x;
+    case ELU:
+        return x > 0 ? x : 0.1 * expm1 (x);
+    case SELU:
+        return x > 0 ? 1.0507 * x : 1.0507 * 1.67326 * expm1 (x);
+    case SIGMOID:
+        return 1 / (1 + exp (-x));
+    case TANH:
+        return tanh (x);
+    case GELU:
+        return 0.5 * x * (1 + erf (x * 0.70710678118654752));
+    case GELU_ACCURATE:
+        return 0.5 * x * (1 + tanh (0.79788456080286536 * (x + 0.044715 * x * x * x)));
+    default:
+        return x;
+    }
+}
+
+// Best of num_iter runs of num_rep calls, each on a fresh copy of input. The copies are timed separately and subtracted.
+static double time_activate (void (*activate) (float *, unsigned int, LAYER_ACT),
+    float *buffer, const float *input, unsigned int num_elements, LAYER_ACT activation, unsigned int num_iter)
+{
+    const unsigned int num_rep = 64;
+    double best = 1e9, best_copy = 1e9;
+    for (unsigned int i = 0; i < num_iter; i++)
+    {
+        double start = get_time_secs ();
+        for (unsigned int r = 0; r < num_rep; r++)
+        {
+            memcpy (buffer, input, num_elements * sizeof(float));
+            activate (buffer, num_elements, activation);
+        }
+        double elapsed = get_time_secs () - start;
+        best = elapsed < best ? elapsed : best;
+        start = get_time_secs ();
+        for (unsigned int r = 0; r < num_rep; r++)
+        {
+            memcpy (buffer, input, num_elements * sizeof(float));
+            __asm__ volatile ("" : : "r" (buffer) : "memory");
+        }
+        elapsed = get_time_secs () - start;
+        best_copy = elapsed < best_copy ? elapsed : best_copy;
+    }
+    return (double) num_rep * num_elements / (best - best_copy);
+}
+
+static double max_error (void (*activate) (float *, unsigned int, LAYER_ACT), float *sweep, unsigned int num_sweep, 
+    LAYER_ACT activation)
+{
+    for (unsigned int i = 0; i < num_sweep; i++)
+        sweep[i] = -20.0f + 40.0f * i / num_sweep;
+    activate (sweep, num_sweep, activation);
+    double max_err = 0;
+    for (unsigned int i = 0; i < num_sweep; i++)
+    {
+        const double ref = reference_activate (-20.0f + 40.0f * i / num_sweep, activation);
+        const double err = fabs (sweep[i] - ref) / (fabs (ref) > 1 ? fabs (ref) : 1);
+        max_err = err > max_err ? err : max_err;
+    }
+    return max_err;
+}
+
+int main (int argc, char **argv)
+{
+    const unsigned int num_elements = argc > 1 ? atoi (argv[1]) : 16384;
+    const unsigned int num_iter = argc > 2 ? atoi (argv[2]) : 20;
+    const unsigned int num_sweep = 1 << 22;
+    const LAYER_ACT act_list[] = {RELU, LEAKY_RELU, ELU, SELU, SIGMOID, TANH, GELU, GELU_ACCURATE};
+    float *input = aspen_calloc (num_elements, sizeof(float));
+    float *buffer = aspen_calloc (num_elements, sizeof(float));
+    float *sweep = aspen_calloc (num_sweep, sizeof(float));
+    for (unsigned int i = 0; i < num_elements; i++)
+        input[i] = 16.0f * rand () / RAND_MAX - 8.0f;
+    printf ("%u elements, best of %u runs\n", num_elements, num_iter);
+    printf ("%-14s %14s %14s %8s %12s %12s\n", "activation", "naive elem/s", "vector elem/s", "speedup", 
+        "naive error", "vector error");
+    for (unsigned int a = 0; a < sizeof(act_list) / sizeof(act_list[0]); a++)
+    {
+        const LAYER_ACT activation = act_list[a];
+        const double naive_eps = time_activate (naive_activate, buffer, input, num_elements, activation, num_iter);
+        const double vector_eps = time_activate (ACTIVATE, buffer, input, num_elements, activation, num_iter);
+        printf ("%-14s %14.3e %14.3e %7.2fx %12.2e %12.2e\n", activation_type_str[activation],
+            naive_eps, vector_eps, vector_eps / naive_eps, 
+                max_error (naive_activate, sweep, num_sweep, activation), max_error (ACTIVATE, sweep, num_sweep, activation));
+    }
+    aspen_free (input);
+    aspen_free (buffer);
+    aspen_free (sweep);
+    return 0;
+}
@@ -0,0 +1,170 @@
+#include "aspen.h"
+#include "apu.h"
+#include "nasm.h"
+#include "dse.h"
+#include "kernels.h"
+
+// Per layer SGEMM microbenchmark: time of the conv, FC and matmul ninsts of each layer with the SGEMM macros and
+// with the shape-specialized JIT kernels, on the same NASM and the same tiling, and the max difference of the outputs.
+// Weights are random, so only the cfg file is needed.
+// Usage: bench_jit_sgemm <cfg_file> [batch] [min_ninst_per_ldata] [iters]
+
+static void run_ldata (nasm_ldata_t *ldata, dse_t *dse)
+{
+    for (unsigned int n = 0; n < ldata->num_ninst; n++)
+    {
+        ninst_t *ninst = &ldata->ninst_arr_start[n];
+        switch (ldata->layer->type)
+        {
+        case CONV_LAYER:
+            tiled_conv2d (ninst, dse);
+            break;
+        case MAXPOOL_LAYER:
+            tiled_maxpool2d (ninst, dse);
+            break;
+        case AVGPOOL_LAYER:
+            tiled_avgpool2d (ninst, dse);
+            break;
+        case FC_LAYER:
+            tiled_fully_connected (ninst, dse);
+            break;
+        case RESIDUAL_LAYER:
+            tiled_residual (ninst, dse);
+            break;
+        case SOFTMAX_LAYER:
+            tiled_softmax (ninst, dse);
+            break;
+        case YOLO_LAYER:
+            tiled_yolo (ninst, dse);
+            break;
+        case APPEND_LAYER:
+            tiled_append (ninst, dse);
+            break;
+        case MATMUL_LAYER:
+            tiled_matmul (ninst, dse);
+            break;
+        case LAYERNORM_LAYER:
+            tiled_layernorm (ninst, dse);
+            break;
+        case K_ATTENTION_LAYER:
+            tiled_k_attention (ninst, dse);
+            break;
+        case V_ATTENTION_LAYER:
+            tiled_v_attention (ninst, dse);
+            break;
+        default:
+            break;
+        }
+    }
+}
+
+static double time_ldata (nasm_ldata_t *ldata, dse_t *dse, unsigned int num_iter)
+{
+    double best = 1e9;
+    for (unsigned int i = 0; i < num_iter; i++)
+    {
+        double start = get_time_secs ();
+        run_ldata (ldata, dse);
+        double elapsed = get_time_secs () - start;
+        best = elapsed < best ? elapsed : best;
+    }
+    return best;
+}
+
+static int is_sgemm_ldata (nasm_ldata_t *ldata)
+{
+    const LAYER_TYPE type = ldata->layer->type;
+    return type == CONV_LAYER || type == FC_LAYER || type == MATMUL_LAYER;
+}
+
+int main (int argc, char **argv)
+{
+    if (argc < 2)
+    {
+        printf ("Usage: %s <cfg_file> [batch] [min_ninst_per_ldata] [iters]\n", argv[0]);
+        return 1;
+    }
+    const unsigned int batch = argc > 2 ? atoi (argv[2]) : 1;
+    const unsigned int min_ninst = argc > 3 ? atoi (argv[3]) : 50;
+    const unsigned int num_iter = argc > 4 ? atoi (argv[4]) : 20;
+    aspen_dnn_t *dnn = apu_create_dnn (argv[1], NULL);
+    if (dnn == NULL)
+        return 1;
+    for (unsigned int l = 0; l < dnn->num_layers; l++)
+    {
+        aspen_tensor_t *weight = dnn->layers[l].tensors[WEIGHT_TENSOR];
+        if (weight == NULL || weight->data == NULL || weight->element_size != sizeof(float))
+            continue;
+        for (size_t i = 0; i < weight->num_elements; i++)
+            ((float *) weight->data)[i] = 0.2f * rand () / RAND_MAX - 0.1f;
+    }
+    nasm_t *nasm = apu_create_nasm (dnn, min_ninst, batch);
+    dse_t dse = {0};
+    dse.gpu_idx = -1;
+    dse.scratchpad = aspen_calloc (DSE_SCRATCHPAD_SIZE, 1);
+
+    // One sequential pass fills every out_mat. Outputs are never released here, so each layer can be rerun on its own.
+    nasm_ldata_t *input_ldata = &nasm->ldata_arr[0];
+    size_t input_size = (size_t) input_ldata->out_mat_dims[OUT_H] * input_ldata->out_mat_dims[OUT_W];
+    float *input = aspen_calloc (input_size, sizeof(float));
+    for (size_t i = 0; i < input_size; i++)
+        input[i] = 2.0f * rand () / RAND_MAX - 1.0f;
+    alloc_ldata_out_mat (input_ldata);
+    copy_buffer_to_ldata_out_mat (input_ldata, input);
+    for (unsigned int l = 1; l < nasm->num_ldata; l++)
+        run_ldata (&nasm->ldata_arr[l], &dse);
+
+    double *macro_time = aspen_calloc (nasm->num_ldata, sizeof(double));
+    float **macro_out = aspen_calloc (nasm->num_ldata, sizeof(float *));
+    for (unsigned int l = 0; l < nasm->num_ldata; l++)
+    {
+        nasm_ldata_t *ldata = &nasm->ldata_arr[l];
+        if (!is_sgemm_ldata (ldata))
+            continue;
+        macro_time[l] = time_ldata (ldata, &dse, num_iter);
+        macro_out[l] = aspen_calloc ((size_t) ldata->out_mat_dims[OUT_H] * ldata->out_mat_dims[OUT_W], sizeof(float));
+        copy_ldata_out_mat_to_buffer (ldata, macro_out[l]);
+    }
+
+    double generate_start = get_time_secs ();
+    for (unsigned int i = 0; i < nasm->num_ninst; i++)
+        request_ninst_jit_sgemm (&nasm->ninst_arr[i]);
+    jit_sgemm_generate ();
+    printf ("%s: batch %u, %u ninsts, JIT generation %.2f ms, best of %u runs\n", argv[1], batch, nasm->num_ninst,
+        (get_time_secs () - generate_start) * 1e3, num_iter);
+    printf ("%-6s %-8s %18s %12s %12s %8s %10s\n", "layer", "type", "output (H x W)", "macro ms", "jit ms", "speedup",
+        "max diff");
+    double macro_total = 0, jit_total = 0;
+    for (unsigned int l = 0; l < nasm->num_ldata; l++)
+    {
+        nasm_ldata_t *ldata = &nasm->ldata_arr[l];
+        if (!is_sgemm_ldata (ldata))
+            continue;
+        const double jit_time = time_ldata (ldata, &dse, num_iter);
+        const size_t out_size = (size_t) ldata->out_mat_dims[OUT_H] * ldata->out_mat_dims[OUT_W];
+        float *jit_out = aspen_calloc (out_size, sizeof(float));
+        copy_ldata_out_mat_to_buffer (ldata, jit_out);
+        double max_diff = 0;
+        for (size_t i = 0; i < out_size; i++)
+        {
+            const double diff = fabs ((double) jit_out[i] - macro_out[l][i]);
+            max_diff = diff > max_diff ? diff : max_diff;
+        }
+        printf ("%-6d %-8s %8u x %-7u %12.3f %12.3f %7.2fx %10.2e\n", ldata->layer->layer_idx,
+            layer_type_str[ldata->layer->type], ldata->out_mat_dims[OUT_H], ldata->out_mat_dims[OUT_W],
+                macro_time[l] * 1e3, jit_time * 1e3, macro_time[l] / jit_time, max_diff);
+        macro_total += macro_time[l];
+        jit_total += jit_time;
+        aspen_free (jit_out);
+        aspen_free (macro_out[l]);
+    }
+    printf ("%-6s %-8s %18s %12.3f %12.3f %7.2fx\n", "total", "", "", macro_total * 1e3, jit_total * 1e3,
+        macro_total / jit_total);
+    aspen_free (macro_time);
+    aspen_free (macro_out);
+    aspen_free (input);
+    aspen_free (dse.scratchpad);
+    apu_destroy_nasm (nasm);
+    apu_destroy_dnn (dnn);
+    return 0;
+}
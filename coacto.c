@@ -205,6 +205,7 @@ int main(int argc, char **argv)
             
             target_dnn[i] = apu_load_dnn_from_file(target_dnn_dirs[i]);
             target_nasm[i] = apu_load_nasm_from_file(target_nasm_dirs[i], target_dnn[i]);
+            apu_set_nasm_profiling(target_nasm[i], 1);
         }
     }
     else if (device_mode == DEV_EDGE)
@@ -222,11 +223,13 @@ int main(int argc, char **argv)
 
         target_dnn[device_idx] = apu_load_dnn_from_file(target_dnn_dirs[device_idx]);
         target_nasm[device_idx] = apu_load_nasm_from_file(target_nasm_dirs[device_idx], target_dnn[device_idx]);
+        apu_set_nasm_profiling(target_nasm[device_idx], 1);
     }
     else if (device_mode == DEV_LOCAL)
     {
         target_dnn[device_idx] = apu_load_dnn_from_file(target_dnn_dirs[device_idx]);
         target_nasm[device_idx] = apu_load_nasm_from_file(target_nasm_dirs[device_idx], target_dnn[device_idx]);
+        apu_set_nasm_profiling(target_nasm[device_idx], 1);
     }
 
     /** STAGE: PROFILING COMPUTATION FOR DYNAMIC OFFLOADING*/
@@ -633,7 +636,7 @@ int main(int argc, char **argv)
                     total_received = 0;
                     for(int j = 0; j < target_nasm[edge_id]->num_ninst; j++)
                     {
-                        if(target_nasm[edge_id]->ninst_arr[j].received_time != 0)
+                        if(target_nasm[edge_id]->ninst_prof_arr && target_nasm[edge_id]->ninst_prof_arr[j].received_time != 0)
                             total_received++;
                     }
                     
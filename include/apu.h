@@ -16,7 +16,14 @@ struct aspen_dnn_t
     aspen_layer_t *layers;
     unsigned int num_layers;
     _Atomic unsigned int ref_nasms;
-    
+    int fuse_residual_layernorm;
+    int fuse_attention;
+    int fuse_qkv;
+    int zero_copy_concat;
+    int fuse_conv_residual;
+    int fuse_conv_maxpool;
+    int jit_sgemm;
+    char sgemm_tune_dir [MAX_STRING_LEN];
 };
 
 struct aspen_tensor_t
@@ -52,8 +59,15 @@ void *aspen_load_input(char *input_filename, unsigned int *input_dims, unsigned
 
 void init_aspen_layer (aspen_layer_t *layer, unsigned int layer_num, aspen_dnn_t *dnn);
 void create_layer_tensors (aspen_layer_t *layer);
+unsigned int get_layer_in_c_per_group (aspen_layer_t *layer);
 void create_layer_output_tensor (aspen_layer_t *layer, int gpu_idx);
 void create_layer_col_idx_tensor (aspen_layer_t *layer, int gpu_idx);
+void create_layer_winograd_tensor (aspen_layer_t *layer);
+void create_layer_int8_tensors (aspen_layer_t *layer);
+void destroy_layer_int8_tensors (aspen_layer_t *layer);
+void get_layer_int8_act_params (aspen_layer_t *layer, float *scale, float *zero_point);
+float *get_layer_fp32_weight (aspen_layer_t *layer);
+void put_layer_fp32_weight (aspen_layer_t *layer, float *weight);
 void destroy_aspen_layers (aspen_layer_t* layers, unsigned int num_layers);
 
 aspen_tensor_t *init_aspen_tensor (unsigned int *params_arr, LAYER_PARAMS *order, int num_dims, unsigned int element_size);
@@ -26,7 +26,6 @@
 
 #define MAX_TENSOR_DIMS 8
 #define MAX_STRING_LEN 256
-#define MAX_PARENT_NINST_NUM (1<<16) // 65536
 #define MAX_NUM_GPUS 16
 #define NINST_H_MIN (64)
 #define NINST_W_MIN (12)
@@ -86,10 +85,11 @@ typedef enum {NO_LAYER_TYPE, INPUT_LAYER, CONV_LAYER, FC_LAYER,
 typedef enum {
     OUT_W, OUT_H, OUT_C, BATCH, IN_W, IN_H, IN_C, WEIGHT_W, WEIGHT_H, SUB_C, STRIDE, PADDING, DILATION, GROUPS,
     NUM_HIDDEN, NUM_HEAD, NUM_SEQ, MAT_M, MAT_N, MAT_K, SUB_M, MASKED,
-    FORM_BYTES, NUM_PARAM_ELEMENTS
+    FORM_BYTES, WINOGRAD, NUM_PARAM_ELEMENTS
 } LAYER_PARAMS;
 typedef enum {NULL_TENSOR, OUTPUT_TENSOR, INPUT_TENSOR, WEIGHT_TENSOR, BIAS_TENSOR, COL_IDX_TENSOR, ANCHOR_TENSOR,
-    BN_VAR_TENSOR, BN_MEAN_TENSOR, BN_WEIGHT_TENSOR, NUM_TENSORS} LAYER_TENSORS;
+    BN_VAR_TENSOR, BN_MEAN_TENSOR, BN_WEIGHT_TENSOR, WINOGRAD_WEIGHT_TENSOR,
+    ACT_RANGE_TENSOR, QUANT_WEIGHT_TENSOR, QUANT_SCALE_TENSOR, QUANT_OFFSET_TENSOR, FP16_WEIGHT_TENSOR, NUM_TENSORS} LAYER_TENSORS;
 typedef enum {PARENT_NONE, PARENT_0, PARENT_1, PARENT_WEIGHT, NUM_PARENT_ELEMENTS} LAYER_PARENTS;
 typedef enum {NO_ACTIVATION, SIGMOID, LINEAR, TANH, RELU, LEAKY_RELU, ELU, SELU, GELU, GELU_ACCURATE, NUM_ACTIVATIONS} LAYER_ACT;
 typedef enum {RPOOL_DNN, RPOOL_LAYER_TYPE, RPOOL_LAYER_IDX, RPOOL_NASM, RPOOL_DSE, NUM_RPOOL_CONDS} RPOOL_CONDS;
@@ -109,8 +109,11 @@ typedef struct aspen_layer_t aspen_layer_t;
 typedef struct aspen_tensor_t aspen_tensor_t;
 
 typedef struct ninst_t ninst_t; // Ninst - ASPEN Graph Nodes
+typedef struct ninst_prof_t ninst_prof_t; // Ninst timing & profiling data
 typedef struct nasm_t nasm_t;   // Nasm - ASPEN Graph
 typedef struct nasm_ldata_t nasm_ldata_t; // Dynamic layer data
+typedef struct sgemm_blocking_t sgemm_blocking_t; // SGEMM cache blocking of an ldata
+typedef struct aspen_kv_cache_t aspen_kv_cache_t; // Keys and values of past tokens for incremental decoding
 
 typedef struct rpool_t rpool_t; // Ready pool
 typedef struct rpool_queue_t rpool_queue_t;
@@ -137,16 +140,41 @@ aspen_dnn_t *apu_create_dnn(char *input_path, char *data_path);
 void apu_destroy_dnn(aspen_dnn_t *dnn);
 void apu_save_dnn_to_file(aspen_dnn_t *dnn, char *filename);
 aspen_dnn_t *apu_load_dnn_from_file(char *filename);
-
-nasm_t *apu_generate_nasm (aspen_dnn_t *dnn, unsigned int batch_size, unsigned int num_iter, int gpu_idx);
-nasm_t *apu_generate_transformer_nasm (aspen_dnn_t *dnn, unsigned int batch_size, unsigned int seq_num, unsigned int num_iter, int gpu_idx);
+void apu_calibrate_dnn_int8 (aspen_dnn_t *dnn, unsigned int *input_params, void *input_data);
+void apu_set_dnn_int8 (aspen_dnn_t *dnn, int enable);
+void apu_set_dnn_fp16 (aspen_dnn_t *dnn, int enable);
+void apu_set_dnn_fused_layernorm (aspen_dnn_t *dnn, int enable);
+void apu_set_dnn_fused_attention (aspen_dnn_t *dnn, int enable);
+void apu_set_dnn_fused_qkv (aspen_dnn_t *dnn, int enable);
+void apu_set_dnn_zero_copy_concat (aspen_dnn_t *dnn, int enable);
+void apu_set_dnn_fused_conv_residual (aspen_dnn_t *dnn, int enable);
+void apu_set_dnn_fused_conv_maxpool (aspen_dnn_t *dnn, int enable);
+void apu_set_dnn_jit_sgemm (aspen_dnn_t *dnn, int enable);
+void apu_set_dnn_sgemm_autotune (aspen_dnn_t *dnn, char *cache_dir);
+
+nasm_t *apu_generate_nasm (aspen_dnn_t *dnn, unsigned int batch_size, unsigned int num_iter, unsigned int num_dse, int gpu_idx);
+nasm_t *apu_generate_transformer_nasm (aspen_dnn_t *dnn, unsigned int batch_size, unsigned int seq_num, unsigned int num_iter, 
+    unsigned int num_dse, int gpu_idx);
 nasm_t *apu_create_nasm(aspen_dnn_t *dnn, unsigned int min_ninst_per_ldata, unsigned int batch_size);
 nasm_t *apu_create_transformer_nasm(aspen_dnn_t *dnn, unsigned int min_ninst_per_ldata, unsigned int batch_size, unsigned int seq_num);
+nasm_t **apu_create_transformer_nasm_buckets (aspen_dnn_t *dnn, unsigned int min_ninst_per_ldata, unsigned int batch_size, 
+    unsigned int *seq_num_arr, unsigned int num_buckets);
+nasm_t *apu_select_transformer_nasm (nasm_t **nasm_arr, unsigned int num_nasm, unsigned int seq_num);
 void apu_destroy_nasm(nasm_t *nasm);
 nasm_t *apu_load_nasm_from_file(char *filename, aspen_dnn_t *dnn);
 void apu_save_nasm_to_file(nasm_t *nasm, char *filename);
+void apu_save_nasm_to_bin_file(nasm_t *nasm, char *filename);
+nasm_t *apu_load_nasm_from_bin_file(char *filename, aspen_dnn_t *dnn);
 void apu_reset_nasm (nasm_t *nasm);
 void apu_set_nasm_num_cores (nasm_t *nasm, unsigned int num_cores);
+void apu_set_nasm_profiling (nasm_t *nasm, int enable);
+aspen_kv_cache_t *apu_create_kv_cache (aspen_dnn_t *dnn, unsigned int batch_size, unsigned int max_seq_len);
+void apu_destroy_kv_cache (aspen_kv_cache_t *kv_cache);
+void apu_reset_kv_cache (aspen_kv_cache_t *kv_cache);
+unsigned int apu_get_kv_cache_len (aspen_kv_cache_t *kv_cache);
+int apu_is_kv_cache_overflowed (aspen_kv_cache_t *kv_cache);
+void apu_set_nasm_kv_cache (nasm_t *nasm, aspen_kv_cache_t *kv_cache);
+void apu_set_nasm_seq_len (nasm_t *nasm, unsigned int *seq_len_arr);
 
 rpool_t *rpool_init (int gpu_idx);
 rpool_t *rpool_init_multigroup (int gpu_idx, int needed_groups);
@@ -155,6 +183,7 @@ void rpool_add_nasm_raw_input (rpool_t *rpool, nasm_t* nasm, void* input_data);
 void rpool_add_nasm (rpool_t *rpool, nasm_t* nasm, char *input_filename);
 void rpool_reset_queue (rpool_t *rpool);
 void rpool_reset_nasm (rpool_t *rpool, nasm_t *nasm);
+void rpool_reset_nasm_raw_input (rpool_t *rpool, nasm_t *nasm, void *input_data);
 
 dse_group_t *dse_group_init (unsigned int num_des, int gpu_idx);
 void dse_group_set_rpool (dse_group_t *dse_group, rpool_t *rpool);
@@ -12,24 +12,123 @@
 #define _VEC_SIZE_N 12
 #define _VEC_SIZE_K 8
 
+// Winograd F(4x4, 3x3): 4x4 output tiles from 6x6 input tiles.
+#define _WINOGRAD_TILE 4
+#define _WINOGRAD_ALPHA 6
+#define _WINOGRAD_MIN_IN_C 16
+#define _WINOGRAD_MAX_TILE_WASTE 2
+#define _WINOGRAD_MIN_NUM_TILES 6
+
+// Layernorm: out = (x - mean) / sqrt(var + _LAYERNORM_EPSILON) * weight + bias, over one out_mat column.
+#define _LAYERNORM_EPSILON 1e-6f
+
+// Fused attention: queries and keys are streamed in blocks of _ATTENTION_BLOCK_SIZE, 
+// so only a block of the score matrix is kept in the DSE scratchpad.
+#define _ATTENTION_BLOCK_SIZE 64
+
+#define _AVX512_VEC_SIZE_M 32
+#define _AVX512_VEC_SIZE_N 12
+
+// INT8 GEMM: weights are packed in _VEC_SIZE_M row blocks with _QGEMM_K_GROUP consecutive k per row,
+// activations are quantized to u8 columns in chunks of _QGEMM_TILE_N.
+#define _QGEMM_K_GROUP 4
+#define _QGEMM_TILE_N 96
+#define _QGEMM_AVX2_VEC_SIZE_N 4
+
+// FP16 weight GEMM: same packed A layout as SGEMM with 16-bit elements, widened to FP32 in registers.
+#define _HGEMM_AVX2_VEC_SIZE_N 6
+
+// Epilogue of the SGEMM kernels, applied to C tiles in registers after their last K block:
+// C[n * ldc + m] = act (C[n * ldc + m] + bias[m] + residual[n * ldr + m]). bias and residual may be NULL.
+typedef struct
+{
+    const float *bias;
+    const float *residual;
+    unsigned int ldr;
+    LAYER_ACT activation;
+} sgemm_epilogue_t;
+
+// Sets out to the epilogue of the C sub-tile at row m and column n and returns it, or returns NULL if epi is NULL.
+static inline const sgemm_epilogue_t *get_sgemm_epilogue_at (const sgemm_epilogue_t *epi, sgemm_epilogue_t *out, 
+    unsigned int m, unsigned int n)
+{
+    if (epi == NULL)
+        return NULL;
+    *out = *epi;
+    if (out->bias != NULL)
+        out->bias += m;
+    if (out->residual != NULL)
+        out->residual += (size_t) n * out->ldr + m;
+    return out;
+}
+
 #if AVX2
-#define SGEMM_KERNEL_OMP avx2_sgemm_vectorized_with_omp
-#define SGEMM_KERNEL avx2_sgemm_vectorized
-#define SGEMM_KERNEL_FULL_TILE avx2_sgemm_full_tile
-#define SGEMM_KERNEL_TILE_M avx2_sgemm_tile_M
-#define SGEMM_KERNEL_TILE_N avx2_sgemm_tile_N
+// x86 SGEMM kernels are picked at load time from the CPU features, see avx512_kernels.c.
+#define SGEMM_KERNEL_OMP sgemm_kernels.sgemm_with_omp
+#define SGEMM_KERNEL sgemm_kernels.sgemm
+#define SGEMM_KERNEL_FULL_TILE sgemm_kernels.sgemm_full_tile
+#define SGEMM_KERNEL_TILE_M sgemm_kernels.sgemm_tile_M
+#define SGEMM_KERNEL_TILE_N sgemm_kernels.sgemm_tile_N
+#define WINOGRAD_INPUT_TRANSFORM avx2_winograd_input_transform
+#define WINOGRAD_OUTPUT_TRANSFORM avx2_winograd_output_transform
+#define DEPTHWISE_CONV avx2_depthwise_conv
+#define GROUPED_CONV avx2_grouped_conv
+#define MAXPOOL_TILE avx2_maxpool_tile
+#define AVGPOOL_TILE avx2_avgpool_tile
+#define QGEMM_KERNEL qgemm_kernels.qgemm
+#define QGEMM_ACT_MAX qgemm_kernels.act_max
+#define QUANTIZE_U8 avx2_quantize_u8
+#define HGEMM_KERNEL sgemm_kernels.hgemm
+#define SGEMM_KERNEL_EPILOGUE sgemm_kernels.sgemm_epilogue
+#define ACTIVATE avx2_activate
+#define LAYERNORM_COL avx2_layernorm_col
+#define RESIDUAL_LAYERNORM_COL avx2_residual_layernorm_col
+#define SOFTMAX_COL avx2_softmax_col
+#define ONLINE_SOFTMAX_COL avx2_online_softmax_col
 #elif NEON
 #define SGEMM_KERNEL_OMP naive_sgemm_vectorized_with_omp
 #define SGEMM_KERNEL neon_sgemm_vectorized
 #define SGEMM_KERNEL_FULL_TILE neon_sgemm_full_tile
 #define SGEMM_KERNEL_TILE_M neon_sgemm_tile_M
 #define SGEMM_KERNEL_TILE_N neon_sgemm_tile_N
+#define WINOGRAD_INPUT_TRANSFORM naive_winograd_input_transform
+#define WINOGRAD_OUTPUT_TRANSFORM naive_winograd_output_transform
+#define DEPTHWISE_CONV neon_depthwise_conv
+#define GROUPED_CONV naive_grouped_conv
+#define MAXPOOL_TILE neon_maxpool_tile
+#define AVGPOOL_TILE neon_avgpool_tile
+#define QGEMM_KERNEL naive_qgemm
+#define QGEMM_ACT_MAX 255
+#define QUANTIZE_U8 naive_quantize_u8
+#define HGEMM_KERNEL naive_hgemm
+#define SGEMM_KERNEL_EPILOGUE naive_sgemm_epilogue
+#define ACTIVATE neon_activate
+#define LAYERNORM_COL neon_layernorm_col
+#define RESIDUAL_LAYERNORM_COL neon_residual_layernorm_col
+#define SOFTMAX_COL neon_softmax_col
+#define ONLINE_SOFTMAX_COL neon_online_softmax_col
 #else
 #define SGEMM_KERNEL_OMP naive_sgemm_vectorized_with_omp
 #define SGEMM_KERNEL naive_sgemm_vectorized
 #define SGEMM_KERNEL_FULL_TILE naive_sgemm_vectorized
 #define SGEMM_KERNEL_TILE_M naive_sgemm_vectorized
 #define SGEMM_KERNEL_TILE_N naive_sgemm_vectorized
+#define WINOGRAD_INPUT_TRANSFORM naive_winograd_input_transform
+#define WINOGRAD_OUTPUT_TRANSFORM naive_winograd_output_transform
+#define DEPTHWISE_CONV naive_depthwise_conv
+#define GROUPED_CONV naive_grouped_conv
+#define MAXPOOL_TILE naive_maxpool_tile
+#define AVGPOOL_TILE naive_avgpool_tile
+#define QGEMM_KERNEL naive_qgemm
+#define QGEMM_ACT_MAX 255
+#define QUANTIZE_U8 naive_quantize_u8
+#define HGEMM_KERNEL naive_hgemm
+#define SGEMM_KERNEL_EPILOGUE naive_sgemm_epilogue
+#define ACTIVATE naive_activate
+#define LAYERNORM_COL naive_layernorm_col
+#define RESIDUAL_LAYERNORM_COL naive_residual_layernorm_col
+#define SOFTMAX_COL naive_softmax_col
+#define ONLINE_SOFTMAX_COL naive_online_softmax_col
 #endif
 
 void tiled_conv2d (ninst_t *ninst, dse_t *dse);
@@ -44,6 +143,35 @@ void tiled_matmul (ninst_t *ninst, dse_t *dse);
 void tiled_layernorm (ninst_t *ninst, dse_t *dse);
 void tiled_k_attention (ninst_t *ninst, dse_t *dse);
 void tiled_v_attention (ninst_t *ninst, dse_t *dse);
+void request_ninst_jit_sgemm (ninst_t *ninst);
+
+extern const sgemm_blocking_t default_sgemm_blocking;
+void tiled_sgemm_epilogue (const unsigned int M, const unsigned int N, const unsigned int K,
+    const float *A, const unsigned int lda, const float *B, const unsigned int ldb, float *C, const unsigned int ldc,
+        const sgemm_epilogue_t *epi, const sgemm_blocking_t *blocking);
+void tiled_sgemm_im2col (const unsigned int M, const unsigned int N, const unsigned int K,
+    const float *A, const unsigned int lda, void **input_pos_arr, const unsigned int input_pos_per_n, 
+        const unsigned int input_col_size, float *B_buf, float *C, const unsigned int ldc,
+            const sgemm_epilogue_t *epi, const sgemm_blocking_t *blocking);
+int is_layer_conv_1x1 (aspen_layer_t *layer);
+int get_ldata_sgemm_dims (nasm_ldata_t *ldata, unsigned int *M, unsigned int *N, unsigned int *K);
+void tune_nasm_sgemm_blocking (nasm_t *nasm, const char *cache_dir);
+
+// SGEMM kernels generated at run time for the exact shape of a tiled_sgemm_block call, see jit_kernels.c.
+// The kernel of a shape computes C = epi (C + A * B), with the bias and residual of the epilogue as arguments.
+typedef struct
+{
+    unsigned int M, N, K, lda, ldb, ldc;
+    unsigned int has_epilogue, has_bias, has_residual, ldr, activation;
+} jit_sgemm_shape_t;
+typedef void (*jit_sgemm_kernel_t) (const float *A, const float *B, float *C, const float *bias, const float *residual);
+void set_jit_sgemm_shape (jit_sgemm_shape_t *shape, const unsigned int M, const unsigned int N, const unsigned int K,
+    const unsigned int lda, const unsigned int ldb, const unsigned int ldc, const sgemm_epilogue_t *epi);
+void jit_sgemm_request (const jit_sgemm_shape_t *shape);
+void jit_sgemm_generate (void);
+int jit_sgemm_block (const unsigned int M, const unsigned int N, const unsigned int K,
+    const float *A, const unsigned int lda, const float *B, const unsigned int ldb, float *C, const unsigned int ldc,
+        const sgemm_epilogue_t *epi);
 
 void naive_sigmoid (float *input, float *output, int size);
 void naive_activate (float *input, unsigned int num_elements, LAYER_ACT activation_type);
@@ -52,7 +180,7 @@ void naive_conv2d
 (const float *input, const float *kernel, const float *bias, float *output, 
     unsigned int batch_size, unsigned int input_channels, unsigned int height, unsigned int width,  
         unsigned int output_channels, unsigned int kernel_width , unsigned int kernel_height, 
-            unsigned int stride, unsigned int padding);
+            unsigned int stride, unsigned int padding, unsigned int dilation, unsigned int groups);
 
 void naive_conv2d_im2col_mm
 (const float *input, const float *kernel, const float *bias, float *output, 
@@ -60,6 +188,39 @@ void naive_conv2d_im2col_mm
         unsigned int output_channels, unsigned int kernel_width , unsigned int kernel_height, 
             unsigned int stride, unsigned int padding);
 
+void naive_grouped_conv (const unsigned int M, const unsigned int N, const unsigned int m0, const unsigned int num_taps,
+    const unsigned int in_c_per_group, const unsigned int out_c_per_group, const float *kernel, const float **input_ptr_arr,
+        float *C, const unsigned int ldc, const float *bias);
+void naive_depthwise_conv (const unsigned int M, const unsigned int N, const unsigned int m0, const unsigned int num_taps,
+    const float *kernel, const float **input_ptr_arr, float *C, const unsigned int ldc, const float *bias);
+void naive_maxpool_tile (const unsigned int M, const unsigned int N, const unsigned int m0, const unsigned int num_taps,
+    const float **input_ptr_arr, float *C, const unsigned int ldc);
+void naive_avgpool_tile (const unsigned int M, const unsigned int N, const unsigned int m0, const unsigned int num_taps,
+    const float **input_ptr_arr, float *C, const unsigned int ldc);
+
+void naive_winograd_weight_transform (const float *kernel, float *output, 
+    unsigned int output_channels, unsigned int input_channels);
+void naive_winograd_input_transform (const float **input_ptr_arr, float *output, unsigned int output_stride, 
+    unsigned int channels);
+void naive_winograd_output_transform (const float *input, unsigned int input_stride, float **output_ptr_arr, 
+    unsigned int channels, const float *bias);
+
+void naive_quantize_weight_int8 (const float *kernel, int8_t *output, float *scale, int32_t *row_sum, 
+    unsigned int M, unsigned int K);
+void naive_quantize_u8 (const float *input, uint8_t *output, unsigned int num_elements, 
+    float inv_scale, float zero_point, unsigned int max);
+void naive_qgemm (const unsigned int M, const unsigned int N, const unsigned int K, const int8_t *A, 
+    const uint8_t *B, const unsigned int ldb, float *C, const unsigned int ldc, const float *scale, const float *offset);
+
+void naive_fp32_to_fp16 (const float *input, uint16_t *output, size_t num_elements);
+void naive_fp16_to_fp32 (const uint16_t *input, float *output, size_t num_elements);
+void naive_hgemm (const unsigned int M, const unsigned int N, const unsigned int K, const uint16_t *A, const unsigned int lda, 
+    const float *B, const unsigned int ldb, float *C, const unsigned int ldc, const sgemm_epilogue_t *epi);
+void naive_apply_epilogue (float *C, const unsigned int M, const unsigned int N, const unsigned int ldc, 
+    const sgemm_epilogue_t *epi);
+void naive_sgemm_epilogue (const unsigned int M, const unsigned int N, const unsigned int K, const float *A, const unsigned int lda, 
+    const float *B, const unsigned int ldb, float *C, const unsigned int ldc, const sgemm_epilogue_t *epi);
+
 void naive_maxpool2d
 (const float *input, float *output, 
     unsigned int batch_size, unsigned int channels, unsigned int height, unsigned int width,  
@@ -93,6 +254,19 @@ void naive_residual (const float *input_1, const float *input_2, float *output,
 
 void naive_softmax (float *input, float *output, unsigned int num_batch, unsigned int num_elements);
 
+// Per-column kernels of the tiled layernorm, residual and softmax layers. input and output may alias.
+// *_residual_layernorm_col also stores input_1 + input_2 to residual_output.
+// *_softmax_col computes softmax (scale * input) for scale > 0.
+// *_online_softmax_col is one step of a softmax over a stream of score blocks: scores = exp (scale * scores - max), 
+// with *max the running max updated by this block and *sum the running sum of exp. Returns the factor exp (old - new max)
+// that rescales the previous sum and the outputs accumulated with it.
+void naive_layernorm_col (const float *input, float *output, unsigned int num_elements, 
+    const float *weight, const float *bias);
+void naive_residual_layernorm_col (const float *input_1, const float *input_2, float *residual_output, float *output, 
+    unsigned int num_elements, const float *weight, const float *bias);
+void naive_softmax_col (const float *input, float *output, unsigned int num_elements, float scale);
+float naive_online_softmax_col (float *scores, unsigned int num_elements, float scale, float *max, float *sum);
+
 void naive_sgemm_with_omp (const unsigned int M, const unsigned int N, const unsigned int K,
 		 const float *A, const unsigned int lda, const float *B, const unsigned int ldb, float *C, const unsigned int ldc);
 
@@ -106,6 +280,56 @@ void naive_sgemm_vectorized (const unsigned int M, const unsigned int N, const u
 		 const float *A, const unsigned int lda, const float *B, const unsigned int ldb, float *C, const unsigned int ldc);
 
 #ifdef AVX2
+typedef void (*sgemm_kernel_t) (const unsigned int M, const unsigned int N, const unsigned int K,
+    const float *A, const unsigned int lda, const float *B, const unsigned int ldb, float *C, const unsigned int ldc);
+// C = epi (C + A * B), with no epilogue if epi is NULL.
+typedef void (*sgemm_epilogue_kernel_t) (const unsigned int M, const unsigned int N, const unsigned int K, 
+    const float *A, const unsigned int lda, const float *B, const unsigned int ldb, float *C, const unsigned int ldc, 
+        const sgemm_epilogue_t *epi);
+typedef void (*hgemm_kernel_t) (const unsigned int M, const unsigned int N, const unsigned int K, 
+    const uint16_t *A, const unsigned int lda, const float *B, const unsigned int ldb, float *C, const unsigned int ldc, 
+        const sgemm_epilogue_t *epi);
+typedef struct
+{
+    const char *name;
+    sgemm_kernel_t sgemm_with_omp;
+    sgemm_kernel_t sgemm;
+    sgemm_kernel_t sgemm_full_tile;
+    sgemm_kernel_t sgemm_tile_M;
+    sgemm_kernel_t sgemm_tile_N;
+    sgemm_epilogue_kernel_t sgemm_epilogue;
+    hgemm_kernel_t hgemm;
+} sgemm_kernel_table_t;
+extern sgemm_kernel_table_t sgemm_kernels;
+
+typedef void (*qgemm_kernel_t) (const unsigned int M, const unsigned int N, const unsigned int K, const int8_t *A, 
+    const uint8_t *B, const unsigned int ldb, float *C, const unsigned int ldc, const float *scale, const float *offset);
+typedef struct
+{
+    const char *name;
+    qgemm_kernel_t qgemm;
+    unsigned int act_max; // Largest quantized activation the kernel can take without saturating.
+} qgemm_kernel_table_t;
+extern qgemm_kernel_table_t qgemm_kernels;
+
+// avx512 matmul kernels, same A/B/C layouts as the avx2 kernels
+void avx512_sgemm_vectorized_with_omp(const unsigned int M, const unsigned int N, const unsigned int K,
+    const float *A, const unsigned int lda, const float *B, const unsigned int ldb, float *C, const unsigned int ldc);
+void avx512_sgemm_vectorized (const unsigned int M, const unsigned int N, const unsigned int K,
+    const float *A, const unsigned int lda, const float *B, const unsigned int ldb, float *C, const unsigned int ldc);
+void avx512_sgemm_full_tile(const unsigned int M, const unsigned int N, const unsigned int K,
+    const float *A, const unsigned int lda, const float *B, const unsigned int ldb, float *C, const unsigned int ldc);
+void avx512_sgemm_tile_M(const unsigned int M, const unsigned int N, const unsigned int K,
+    const float *A, const unsigned int lda, const float *B, const unsigned int ldb, float *C, const unsigned int ldc);
+void avx512_sgemm_tile_N(const unsigned int M, const unsigned int N, const unsigned int K,
+    const float *A, const unsigned int lda, const float *B, const unsigned int ldb, float *C, const unsigned int ldc);
+void avx512_sgemm_epilogue (const unsigned int M, const unsigned int N, const unsigned int K, const float *A, const unsigned int lda, 
+    const float *B, const unsigned int ldb, float *C, const unsigned int ldc, const sgemm_epilogue_t *epi);
+void avx512_hgemm (const unsigned int M, const unsigned int N, const unsigned int K, const uint16_t *A, const unsigned int lda, 
+    const float *B, const unsigned int ldb, float *C, const unsigned int ldc, const sgemm_epilogue_t *epi);
+void avx512_vnni_qgemm (const unsigned int M, const unsigned int N, const unsigned int K, const int8_t *A, 
+    const uint8_t *B, const unsigned int ldb, float *C, const unsigned int ldc, const float *scale, const float *offset);
+
 // avx2 accelerated matmul kernels
 void avx2_sgemm_vectorized_with_omp(const unsigned int M, const unsigned int N, const unsigned int K,
     const float *A, const unsigned int lda, const float *B, const unsigned int ldb, float *C, const unsigned int ldc);
@@ -117,9 +341,50 @@ void avx2_sgemm_tile_M(const unsigned int M, const unsigned int N, const unsigne
     const float *A, const unsigned int lda, const float *B, const unsigned int ldb, float *C, const unsigned int ldc);
 void avx2_sgemm_tile_N(const unsigned int M, const unsigned int N, const unsigned int K,
     const float *A, const unsigned int lda, const float *B, const unsigned int ldb, float *C, const unsigned int ldc);
+void avx2_sgemm_epilogue (const unsigned int M, const unsigned int N, const unsigned int K, const float *A, const unsigned int lda, 
+    const float *B, const unsigned int ldb, float *C, const unsigned int ldc, const sgemm_epilogue_t *epi);
+void avx2_hgemm (const unsigned int M, const unsigned int N, const unsigned int K, const uint16_t *A, const unsigned int lda, 
+    const float *B, const unsigned int ldb, float *C, const unsigned int ldc, const sgemm_epilogue_t *epi);
+void avx2_activate (float *input, unsigned int num_elements, LAYER_ACT activation_type);
+void avx2_layernorm_col (const float *input, float *output, unsigned int num_elements, 
+    const float *weight, const float *bias);
+void avx2_residual_layernorm_col (const float *input_1, const float *input_2, float *residual_output, float *output, 
+    unsigned int num_elements, const float *weight, const float *bias);
+void avx2_softmax_col (const float *input, float *output, unsigned int num_elements, float scale);
+float avx2_online_softmax_col (float *scores, unsigned int num_elements, float scale, float *max, float *sum);
+void avx2_winograd_input_transform (const float **input_ptr_arr, float *output, unsigned int output_stride, 
+    unsigned int channels);
+void avx2_winograd_output_transform (const float *input, unsigned int input_stride, float **output_ptr_arr, 
+    unsigned int channels, const float *bias);
+void avx2_depthwise_conv (const unsigned int M, const unsigned int N, const unsigned int m0, const unsigned int num_taps,
+    const float *kernel, const float **input_ptr_arr, float *C, const unsigned int ldc, const float *bias);
+void avx2_maxpool_tile (const unsigned int M, const unsigned int N, const unsigned int m0, const unsigned int num_taps,
+    const float **input_ptr_arr, float *C, const unsigned int ldc);
+void avx2_avgpool_tile (const unsigned int M, const unsigned int N, const unsigned int m0, const unsigned int num_taps,
+    const float **input_ptr_arr, float *C, const unsigned int ldc);
+void avx2_grouped_conv (const unsigned int M, const unsigned int N, const unsigned int m0, const unsigned int num_taps,
+    const unsigned int in_c_per_group, const unsigned int out_c_per_group, const float *kernel, const float **input_ptr_arr,
+        float *C, const unsigned int ldc, const float *bias);
+void avx2_quantize_u8 (const float *input, uint8_t *output, unsigned int num_elements, 
+    float inv_scale, float zero_point, unsigned int max);
+void avx2_qgemm (const unsigned int M, const unsigned int N, const unsigned int K, const int8_t *A, 
+    const uint8_t *B, const unsigned int ldb, float *C, const unsigned int ldc, const float *scale, const float *offset);
 #endif //_AVX2
 #ifdef NEON
 void neon_sgemm_vectorized (const unsigned int M, const unsigned int N, const unsigned int K,
     const float *A, const unsigned int lda, const float *B, const unsigned int ldb, float *C, const unsigned int ldc);
+void neon_activate (float *input, unsigned int num_elements, LAYER_ACT activation_type);
+void neon_layernorm_col (const float *input, float *output, unsigned int num_elements, 
+    const float *weight, const float *bias);
+void neon_residual_layernorm_col (const float *input_1, const float *input_2, float *residual_output, float *output, 
+    unsigned int num_elements, const float *weight, const float *bias);
+void neon_softmax_col (const float *input, float *output, unsigned int num_elements, float scale);
+float neon_online_softmax_col (float *scores, unsigned int num_elements, float scale, float *max, float *sum);
+void neon_depthwise_conv (const unsigned int M, const unsigned int N, const unsigned int m0, const unsigned int num_taps,
+    const float *kernel, const float **input_ptr_arr, float *C, const unsigned int ldc, const float *bias);
+void neon_maxpool_tile (const unsigned int M, const unsigned int N, const unsigned int m0, const unsigned int num_taps,
+    const float **input_ptr_arr, float *C, const unsigned int ldc);
+void neon_avgpool_tile (const unsigned int M, const unsigned int N, const unsigned int m0, const unsigned int num_taps,
+    const float **input_ptr_arr, float *C, const unsigned int ldc);
 #endif //_NEON
 #endif // _KERNELS_H_
\ No newline at end of file
@@ -12,8 +12,33 @@
 #define APU_GENERATION_COEFF_GPU ((double)0.8)
 #define APU_GENERATION_NUM_NINST_GPU 50
 #define APU_GENERATION_NUM_FLOPS 5e8
+#define APU_GENERATION_MAX_NINST_PER_LDATA 4096
+#define APU_GENERATION_PARALLEL_SLACK ((double)4.0)
+#define APU_GENERATION_NINST_OVERHEAD_SEC ((double)4e-6)
+#define APU_GENERATION_COST_TOLERANCE ((double)0.03)
+#define APU_GENERATION_REFINE_NUM_RUN 10
+#define APU_COST_MODEL_NUM_M 5
+#define APU_COST_MODEL_NUM_N 5
+#define APU_COST_MODEL_NUM_K 4
+#define APU_COST_MODEL_CALIB_SEC ((double)5e-4)
 #define INIT_NUM_PARENT_LDATA 2
 
+#define NASM_BIN_MAGIC "ASPEN_NASM_BIN"
+#define NASM_BIN_MAGIC_LEN 16
+#define NASM_BIN_VERSION 3
+#define NASM_BIN_ALIGN 64
+#define NASM_BIN_PARALLEL_FIXUP_MIN_NINST 4096
+
+// Plan options of a NASM, fixed when it is created. They change its tiling or its ninst parents, 
+// so NASM files record them and are only loaded into a NASM planned the same way.
+#define NASM_PLAN_WINOGRAD_TILING 0x01
+#define NASM_PLAN_FUSE_CONV_RESIDUAL 0x02
+#define NASM_PLAN_FUSE_CONV_MAXPOOL 0x04
+#define NASM_PLAN_ZERO_COPY_CONCAT 0x08
+#define NASM_PLAN_FUSE_QKV 0x10
+#define NASM_PLAN_FUSE_ATTENTION 0x20
+#define NASM_PLAN_FUSE_RESIDUAL_LAYERNORM 0x40
+
 #define NINST_COMPUTE_NO    0
 #define NINST_COMPUTE_DUMMY 1
 #define NINST_COMPUTE_YES   2
@@ -26,13 +51,26 @@ struct nasm_t
     unsigned int tr_seq_len;
     nasm_ldata_t *ldata_arr;
     ninst_t *ninst_arr;
+    ninst_prof_t *ninst_prof_arr;
+    // Parent/child adjacency in CSR form. Ninst arr pointers point into these pools.
+    unsigned int *parent_ninst_idx_csr;
+    ninst_t **child_ninst_csr;
+    size_t num_parent_edges;
+    size_t num_child_edges;
+    // Private mapping of the binary NASM file that parent_ninst_idx_csr points into, or NULL.
+    void *bin_map;
+    size_t bin_map_size;
     unsigned int num_ldata;
     _Atomic unsigned int num_ldata_completed;
     _Atomic unsigned int completed;
     unsigned int num_ninst;
     unsigned int min_ninst_per_ldata;
+    // Per-ldata override of min_ninst_per_ldata, set by the granularity selector. NULL if unused.
+    unsigned int *ldata_min_ninst_arr;
     unsigned int flop_per_ninst;
     size_t total_flops;
+    // NASM_PLAN_* options the NASM was created with.
+    unsigned int plan_flags;
     
     int gpu_idx;
 
@@ -58,6 +96,32 @@ struct nasm_t
 
     double queueing_overhead;
     double start_time;
+
+    // If not NULL, the nasm processes tr_seq_len tokens that follow the tokens in the cache, and appends them to it.
+    aspen_kv_cache_t *kv_cache;
+    // If not NULL, the number of valid tokens of each batch. Attention ignores the padding tokens after them.
+    unsigned int *seq_len_arr;
+};
+
+// Keys and values of the num_tokens tokens processed so far, for each fused V-attention layer (indexed by layer_idx,
+// NULL for other layers). Each holds batch_size blocks of max_seq_len columns of num_hidden.
+struct aspen_kv_cache_t
+{
+    aspen_dnn_t *dnn;
+    unsigned int batch_size;
+    unsigned int max_seq_len;
+    unsigned int num_tokens;
+    // Set when a run did not fit in the cache (its attention outputs are zero), until apu_reset_kv_cache.
+    _Atomic int overflow;
+    float **key;
+    float **value;
+};
+
+// Cache blocking of the FP32 SGEMMs of an ldata: the rows, columns and reduction length of one block.
+// Defaults to _TILE_SIZE_M, _TILE_SIZE_N and _TILE_SIZE_K, see tune_nasm_sgemm_blocking.
+struct sgemm_blocking_t
+{
+    unsigned int tile_m, tile_n, tile_k;
 };
 
 struct nasm_ldata_t
@@ -76,37 +140,58 @@ struct nasm_ldata_t
     void *out_mat;
     void *out_mat_dummy;
     pthread_mutex_t out_mat_mutex;
+    int out_mat_owner_idx; // Ldata whose out_mat holds this output (zero-copy concat, fused conv + residual), or -1.
+    unsigned int out_mat_row_offset;
+    _Atomic unsigned int num_out_mat_users; // Ldata that still hold this out_mat, including this one.
     unsigned int ninst_tile_dims [2];
+    sgemm_blocking_t sgemm_blocking;
+    int conv_1x1_direct; // 1x1 conv whose ninsts read the parent out_mat as the SGEMM B operand instead of im2col.
+    // Fusions of the ldata, resolved once by plan_ldata_fusion when the NASM is created.
+    int fused_attention; // K- or V-attention of a fused attention.
+    nasm_ldata_t *fused_layernorm_ldata; // Layernorm written by the ninsts of this residual, or NULL.
+    nasm_ldata_t *fused_qkv_leader_ldata; // Matmul whose ninsts compute this fused QKV matmul (itself for the first), or NULL.
+    nasm_ldata_t *fused_maxpool_ldata; // Maxpool computed by the ninsts of this conv, or NULL.
     ninst_t *ninst_arr_start;
     
     unsigned int num_ninst;
     _Atomic unsigned int num_ninst_completed;
 };
 
+// Hot part of a ninst, read and updated by the DSEs on every dispatch and completion.
+// Aligned to a cache line so that neighbouring ninsts completed by different DSEs do not false-share.
 struct ninst_t 
 {
-    nasm_ldata_t *ldata;
     _Atomic NINST_STATE state;
+    _Atomic unsigned int num_parent_ninsts_completed;
+    unsigned int num_parent_ninsts;
+    _Atomic unsigned int num_child_ninsts;
     unsigned int ninst_idx;
     unsigned int out_mat_pos [2];
     unsigned int tile_dims [2];
-    
-    unsigned int *parent_ninst_idx_arr;
-    unsigned int num_parent_ninsts;
-    _Atomic unsigned int num_parent_ninsts_completed;
+    int compute_option;
+    nasm_ldata_t *ldata;
+    unsigned int *parent_ninst_idx_arr; // Slice of nasm->parent_ninst_idx_csr
+    ninst_t **child_ninst_arr;          // Slice of nasm->child_ninst_csr
 
-    ninst_t **child_ninst_arr;
-    _Atomic unsigned int num_child_ninsts;
-    
-    unsigned int num_ancestor_ninsts;
+    // For Scheduling (bit i set = device/core i)
+    atomic_uint dev_to_compute;         // who will compute this ninst?
+    atomic_uint dev_send_target;        // who wants the result of this ninst?
+    _Atomic uint64_t core_allowed;      // which core is allowed to compute this ninst?
+    unsigned int num_cores;
+    _Atomic unsigned int lock_network_buf;
+    double priority;
+    void *network_buf;
+    rpool_t *affinity_pool;
 
+    unsigned int num_ancestor_ninsts;
+    unsigned int num_input_pos;
     int *input_pos_idx_arr;
     void **input_pos_ptr_arr_gpu;
-    unsigned int num_input_pos;
-    void *network_buf;
-    _Atomic unsigned int lock_network_buf;
-    rpool_t *affinity_pool;
+} __attribute__((aligned(64)));
 
+// Cold part of a ninst, allocated in nasm->ninst_prof_arr only when profiling is enabled.
+struct ninst_prof_t
+{
     //For logging
     float computed_time;
     float received_time;
@@ -115,35 +200,30 @@ struct ninst_t
     float eft_server;
     int dse_idx;
 
-    // For Scheduling
-    atomic_int dev_to_compute [SCHEDULE_MAX_DEVICES+1];       // who will compute this ninst?
-    atomic_int dev_send_target [SCHEDULE_MAX_DEVICES+1];    // who wants the result of this ninst?
-    double priority;
-    
-    // For core allocation
-    unsigned int num_cores;
-    atomic_int core_allowed[SCHEDULE_MAX_CORE]; // which core is allowed to compute this ninst?
-
     double compute_start;
     double compute_end;
-    // float send_from_here;
-    // float recv_from_other;
 
     float rank_upward;
     float rank_downward;
-
-    int compute_option;
-
-    // #ifdef GPU
-    // cudaGraphNode_t cudagraph_node;
-    // #endif
 };
 
-nasm_t *apu_create_nasm_without_finding_ninst_parents (aspen_dnn_t *dnn, unsigned int flop_per_ninst, unsigned int batch_size,  unsigned int min_ninst_per_ldata, unsigned int transformer_seq_len);
+static inline ninst_prof_t *get_ninst_prof (ninst_t *ninst)
+{
+    ninst_prof_t *prof_arr = ninst->ldata->nasm->ninst_prof_arr;
+    return prof_arr == NULL ? NULL : prof_arr + ninst->ninst_idx;
+}
+
+int get_nasm_ldata_num_per_layer (aspen_layer_t *layer);
+unsigned int get_dnn_nasm_plan_flags (aspen_dnn_t *dnn);
+nasm_t *apu_create_nasm_without_finding_ninst_parents (aspen_dnn_t *dnn, unsigned int flop_per_ninst, unsigned int batch_size,  
+    unsigned int min_ninst_per_ldata, unsigned int *ldata_min_ninst_arr, unsigned int transformer_seq_len, unsigned int plan_flags);
 
-double test_nasm_time_sec (nasm_t *nasm, unsigned int num_iter, int gpu_idx);
+double test_nasm_time_sec (nasm_t *nasm, unsigned int num_iter, unsigned int num_dse, int gpu_idx);
 
 void init_nasm_ldata (nasm_t *nasm, nasm_ldata_t *ldata, aspen_layer_t *layer);
+void set_ldata_ninst_tile_dims (nasm_ldata_t *ldata, unsigned int min_ninst);
+void nasm_find_ninst_parents_and_children (nasm_t *nasm);
+void nasm_build_csr (nasm_t *nasm);
 void set_nasm_inference_id (nasm_t *nasm, int inference_id);
 void destroy_nasm_ldata_arr (nasm_ldata_t *ldata_arr, int num_ldata);
 void set_nasm_to_finished (nasm_t *nasm);
@@ -156,10 +236,14 @@ void copy_buffer_to_ninst_dummy_data (ninst_t *ninst, void *buffer);
 
 void alloc_ldata_out_mat (nasm_ldata_t *ldata);
 void free_ldata_out_mat (nasm_ldata_t *ldata);
+void release_ldata_out_mat (nasm_ldata_t *ldata);
 
 void *get_ninst_out_mem (ninst_t *ninst);
 void *get_ninst_out_mem_dummy (ninst_t *ninst);
 void *get_ninst_out_mem_without_alloc (ninst_t *ninst);
+nasm_ldata_t *get_fused_conv_residual_ldata (nasm_ldata_t *ldata);
+void advance_nasm_kv_cache (nasm_t *nasm);
+unsigned int get_nasm_seq_len (nasm_t *nasm, unsigned int batch);
 
 unsigned int get_tensor_idx_from_pos (aspen_tensor_t *tensor, unsigned int *pos);
 void get_tensor_pos_from_idx (aspen_tensor_t *tensor, unsigned int idx, unsigned int *pos);
@@ -9,6 +9,8 @@
 #define RPOOL_INIT_QUEUE_SIZE 1024
 #define MAX_QUEUE_GROUPS 128
 #define MAX_NUM_QUEUES (1024*4)
+#define RPOOL_QUEUE_CHUNK_SIZE 64
+#define MAX_QUEUE_CHUNKS (MAX_NUM_QUEUES / RPOOL_QUEUE_CHUNK_SIZE)
 #define NINST_PUSH_BATCH_SIZE 16
 #define NUM_QUEUE_PER_LAYER ((float)0.5)
 #define NUM_LAYERQUEUE_PER_DSE ((float)0.1)
@@ -23,7 +25,7 @@ struct rpool_queue_t
     unsigned int num_stored;
     unsigned int max_stored;
     ninst_t **ninst_ptr_arr;
-};
+} __attribute__((aligned(64)));
 
 struct rpool_queue_group_t
 {
@@ -31,7 +33,10 @@ struct rpool_queue_group_t
     char queue_group_info[MAX_STRING_LEN];
     void* blacklist_conds [NUM_RPOOL_CONDS];
     void* whitelist_conds [NUM_RPOOL_CONDS];
-    rpool_queue_t queue_arr[MAX_NUM_QUEUES];
+    // Queues live in chunks of RPOOL_QUEUE_CHUNK_SIZE that never move, so DSEs can scan them while queues are added.
+    rpool_queue_t *queue_chunk_arr [MAX_QUEUE_CHUNKS];
+    // Layers of the NASM the queue count was sized for, 0 if unknown. Bounds the queues added by add_ref_dses.
+    unsigned int num_layers;
     _Atomic unsigned int num_queues;
     // _Atomic unsigned int num_ninsts;
     // _Atomic unsigned int num_fetched;
@@ -41,8 +46,9 @@ struct rpool_t
 {
     unsigned int needed_groups;
     _Atomic unsigned int num_groups;
-    rpool_queue_group_t queue_group_arr[MAX_QUEUE_GROUPS];
-    float queue_group_weight_arr[MAX_QUEUE_GROUPS];
+    // MAX_QUEUE_GROUPS entries, allocated at init so that groups never move.
+    rpool_queue_group_t *queue_group_arr;
+    float *queue_group_weight_arr;
     float queue_group_weight_sum;
     rpool_queue_t default_queue;
     _Atomic unsigned int ref_dses;
@@ -52,6 +58,11 @@ struct rpool_t
     unsigned int is_core_exclusive;
 };
 
+static inline rpool_queue_t *get_rpool_queue (rpool_queue_group_t *rpool_queue_group, unsigned int idx)
+{
+    return &rpool_queue_group->queue_chunk_arr[idx / RPOOL_QUEUE_CHUNK_SIZE][idx % RPOOL_QUEUE_CHUNK_SIZE];
+}
+
 void rpool_init_queue (rpool_queue_t *rpool_queue);
 void rpool_destroy_queue (rpool_queue_t *rpool_queue);
 
@@ -68,6 +79,7 @@ void rpool_add_queue_group (rpool_t *rpool, char *queue_group_info, unsigned int
 void rpool_queue_group_set_blacklist (rpool_queue_group_t *rpool_queue_group, void **blacklist);
 void rpool_queue_group_set_whitelist (rpool_queue_group_t *rpool_queue_group, void **whitelist);
 void rpool_set_nasm_weight (rpool_t *rpool, nasm_t* nasm, float weight);
+unsigned int get_rpool_num_queues_for_nasm (rpool_t *rpool, nasm_t *nasm);
 
 void set_queue_group_weight (rpool_t *rpool, rpool_queue_group_t *rpool_queue_group, float weight);
 void queue_group_add_queues (rpool_queue_group_t *rpool_queue_group, unsigned int num_queues);
@@ -116,6 +116,7 @@ struct fl_path_t {
 
 int is_offloaded(ninst_t *ninst);
 int is_dev_compute(ninst_t *ninst, int device_idx);
+int is_dev_send_target(ninst_t *ninst, int device_idx);
 int is_core_compute(ninst_t *ninst, int core_idx);
 void ninst_clear_compute_device(ninst_t *ninst);
 void ninst_set_compute_device(ninst_t *ninst, int device_idx);
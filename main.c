@@ -13,6 +13,7 @@ int main (int argc, char **argv)
     int num_cores = 1;
     int num_tiles = 50;
     int gpu_idx = -1;
+    int save_bin_nasm = 0;
 
     if (argc > 5)
     {
@@ -21,10 +22,12 @@ int main (int argc, char **argv)
         num_tiles = atoi (argv[3]);
         number_of_iterations = atoi (argv[4]);
         num_cores = atoi (argv[5]);
+        if (argc > 6)
+            save_bin_nasm = strcmp (argv[6], "bin") == 0;
     }
     else
     {
-        printf ("Usage: %s <dnn> <batch_size> <num_tiles> <number_of_iterations> <num_cores>\n", argv[0]);
+        printf ("Usage: %s <dnn> <batch_size> <num_tiles> <number_of_iterations> <num_cores> [nasm_format (text|bin)]\n", argv[0]);
         exit (0);
     }
 
@@ -48,7 +51,11 @@ int main (int argc, char **argv)
         target_nasm = apu_create_transformer_nasm (target_dnn, num_tiles, batch_size, 128);
     else
         target_nasm = apu_create_nasm (target_dnn, num_tiles, batch_size);
-    apu_save_nasm_to_file (target_nasm, nasm_file_name);
+    // apu_load_nasm_from_file reads either format, so main_fl and coacto load the binary file under the same name.
+    if (save_bin_nasm)
+        apu_save_nasm_to_bin_file (target_nasm, nasm_file_name);
+    else
+        apu_save_nasm_to_file (target_nasm, nasm_file_name);
 
     
     if (target_dnn == NULL)
@@ -95,6 +95,7 @@ int main (int argc, char **argv)
         printf ("Unable to load nasm file\n");
         exit (0);
     }
+    apu_set_nasm_profiling (target_nasm, 1);
 
     /* PROFILING */
 profiling:
@@ -102,6 +103,7 @@ profiling:
     PRTF("STAGE: PROFILING\n");
 
     nasm_t *test_nasm = apu_load_nasm_from_file (nasm_file_name, target_dnn);
+    apu_set_nasm_profiling (test_nasm, 1);
 
     int server_sock = -1, client_sock = -1;
     int control_port = server_port + 1;
@@ -227,7 +229,7 @@ profiling:
         unsigned int last_layer_num_ninst = target_nasm->ldata_arr[target_nasm->num_ldata - 1].num_ninst;
 
         for (int i=0; i<last_layer_num_ninst; i++) {
-            last_layer_ninst_arr_start[i].dev_send_target[DEV_EDGE] = 1;
+            ninst_set_send_target_device(&last_layer_ninst_arr_start[i], DEV_EDGE);
         }
     }
     else if (dev_mode == DEV_LOCAL) init_allow_all(target_nasm, 3);
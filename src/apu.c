@@ -25,7 +25,9 @@ aspen_dnn_t *apu_create_dnn (char *input_path, char *weight_path)
             memcpy (params, layer->params, sizeof(unsigned int) * NUM_PARAM_ELEMENTS);
             params[SUB_C] = _VEC_SIZE_M;
             params[OUT_C] = (layer->params[OUT_C] + params[SUB_C] - 1) / params[SUB_C];
+            params[IN_C] = get_layer_in_c_per_group (layer);
             reorder_aspen_tensor (&layer->tensors[WEIGHT_TENSOR], params, weight_dim_order, 5);
+            create_layer_winograd_tensor (layer);
         }
         else if (layer->type == FC_LAYER)
         {
@@ -441,13 +443,25 @@ void destroy_aspen_tensor(aspen_tensor_t *tensor)
     free(tensor);
 }
 
+// Input channels seen by each output channel. Grouped convs (GROUPS > 1) connect output group g 
+// only to input channels [g * IN_C / GROUPS, (g + 1) * IN_C / GROUPS).
+unsigned int get_layer_in_c_per_group (aspen_layer_t *layer)
+{
+    if (layer->type != CONV_LAYER || layer->params[GROUPS] <= 1)
+        return layer->params[IN_C];
+    return layer->params[IN_C] / layer->params[GROUPS];
+}
+
 // Change to add a new layer type
 void create_layer_tensors (aspen_layer_t *layer)
 {
     if (layer->type == CONV_LAYER)
     {
         LAYER_PARAMS weight_dim_order[] = {OUT_C, WEIGHT_H, WEIGHT_W, IN_C};
-        layer->tensors [WEIGHT_TENSOR] = init_aspen_tensor (layer->params, weight_dim_order, 4, layer->dnn->element_size);
+        unsigned int params[NUM_PARAM_ELEMENTS] = {0};
+        memcpy (params, layer->params, sizeof(unsigned int) * NUM_PARAM_ELEMENTS);
+        params[IN_C] = get_layer_in_c_per_group (layer);
+        layer->tensors [WEIGHT_TENSOR] = init_aspen_tensor (params, weight_dim_order, 4, layer->dnn->element_size);
         calloc_aspen_tensor (layer->tensors [WEIGHT_TENSOR]);
         calloc_aspen_gpu_tensors (layer->tensors [WEIGHT_TENSOR]);
         
@@ -505,6 +519,335 @@ void create_layer_tensors (aspen_layer_t *layer)
         fill_tensor_with_rand_nums (layer->tensors[BIAS_TENSOR], 0.3);
 }
 
+// 3x3 stride-1 convs keep a copy of their weights in the Winograd F(4x4, 3x3) domain, unless disabled with winograd=0.
+// Expects the weight tensor in (O/8)HWI8 format.
+void create_layer_winograd_tensor (aspen_layer_t *layer)
+{
+    if (layer->type != CONV_LAYER || layer->params[WINOGRAD] == 0 || layer->tensors[WINOGRAD_WEIGHT_TENSOR] != NULL)
+        return;
+    if (layer->params[WEIGHT_H] != 3 || layer->params[WEIGHT_W] != 3 || layer->params[STRIDE] != 1 
+        || layer->params[DILATION] > 1 || layer->params[GROUPS] > 1 || layer->params[IN_C] < _WINOGRAD_MIN_IN_C)
+        return;
+    aspen_tensor_t *weight = layer->tensors[WEIGHT_TENSOR];
+    if (weight == NULL || weight->data == NULL || weight->num_dims != 5 || weight->data_dim_order[4] != SUB_C)
+        return;
+    LAYER_PARAMS winograd_dim_order[] = {WEIGHT_H, WEIGHT_W, OUT_C, IN_C, SUB_C};
+    unsigned int params[NUM_PARAM_ELEMENTS] = {0};
+    memcpy (params, layer->params, sizeof(unsigned int) * NUM_PARAM_ELEMENTS);
+    params[WEIGHT_H] = _WINOGRAD_ALPHA;
+    params[WEIGHT_W] = _WINOGRAD_ALPHA;
+    params[SUB_C] = _VEC_SIZE_M;
+    params[OUT_C] = (layer->params[OUT_C] + params[SUB_C] - 1) / params[SUB_C];
+    layer->tensors[WINOGRAD_WEIGHT_TENSOR] = init_aspen_tensor (params, winograd_dim_order, 5, layer->dnn->element_size);
+    calloc_aspen_tensor (layer->tensors[WINOGRAD_WEIGHT_TENSOR]);
+    naive_winograd_weight_transform (weight->data, layer->tensors[WINOGRAD_WEIGHT_TENSOR]->data, 
+        layer->params[OUT_C], layer->params[IN_C]);
+}
+
+// Asymmetric per-tensor activation quantization from the calibrated input range of the layer.
+void get_layer_int8_act_params (aspen_layer_t *layer, float *scale, float *zero_point)
+{
+    const float *range = layer->tensors[ACT_RANGE_TENSOR]->data;
+    const float min = range[0] < 0 ? range[0] : 0, max = range[1] > 0 ? range[1] : 0;
+    *scale = max > min ? (max - min) / QGEMM_ACT_MAX : 1.0f;
+    *zero_point = nearbyintf (-min / *scale);
+}
+
+// Conv, FC and matmul layers with a calibrated input range (see apu_calibrate_dnn_int8) keep a per-output-channel INT8 copy 
+// of their weights. Dequantization, activation zero point and bias are folded into one scale and offset per output channel.
+// Expects the weight tensor in the packed SGEMM format.
+void create_layer_int8_tensors (aspen_layer_t *layer)
+{
+    if (layer->type != CONV_LAYER && layer->type != FC_LAYER && layer->type != MATMUL_LAYER)
+        return;
+    if (layer->tensors[ACT_RANGE_TENSOR] == NULL || layer->tensors[QUANT_WEIGHT_TENSOR] != NULL)
+        return;
+    if (layer->type == CONV_LAYER && layer->params[GROUPS] > 1)
+        return;
+    aspen_tensor_t *weight = layer->tensors[WEIGHT_TENSOR] != NULL ? 
+        layer->tensors[WEIGHT_TENSOR] : layer->tensors[FP16_WEIGHT_TENSOR];
+    if (weight == NULL || weight->data == NULL || weight->num_dims < 3 
+        || (weight->data_dim_order[weight->num_dims - 1] != SUB_C && weight->data_dim_order[weight->num_dims - 1] != SUB_M))
+        return;
+    unsigned int M = layer->params[OUT_C], K = layer->params[IN_C] * layer->params[IN_H] * layer->params[IN_W];
+    if (layer->type == CONV_LAYER)
+        K = layer->params[WEIGHT_H] * layer->params[WEIGHT_W] * layer->params[IN_C];
+    else if (layer->type == MATMUL_LAYER)
+    {
+        M = layer->params[MAT_M];
+        K = layer->params[MAT_K];
+    }
+    const unsigned int M_pad = get_smallest_dividable (M, _VEC_SIZE_M);
+    LAYER_PARAMS weight_dim_order[] = {MAT_M, MAT_K, SUB_M};
+    LAYER_PARAMS scale_dim_order[] = {MAT_M};
+    unsigned int params[NUM_PARAM_ELEMENTS] = {0};
+    params[MAT_M] = M_pad / _VEC_SIZE_M;
+    params[MAT_K] = get_smallest_dividable (K, _QGEMM_K_GROUP);
+    params[SUB_M] = _VEC_SIZE_M;
+    layer->tensors[QUANT_WEIGHT_TENSOR] = init_aspen_tensor (params, weight_dim_order, 3, sizeof(int8_t));
+    calloc_aspen_tensor (layer->tensors[QUANT_WEIGHT_TENSOR]);
+    params[MAT_M] = M_pad;
+    layer->tensors[QUANT_SCALE_TENSOR] = init_aspen_tensor (params, scale_dim_order, 1, sizeof(float));
+    calloc_aspen_tensor (layer->tensors[QUANT_SCALE_TENSOR]);
+    layer->tensors[QUANT_OFFSET_TENSOR] = init_aspen_tensor (params, scale_dim_order, 1, sizeof(float));
+    calloc_aspen_tensor (layer->tensors[QUANT_OFFSET_TENSOR]);
+    float *scale = layer->tensors[QUANT_SCALE_TENSOR]->data;
+    float *offset = layer->tensors[QUANT_OFFSET_TENSOR]->data;
+    int32_t *row_sum = calloc (M_pad, sizeof(int32_t));
+    float *weight_fp32 = get_layer_fp32_weight (layer);
+    naive_quantize_weight_int8 (weight_fp32, layer->tensors[QUANT_WEIGHT_TENSOR]->data, scale, row_sum, M, K);
+    put_layer_fp32_weight (layer, weight_fp32);
+    float act_scale, zero_point;
+    get_layer_int8_act_params (layer, &act_scale, &zero_point);
+    const float *bias = layer->tensors[BIAS_TENSOR] != NULL ? layer->tensors[BIAS_TENSOR]->data : NULL;
+    for (unsigned int m = 0; m < M_pad; m++)
+    {
+        scale[m] *= act_scale;
+        offset[m] = m < M ? (bias != NULL ? bias[m] : 0) - zero_point * row_sum[m] * scale[m] : 0;
+    }
+    free (row_sum);
+}
+
+void destroy_layer_int8_tensors (aspen_layer_t *layer)
+{
+    for (LAYER_TENSORS t = QUANT_WEIGHT_TENSOR; t <= QUANT_OFFSET_TENSOR; t++)
+    {
+        if (layer->tensors[t] != NULL)
+            destroy_aspen_tensor (layer->tensors[t]);
+        layer->tensors[t] = NULL;
+    }
+}
+
+// Records the input range of every conv, FC and matmul layer over a naive FP32 inference of input_data.
+// Ranges accumulate over calls and are saved with the DNN. Call apu_set_dnn_int8 to (re)quantize the weights afterwards.
+void apu_calibrate_dnn_int8 (aspen_dnn_t *dnn, unsigned int *input_params, void *input_data)
+{
+    if (dnn == NULL || input_params == NULL || input_data == NULL)
+    {
+        ERROR_PRTF ("Error in apu_calibrate_dnn_int8: invalid arguments.\n");
+        return;
+    }
+    aspen_init_naive (dnn, input_params, input_data, -1);
+    aspen_run_naive (dnn, input_params, input_data, -1);
+    for (int i = 0; i < dnn->num_layers; i++)
+    {
+        aspen_layer_t *layer = &dnn->layers[i];
+        if (layer->type != CONV_LAYER && layer->type != FC_LAYER && layer->type != MATMUL_LAYER)
+            continue;
+        aspen_tensor_t *input = layer->parent_layers[PARENT_0]->tensors[OUTPUT_TENSOR];
+        if (layer->tensors[ACT_RANGE_TENSOR] == NULL)
+        {
+            LAYER_PARAMS range_dim_order[] = {MAT_M};
+            unsigned int params[NUM_PARAM_ELEMENTS] = {0};
+            params[MAT_M] = 2;
+            layer->tensors[ACT_RANGE_TENSOR] = init_aspen_tensor (params, range_dim_order, 1, sizeof(float));
+            calloc_aspen_tensor (layer->tensors[ACT_RANGE_TENSOR]);
+            ((float *) layer->tensors[ACT_RANGE_TENSOR]->data)[0] = FLT_MAX;
+            ((float *) layer->tensors[ACT_RANGE_TENSOR]->data)[1] = -FLT_MAX;
+        }
+        float *range = layer->tensors[ACT_RANGE_TENSOR]->data;
+        const float *data = input->data;
+        for (unsigned int j = 0; j < input->num_elements; j++)
+        {
+            range[0] = data[j] < range[0] ? data[j] : range[0];
+            range[1] = data[j] > range[1] ? data[j] : range[1];
+        }
+    }
+    // Free the naive run buffers, so that they are neither kept around nor saved with the DNN.
+    for (int i = 0; i < dnn->num_layers; i++)
+    {
+        aspen_layer_t *layer = &dnn->layers[i];
+        if (layer->tensors[OUTPUT_TENSOR] != NULL)
+            destroy_aspen_tensor (layer->tensors[OUTPUT_TENSOR]);
+        if (layer->tensors[COL_IDX_TENSOR] != NULL)
+            destroy_aspen_tensor (layer->tensors[COL_IDX_TENSOR]);
+        layer->tensors[OUTPUT_TENSOR] = NULL;
+        layer->tensors[COL_IDX_TENSOR] = NULL;
+    }
+}
+
+// Switches the CPU conv, FC and matmul kernels of calibrated layers between INT8 and FP32.
+void apu_set_dnn_int8 (aspen_dnn_t *dnn, int enable)
+{
+    unsigned int num_quantized = 0;
+    for (int i = 0; i < dnn->num_layers; i++)
+    {
+        destroy_layer_int8_tensors (&dnn->layers[i]);
+        if (enable)
+            create_layer_int8_tensors (&dnn->layers[i]);
+        num_quantized += dnn->layers[i].tensors[QUANT_WEIGHT_TENSOR] != NULL;
+    }
+    if (enable && num_quantized == 0)
+        ERROR_PRTF ("Error in apu_set_dnn_int8: DNN %s has no calibrated layers.\n", dnn->name);
+}
+
+// Returns the packed FP32 weights of the layer. FP16 weights are widened into a temporary copy, 
+// which is released with put_layer_fp32_weight.
+float *get_layer_fp32_weight (aspen_layer_t *layer)
+{
+    if (layer->tensors[WEIGHT_TENSOR] != NULL || layer->tensors[FP16_WEIGHT_TENSOR] == NULL)
+        return layer->tensors[WEIGHT_TENSOR] != NULL ? layer->tensors[WEIGHT_TENSOR]->data : NULL;
+    aspen_tensor_t *fp16 = layer->tensors[FP16_WEIGHT_TENSOR];
+    float *weight = aspen_calloc (fp16->num_elements, sizeof(float));
+    naive_fp16_to_fp32 (fp16->data, weight, fp16->num_elements);
+    return weight;
+}
+
+void put_layer_fp32_weight (aspen_layer_t *layer, float *weight)
+{
+    if (weight != NULL && (layer->tensors[WEIGHT_TENSOR] == NULL || weight != layer->tensors[WEIGHT_TENSOR]->data))
+        aspen_free (weight);
+}
+
+// Stores the packed weights of FC and matmul layers in FP16 (enable != 0) or FP32. 
+// The CPU kernels widen FP16 weights in registers, so this halves the weight memory and bandwidth of these layers.
+// FP16 weights replace the FP32 ones in memory and in saved DNN files.
+void apu_set_dnn_fp16 (aspen_dnn_t *dnn, int enable)
+{
+    if (enable && aspen_num_gpus > 0)
+    {
+        ERROR_PRTF ("Error in apu_set_dnn_fp16: FP16 weights are not supported on GPUs.\n");
+        return;
+    }
+    for (int i = 0; i < dnn->num_layers; i++)
+    {
+        aspen_layer_t *layer = &dnn->layers[i];
+        if (layer->type != FC_LAYER && layer->type != MATMUL_LAYER)
+            continue;
+        if (enable && layer->tensors[WEIGHT_TENSOR] != NULL && layer->tensors[WEIGHT_TENSOR]->data != NULL)
+        {
+            aspen_tensor_t *weight = layer->tensors[WEIGHT_TENSOR];
+            aspen_tensor_t *fp16 = init_aspen_tensor (weight->dims, weight->data_dim_order, weight->num_dims, sizeof(uint16_t));
+            calloc_aspen_tensor (fp16);
+            naive_fp32_to_fp16 (weight->data, fp16->data, weight->num_elements);
+            destroy_aspen_tensor (weight);
+            layer->tensors[WEIGHT_TENSOR] = NULL;
+            layer->tensors[FP16_WEIGHT_TENSOR] = fp16;
+        }
+        else if (!enable && layer->tensors[FP16_WEIGHT_TENSOR] != NULL)
+        {
+            aspen_tensor_t *fp16 = layer->tensors[FP16_WEIGHT_TENSOR];
+            aspen_tensor_t *weight = init_aspen_tensor (fp16->dims, fp16->data_dim_order, fp16->num_dims, layer->dnn->element_size);
+            calloc_aspen_tensor (weight);
+            naive_fp16_to_fp32 (fp16->data, weight->data, fp16->num_elements);
+            destroy_aspen_tensor (fp16);
+            layer->tensors[FP16_WEIGHT_TENSOR] = NULL;
+            layer->tensors[WEIGHT_TENSOR] = weight;
+            calloc_aspen_gpu_tensors (weight);
+            sync_dnn_data_to_gpu_layer (layer);
+        }
+    }
+}
+
+// Computes each layernorm that follows an activation-free residual layer in the residual ninsts (enable != 0),
+// in one pass over the residual sum. Applies to NASMs created afterwards, and only to local CPU runs.
+void apu_set_dnn_fused_layernorm (aspen_dnn_t *dnn, int enable)
+{
+    if (enable && aspen_num_gpus > 0)
+    {
+        ERROR_PRTF ("Error in apu_set_dnn_fused_layernorm: Fused layernorm is not supported on GPUs.\n");
+        return;
+    }
+    dnn->fuse_residual_layernorm = enable != 0;
+}
+
+// Computes each K-attention (scores and softmax) inside its V-attention ninsts (enable != 0), streaming key and value
+// blocks with an online softmax, so the seq x seq score matrix is never stored. 
+// Applies to NASMs created afterwards, and only to local CPU runs.
+void apu_set_dnn_fused_attention (aspen_dnn_t *dnn, int enable)
+{
+    if (enable && aspen_num_gpus > 0)
+    {
+        ERROR_PRTF ("Error in apu_set_dnn_fused_attention: Fused attention is not supported on GPUs.\n");
+        return;
+    }
+    dnn->fuse_attention = enable != 0;
+}
+
+// Computes the matmul layers of the same shape that read the same parent, such as the Query, Key and Value 
+// projections of a transformer block, in the ninsts of the first one (enable != 0). Each ninst runs the same tile 
+// of every projection while its input columns are in cache. Applies to NASMs created afterwards, and only to local CPU runs.
+void apu_set_dnn_fused_qkv (aspen_dnn_t *dnn, int enable)
+{
+    if (enable && aspen_num_gpus > 0)
+    {
+        ERROR_PRTF ("Error in apu_set_dnn_fused_qkv: Fused QKV is not supported on GPUs.\n");
+        return;
+    }
+    dnn->fuse_qkv = enable != 0;
+}
+
+// Lets the parents of each append layer write their outputs into their channel slice of the append output (enable != 0),
+// so the append copies nothing. A parent is placed in the slice only if its tiles fit in it and it is not upsampled.
+// Applies to NASMs created afterwards, and only to local CPU runs.
+void apu_set_dnn_zero_copy_concat (aspen_dnn_t *dnn, int enable)
+{
+    if (enable && aspen_num_gpus > 0)
+    {
+        ERROR_PRTF ("Error in apu_set_dnn_zero_copy_concat: Zero-copy concat is not supported on GPUs.\n");
+        return;
+    }
+    dnn->zero_copy_concat = enable != 0;
+}
+
+// Computes each residual layer in the ninsts of the conv that is its only producer (enable != 0): the skip connection 
+// is added and the residual activation applied in the conv epilogue, and the residual ninsts do nothing.
+// The conv must have no activation of its own. Applies to NASMs created afterwards, and only to local CPU runs.
+void apu_set_dnn_fused_conv_residual (aspen_dnn_t *dnn, int enable)
+{
+    if (enable && aspen_num_gpus > 0)
+    {
+        ERROR_PRTF ("Error in apu_set_dnn_fused_conv_residual: Fused conv + residual is not supported on GPUs.\n");
+        return;
+    }
+    dnn->fuse_conv_residual = enable != 0;
+}
+
+// Computes each 2x2, stride 2 maxpool layer in the ninsts of the conv that is its only input (enable != 0): conv ninsts 
+// cover whole pairs of output rows and pool their tile right after computing it, and the maxpool ninsts do nothing.
+// Applies to NASMs created afterwards, and only to local CPU runs.
+void apu_set_dnn_fused_conv_maxpool (aspen_dnn_t *dnn, int enable)
+{
+    if (enable && aspen_num_gpus > 0)
+    {
+        ERROR_PRTF ("Error in apu_set_dnn_fused_conv_maxpool: Fused conv + maxpool is not supported on GPUs.\n");
+        return;
+    }
+    dnn->fuse_conv_maxpool = enable != 0;
+}
+
+// Runs the FP32 conv, fully connected and matmul GEMMs on x86-64 kernels generated for their exact tile shapes and 
+// epilogues (enable != 0), built when the NASM is created. Kernels are cached by shape for the whole process.
+// Hosts without AVX2 keep the kernel macros. Applies to NASMs created afterwards, and only to local CPU runs.
+void apu_set_dnn_jit_sgemm (aspen_dnn_t *dnn, int enable)
+{
+    if (enable && aspen_num_gpus > 0)
+    {
+        ERROR_PRTF ("Error in apu_set_dnn_jit_sgemm: JIT SGEMM kernels are not supported on GPUs.\n");
+        return;
+    }
+    dnn->jit_sgemm = enable != 0;
+}
+
+// Tunes the cache blocking of the FP32 conv, fully connected and matmul GEMMs for this host (cache_dir != NULL): 
+// the first NASM with a new tile shape benchmarks candidate blockings for it, and the winners are kept in the file 
+// aspen_sgemm_tune_<hostname>.txt in cache_dir, so later runs reuse them. cache_dir NULL restores the default blocking.
+// Applies to NASMs created afterwards, and only to local CPU runs.
+void apu_set_dnn_sgemm_autotune (aspen_dnn_t *dnn, char *cache_dir)
+{
+    if (cache_dir != NULL && aspen_num_gpus > 0)
+    {
+        ERROR_PRTF ("Error in apu_set_dnn_sgemm_autotune: SGEMM autotuning is not supported on GPUs.\n");
+        return;
+    }
+    if (cache_dir != NULL && strlen (cache_dir) >= MAX_STRING_LEN)
+    {
+        ERROR_PRTF ("Error in apu_set_dnn_sgemm_autotune: cache_dir is longer than %d characters.\n", MAX_STRING_LEN - 1);
+        return;
+    }
+    strcpy (dnn->sgemm_tune_dir, cache_dir != NULL ? cache_dir : "");
+}
+
 // Change to add a new layer type
 void create_layer_output_tensor (aspen_layer_t *layer, int gpu_idx)
 {
@@ -584,8 +927,8 @@ void layer_find_input_pos_idx (aspen_layer_t *layer)
                     {
                         for (int kw = 0; kw < layer->params[WEIGHT_W]; kw++)
                         {
-                            int in_h = out_h * layer->params[STRIDE] + kh  - layer->params[PADDING];
-                            int in_w = out_w * layer->params[STRIDE] + kw  - layer->params[PADDING];
+                            int in_h = out_h * layer->params[STRIDE] + kh * layer->params[DILATION] - layer->params[PADDING];
+                            int in_w = out_w * layer->params[STRIDE] + kw * layer->params[DILATION] - layer->params[PADDING];
                             if (in_h < 0 || in_h >= p_layer->params[OUT_H] || in_w < 0 || in_w >= p_layer->params[OUT_W])
                             {
                                 input_idx_arr[num_idx++] = -1;
@@ -975,7 +1318,7 @@ void aspen_run_naive (aspen_dnn_t* dnn, unsigned int *input_params, void *input_
                 naive_conv2d (input, layer->tensors[WEIGHT_TENSOR]->data, layer->tensors[BIAS_TENSOR]->data, output,
                     layer->params[BATCH], layer->params[IN_C], layer->params[IN_H], layer->params[IN_W],
                     layer->params[OUT_C], layer->params[WEIGHT_H], layer->params[WEIGHT_W],
-                    layer->params[STRIDE], layer->params[PADDING]);
+                    layer->params[STRIDE], layer->params[PADDING], layer->params[DILATION], layer->params[GROUPS]);
             }
             else if (layer->type == MAXPOOL_LAYER)
             {
@@ -993,8 +1336,10 @@ void aspen_run_naive (aspen_dnn_t* dnn, unsigned int *input_params, void *input_
             }
             else if (layer->type == FC_LAYER)
             {
-                naive_fully_connected (input, layer->tensors[WEIGHT_TENSOR]->data, layer->tensors[BIAS_TENSOR]->data, output,
+                float *weight = get_layer_fp32_weight (layer);
+                naive_fully_connected (input, weight, layer->tensors[BIAS_TENSOR]->data, output,
                     layer->params[BATCH], layer->params[IN_C]*layer->params[IN_H]*layer->params[IN_W], layer->params[OUT_C]);
+                put_layer_fp32_weight (layer, weight);
             }
             else if (layer->type == RESIDUAL_LAYER)
             {
@@ -1003,9 +1348,11 @@ void aspen_run_naive (aspen_dnn_t* dnn, unsigned int *input_params, void *input_
             else if (layer->type == MATMUL_LAYER)
             {
                 memset (output, 0, layer->tensors[OUTPUT_TENSOR]->num_elements * layer->tensors[OUTPUT_TENSOR]->element_size);
+                float *weight = get_layer_fp32_weight (layer);
                 SGEMM_KERNEL_OMP (layer->params[MAT_M], layer->params[MAT_N]*layer->params[BATCH], layer->params[MAT_K], 
-                    layer->tensors[WEIGHT_TENSOR]->data, layer->params[MAT_K], input, layer->params[MAT_K], 
+                    weight, layer->params[MAT_K], input, layer->params[MAT_K], 
                         output, layer->params[MAT_M]);
+                put_layer_fp32_weight (layer, weight);
                 for (int j = 0; j < layer->params[MAT_N]*layer->params[BATCH]; j++)
                 {
                     for (int k = 0; k < layer->params[MAT_M]; k++)
@@ -2,6 +2,9 @@
 #include "apu.h"
 #include "nasm.h"
 #include "input_parser.h"
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
 
 
 extern char* branch_info;
@@ -45,6 +48,31 @@ char *read_and_return_if_EOF (FILE *fp, char *buffer, char *check_str, unsigned
     return line + strlen(check_str);
 }
 
+// Reads the next "<idx> <val>" entry of a list section such as LAYER_PARAMS. Returns 1 for an entry, 0 once the
+// end_str line closing the section is read, and -1 on EOF or a malformed line. Sections are read up to end_str
+// rather than for a fixed count, so that files written before or after an enum grew still parse.
+static int read_indexed_entry (FILE *fp, char *buffer, char *end_str, unsigned int *line_num, int *idx, int *val)
+{
+    if (fgets(buffer, MAX_STRING_LEN, fp) == NULL)
+    {
+        ERROR_PRTF ("ASPEN DNN file parse error: Unexpected EOF, expected \"%s\".\n", end_str);
+        return -1;
+    }
+    (*line_num)++;
+    buffer[strcspn(buffer, "\n")] = 0;
+    char *line = buffer;
+    while (*line == ' ' || *line == '\t')
+        line++;
+    if (strncmp(line, end_str, strlen(end_str)) == 0)
+        return 0;
+    if (sscanf(line, "%d %d", idx, val) != 2)
+    {
+        ERROR_PRTF ("Wrong ASPEN DNN file format at line %d, expected \"%s\", got \"%s\"\n", *line_num, end_str, line);
+        return -1;
+    }
+    return 1;
+}
+
 void apu_load_dnn_data_from_file (aspen_dnn_t *dnn, char *input_path)
 {
     FILE *fp = fopen(input_path, "rb");
@@ -404,7 +432,7 @@ void apu_load_dnn_data_from_file (aspen_dnn_t *dnn, char *input_path)
             fold_batchnorm_float (bn_var, bn_mean, bn_weight,
                                   layer->tensors[WEIGHT_TENSOR]->data,
                                   layer->tensors[BIAS_TENSOR]->data,
-                                  layer->params[OUT_C], layer->params[IN_C],
+                                  layer->params[OUT_C], get_layer_in_c_per_group (layer),
                                   layer->params[WEIGHT_H], layer->params[WEIGHT_W]);
             free(bn_var);
             free(bn_mean);
@@ -472,7 +500,9 @@ void apu_save_dnn_to_file(aspen_dnn_t *dnn, char *filename)
         fprintf (fp, "\tLAYER_TENSORS:\n");
         for (unsigned int j = 0; j < NUM_TENSORS; j++)
         {
-            if (layer->tensors[j] != NULL)
+            // Winograd and INT8 weights are recomputed from the weight tensor on load.
+            if (layer->tensors[j] != NULL && j != WINOGRAD_WEIGHT_TENSOR 
+                && j != QUANT_WEIGHT_TENSOR && j != QUANT_SCALE_TENSOR && j != QUANT_OFFSET_TENSOR)
             {
                 aspen_tensor_t *tensor = layer->tensors[j];
                 fprintf (fp, "\t\t%d 1\n", j);
@@ -490,7 +520,7 @@ void apu_save_dnn_to_file(aspen_dnn_t *dnn, char *filename)
                 }
                 fprintf (fp, "\t\tTENSOR_DIMS_END\n");
                 fprintf (fp, "\t\tTENSOR_DATA:\n");
-                fwrite (tensor->data, dnn->element_size, tensor->num_elements, fp);
+                fwrite (tensor->data, tensor->element_size, tensor->num_elements, fp);
                 fprintf (fp, "\t\tTENSOR_DATA_END\n");
             }
             else
@@ -609,26 +639,15 @@ aspen_dnn_t *apu_parse_dnn_from_file(char *filename, FILE **fp_t, unsigned int *
             apu_destroy_dnn(dnn);
             return NULL;
         }
-        for (unsigned int j = 0; j < NUM_PARAM_ELEMENTS; j++)
+        // Layers of files written before the Winograd path existed may use it, as darknet cfgs do by default.
+        layer->params[WINOGRAD] = 1;
+        int param_idx = 0, param_val = 0, ret = 0;
+        while ((ret = read_indexed_entry (*fp_t, line, "LAYER_PARAMS_END", line_num, &param_idx, &param_val)) == 1)
         {
-            void *tmp = fgets (line, MAX_STRING_LEN, *fp_t);
-            if (tmp == NULL)
-            {
-                ERROR_PRTF ("ASPEN DNN file %s parse error at source line %d, soruce file %s\n", 
-                    filename, 0, " ");
-                apu_destroy_dnn(dnn);
-                return NULL;
-            }
-            *line_num += 1;
-            ptr = line;
-            while (*ptr == ' ' || *ptr == '\t')
-                ptr++;
-            int param_idx = 0;
-            int param_val = 0;
-            sscanf(ptr, "%d %d", &param_idx, &param_val);
-            layer->params[param_idx] = param_val;
+            if (param_idx >= 0 && param_idx < NUM_PARAM_ELEMENTS)
+                layer->params[param_idx] = param_val;
         }
-        if ((ptr = read_check_and_return (*fp_t, line, "LAYER_PARAMS_END", line_num)) == NULL)
+        if (ret != 0)
         {
             ERROR_PRTF ("ASPEN DNN file %s parse error: Missing LAYER_PARAMS_END.\n", filename);
             apu_destroy_dnn(dnn);
@@ -640,23 +659,19 @@ aspen_dnn_t *apu_parse_dnn_from_file(char *filename, FILE **fp_t, unsigned int *
             apu_destroy_dnn(dnn);
             return NULL;
         }
-        for (unsigned int j = 0; j < NUM_TENSORS; j++)
+        int tensor_idx = 0, tensor_val = 0;
+        while ((ret = read_indexed_entry (*fp_t, line, "LAYER_TENSORS_END", line_num, &tensor_idx, &tensor_val)) == 1)
         {
-            void * tmp = fgets (line, MAX_STRING_LEN, *fp_t);
-            if (tmp == NULL)
+            if (tensor_idx < 0 || tensor_idx >= NUM_TENSORS)
             {
-                ERROR_PRTF ("ASPEN DNN file %s parse error at source line %d, soruce file %s\n", 
-                    filename, 0, " ");
+                // The element size of an unknown tensor is unknown, so its data cannot be skipped.
+                if (tensor_val == -1)
+                    continue;
+                ERROR_PRTF ("ASPEN DNN file %s parse error: Unknown tensor %d, written by a newer ASPEN build.\n", 
+                    filename, tensor_idx);
                 apu_destroy_dnn(dnn);
                 return NULL;
             }
-            *line_num += 1;
-            ptr = line;
-            while (*ptr == ' ' || *ptr == '\t')
-                ptr++;
-            int tensor_idx = 0;
-            int tensor_val = 0;
-            sscanf(ptr, "%d %d", &tensor_idx, &tensor_val);
             if (tensor_val == -1)
                 layer->tensors[tensor_idx] = NULL;
             else
@@ -713,26 +728,13 @@ aspen_dnn_t *apu_parse_dnn_from_file(char *filename, FILE **fp_t, unsigned int *
                     apu_destroy_dnn(dnn);
                     return NULL;
                 }
-                for (unsigned int k = 0; k < NUM_PARAM_ELEMENTS; k++)
+                int dim_idx = 0, dim_val = 0;
+                while ((ret = read_indexed_entry (*fp_t, line, "TENSOR_DIMS_END", line_num, &dim_idx, &dim_val)) == 1)
                 {
-                    void * tmp = fgets (line, MAX_STRING_LEN, *fp_t);
-                    if (tmp == NULL)
-                    {
-                        ERROR_PRTF ("ASPEN DNN file %s parse error at source line %d, soruce file %s\n", 
-                            filename, 0, " ");
-                        apu_destroy_dnn(dnn);
-                        return NULL;
-                    }
-                    *line_num += 1;
-                    ptr = line;
-                    while (*ptr == ' ' || *ptr == '\t')
-                        ptr++;
-                    int dim_idx = 0;
-                    int dim_val = 0;
-                    sscanf(ptr, "%d %d", &dim_idx, &dim_val);
-                    tensor->dims[dim_idx] = dim_val;
+                    if (dim_idx >= 0 && dim_idx < NUM_PARAM_ELEMENTS)
+                        tensor->dims[dim_idx] = dim_val;
                 }
-                if ((ptr = read_check_and_return (*fp_t, line, "TENSOR_DIMS_END", line_num)) == NULL)
+                if (ret != 0)
                 {
                     ERROR_PRTF ("ASPEN DNN file %s parse error: Missing TENSOR_DIMS_END.\n", filename);
                     apu_destroy_dnn(dnn);
@@ -750,17 +752,17 @@ aspen_dnn_t *apu_parse_dnn_from_file(char *filename, FILE **fp_t, unsigned int *
                     num_elements *= tensor->dims[tensor->data_dim_order[k]];
                 }
                 tensor->num_elements = num_elements;
-                tensor->element_size = layer->dnn->element_size;
+                tensor->element_size = tensor_idx == FP16_WEIGHT_TENSOR ? sizeof(uint16_t) : layer->dnn->element_size;
                 if (skip_alloc == 0)
                 {
-                    tensor->data = aspen_calloc (num_elements, layer->dnn->element_size);
+                    tensor->data = aspen_calloc (num_elements, tensor->element_size);
                     if (tensor->data == NULL)
                     {
                         ERROR_PRTF ("ASPEN DNN file %s parse error: Failed to allocate tensor data.\n", filename);
                         apu_destroy_dnn(dnn);
                         return NULL;
                     }
-                    size_t val = fread (tensor->data, layer->dnn->element_size, num_elements, *fp_t);
+                    size_t val = fread (tensor->data, tensor->element_size, num_elements, *fp_t);
                     if (val != num_elements)
                     {
                         ERROR_PRTF ("ASPEN DNN file %s parse error: Failed to read tensor data.\n", filename);
@@ -778,7 +780,7 @@ aspen_dnn_t *apu_parse_dnn_from_file(char *filename, FILE **fp_t, unsigned int *
                 }
                 else
                 {
-                    fseek (*fp_t, num_elements*layer->dnn->element_size, SEEK_CUR);
+                    fseek (*fp_t, num_elements*tensor->element_size, SEEK_CUR);
                 }
                 if ((ptr = read_check_and_return (*fp_t, line, "TENSOR_DATA_END", line_num)) == NULL)
                 {
@@ -788,7 +790,7 @@ aspen_dnn_t *apu_parse_dnn_from_file(char *filename, FILE **fp_t, unsigned int *
                 }
             }
         }
-        if ((ptr = read_check_and_return (*fp_t, line, "LAYER_TENSORS_END", line_num)) == NULL)
+        if (ret != 0)
         {
             ERROR_PRTF ("ASPEN DNN file %s parse error: Missing LAYER_TENSORS_END.\n", filename);
             apu_destroy_dnn(dnn);
@@ -817,6 +819,17 @@ aspen_dnn_t *apu_load_dnn_from_file(char *filename)
     unsigned int line_num = 0;
     aspen_dnn_t *dnn = apu_parse_dnn_from_file (filename, &fp, &line_num, 0);
     fclose (fp);
+    if (dnn != NULL)
+    {
+        for (int i = 0; i < dnn->num_layers; i++)
+        {
+            create_layer_winograd_tensor (&dnn->layers[i]);
+            create_layer_int8_tensors (&dnn->layers[i]);
+        }
+        // The GPU kernels only take FP32 weights.
+        if (aspen_num_gpus > 0)
+            apu_set_dnn_fp16 (dnn, 0);
+    }
     return dnn;
 }
 
@@ -845,6 +858,14 @@ void apu_save_nasm_to_file(nasm_t *nasm, char *filename)
     fprintf (fp, "TOTAL_FLOPS:%ld\n", nasm->total_flops);
     fprintf (fp, "FLOP_PER_NINST:%d\n", nasm->flop_per_ninst);
     fprintf (fp, "SEQ_LEN:%d\n", nasm->tr_seq_len);
+    fprintf (fp, "PLAN_FLAGS:%u\n", nasm->plan_flags);
+    if (nasm->ldata_min_ninst_arr != NULL)
+    {
+        fprintf (fp, "LDATA_MIN_NINST:%d\n", nasm->num_ldata);
+        for (unsigned int i = 0; i < nasm->num_ldata; i++)
+            fprintf (fp, "\t%d %d\n", i, nasm->ldata_min_ninst_arr[i]);
+        fprintf (fp, "LDATA_MIN_NINST_END\n");
+    }
     fprintf (fp, "NASM_NINSTS:\n");
     for (unsigned int i = 0; i < nasm->num_ldata; i++)
     {
@@ -878,6 +899,359 @@ void apu_save_nasm_to_file(nasm_t *nasm, char *filename)
     fclose (fp);
 }
 
+// Binary NASM layout. Every section starts at a NASM_BIN_ALIGN aligned offset:
+// header | ldata geometry | ninst geometry | parent offsets | child offsets | parent idx | child idx
+typedef struct nasm_bin_header_t
+{
+    char magic [NASM_BIN_MAGIC_LEN];
+    uint32_t version;
+    uint32_t batch_size;
+    uint32_t min_ninst_per_ldata;
+    uint32_t flop_per_ninst;
+    uint32_t tr_seq_len;
+    uint32_t num_ldata;
+    uint32_t num_ninst;
+    uint32_t element_size;
+    uint32_t plan_flags;
+    uint32_t reserved;
+    uint64_t total_flops;
+    uint64_t num_parent_edges;
+    uint64_t num_child_edges;
+    char dnn_name [MAX_STRING_LEN];
+} nasm_bin_header_t;
+
+typedef struct nasm_bin_ldata_t
+{
+    uint32_t out_mat_dims [2];
+    uint32_t ninst_tile_dims [2];
+    uint32_t num_ninst;
+    uint32_t min_ninst;
+} nasm_bin_ldata_t;
+
+typedef struct nasm_bin_ninst_t
+{
+    uint32_t out_mat_pos [2];
+    uint32_t tile_dims [2];
+    uint32_t num_input_pos;
+} nasm_bin_ninst_t;
+
+typedef struct nasm_bin_layout_t
+{
+    size_t ldata_offset;
+    size_t ninst_offset;
+    size_t parent_offset_offset;
+    size_t child_offset_offset;
+    size_t parent_idx_offset;
+    size_t child_idx_offset;
+    size_t file_size;
+} nasm_bin_layout_t;
+
+static void get_nasm_bin_layout (size_t num_ldata, size_t num_ninst, 
+    size_t num_parent_edges, size_t num_child_edges, nasm_bin_layout_t *layout)
+{
+    layout->ldata_offset = get_smallest_dividable (sizeof(nasm_bin_header_t), NASM_BIN_ALIGN);
+    layout->ninst_offset = layout->ldata_offset 
+        + get_smallest_dividable (num_ldata * sizeof(nasm_bin_ldata_t), NASM_BIN_ALIGN);
+    layout->parent_offset_offset = layout->ninst_offset 
+        + get_smallest_dividable (num_ninst * sizeof(nasm_bin_ninst_t), NASM_BIN_ALIGN);
+    layout->child_offset_offset = layout->parent_offset_offset 
+        + get_smallest_dividable ((num_ninst + 1) * sizeof(uint64_t), NASM_BIN_ALIGN);
+    layout->parent_idx_offset = layout->child_offset_offset 
+        + get_smallest_dividable ((num_ninst + 1) * sizeof(uint64_t), NASM_BIN_ALIGN);
+    layout->child_idx_offset = layout->parent_idx_offset 
+        + get_smallest_dividable (num_parent_edges * sizeof(uint32_t), NASM_BIN_ALIGN);
+    layout->file_size = layout->child_idx_offset 
+        + get_smallest_dividable (num_child_edges * sizeof(uint32_t), NASM_BIN_ALIGN);
+}
+
+void apu_save_nasm_to_bin_file(nasm_t *nasm, char *filename)
+{
+    if (nasm == NULL)
+    {
+        ERROR_PRTF ("ASPEN NASM to save is null.\n");
+        return;
+    }
+    if (filename == NULL)
+    {
+        ERROR_PRTF ("ASPEN NASM file name not specified.\n");
+        return;
+    }
+    size_t num_parent_edges = 0, num_child_edges = 0;
+    for (unsigned int i = 0; i < nasm->num_ninst; i++)
+    {
+        num_parent_edges += nasm->ninst_arr[i].num_parent_ninsts;
+        num_child_edges += nasm->ninst_arr[i].num_child_ninsts;
+    }
+    nasm_bin_layout_t layout;
+    get_nasm_bin_layout (nasm->num_ldata, nasm->num_ninst, num_parent_edges, num_child_edges, &layout);
+    char *buffer = calloc (1, layout.file_size);
+    nasm_bin_header_t *header = (nasm_bin_header_t *)buffer;
+    strncpy (header->magic, NASM_BIN_MAGIC, NASM_BIN_MAGIC_LEN);
+    header->version = NASM_BIN_VERSION;
+    header->batch_size = nasm->batch_size;
+    header->min_ninst_per_ldata = nasm->min_ninst_per_ldata;
+    header->flop_per_ninst = nasm->flop_per_ninst;
+    header->tr_seq_len = nasm->tr_seq_len;
+    header->num_ldata = nasm->num_ldata;
+    header->num_ninst = nasm->num_ninst;
+    header->element_size = nasm->dnn->element_size;
+    header->plan_flags = nasm->plan_flags;
+    header->total_flops = nasm->total_flops;
+    header->num_parent_edges = num_parent_edges;
+    header->num_child_edges = num_child_edges;
+    snprintf (header->dnn_name, MAX_STRING_LEN, "%s", nasm->dnn->name);
+    nasm_bin_ldata_t *bin_ldata_arr = (nasm_bin_ldata_t *)(buffer + layout.ldata_offset);
+    for (unsigned int i = 0; i < nasm->num_ldata; i++)
+    {
+        nasm_ldata_t *ldata = &nasm->ldata_arr[i];
+        bin_ldata_arr[i].out_mat_dims[OUT_H] = ldata->out_mat_dims[OUT_H];
+        bin_ldata_arr[i].out_mat_dims[OUT_W] = ldata->out_mat_dims[OUT_W];
+        bin_ldata_arr[i].ninst_tile_dims[OUT_H] = ldata->ninst_tile_dims[OUT_H];
+        bin_ldata_arr[i].ninst_tile_dims[OUT_W] = ldata->ninst_tile_dims[OUT_W];
+        bin_ldata_arr[i].num_ninst = ldata->num_ninst;
+        bin_ldata_arr[i].min_ninst = nasm->ldata_min_ninst_arr != NULL ? 
+            nasm->ldata_min_ninst_arr[i] : nasm->min_ninst_per_ldata;
+    }
+    nasm_bin_ninst_t *bin_ninst_arr = (nasm_bin_ninst_t *)(buffer + layout.ninst_offset);
+    uint64_t *parent_offset = (uint64_t *)(buffer + layout.parent_offset_offset);
+    uint64_t *child_offset = (uint64_t *)(buffer + layout.child_offset_offset);
+    uint32_t *parent_idx = (uint32_t *)(buffer + layout.parent_idx_offset);
+    uint32_t *child_idx = (uint32_t *)(buffer + layout.child_idx_offset);
+    parent_offset[0] = 0;
+    child_offset[0] = 0;
+    for (unsigned int i = 0; i < nasm->num_ninst; i++)
+    {
+        ninst_t *ninst = &nasm->ninst_arr[i];
+        bin_ninst_arr[i].out_mat_pos[OUT_H] = ninst->out_mat_pos[OUT_H];
+        bin_ninst_arr[i].out_mat_pos[OUT_W] = ninst->out_mat_pos[OUT_W];
+        bin_ninst_arr[i].tile_dims[OUT_H] = ninst->tile_dims[OUT_H];
+        bin_ninst_arr[i].tile_dims[OUT_W] = ninst->tile_dims[OUT_W];
+        bin_ninst_arr[i].num_input_pos = ninst->num_input_pos;
+        parent_offset[i + 1] = parent_offset[i] + ninst->num_parent_ninsts;
+        child_offset[i + 1] = child_offset[i] + ninst->num_child_ninsts;
+        for (unsigned int k = 0; k < ninst->num_parent_ninsts; k++)
+            parent_idx[parent_offset[i] + k] = ninst->parent_ninst_idx_arr[k];
+        for (unsigned int k = 0; k < ninst->num_child_ninsts; k++)
+            child_idx[child_offset[i] + k] = ninst->child_ninst_arr[k] - nasm->ninst_arr;
+    }
+    FILE *fp = fopen (filename, "wb");
+    if (fp == NULL)
+    {
+        ERROR_PRTF ( "Error: apu_save_nasm_to_bin_file Failed to open file %s for writing\n", filename);
+        free (buffer);
+        return;
+    }
+    if (fwrite (buffer, 1, layout.file_size, fp) != layout.file_size)
+        ERROR_PRTF ( "Error: apu_save_nasm_to_bin_file Failed to write file %s\n", filename);
+    fclose (fp);
+    free (buffer);
+}
+
+// A NASM file can only be loaded into a dnn with the fusion options it was planned with: fused ninsts depend on 
+// parents that an unfused plan does not list, and the other way round. Winograd tiling follows the file.
+static int is_nasm_plan_flags_compatible (char *filename, unsigned int plan_flags, aspen_dnn_t *dnn)
+{
+    const unsigned int dnn_plan_flags = get_dnn_nasm_plan_flags (dnn);
+    if ((plan_flags ^ dnn_plan_flags) & ~NASM_PLAN_WINOGRAD_TILING)
+    {
+        ERROR_PRTF ("ASPEN NASM file %s was planned with options 0x%x, but the dnn has 0x%x. "
+            "Create the NASM again with the current options.\n", filename, plan_flags, dnn_plan_flags);
+        return 0;
+    }
+    return 1;
+}
+
+// Checks that the CSR offsets start at 0, never decrease and end at num_edges, 
+// and that every index refers to a ninst of the NASM.
+static int is_nasm_bin_csr_valid (const uint64_t *offset, const uint32_t *idx, size_t num_ninst, size_t num_edges)
+{
+    if (offset[0] != 0 || offset[num_ninst] != num_edges)
+        return 0;
+    for (size_t i = 0; i < num_ninst; i++)
+    {
+        if (offset[i + 1] < offset[i])
+            return 0;
+    }
+    for (size_t i = 0; i < num_edges; i++)
+    {
+        if (idx[i] >= num_ninst)
+            return 0;
+    }
+    return 1;
+}
+
+nasm_t *apu_load_nasm_from_bin_file(char *filename, aspen_dnn_t *dnn)
+{
+    int fd = open (filename, O_RDONLY);
+    if (fd < 0)
+    {
+        ERROR_PRTF ("ASPEN DNN NASM load error: file %s not found.\n", filename);
+        return NULL;
+    }
+    struct stat st;
+    if (fstat (fd, &st) != 0 || st.st_size < sizeof(nasm_bin_header_t))
+    {
+        ERROR_PRTF ("ASPEN NASM binary file %s parse error: File too small.\n", filename);
+        close (fd);
+        return NULL;
+    }
+    size_t map_size = st.st_size;
+    // Copy-on-write, so that the parent CSR used in place stays writable like that of a generated NASM.
+    char *map = mmap (NULL, map_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+    close (fd);
+    if (map == MAP_FAILED)
+    {
+        ERROR_PRTF ("ASPEN NASM binary file %s mmap failed.\n", filename);
+        return NULL;
+    }
+    nasm_bin_header_t *header = (nasm_bin_header_t *)map;
+    char dnn_name [MAX_STRING_LEN];
+    memcpy (dnn_name, header->dnn_name, MAX_STRING_LEN);
+    dnn_name[MAX_STRING_LEN - 1] = '\0';
+    if (strncmp (header->magic, NASM_BIN_MAGIC, NASM_BIN_MAGIC_LEN) != 0)
+    {
+        ERROR_PRTF ("ASPEN NASM binary file %s parse error: Not an ASPEN NASM binary file.\n", filename);
+        munmap (map, map_size);
+        return NULL;
+    }
+    if (header->version != NASM_BIN_VERSION)
+    {
+        ERROR_PRTF ("ASPEN NASM binary file %s parse error: Version %d, expected %d.\n", 
+            filename, header->version, NASM_BIN_VERSION);
+        munmap (map, map_size);
+        return NULL;
+    }
+    if (strcmp (dnn_name, dnn->name) != 0)
+    {
+        ERROR_PRTF ("ASPEN NASM binary file %s parse error: DNN_NAME %s does not match dnn name %s.\n", 
+            filename, dnn_name, dnn->name);
+        munmap (map, map_size);
+        return NULL;
+    }
+    if (header->element_size != dnn->element_size)
+    {
+        ERROR_PRTF ("ASPEN NASM binary file %s parse error: Element size %d does not match dnn element size %d.\n", 
+            filename, header->element_size, dnn->element_size);
+        munmap (map, map_size);
+        return NULL;
+    }
+    // Edge counts are bounded by the file size first, so that the layout below cannot overflow.
+    if (header->num_parent_edges > map_size / sizeof(uint32_t) || header->num_child_edges > map_size / sizeof(uint32_t))
+    {
+        ERROR_PRTF ("ASPEN NASM binary file %s parse error: Truncated file.\n", filename);
+        munmap (map, map_size);
+        return NULL;
+    }
+    nasm_bin_layout_t layout;
+    get_nasm_bin_layout (header->num_ldata, header->num_ninst, 
+        header->num_parent_edges, header->num_child_edges, &layout);
+    if (layout.file_size > map_size)
+    {
+        ERROR_PRTF ("ASPEN NASM binary file %s parse error: Truncated file.\n", filename);
+        munmap (map, map_size);
+        return NULL;
+    }
+    unsigned int num_ldata = 0;
+    for (int i = 0; i < dnn->num_layers; i++)
+        num_ldata += get_nasm_ldata_num_per_layer (&dnn->layers[i]);
+    if (num_ldata != header->num_ldata)
+    {
+        ERROR_PRTF ("ASPEN NASM binary file %s parse error: DNN has %d ldata, file has %d.\n", 
+            filename, num_ldata, header->num_ldata);
+        munmap (map, map_size);
+        return NULL;
+    }
+    nasm_bin_ninst_t *bin_ninst_arr = (nasm_bin_ninst_t *)(map + layout.ninst_offset);
+    uint64_t *parent_offset = (uint64_t *)(map + layout.parent_offset_offset);
+    uint64_t *child_offset = (uint64_t *)(map + layout.child_offset_offset);
+    uint32_t *parent_idx = (uint32_t *)(map + layout.parent_idx_offset);
+    uint32_t *child_idx = (uint32_t *)(map + layout.child_idx_offset);
+    if (!is_nasm_bin_csr_valid (parent_offset, parent_idx, header->num_ninst, header->num_parent_edges)
+        || !is_nasm_bin_csr_valid (child_offset, child_idx, header->num_ninst, header->num_child_edges))
+    {
+        ERROR_PRTF ("ASPEN NASM binary file %s parse error: Corrupted parent or child lists.\n", filename);
+        munmap (map, map_size);
+        return NULL;
+    }
+    if (!is_nasm_plan_flags_compatible (filename, header->plan_flags, dnn))
+    {
+        munmap (map, map_size);
+        return NULL;
+    }
+    nasm_bin_ldata_t *bin_ldata_arr = (nasm_bin_ldata_t *)(map + layout.ldata_offset);
+    unsigned int *ldata_min_ninst_arr = malloc (num_ldata * sizeof(unsigned int));
+    for (unsigned int i = 0; i < num_ldata; i++)
+        ldata_min_ninst_arr[i] = bin_ldata_arr[i].min_ninst;
+    nasm_t *nasm = apu_create_nasm_without_finding_ninst_parents 
+        (dnn, header->flop_per_ninst, header->batch_size, header->min_ninst_per_ldata, ldata_min_ninst_arr, header->tr_seq_len, 
+            header->plan_flags);
+    free (ldata_min_ninst_arr);
+    if (nasm == NULL)
+    {
+        ERROR_PRTF ("ASPEN NASM binary file %s parse error: Failed to create NASM.\n", filename);
+        munmap (map, map_size);
+        return NULL;
+    }
+    nasm->total_flops = header->total_flops;
+    if (nasm->num_ldata != header->num_ldata || nasm->num_ninst != header->num_ninst)
+    {
+        ERROR_PRTF ("ASPEN NASM binary file %s parse error: NASM has %d ldata and %d ninsts, file has %d and %d.\n", 
+            filename, nasm->num_ldata, nasm->num_ninst, header->num_ldata, header->num_ninst);
+        apu_destroy_nasm (nasm);
+        munmap (map, map_size);
+        return NULL;
+    }
+    for (unsigned int i = 0; i < nasm->num_ldata; i++)
+    {
+        nasm_ldata_t *ldata = &nasm->ldata_arr[i];
+        if (bin_ldata_arr[i].num_ninst != ldata->num_ninst
+            || bin_ldata_arr[i].ninst_tile_dims[OUT_H] != ldata->ninst_tile_dims[OUT_H]
+            || bin_ldata_arr[i].ninst_tile_dims[OUT_W] != ldata->ninst_tile_dims[OUT_W])
+        {
+            ERROR_PRTF ("ASPEN NASM binary file %s parse error: Tile geometry mismatch at ldata %d.\n", filename, i);
+            apu_destroy_nasm (nasm);
+            munmap (map, map_size);
+            return NULL;
+        }
+    }
+    // The parent CSR is used in place, and the mapping lives as long as the NASM. The child CSR holds ninst 
+    // pointers, so it is rebuilt from the child indices of the file.
+    nasm->bin_map = map;
+    nasm->bin_map_size = map_size;
+    nasm->num_parent_edges = header->num_parent_edges;
+    nasm->num_child_edges = header->num_child_edges;
+    nasm->parent_ninst_idx_csr = parent_idx;
+    nasm->child_ninst_csr = malloc ((header->num_child_edges + 1) * sizeof(ninst_t *));
+    unsigned int num_error = 0;
+    #pragma omp parallel for reduction(+:num_error) if (nasm->num_ninst >= NASM_BIN_PARALLEL_FIXUP_MIN_NINST)
+    for (unsigned int i = 0; i < nasm->num_ninst; i++)
+    {
+        ninst_t *ninst = &nasm->ninst_arr[i];
+        if (bin_ninst_arr[i].out_mat_pos[OUT_H] != ninst->out_mat_pos[OUT_H]
+            || bin_ninst_arr[i].out_mat_pos[OUT_W] != ninst->out_mat_pos[OUT_W]
+            || bin_ninst_arr[i].tile_dims[OUT_H] != ninst->tile_dims[OUT_H]
+            || bin_ninst_arr[i].tile_dims[OUT_W] != ninst->tile_dims[OUT_W])
+        {
+            num_error++;
+            continue;
+        }
+        ninst->num_input_pos = bin_ninst_arr[i].num_input_pos;
+        ninst->num_parent_ninsts = parent_offset[i + 1] - parent_offset[i];
+        ninst->parent_ninst_idx_arr = nasm->parent_ninst_idx_csr + parent_offset[i];
+        ninst->num_child_ninsts = child_offset[i + 1] - child_offset[i];
+        ninst->child_ninst_arr = nasm->child_ninst_csr + child_offset[i];
+        for (unsigned int k = 0; k < ninst->num_child_ninsts; k++)
+            ninst->child_ninst_arr[k] = nasm->ninst_arr + child_idx[child_offset[i] + k];
+    }
+    if (num_error != 0)
+    {
+        ERROR_PRTF ("ASPEN NASM binary file %s parse error: %d ninsts do not match the DNN.\n", filename, num_error);
+        apu_destroy_nasm (nasm);
+        return NULL;
+    }
+    return nasm;
+}
+
 nasm_t *apu_load_nasm_from_file(char *filename, aspen_dnn_t *dnn)
 {
     if (dnn == NULL)
@@ -891,6 +1265,14 @@ nasm_t *apu_load_nasm_from_file(char *filename, aspen_dnn_t *dnn)
         ERROR_PRTF ("ASPEN DNN NASM load error: file %s not found.\n", filename);
         return NULL;
     }
+    char magic[NASM_BIN_MAGIC_LEN] = {0};
+    if (fread (magic, 1, NASM_BIN_MAGIC_LEN, fp) == NASM_BIN_MAGIC_LEN 
+        && strncmp (magic, NASM_BIN_MAGIC, NASM_BIN_MAGIC_LEN) == 0)
+    {
+        fclose (fp);
+        return apu_load_nasm_from_bin_file (filename, dnn);
+    }
+    rewind (fp);
     char line[MAX_STRING_LEN] = {0};
     char* ptr;
     unsigned int line_num = 0;
@@ -950,8 +1332,66 @@ nasm_t *apu_load_nasm_from_file(char *filename, aspen_dnn_t *dnn)
         return NULL;
     }
     tr_seq_len = atoi(ptr);
+    // Files written before PLAN_FLAGS existed were planned without Winograd tiling or fusion.
+    unsigned int plan_flags = 0;
+    long line_start = ftell (fp);
+    if (fgets (line, MAX_STRING_LEN, fp) != NULL && strncmp (line, "PLAN_FLAGS:", 11) == 0)
+    {
+        line_num++;
+        plan_flags = atoi (line + 11);
+    }
+    else
+        fseek (fp, line_start, SEEK_SET);
+    if (!is_nasm_plan_flags_compatible (filename, plan_flags, dnn))
+    {
+        fclose (fp);
+        return NULL;
+    }
+    // Optional per-ldata granularity, written for NASMs from the granularity selector.
+    unsigned int *ldata_min_ninst_arr = NULL;
+    line_start = ftell (fp);
+    if (fgets (line, MAX_STRING_LEN, fp) != NULL && strncmp (line, "LDATA_MIN_NINST:", 16) == 0)
+    {
+        line_num++;
+        unsigned int num_ldata = atoi (line + 16);
+        ldata_min_ninst_arr = calloc (num_ldata > 0 ? num_ldata : 1, sizeof(unsigned int));
+        for (unsigned int i = 0; i < num_ldata; i++)
+        {
+            unsigned int idx = 0, min_ninst = 0;
+            if (fgets (line, MAX_STRING_LEN, fp) == NULL || sscanf (line, "%u %u", &idx, &min_ninst) != 2 || idx != i)
+            {
+                ERROR_PRTF ("ASPEN DNN file %s parse error: Wrong LDATA_MIN_NINST entry at line %d.\n", filename, line_num + 1);
+                free (ldata_min_ninst_arr);
+                fclose (fp);
+                return NULL;
+            }
+            line_num++;
+            ldata_min_ninst_arr[i] = min_ninst;
+        }
+        if ((ptr = read_check_and_return (fp, line, "LDATA_MIN_NINST_END", &line_num)) == NULL)
+        {
+            ERROR_PRTF ("ASPEN DNN file %s parse error: Missing LDATA_MIN_NINST_END.\n", filename);
+            free (ldata_min_ninst_arr);
+            fclose (fp);
+            return NULL;
+        }
+        unsigned int dnn_num_ldata = 0;
+        for (int i = 0; i < dnn->num_layers; i++)
+            dnn_num_ldata += get_nasm_ldata_num_per_layer (&dnn->layers[i]);
+        if (num_ldata != dnn_num_ldata)
+        {
+            ERROR_PRTF ("ASPEN DNN file %s parse error: DNN has %d ldata, file has %d.\n", filename, dnn_num_ldata, num_ldata);
+            free (ldata_min_ninst_arr);
+            fclose (fp);
+            return NULL;
+        }
+    }
+    else
+        fseek (fp, line_start, SEEK_SET);
     nasm = apu_create_nasm_without_finding_ninst_parents 
-        (dnn, flop_per_ninst, batch_size, min_ninst_per_ldata, tr_seq_len);
+        (dnn, flop_per_ninst, batch_size, min_ninst_per_ldata, ldata_min_ninst_arr, tr_seq_len, plan_flags);
+    if (ldata_min_ninst_arr != NULL)
+        free (ldata_min_ninst_arr);
     if (nasm == NULL)
     {
         ERROR_PRTF ("ASPEN DNN file %s parse error: Failed to create NASM.\n", filename);
@@ -1130,5 +1570,6 @@ nasm_t *apu_load_nasm_from_file(char *filename, aspen_dnn_t *dnn)
         return NULL;
     }
     fclose (fp);
+    nasm_build_csr (nasm);
     return nasm;
-}
\ No newline at end of file
+}
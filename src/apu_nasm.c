@@ -2,9 +2,12 @@
 #include "apu.h"
 #include "nasm.h"
 #include "input_parser.h"
+#include <sys/mman.h>
 
 static unsigned int nasm_num = 0;
 
+static void plan_ldata_fusion (nasm_t *nasm);
+
 int get_nasm_ldata_num_per_layer (aspen_layer_t *layer)
 {
     switch (layer->type)
@@ -74,456 +77,403 @@ void ninst_find_input_pos_idx (ninst_t *ninst)
     }
 }
 
+// Per-thread scratch for parent discovery. The bitmap spans every ninst of the
+// NASM and deduplicates parents; parent_arr lists the bits set for the current ninst.
+typedef struct
+{
+    uint64_t *bitmap;
+    unsigned int *parent_arr;
+    unsigned int num_parents;
+    unsigned int max_parents;
+} parent_scratch_t;
+
+static inline void scratch_add_parent (parent_scratch_t *scratch, unsigned int ninst_idx)
+{
+    uint64_t bit = 1ULL << (ninst_idx & 63);
+    if (scratch->bitmap[ninst_idx >> 6] & bit)
+        return;
+    scratch->bitmap[ninst_idx >> 6] |= bit;
+    if (scratch->num_parents == scratch->max_parents)
+    {
+        scratch->max_parents *= 2;
+        scratch->parent_arr = realloc (scratch->parent_arr, scratch->max_parents * sizeof(unsigned int));
+    }
+    scratch->parent_arr[scratch->num_parents++] = ninst_idx;
+}
+
+static inline void scratch_add_parent_at_tensor_pos (parent_scratch_t *scratch, nasm_ldata_t *parent_ldata, unsigned int *tensor_pos)
+{
+    scratch_add_parent (scratch, get_ninst_from_tensor_pos (parent_ldata, tensor_pos)->ninst_idx);
+}
+
+// Adds every ninst of parent_ldata whose tile overlaps out_mat rows [h0, h1] and columns [w0, w1].
+static void scratch_add_parent_rect (parent_scratch_t *scratch, nasm_ldata_t *parent_ldata, 
+    unsigned int h0, unsigned int h1, unsigned int w0, unsigned int w1)
+{
+    unsigned int tile_h = parent_ldata->ninst_tile_dims[OUT_H];
+    unsigned int tile_w = parent_ldata->ninst_tile_dims[OUT_W];
+    unsigned int num_tiles_h = get_smallest_dividable (parent_ldata->out_mat_dims[OUT_H], tile_h) / tile_h;
+    unsigned int first_idx = parent_ldata->ninst_arr_start->ninst_idx;
+    for (unsigned int tw = w0 / tile_w; tw <= w1 / tile_w; tw++)
+    {
+        for (unsigned int th = h0 / tile_h; th <= h1 / tile_h; th++)
+            scratch_add_parent (scratch, first_idx + tw * num_tiles_h + th);
+    }
+}
+
+// Adds the parents of all elements between two tensor positions, which must form
+// a rectangle in parent_ldata's output matrix.
+static void scratch_add_parent_tensor_rect (parent_scratch_t *scratch, nasm_ldata_t *parent_ldata, 
+    unsigned int *first_pos, unsigned int *last_pos)
+{
+    unsigned int first_mat_pos[2] = {0,0}, last_mat_pos[2] = {0,0};
+    get_out_mat_pos_from_tensor_pos (parent_ldata, first_pos, first_mat_pos);
+    get_out_mat_pos_from_tensor_pos (parent_ldata, last_pos, last_mat_pos);
+    scratch_add_parent_rect (scratch, parent_ldata, first_mat_pos[OUT_H], last_mat_pos[OUT_H], 
+        first_mat_pos[OUT_W], last_mat_pos[OUT_W]);
+}
+
+// Adds the sibling row tiles [h0, h1] of each parent added since first_parent.
+// Lets column-only dependencies be collected once per parent column.
+static void scratch_expand_parent_rows (parent_scratch_t *scratch, nasm_ldata_t *parent_ldata, 
+    unsigned int first_parent, unsigned int h0, unsigned int h1)
+{
+    unsigned int tile_h = parent_ldata->ninst_tile_dims[OUT_H];
+    unsigned int num_tiles_h = get_smallest_dividable (parent_ldata->out_mat_dims[OUT_H], tile_h) / tile_h;
+    unsigned int first_idx = parent_ldata->ninst_arr_start->ninst_idx;
+    unsigned int last_parent = scratch->num_parents;
+    for (unsigned int i = first_parent; i < last_parent; i++)
+    {
+        unsigned int tw = (scratch->parent_arr[i] - first_idx) / num_tiles_h;
+        for (unsigned int th = h0 / tile_h; th <= h1 / tile_h; th++)
+            scratch_add_parent (scratch, first_idx + tw * num_tiles_h + th);
+    }
+}
+
+static int compare_parent_idx (const void *a, const void *b)
+{
+    unsigned int x = *(const unsigned int *)a, y = *(const unsigned int *)b;
+    return (x > y) - (x < y);
+}
+
 // Change to add a new layer type
-void ninst_find_parent (ninst_t *ninst)
+// Parents are derived from the ninst's tile rectangle: layers whose inputs depend only on the
+// output column (conv, pool, fc, matmul, attention) walk columns and receptive-field intervals
+// instead of every output element, and element-wise layers map each element once.
+static void ninst_find_parent (ninst_t *ninst, parent_scratch_t *scratch)
 {
     nasm_ldata_t *ldata = ninst->ldata;
     aspen_layer_t *layer = ldata->layer;
+    nasm_t *nasm = ldata->nasm;
     ninst->num_parent_ninsts = 0;
-    nasm_ldata_t *parent_ldata = ldata->nasm->ldata_arr + ldata->parent_ldata_idx_arr[PARENT_0];
-    unsigned int *parent_arr = calloc (MAX_PARENT_NINST_NUM, sizeof(unsigned int));
-    for (unsigned int tile_w = 0; tile_w < ninst->tile_dims[OUT_W]; tile_w++)
+    if (layer->type == INPUT_LAYER)
+        return;
+    nasm_ldata_t *parent_ldata = nasm->ldata_arr + ldata->parent_ldata_idx_arr[PARENT_0];
+    scratch->num_parents = 0;
+    const unsigned int w_start = ninst->out_mat_pos[OUT_W], w_end = w_start + ninst->tile_dims[OUT_W];
+    const unsigned int h_start = ninst->out_mat_pos[OUT_H], h_end = h_start + ninst->tile_dims[OUT_H];
+    nasm_ldata_t *qkv_ldata = ldata->fused_qkv_leader_ldata;
+    if (layer->type == CONV_LAYER || layer->type == MAXPOOL_LAYER || layer->type == AVGPOOL_LAYER)
     {
-        for (unsigned int tile_h = 0; tile_h < ninst->tile_dims[OUT_H]; tile_h++)
+        // Every input channel is read, so collect one row tile per parent column and expand after.
+        // Grouped convs read only the input channels of the groups in the tile.
+        unsigned int first_c_pos[NUM_PARAM_ELEMENTS] = {0}, last_c_pos[NUM_PARAM_ELEMENTS] = {0};
+        unsigned int first_mat_pos[2] = {0,0}, last_mat_pos[2] = {0,0};
+        last_c_pos[OUT_C] = layer->params[IN_C] - 1;
+        if (layer->type == CONV_LAYER && layer->params[GROUPS] > 1)
+        {
+            const unsigned int in_c_per_group = get_layer_in_c_per_group (layer);
+            const unsigned int out_c_per_group = layer->params[OUT_C] / layer->params[GROUPS];
+            const unsigned int h_last = h_end < layer->params[OUT_C] ? h_end - 1 : layer->params[OUT_C] - 1;
+            first_c_pos[OUT_C] = (h_start / out_c_per_group) * in_c_per_group;
+            last_c_pos[OUT_C] = (h_last / out_c_per_group + 1) * in_c_per_group - 1;
+        }
+        get_out_mat_pos_from_tensor_pos (parent_ldata, first_c_pos, first_mat_pos);
+        get_out_mat_pos_from_tensor_pos (parent_ldata, last_c_pos, last_mat_pos);
+        for (unsigned int w = w_start; w < w_end; w++)
         {
-            unsigned int out_mat_pos[2] = {ninst->out_mat_pos[OUT_W] + tile_w, ninst->out_mat_pos[OUT_H] + tile_h};
-            unsigned int out_tensor_pos[NUM_PARAM_ELEMENTS] = {0}, in_tensor_pos[NUM_PARAM_ELEMENTS] = {0}; 
-            get_tensor_pos_from_out_mat_pos(ldata, out_mat_pos, out_tensor_pos);
+            unsigned int out_mat_pos[2] = {w, h_start};
+            unsigned int out_tensor_pos[NUM_PARAM_ELEMENTS] = {0}, in_tensor_pos[NUM_PARAM_ELEMENTS] = {0};
+            get_tensor_pos_from_out_mat_pos (ldata, out_mat_pos, out_tensor_pos);
+            if (out_tensor_pos[BATCH] >= nasm->batch_size)
+                continue;
             in_tensor_pos[BATCH] = out_tensor_pos[BATCH];
-            // if (layer->params[MAT_M] == 0)
-            //     printf ("NT Layer %d, ninst %d, tile_w %d, tile_h %d, tensor pos %d,%d,%d,%d\n", 
-            //         ldata->layer->layer_idx, ninst->ninst_idx, tile_w, tile_h, out_tensor_pos[BATCH], out_tensor_pos[OUT_C],
-            //             out_tensor_pos[OUT_H],
-            //             out_tensor_pos[OUT_W]);
-            // else
-            //     printf ("Transformer Layer %d, ninst %d, tile_w %d, tile_h %d, tensor pos %d,%d,%d,%d\n", 
-            //         ldata->layer->layer_idx, ninst->ninst_idx, tile_w, tile_h, out_tensor_pos[BATCH], out_tensor_pos[NUM_HEAD],
-            //             out_tensor_pos[MAT_M],
-            //             out_tensor_pos[MAT_N]);
-            if (layer->type == CONV_LAYER || layer->type == MAXPOOL_LAYER || layer->type == AVGPOOL_LAYER)
+            for (int j = 0; j < layer->params[WEIGHT_H]; j++)
             {
-                for (int i = 0; i < layer->params[IN_C]; i++)
+                in_tensor_pos[OUT_H] = out_tensor_pos[OUT_H]*layer->params[STRIDE]
+                    + j*layer->params[DILATION] - layer->params[PADDING];
+                if (in_tensor_pos[OUT_H] >= layer->params[IN_H])
+                    continue;
+                for (int k = 0; k < layer->params[WEIGHT_W]; k++)
                 {
-                    in_tensor_pos[OUT_C] = i;
-                    for (int j = 0; j < layer->params[WEIGHT_H]; j++)
-                    {
-                        in_tensor_pos[OUT_H] = out_tensor_pos[OUT_H]*layer->params[STRIDE]
-                            + j*layer->params[DILATION] - layer->params[PADDING];
-                        for (int k = 0; k < layer->params[WEIGHT_W]; k++)
-                        {
-                            in_tensor_pos[OUT_W] = out_tensor_pos[OUT_W]*layer->params[STRIDE]
-                                + k*layer->params[DILATION] - layer->params[PADDING];
-                            if (in_tensor_pos[BATCH] >= 0 && in_tensor_pos[BATCH] < ldata->nasm->batch_size && in_tensor_pos[OUT_C] >= 0 && in_tensor_pos[OUT_C] < layer->params[IN_C] &&
-                                in_tensor_pos[OUT_H] >= 0 && in_tensor_pos[OUT_H] < layer->params[IN_H] && in_tensor_pos[OUT_W] >= 0 && in_tensor_pos[OUT_W] < layer->params[IN_W])
-                            {
-                                ninst_t *input_nist = get_ninst_from_tensor_pos(parent_ldata, in_tensor_pos);
-                                int duplicate = 0;
-                                // printf ("%d,%d,%d,%d,p:%d ", in_tensor_pos[BATCH], in_tensor_pos[OUT_C],
-                                //     in_tensor_pos[OUT_H],
-                                //     in_tensor_pos[OUT_W], input_nist->ninst_idx);
-                                for (int l = 0; l < ninst->num_parent_ninsts; l++)
-                                {
-                                    if (parent_arr[l] == input_nist->ninst_idx)
-                                    {
-                                        duplicate = 1;
-                                    }
-                                }
-                                if (!duplicate)
-                                {
-                                    parent_arr[ninst->num_parent_ninsts] = input_nist->ninst_idx;
-                                    ninst->num_parent_ninsts++;  
-                                    // printf ("\n\tnum parent:%d\n", ninst->num_parent_ninsts);
-                                }
-                            }
-                        }
-                    }
+                    in_tensor_pos[OUT_W] = out_tensor_pos[OUT_W]*layer->params[STRIDE]
+                        + k*layer->params[DILATION] - layer->params[PADDING];
+                    if (in_tensor_pos[OUT_W] >= layer->params[IN_W])
+                        continue;
+                    scratch_add_parent_at_tensor_pos (scratch, parent_ldata, in_tensor_pos);
                 }
             }
-            else if (layer->type == RESIDUAL_LAYER)
+        }
+        scratch_expand_parent_rows (scratch, parent_ldata, 0, first_mat_pos[OUT_H], last_mat_pos[OUT_H]);
+        // A fused residual reads the same tile of the skip connection.
+        nasm_ldata_t *res_ldata = layer->type == CONV_LAYER ? get_fused_conv_residual_ldata (ldata) : NULL;
+        if (res_ldata != NULL)
+        {
+            const LAYER_PARENTS skip_pidx = nasm->ldata_arr + res_ldata->parent_ldata_idx_arr[PARENT_0] == ldata ? PARENT_1 : PARENT_0;
+            scratch_add_parent_rect (scratch, nasm->ldata_arr + res_ldata->parent_ldata_idx_arr[skip_pidx], 
+                h_start, h_end - 1, w_start, w_end - 1);
+        }
+    }
+    else if (layer->type == FC_LAYER)
+    {
+        if (parent_ldata->out_mat_stride != parent_ldata->out_mat_dims[OUT_H])
+        {
+            ERROR_PRTF ("ERROR: FC layer parent stride mismatatch - %d, %d\n", 
+                parent_ldata->out_mat_stride, parent_ldata->out_mat_dims[OUT_H]);
+            assert (0);
+        }
+        // Each batch reads its whole input tensor.
+        unsigned int prev_batch = UINT_MAX;
+        for (unsigned int w = w_start; w < w_end; w++)
+        {
+            unsigned int out_mat_pos[2] = {w, h_start};
+            unsigned int out_tensor_pos[NUM_PARAM_ELEMENTS] = {0};
+            get_tensor_pos_from_out_mat_pos (ldata, out_mat_pos, out_tensor_pos);
+            if (out_tensor_pos[BATCH] == prev_batch || out_tensor_pos[BATCH] >= nasm->batch_size)
+                continue;
+            prev_batch = out_tensor_pos[BATCH];
+            unsigned int first_pos[NUM_PARAM_ELEMENTS] = {0}, last_pos[NUM_PARAM_ELEMENTS] = {0};
+            first_pos[BATCH] = last_pos[BATCH] = out_tensor_pos[BATCH];
+            last_pos[OUT_C] = layer->params[IN_C] - 1;
+            last_pos[OUT_H] = layer->params[IN_H] - 1;
+            last_pos[OUT_W] = layer->params[IN_W] - 1;
+            scratch_add_parent_tensor_rect (scratch, parent_ldata, first_pos, last_pos);
+        }
+    }
+    else if (qkv_ldata != NULL && qkv_ldata != ldata)
+    {
+        // Written by the same tile of the first matmul of the fused QKV group.
+        scratch_add_parent_rect (scratch, qkv_ldata, h_start, h_end - 1, w_start, w_end - 1);
+    }
+    else if (layer->type == MATMUL_LAYER)
+    {
+        aspen_layer_t *p_layer = parent_ldata->layer;
+        unsigned int num_k = layer->params[MAT_K] < p_layer->params[MAT_M] ? layer->params[MAT_K] : p_layer->params[MAT_M];
+        for (unsigned int w = w_start; w < w_end && num_k > 0; w++)
+        {
+            unsigned int out_mat_pos[2] = {w, h_start};
+            unsigned int out_tensor_pos[NUM_PARAM_ELEMENTS] = {0};
+            get_tensor_pos_from_out_mat_pos (ldata, out_mat_pos, out_tensor_pos);
+            if (out_tensor_pos[BATCH] >= nasm->batch_size || out_tensor_pos[MAT_N] >= nasm->tr_seq_len)
+                continue;
+            unsigned int first_pos[NUM_PARAM_ELEMENTS] = {0}, last_pos[NUM_PARAM_ELEMENTS] = {0};
+            first_pos[BATCH] = last_pos[BATCH] = out_tensor_pos[BATCH];
+            first_pos[MAT_N] = last_pos[MAT_N] = out_tensor_pos[MAT_N];
+            last_pos[MAT_M] = num_k - 1;
+            scratch_add_parent_tensor_rect (scratch, parent_ldata, first_pos, last_pos);
+        }
+    }
+    else if (layer->type == K_ATTENTION_LAYER)
+    {
+        nasm_ldata_t *parent_k_ldata = nasm->ldata_arr + ldata->parent_ldata_idx_arr[PARENT_1];
+        aspen_layer_t *p_layer = parent_ldata->layer;
+        aspen_layer_t *pk_layer = parent_k_ldata->layer;
+        unsigned int hidden_per_head = layer->params[NUM_HIDDEN] / layer->params[NUM_HEAD];
+        const int masked = layer->params[MASKED] == 1;
+        unsigned int prev_batch = UINT_MAX, prev_head = UINT_MAX;
+        for (unsigned int w = w_start; w < w_end; w++)
+        {
+            unsigned int out_mat_pos[2] = {w, h_start};
+            unsigned int out_tensor_pos[NUM_PARAM_ELEMENTS] = {0};
+            get_tensor_pos_from_out_mat_pos (ldata, out_mat_pos, out_tensor_pos);
+            if (out_tensor_pos[BATCH] >= nasm->batch_size)
+                continue;
+            unsigned int head_start = out_tensor_pos[NUM_HEAD] * hidden_per_head;
+            unsigned int first_pos[NUM_PARAM_ELEMENTS] = {0}, last_pos[NUM_PARAM_ELEMENTS] = {0};
+            first_pos[BATCH] = last_pos[BATCH] = out_tensor_pos[BATCH];
+            // Input 0 (Query): hidden slice of this head at the output column's sequence position
+            unsigned int head_end = head_start + layer->params[MAT_K];
+            if (head_end > p_layer->params[MAT_M])
+                head_end = p_layer->params[MAT_M];
+            if (head_start < head_end && out_tensor_pos[MAT_N] < nasm->tr_seq_len)
             {
-                if (layer->params[MAT_M] == 0)
-                {
-                    in_tensor_pos[OUT_C] = out_tensor_pos[OUT_C];
-                    in_tensor_pos[OUT_H] = out_tensor_pos[OUT_H];
-                    in_tensor_pos[OUT_W] = out_tensor_pos[OUT_W];
-                }
-                else
-                {
-                    in_tensor_pos[MAT_M] = out_tensor_pos[MAT_M];
-                    in_tensor_pos[MAT_N] = out_tensor_pos[MAT_N];
-                    in_tensor_pos[OUT_C] = out_tensor_pos[OUT_C];
-                    in_tensor_pos[OUT_H] = out_tensor_pos[OUT_H];
-                    in_tensor_pos[OUT_W] = out_tensor_pos[OUT_W];
-                }
-                if ((in_tensor_pos[BATCH] >= 0 && in_tensor_pos[BATCH] < ldata->nasm->batch_size && in_tensor_pos[OUT_C] >= 0 && in_tensor_pos[OUT_C] < layer->params[IN_C] &&
-                    in_tensor_pos[OUT_H] >= 0 && in_tensor_pos[OUT_H] < layer->params[IN_H] && in_tensor_pos[OUT_W] >= 0 && in_tensor_pos[OUT_W] < layer->params[IN_W]) ||
-                    (in_tensor_pos[BATCH] >= 0 && in_tensor_pos[BATCH] < ldata->nasm->batch_size &&
-                    in_tensor_pos[MAT_M] >= 0 && in_tensor_pos[MAT_M] < layer->params[MAT_M] && in_tensor_pos[MAT_N] >= 0 && in_tensor_pos[MAT_N] < ldata->nasm->tr_seq_len))
-                {
-                    ninst_t *input_nist = get_ninst_from_tensor_pos(parent_ldata, in_tensor_pos);
-                    int duplicate = 0;
-                    // printf ("%d,%d,%d,%d,p:%d ", in_tensor_pos[BATCH], in_tensor_pos[OUT_C],
-                    //     in_tensor_pos[OUT_H],
-                    //     in_tensor_pos[OUT_W], input_nist->ninst_idx);
-                    for (int l = 0; l < ninst->num_parent_ninsts; l++)
-                    {
-                        if (parent_arr[l] == input_nist->ninst_idx)
-                        {
-                            duplicate = 1;
-                        }
-                    }
-                    if (!duplicate)
-                    {
-                        parent_arr[ninst->num_parent_ninsts] = input_nist->ninst_idx;
-                        ninst->num_parent_ninsts++;  
-                        // printf ("\n\tnum parent:%d\n", ninst->num_parent_ninsts);
-                    }
-                    input_nist = get_ninst_from_tensor_pos(ldata->nasm->ldata_arr + ldata->parent_ldata_idx_arr[PARENT_1], in_tensor_pos);
-                    for (int l = 0; l < ninst->num_parent_ninsts; l++)
-                    {
-                        if (parent_arr[l] == input_nist->ninst_idx)
-                        {
-                            duplicate = 1;
-                        }
-                    }
-                    if (!duplicate)
-                    {
-                        parent_arr[ninst->num_parent_ninsts] = input_nist->ninst_idx;
-                        ninst->num_parent_ninsts++;  
-                        // printf ("\n\tnum parent:%d\n", ninst->num_parent_ninsts);
-                    }
-                }
+                first_pos[MAT_N] = last_pos[MAT_N] = out_tensor_pos[MAT_N];
+                first_pos[MAT_M] = head_start;
+                last_pos[MAT_M] = head_end - 1;
+                scratch_add_parent_tensor_rect (scratch, parent_ldata, first_pos, last_pos);
             }
-            else if (layer->type == FC_LAYER)
+            // Input 1 (Key): same hidden slice at the sequence positions of the tile rows,
+            // up to the query position with a causal mask
+            if (!masked && out_tensor_pos[BATCH] == prev_batch && out_tensor_pos[NUM_HEAD] == prev_head)
+                continue;
+            prev_batch = out_tensor_pos[BATCH];
+            prev_head = out_tensor_pos[NUM_HEAD];
+            head_end = head_start + layer->params[MAT_K];
+            if (head_end > pk_layer->params[MAT_M])
+                head_end = pk_layer->params[MAT_M];
+            unsigned int seq_end = h_end < nasm->tr_seq_len ? h_end : nasm->tr_seq_len;
+            if (masked && out_tensor_pos[MAT_N] + 1 < seq_end)
+                seq_end = out_tensor_pos[MAT_N] + 1;
+            if (head_start < head_end && h_start < seq_end)
             {
-                if (parent_ldata->out_mat_stride != parent_ldata->out_mat_dims[OUT_H])
-                {
-                    ERROR_PRTF ("ERROR: FC layer parent stride mismatatch - %d, %d\n", 
-                        parent_ldata->out_mat_stride, parent_ldata->out_mat_dims[OUT_H]);
-                    assert (0);
-                }
-                if (in_tensor_pos[BATCH] >= 0 && in_tensor_pos[BATCH] < ldata->nasm->batch_size)
-                {
-                    for (int i = 0; i < layer->params[IN_C]; i++)
-                    {
-                        in_tensor_pos[OUT_C] = i;
-                        for (int j = 0; j < layer->params[IN_H]; j++)
-                        {
-                            in_tensor_pos[OUT_H] = j;
-                            for (int k = 0; k < layer->params[IN_W]; k++)
-                            {
-                                in_tensor_pos[OUT_W] = k;
-                                if (in_tensor_pos[BATCH] >= 0 && in_tensor_pos[BATCH] < ldata->nasm->batch_size && in_tensor_pos[OUT_C] >= 0 && in_tensor_pos[OUT_C] < layer->params[IN_C] &&
-                                    in_tensor_pos[OUT_H] >= 0 && in_tensor_pos[OUT_H] < layer->params[IN_H] && in_tensor_pos[OUT_W] >= 0 && in_tensor_pos[OUT_W] < layer->params[IN_W])
-                                {
-                                    ninst_t *input_nist = get_ninst_from_tensor_pos(parent_ldata, in_tensor_pos);
-                                    int duplicate = 0;
-                                    for (int l = 0; l < ninst->num_parent_ninsts; l++)
-                                    {
-                                        if (parent_arr[l] == input_nist->ninst_idx)
-                                        {
-                                            duplicate = 1;
-                                            break;
-                                        }
-                                    }
-                                    if (!duplicate)
-                                    {
-                                        parent_arr[ninst->num_parent_ninsts] = input_nist->ninst_idx;
-                                        ninst->num_parent_ninsts++;
-                                    }
-                                }
-                            }
-                        }
-                    }
-                }
-            } 
-            else if (layer->type == SOFTMAX_LAYER)
+                first_pos[MAT_N] = h_start;
+                last_pos[MAT_N] = seq_end - 1;
+                first_pos[MAT_M] = head_start;
+                last_pos[MAT_M] = head_end - 1;
+                scratch_add_parent_tensor_rect (scratch, parent_k_ldata, first_pos, last_pos);
+            }
+        }
+    }
+    else if (layer->type == V_ATTENTION_LAYER)
+    {
+        nasm_ldata_t *parent_v_ldata = nasm->ldata_arr + ldata->parent_ldata_idx_arr[PARENT_1];
+        aspen_layer_t *p_layer = parent_ldata->layer;
+        aspen_layer_t *pv_layer = parent_v_ldata->layer;
+        unsigned int hidden_per_head = layer->params[NUM_HIDDEN] / layer->params[NUM_HEAD];
+        unsigned int seq_num = nasm->tr_seq_len;
+        unsigned int head_first = h_start / hidden_per_head, head_last = (h_end - 1) / hidden_per_head;
+        if (head_last >= p_layer->params[NUM_HEAD])
+            head_last = p_layer->params[NUM_HEAD] - 1;
+        unsigned int row_end = h_end < pv_layer->params[MAT_M] ? h_end : pv_layer->params[MAT_M];
+        const int masked = p_layer->params[MASKED] == 1;
+        unsigned int prev_batch = UINT_MAX;
+        for (unsigned int w = w_start; w < w_end && seq_num > 0; w++)
+        {
+            unsigned int out_mat_pos[2] = {w, h_start};
+            unsigned int out_tensor_pos[NUM_PARAM_ELEMENTS] = {0};
+            get_tensor_pos_from_out_mat_pos (ldata, out_mat_pos, out_tensor_pos);
+            if (out_tensor_pos[BATCH] >= nasm->batch_size)
+                continue;
+            unsigned int first_pos[NUM_PARAM_ELEMENTS] = {0}, last_pos[NUM_PARAM_ELEMENTS] = {0};
+            first_pos[BATCH] = last_pos[BATCH] = out_tensor_pos[BATCH];
+            // Input 0 (Key_out): every key position of each head covered by the tile rows
+            if (out_tensor_pos[MAT_N] < seq_num)
             {
-                memcpy (in_tensor_pos, out_tensor_pos, sizeof(int) * NUM_PARAM_ELEMENTS);
-                if (in_tensor_pos[BATCH] >= 0 && in_tensor_pos[BATCH] < ldata->nasm->batch_size && in_tensor_pos[OUT_C] >= 0 && in_tensor_pos[OUT_C] < layer->params[IN_C] &&
-                    in_tensor_pos[OUT_H] >= 0 && in_tensor_pos[OUT_H] < layer->params[IN_H] && in_tensor_pos[OUT_W] >= 0 && in_tensor_pos[OUT_W] < layer->params[IN_W])
+                for (unsigned int head = head_first; head <= head_last && head_first < p_layer->params[NUM_HEAD]; head++)
                 {
-                    ninst_t *input_nist = get_ninst_from_tensor_pos(parent_ldata, in_tensor_pos);
-                    int duplicate = 0;
-                    for (int l = 0; l < ninst->num_parent_ninsts; l++)
-                    {
-                        if (parent_arr[l] == input_nist->ninst_idx)
-                        {
-                            duplicate = 1;
-                            break;
-                        }
-                    }
-                    if (!duplicate)
-                    {
-                        parent_arr[ninst->num_parent_ninsts] = input_nist->ninst_idx;
-                        ninst->num_parent_ninsts++;
-                    }
+                    first_pos[NUM_HEAD] = last_pos[NUM_HEAD] = head;
+                    first_pos[MAT_N] = last_pos[MAT_N] = out_tensor_pos[MAT_N];
+                    first_pos[MAT_M] = 0;
+                    last_pos[MAT_M] = seq_num - 1;
+                    scratch_add_parent_tensor_rect (scratch, parent_ldata, first_pos, last_pos);
                 }
             }
-            else if (layer->type == YOLO_LAYER)
+            // Input 1 (Value): the tile rows at every sequence position of the batch,
+            // up to the query position with a causal mask
+            if (!masked && out_tensor_pos[BATCH] == prev_batch)
+                continue;
+            prev_batch = out_tensor_pos[BATCH];
+            if (h_start < row_end)
             {
-                int aidx = out_tensor_pos[OUT_W] / (layer->params[IN_H] * layer->params[IN_W]);
-                int wh = out_tensor_pos[OUT_W] % (layer->params[IN_H] * layer->params[IN_W]);
-                in_tensor_pos[OUT_H] = wh / layer->params[IN_W];
-                in_tensor_pos[OUT_W] = wh % layer->params[IN_W];
-                in_tensor_pos[OUT_C] = out_tensor_pos[OUT_C] + aidx * layer->params[OUT_C];
-                if (in_tensor_pos[BATCH] >= 0 && in_tensor_pos[BATCH] < ldata->nasm->batch_size && in_tensor_pos[OUT_C] >= 0 && in_tensor_pos[OUT_C] < layer->params[IN_C] &&
-                    in_tensor_pos[OUT_H] >= 0 && in_tensor_pos[OUT_H] < layer->params[IN_H] && in_tensor_pos[OUT_W] >= 0 && in_tensor_pos[OUT_W] < layer->params[IN_W])
-                {
-                    ninst_t *input_nist = get_ninst_from_tensor_pos(parent_ldata, in_tensor_pos);
-                    int duplicate = 0;
-                    for (int l = 0; l < ninst->num_parent_ninsts; l++)
-                    {
-                        if (parent_arr[l] == input_nist->ninst_idx)
-                        {
-                            duplicate = 1;
-                            break;
-                        }
-                    }
-                    if (!duplicate)
-                    {
-                        parent_arr[ninst->num_parent_ninsts] = input_nist->ninst_idx;
-                        ninst->num_parent_ninsts++;
-                    }
-                }
+                first_pos[MAT_M] = h_start;
+                last_pos[MAT_M] = row_end - 1;
+                first_pos[MAT_N] = 0;
+                last_pos[MAT_N] = masked && out_tensor_pos[MAT_N] < seq_num ? out_tensor_pos[MAT_N] : seq_num - 1;
+                scratch_add_parent_tensor_rect (scratch, parent_v_ldata, first_pos, last_pos);
             }
-            else if (layer->type == APPEND_LAYER)
+        }
+    }
+    else
+    {
+        for (unsigned int w = w_start; w < w_end; w++)
+        {
+            for (unsigned int h = h_start; h < h_end; h++)
             {
-                nasm_ldata_t *target_ldata = NULL;
-                if (out_tensor_pos[OUT_C] < layer->params[IN_C])
-                {
-                    target_ldata = ldata->nasm->ldata_arr + ldata->parent_ldata_idx_arr[PARENT_0];
-                    in_tensor_pos[OUT_C] = out_tensor_pos[OUT_C];
-                    in_tensor_pos[OUT_W] = out_tensor_pos[OUT_W] / layer->params[STRIDE];
-                    in_tensor_pos[OUT_H] = out_tensor_pos[OUT_H] / layer->params[STRIDE];
-                }
-                else
-                {
-                    target_ldata = ldata->nasm->ldata_arr + ldata->parent_ldata_idx_arr[PARENT_1];
-                    in_tensor_pos[OUT_C] = out_tensor_pos[OUT_C] - layer->params[IN_C];
-                    in_tensor_pos[OUT_W] = out_tensor_pos[OUT_W];
-                    in_tensor_pos[OUT_H] = out_tensor_pos[OUT_H];
-                }
-                if (in_tensor_pos[BATCH] >= 0 && in_tensor_pos[BATCH] < ldata->nasm->batch_size && in_tensor_pos[OUT_C] >= 0 && in_tensor_pos[OUT_C] < layer->params[IN_C] &&
-                    in_tensor_pos[OUT_H] >= 0 && in_tensor_pos[OUT_H] < layer->params[IN_H] && in_tensor_pos[OUT_W] >= 0 && in_tensor_pos[OUT_W] < layer->params[IN_W])
+                unsigned int out_mat_pos[2] = {w, h};
+                unsigned int out_tensor_pos[NUM_PARAM_ELEMENTS] = {0}, in_tensor_pos[NUM_PARAM_ELEMENTS] = {0}; 
+                get_tensor_pos_from_out_mat_pos(ldata, out_mat_pos, out_tensor_pos);
+                in_tensor_pos[BATCH] = out_tensor_pos[BATCH];
+                if (layer->type == RESIDUAL_LAYER)
                 {
-                    ninst_t *input_nist = get_ninst_from_tensor_pos(target_ldata, in_tensor_pos);
-                    int duplicate = 0;
-                    for (int l = 0; l < ninst->num_parent_ninsts; l++)
+                    if (layer->params[MAT_M] == 0)
                     {
-                        if (parent_arr[l] == input_nist->ninst_idx)
-                        {
-                            duplicate = 1;
-                            break;
-                        }
+                        in_tensor_pos[OUT_C] = out_tensor_pos[OUT_C];
+                        in_tensor_pos[OUT_H] = out_tensor_pos[OUT_H];
+                        in_tensor_pos[OUT_W] = out_tensor_pos[OUT_W];
                     }
-                    if (!duplicate)
+                    else
                     {
-                        parent_arr[ninst->num_parent_ninsts] = input_nist->ninst_idx;
-                        ninst->num_parent_ninsts++;
+                        in_tensor_pos[MAT_M] = out_tensor_pos[MAT_M];
+                        in_tensor_pos[MAT_N] = out_tensor_pos[MAT_N];
+                        in_tensor_pos[OUT_C] = out_tensor_pos[OUT_C];
+                        in_tensor_pos[OUT_H] = out_tensor_pos[OUT_H];
+                        in_tensor_pos[OUT_W] = out_tensor_pos[OUT_W];
                     }
-                }
-            }
-            else if (layer->type == LAYERNORM_LAYER)
-            {
-                aspen_layer_t *p_layer = parent_ldata->layer;
-                in_tensor_pos[MAT_M] = out_tensor_pos[MAT_M];
-                in_tensor_pos[MAT_N] = out_tensor_pos[MAT_N];
-                if (in_tensor_pos[BATCH] >= 0 && in_tensor_pos[BATCH] < ldata->nasm->batch_size && in_tensor_pos[MAT_M] >= 0 
-                    && in_tensor_pos[MAT_M] < p_layer->params[MAT_M] && in_tensor_pos[MAT_N] >= 0 && in_tensor_pos[MAT_N] < ldata->nasm->tr_seq_len)
-                {
-                    ninst_t *input_nist = get_ninst_from_tensor_pos(parent_ldata, in_tensor_pos);
-                    int duplicate = 0;
-                    for (int l = 0; l < ninst->num_parent_ninsts; l++)
+                    if ((in_tensor_pos[BATCH] < nasm->batch_size && in_tensor_pos[OUT_C] < layer->params[IN_C] &&
+                        in_tensor_pos[OUT_H] < layer->params[IN_H] && in_tensor_pos[OUT_W] < layer->params[IN_W]) ||
+                        (in_tensor_pos[BATCH] < nasm->batch_size &&
+                        in_tensor_pos[MAT_M] < layer->params[MAT_M] && in_tensor_pos[MAT_N] < nasm->tr_seq_len))
                     {
-                        if (parent_arr[l] == input_nist->ninst_idx)
-                        {
-                            duplicate = 1;
-                            break;
-                        }
-                    }
-                    if (!duplicate)
-                    {
-                        parent_arr[ninst->num_parent_ninsts] = input_nist->ninst_idx;
-                        ninst->num_parent_ninsts++;
+                        scratch_add_parent_at_tensor_pos (scratch, parent_ldata, in_tensor_pos);
+                        scratch_add_parent_at_tensor_pos (scratch, nasm->ldata_arr + ldata->parent_ldata_idx_arr[PARENT_1], in_tensor_pos);
                     }
                 }
-            }
-            else if (layer->type == MATMUL_LAYER)
-            {
-                aspen_layer_t *p_layer = parent_ldata->layer;
-                for (int i = 0; i < layer->params[MAT_K]; i++)
+                else if (layer->type == SOFTMAX_LAYER)
                 {
-                    in_tensor_pos[MAT_M] = i;
-                    in_tensor_pos[MAT_N] = out_tensor_pos[MAT_N];
-                    if (in_tensor_pos[BATCH] >= 0 && in_tensor_pos[BATCH] < ldata->nasm->batch_size && in_tensor_pos[MAT_M] >= 0 
-                        && in_tensor_pos[MAT_M] < p_layer->params[MAT_M] && in_tensor_pos[MAT_N] >= 0 && in_tensor_pos[MAT_N] < ldata->nasm->tr_seq_len)
-                    {
-                        ninst_t *input_nist = get_ninst_from_tensor_pos(parent_ldata, in_tensor_pos);
-                        int duplicate = 0;
-                        for (int l = 0; l < ninst->num_parent_ninsts; l++)
-                        {
-                            if (parent_arr[l] == input_nist->ninst_idx)
-                            {
-                                duplicate = 1;
-                                break;
-                            }
-                        }
-                        if (!duplicate)
-                        {
-                            parent_arr[ninst->num_parent_ninsts] = input_nist->ninst_idx;
-                            ninst->num_parent_ninsts++;
-                        }
-                    }
+                    memcpy (in_tensor_pos, out_tensor_pos, sizeof(int) * NUM_PARAM_ELEMENTS);
+                    if (in_tensor_pos[BATCH] < nasm->batch_size && in_tensor_pos[OUT_C] < layer->params[IN_C] &&
+                        in_tensor_pos[OUT_H] < layer->params[IN_H] && in_tensor_pos[OUT_W] < layer->params[IN_W])
+                        scratch_add_parent_at_tensor_pos (scratch, parent_ldata, in_tensor_pos);
                 }
-            }
-            else if (layer->type == K_ATTENTION_LAYER)
-            {
-                aspen_layer_t *p_layer = parent_ldata->layer;
-                unsigned int hidden_per_head = layer->params[NUM_HIDDEN] / layer->params[NUM_HEAD];
-                // Input 0 (Query)
-                for (int k = 0; k < layer->params[MAT_K]; k++)
+                else if (layer->type == YOLO_LAYER)
                 {
-                    in_tensor_pos[MAT_M] = k + out_tensor_pos[NUM_HEAD] * hidden_per_head;
-                    in_tensor_pos[MAT_N] = out_tensor_pos[MAT_N];
-                    if (in_tensor_pos[BATCH] >= 0 && in_tensor_pos[BATCH] < ldata->nasm->batch_size && in_tensor_pos[MAT_M] >= 0 
-                        && in_tensor_pos[MAT_M] < p_layer->params[MAT_M] && in_tensor_pos[MAT_N] >= 0 && in_tensor_pos[MAT_N] < ldata->nasm->tr_seq_len)
-                    {
-                        ninst_t *input_nist = get_ninst_from_tensor_pos(parent_ldata, in_tensor_pos);
-                        int duplicate = 0;
-                        for (int l = 0; l < ninst->num_parent_ninsts; l++)
-                        {
-                            if (parent_arr[l] == input_nist->ninst_idx)
-                            {
-                                duplicate = 1;
-                                break;
-                            }
-                        }
-                        if (!duplicate)
-                        {
-                            parent_arr[ninst->num_parent_ninsts] = input_nist->ninst_idx;
-                            ninst->num_parent_ninsts++;
-                        }
-                    }
+                    int aidx = out_tensor_pos[OUT_W] / (layer->params[IN_H] * layer->params[IN_W]);
+                    int wh = out_tensor_pos[OUT_W] % (layer->params[IN_H] * layer->params[IN_W]);
+                    in_tensor_pos[OUT_H] = wh / layer->params[IN_W];
+                    in_tensor_pos[OUT_W] = wh % layer->params[IN_W];
+                    in_tensor_pos[OUT_C] = out_tensor_pos[OUT_C] + aidx * layer->params[OUT_C];
+                    if (in_tensor_pos[BATCH] < nasm->batch_size && in_tensor_pos[OUT_C] < layer->params[IN_C] &&
+                        in_tensor_pos[OUT_H] < layer->params[IN_H] && in_tensor_pos[OUT_W] < layer->params[IN_W])
+                        scratch_add_parent_at_tensor_pos (scratch, parent_ldata, in_tensor_pos);
                 }
-                // Input 1 (Key)
-                nasm_ldata_t *parent_k_ldata = ldata->nasm->ldata_arr + ldata->parent_ldata_idx_arr[PARENT_1];
-                aspen_layer_t *pk_layer = parent_k_ldata->layer;
-                for (int k = 0; k < layer->params[MAT_K]; k++)
+                else if (layer->type == APPEND_LAYER)
                 {
-                    in_tensor_pos[MAT_N] = out_tensor_pos[MAT_M];
-                    in_tensor_pos[MAT_M] = k + out_tensor_pos[NUM_HEAD] * hidden_per_head;
-                    if (in_tensor_pos[BATCH] >= 0 && in_tensor_pos[BATCH] < ldata->nasm->batch_size && in_tensor_pos[MAT_M] >= 0 
-                    && in_tensor_pos[MAT_M] < pk_layer->params[MAT_M] && in_tensor_pos[MAT_N] >= 0 && in_tensor_pos[MAT_N] < ldata->nasm->tr_seq_len)
+                    nasm_ldata_t *target_ldata = NULL;
+                    if (out_tensor_pos[OUT_C] < layer->params[IN_C])
                     {
-                        ninst_t *input_nist = get_ninst_from_tensor_pos(parent_k_ldata, in_tensor_pos);
-                        int duplicate = 0;
-                        for (int l = 0; l < ninst->num_parent_ninsts; l++)
-                        {
-                            if (parent_arr[l] == input_nist->ninst_idx)
-                            {
-                                duplicate = 1;
-                                break;
-                            }
-                        }
-                        if (!duplicate)
-                        {
-                            parent_arr[ninst->num_parent_ninsts] = input_nist->ninst_idx;
-                            ninst->num_parent_ninsts++;
-                        }
+                        target_ldata = parent_ldata;
+                        in_tensor_pos[OUT_C] = out_tensor_pos[OUT_C];
+                        in_tensor_pos[OUT_W] = out_tensor_pos[OUT_W] / layer->params[STRIDE];
+                        in_tensor_pos[OUT_H] = out_tensor_pos[OUT_H] / layer->params[STRIDE];
                     }
-                }
-            }
-            else if (layer->type == V_ATTENTION_LAYER)
-            {
-                aspen_layer_t *p_layer = parent_ldata->layer;
-                unsigned int hidden_per_head = layer->params[NUM_HIDDEN] / layer->params[NUM_HEAD];
-                unsigned int head_pos = out_tensor_pos[MAT_M] / hidden_per_head;
-                unsigned int seq_num = ldata->nasm->tr_seq_len;
-                // Input 0 (Key_out)
-                for (int k = 0; k < seq_num; k++)
-                {
-                    in_tensor_pos[NUM_HEAD] = head_pos;
-                    in_tensor_pos[MAT_M] = k;
-                    in_tensor_pos[MAT_N] = out_tensor_pos[MAT_N];
-                    if (in_tensor_pos[BATCH] >= 0 && in_tensor_pos[BATCH] < ldata->nasm->batch_size && in_tensor_pos[MAT_M] >= 0 
-                        && in_tensor_pos[MAT_M] < ldata->nasm->tr_seq_len && in_tensor_pos[MAT_N] >= 0 && in_tensor_pos[MAT_N] < ldata->nasm->tr_seq_len
-                        && in_tensor_pos[NUM_HEAD] >= 0 && in_tensor_pos[NUM_HEAD] < p_layer->params[NUM_HEAD])
+                    else
                     {
-                        ninst_t *input_nist = get_ninst_from_tensor_pos(parent_ldata, in_tensor_pos);
-                        int duplicate = 0;
-                        for (int l = 0; l < ninst->num_parent_ninsts; l++)
-                        {
-                            if (parent_arr[l] == input_nist->ninst_idx)
-                            {
-                                duplicate = 1;
-                                break;
-                            }
-                        }
-                        if (!duplicate)
-                        {
-                            parent_arr[ninst->num_parent_ninsts] = input_nist->ninst_idx;
-                            ninst->num_parent_ninsts++;
-                        }
+                        target_ldata = nasm->ldata_arr + ldata->parent_ldata_idx_arr[PARENT_1];
+                        in_tensor_pos[OUT_C] = out_tensor_pos[OUT_C] - layer->params[IN_C];
+                        in_tensor_pos[OUT_W] = out_tensor_pos[OUT_W];
+                        in_tensor_pos[OUT_H] = out_tensor_pos[OUT_H];
                     }
+                    if (in_tensor_pos[BATCH] < nasm->batch_size && in_tensor_pos[OUT_C] < layer->params[IN_C] &&
+                        in_tensor_pos[OUT_H] < layer->params[IN_H] && in_tensor_pos[OUT_W] < layer->params[IN_W])
+                        scratch_add_parent_at_tensor_pos (scratch, target_ldata, in_tensor_pos);
                 }
-                // Input 1 (Value)
-                nasm_ldata_t *parent_v_ldata = ldata->nasm->ldata_arr + ldata->parent_ldata_idx_arr[PARENT_1];
-                aspen_layer_t *pv_layer = parent_v_ldata->layer;
-                for (int k = 0; k < seq_num; k++)
+                else if (layer->type == LAYERNORM_LAYER)
                 {
-                    in_tensor_pos[MAT_N] = k;
+                    aspen_layer_t *p_layer = parent_ldata->layer;
                     in_tensor_pos[MAT_M] = out_tensor_pos[MAT_M];
-                    if (in_tensor_pos[BATCH] >= 0 && in_tensor_pos[BATCH] < ldata->nasm->batch_size && in_tensor_pos[MAT_M] >= 0 
-                    && in_tensor_pos[MAT_M] < pv_layer->params[MAT_M] && in_tensor_pos[MAT_N] >= 0 && in_tensor_pos[MAT_N] < ldata->nasm->tr_seq_len)
-                    {
-                        ninst_t *input_nist = get_ninst_from_tensor_pos(parent_v_ldata, in_tensor_pos);
-                        int duplicate = 0;
-                        for (int l = 0; l < ninst->num_parent_ninsts; l++)
-                        {
-                            if (parent_arr[l] == input_nist->ninst_idx)
-                            {
-                                duplicate = 1;
-                                break;
-                            }
-                        }
-                        if (!duplicate)
-                        {
-                            parent_arr[ninst->num_parent_ninsts] = input_nist->ninst_idx;
-                            ninst->num_parent_ninsts++;
-                        }
-                    }
+                    in_tensor_pos[MAT_N] = out_tensor_pos[MAT_N];
+                    if (in_tensor_pos[BATCH] < nasm->batch_size && in_tensor_pos[MAT_M] < p_layer->params[MAT_M] 
+                        && in_tensor_pos[MAT_N] < nasm->tr_seq_len)
+                        scratch_add_parent_at_tensor_pos (scratch, parent_ldata, in_tensor_pos);
+                }
+                else
+                {
+                    ERROR_PRTF ( "ERROR: Unsupported layer type %s, at line %d in file %s\n" , layer_type_str[layer->type], 0, " ");
+                    assert (0);
                 }
             }
-            else if (layer->type == INPUT_LAYER)
-            {
-                // printf ("\n");
-                return;
-            }
-            else
-            {
-                ERROR_PRTF ( "ERROR: Unsupported layer type %s, at line %d in file %s\n" , layer_type_str[layer->type], 0, " ");
-                assert (0);
-            }
-            // printf ("\n");
         }
     }
-    // fflush (stdout);
+    qsort (scratch->parent_arr, scratch->num_parents, sizeof(unsigned int), compare_parent_idx);
+    ninst->num_parent_ninsts = scratch->num_parents;
     ninst->parent_ninst_idx_arr = calloc(ninst->num_parent_ninsts, sizeof(unsigned int));
-    memcpy (ninst->parent_ninst_idx_arr, parent_arr, ninst->num_parent_ninsts*sizeof(unsigned int));
+    memcpy (ninst->parent_ninst_idx_arr, scratch->parent_arr, ninst->num_parent_ninsts*sizeof(unsigned int));
     for (int i = 0; i < ninst->num_parent_ninsts; i++)
     {
-        ninst_t *parent = ninst->parent_ninst_idx_arr[i] + ldata->nasm->ninst_arr;
+        ninst_t *parent = ninst->parent_ninst_idx_arr[i] + nasm->ninst_arr;
         atomic_fetch_add (&parent->num_child_ninsts, 1);
+        scratch->bitmap[ninst->parent_ninst_idx_arr[i] >> 6] = 0;
     }
-    free (parent_arr);
-    // printf ("Layer %d, ninst %d, num_parent_ninsts %d\n", 
-    //     ldata->layer->layer_idx, ninst->ninst_idx, ninst->num_parent_ninsts);
-    // for (int i = 0; i < ninst->num_parent_ninsts; i++)
-    // {
-    //     ninst_t *parent = ninst->parent_ninst_idx_arr[i] + ldata->nasm->ninst_arr;
-    //     printf ("\tparent_ninst %d, layer %d, ninst %d\n", i, parent->ldata->layer->layer_idx, parent->ninst_idx);
-    // }
     ninst_find_input_pos_idx (ninst);
 }
 
@@ -547,9 +497,10 @@ void destroy_ninst (ninst_t *ninst)
 {
     if (ninst == NULL)
         return;
-    if (ninst->parent_ninst_idx_arr != NULL)
+    // Parent and child arrays of a CSR-packed NASM are owned by the NASM.
+    if (ninst->ldata->nasm->parent_ninst_idx_csr == NULL && ninst->parent_ninst_idx_arr != NULL)
         free (ninst->parent_ninst_idx_arr);
-    if (ninst->child_ninst_arr != NULL)
+    if (ninst->ldata->nasm->child_ninst_csr == NULL && ninst->child_ninst_arr != NULL)
         free (ninst->child_ninst_arr);
     if (ninst->input_pos_idx_arr != NULL)
         free (ninst->input_pos_idx_arr);
@@ -561,7 +512,128 @@ void destroy_ninst (ninst_t *ninst)
     }
 }
 
-nasm_t *apu_create_nasm_without_finding_ninst_parents (aspen_dnn_t *dnn, unsigned int flop_per_ninst, unsigned int batch_size,  unsigned int min_ninst_per_ldata, unsigned int transformer_seq_len)
+static void reset_ldata_out_mat_users (nasm_t *nasm)
+{
+    for (int i = 0; i < nasm->num_ldata; i++)
+        atomic_store (&nasm->ldata_arr[i].num_out_mat_users, 1);
+    for (int i = 0; i < nasm->num_ldata; i++)
+    {
+        nasm_ldata_t *ldata = &nasm->ldata_arr[i];
+        if (ldata->out_mat_owner_idx != -1)
+            atomic_fetch_add (&nasm->ldata_arr[ldata->out_mat_owner_idx].num_out_mat_users, 1);
+    }
+}
+
+// Generates the JIT SGEMM kernels of every ldata, from the first ninst of each tile size. 
+// Runs after the fusion plans, which decide the strides and epilogues of the GEMMs.
+static void plan_jit_sgemm (nasm_t *nasm)
+{
+    for (int i = 0; i < nasm->num_ldata; i++)
+    {
+        nasm_ldata_t *ldata = &nasm->ldata_arr[i];
+        for (int j = 0; j < ldata->num_ninst; j++)
+        {
+            ninst_t *ninst = &ldata->ninst_arr_start[j];
+            if (j > 0 && ninst->tile_dims[OUT_H] == ninst[-1].tile_dims[OUT_H] 
+                && ninst->tile_dims[OUT_W] == ninst[-1].tile_dims[OUT_W])
+                continue;
+            request_ninst_jit_sgemm (ninst);
+        }
+    }
+    jit_sgemm_generate ();
+}
+
+// Places the output of each parent of an APPEND ldata in its channel slice of the APPEND out_mat, using the APPEND
+// stride. A parent qualifies if it is read at the same resolution, its tiles (including padding) fit in the slice, 
+// and no child needs it to be packed.
+static void plan_zero_copy_concat (nasm_t *nasm)
+{
+    for (int i = 0; i < nasm->num_ldata; i++)
+    {
+        nasm_ldata_t *ldata = &nasm->ldata_arr[i];
+        aspen_layer_t *layer = ldata->layer;
+        if (layer->type != APPEND_LAYER)
+            continue;
+        const unsigned int out_w = get_smallest_dividable (ldata->out_mat_dims[OUT_W], ldata->ninst_tile_dims[OUT_W]);
+        for (LAYER_PARENTS pidx = PARENT_0; pidx <= PARENT_1; pidx++)
+        {
+            // The first parent is upsampled by the stride.
+            if (ldata->parent_ldata_idx_arr[pidx] == -1 || ldata->parent_ldata_idx_arr[pidx] == 0
+                || (pidx == PARENT_0 && layer->params[STRIDE] != 1))
+                continue;
+            nasm_ldata_t *p_ldata = &nasm->ldata_arr[ldata->parent_ldata_idx_arr[pidx]];
+            if (p_ldata->out_mat_owner_idx != -1 || p_ldata->layer->type == APPEND_LAYER)
+                continue;
+            const unsigned int row_offset = pidx == PARENT_0 ? 0 : layer->params[IN_C];
+            const unsigned int row_end = pidx == PARENT_0 ? layer->params[IN_C] : ldata->out_mat_stride;
+            const unsigned int p_out_w = get_smallest_dividable (p_ldata->out_mat_dims[OUT_W], p_ldata->ninst_tile_dims[OUT_W]);
+            if (p_ldata->out_mat_dims[OUT_W] != ldata->out_mat_dims[OUT_W] || p_out_w > out_w 
+                || row_offset + p_ldata->out_mat_stride > row_end)
+                continue;
+            int packed_child = 0;
+            for (int c = 0; c < p_ldata->num_child_ldata; c++)
+                packed_child |= nasm->ldata_arr[p_ldata->child_ldata_idx_arr[c]].layer->type == FC_LAYER;
+            if (packed_child)
+                continue;
+            p_ldata->out_mat_owner_idx = i;
+            p_ldata->out_mat_row_offset = row_offset;
+            p_ldata->out_mat_stride = ldata->out_mat_stride;
+        }
+    }
+}
+
+// Makes each residual ldata a view of the out_mat of a conv parent that has no activation and no other child,
+// so that the conv ninsts write the residual output. The first parent is preferred.
+static void plan_fused_conv_residual (nasm_t *nasm)
+{
+    for (int i = 0; i < nasm->num_ldata; i++)
+    {
+        nasm_ldata_t *ldata = &nasm->ldata_arr[i];
+        if (ldata->layer->type != RESIDUAL_LAYER || ldata->fused_layernorm_ldata != NULL
+            || ldata->parent_ldata_idx_arr[PARENT_0] == ldata->parent_ldata_idx_arr[PARENT_1])
+            continue;
+        for (LAYER_PARENTS pidx = PARENT_0; pidx <= PARENT_1; pidx++)
+        {
+            if (ldata->parent_ldata_idx_arr[pidx] == -1 || ldata->parent_ldata_idx_arr[pidx] == 0)
+                continue;
+            nasm_ldata_t *conv_ldata = &nasm->ldata_arr[ldata->parent_ldata_idx_arr[pidx]];
+            aspen_layer_t *conv_layer = conv_ldata->layer;
+            if (conv_layer->type != CONV_LAYER || conv_ldata->num_child_ldata != 1 || conv_ldata->out_mat_owner_idx != -1
+                || (conv_layer->activation != NO_ACTIVATION && conv_layer->activation != LINEAR)
+                || conv_ldata->out_mat_dims[OUT_H] != ldata->out_mat_dims[OUT_H] 
+                || conv_ldata->out_mat_dims[OUT_W] != ldata->out_mat_dims[OUT_W])
+                continue;
+            ldata->out_mat_owner_idx = ldata->parent_ldata_idx_arr[pidx];
+            ldata->out_mat_row_offset = 0;
+            ldata->out_mat_stride = conv_ldata->out_mat_stride;
+            break;
+        }
+    }
+}
+
+// NASM_PLAN_* options of NASMs created from the dnn.
+unsigned int get_dnn_nasm_plan_flags (aspen_dnn_t *dnn)
+{
+    unsigned int plan_flags = NASM_PLAN_WINOGRAD_TILING;
+    if (dnn->fuse_conv_residual)
+        plan_flags |= NASM_PLAN_FUSE_CONV_RESIDUAL;
+    if (dnn->fuse_conv_maxpool)
+        plan_flags |= NASM_PLAN_FUSE_CONV_MAXPOOL;
+    if (dnn->zero_copy_concat)
+        plan_flags |= NASM_PLAN_ZERO_COPY_CONCAT;
+    if (dnn->fuse_qkv)
+        plan_flags |= NASM_PLAN_FUSE_QKV;
+    if (dnn->fuse_attention)
+        plan_flags |= NASM_PLAN_FUSE_ATTENTION;
+    if (dnn->fuse_residual_layernorm)
+        plan_flags |= NASM_PLAN_FUSE_RESIDUAL_LAYERNORM;
+    return plan_flags;
+}
+
+// ldata_min_ninst_arr, if not NULL, holds one min ninst count per ldata and overrides min_ninst_per_ldata.
+// plan_flags are the NASM_PLAN_* options, get_dnn_nasm_plan_flags (dnn) unless they come from a NASM file.
+nasm_t *apu_create_nasm_without_finding_ninst_parents (aspen_dnn_t *dnn, unsigned int flop_per_ninst, unsigned int batch_size,  
+    unsigned int min_ninst_per_ldata, unsigned int *ldata_min_ninst_arr, unsigned int transformer_seq_len, unsigned int plan_flags)
 {
     if (min_ninst_per_ldata < 1)
     {
@@ -575,6 +647,7 @@ nasm_t *apu_create_nasm_without_finding_ninst_parents (aspen_dnn_t *dnn, unsigne
     new_nasm->batch_size = batch_size > 0? batch_size : 1;
     new_nasm->nasm_id = nasm_num;
     new_nasm->min_ninst_per_ldata = min_ninst_per_ldata;
+    new_nasm->plan_flags = plan_flags;
     new_nasm->gpu_idx = -1;
     atomic_store (&new_nasm->completed, 0);
     new_nasm->operating_mode = OPER_MODE_DEFAULT;
@@ -584,6 +657,12 @@ nasm_t *apu_create_nasm_without_finding_ninst_parents (aspen_dnn_t *dnn, unsigne
         new_nasm->num_ldata += get_nasm_ldata_num_per_layer(&dnn->layers[i]);
     }
     new_nasm->ldata_arr = calloc(new_nasm->num_ldata, sizeof(nasm_ldata_t));
+    if (ldata_min_ninst_arr != NULL)
+    {
+        new_nasm->ldata_min_ninst_arr = malloc(new_nasm->num_ldata * sizeof(unsigned int));
+        for (int i = 0; i < new_nasm->num_ldata; i++)
+            new_nasm->ldata_min_ninst_arr[i] = ldata_min_ninst_arr[i] > 0 ? ldata_min_ninst_arr[i] : 1;
+    }
     nasm_ldata_t *ldata_ptr = new_nasm->ldata_arr;
     for (int i = 0; i < dnn->num_layers; i++)
     {
@@ -596,7 +675,9 @@ nasm_t *apu_create_nasm_without_finding_ninst_parents (aspen_dnn_t *dnn, unsigne
         total_ninst += new_nasm->ldata_arr[i].num_ninst;
     }
     new_nasm->num_ninst = total_ninst;
-    new_nasm->ninst_arr = calloc(total_ninst, sizeof(ninst_t));
+    // ninst_t is cache-line aligned; keep each ninst on its own line(s).
+    new_nasm->ninst_arr = aligned_alloc(64, total_ninst * sizeof(ninst_t));
+    bzero (new_nasm->ninst_arr, total_ninst * sizeof(ninst_t));
     ninst_t *ninst_ptr = new_nasm->ninst_arr;
     total_ninst = 0;
     for (int i = 0; i < new_nasm->num_ldata; i++)
@@ -613,53 +694,109 @@ nasm_t *apu_create_nasm_without_finding_ninst_parents (aspen_dnn_t *dnn, unsigne
     {
         update_ldata_child_list(&new_nasm->ldata_arr[i]);
     }
+    plan_ldata_fusion (new_nasm);
+    if (plan_flags & NASM_PLAN_FUSE_CONV_RESIDUAL)
+        plan_fused_conv_residual (new_nasm);
+    if (plan_flags & NASM_PLAN_ZERO_COPY_CONCAT)
+        plan_zero_copy_concat (new_nasm);
+    reset_ldata_out_mat_users (new_nasm);
+    if (dnn->sgemm_tune_dir[0] != '\0')
+        tune_nasm_sgemm_blocking (new_nasm, dnn->sgemm_tune_dir);
+    if (dnn->jit_sgemm)
+        plan_jit_sgemm (new_nasm);
     dnn->ref_nasms++;
     return new_nasm;
 }
 
-void set_child_list (ninst_t *ninst)
+// Finds the parents of every ninst, in parallel across all ldata, then fills the child
+// lists in one pass over the parent lists. Children end up in ascending ninst order.
+void nasm_find_ninst_parents_and_children (nasm_t *nasm)
 {
-    if (ninst == NULL)
-        return;
-    if (ninst->num_child_ninsts <= 0)
+    #pragma omp parallel
+    {
+        parent_scratch_t scratch;
+        scratch.bitmap = calloc ((nasm->num_ninst + 63) / 64, sizeof(uint64_t));
+        scratch.max_parents = 1024;
+        scratch.parent_arr = malloc (scratch.max_parents * sizeof(unsigned int));
+        scratch.num_parents = 0;
+        #pragma omp for schedule(dynamic, 16)
+        for (unsigned int i = 0; i < nasm->num_ninst; i++)
+            ninst_find_parent (&nasm->ninst_arr[i], &scratch);
+        free (scratch.bitmap);
+        free (scratch.parent_arr);
+    }
+    unsigned int *num_children_set = calloc (nasm->num_ninst, sizeof(unsigned int));
+    for (unsigned int i = 0; i < nasm->num_ninst; i++)
+    {
+        ninst_t *ninst = &nasm->ninst_arr[i];
+        if (ninst->num_child_ninsts > 0)
+            ninst->child_ninst_arr = calloc(ninst->num_child_ninsts, sizeof(ninst_t*));
+    }
+    for (unsigned int i = 0; i < nasm->num_ninst; i++)
+    {
+        ninst_t *ninst = &nasm->ninst_arr[i];
+        for (unsigned int j = 0; j < ninst->num_parent_ninsts; j++)
+        {
+            unsigned int parent_idx = ninst->parent_ninst_idx_arr[j];
+            nasm->ninst_arr[parent_idx].child_ninst_arr[num_children_set[parent_idx]++] = ninst;
+        }
+    }
+    free (num_children_set);
+}
+
+// Moves the per-ninst parent and child arrays into two NASM-wide CSR pools.
+void nasm_build_csr (nasm_t *nasm)
+{
+    if (nasm->parent_ninst_idx_csr != NULL || nasm->child_ninst_csr != NULL)
         return;
-    ninst->child_ninst_arr = calloc(ninst->num_child_ninsts, sizeof(ninst_t*));
-    nasm_ldata_t *ldata = ninst->ldata;
-    nasm_t *nasm = ldata->nasm;
-    unsigned int child_idx = 0;
-    for (size_t i = ldata - nasm->ldata_arr; i < nasm->num_ldata; i++) // May cause a bug if child ninst is in previous ldata.
-    {
-        for (int j = 0; j < nasm->ldata_arr[i].num_ninst; j++)
+    size_t *parent_offset = malloc ((nasm->num_ninst + 1) * sizeof(size_t));
+    size_t *child_offset = malloc ((nasm->num_ninst + 1) * sizeof(size_t));
+    parent_offset[0] = 0;
+    child_offset[0] = 0;
+    for (unsigned int i = 0; i < nasm->num_ninst; i++)
+    {
+        ninst_t *ninst = &nasm->ninst_arr[i];
+        parent_offset[i + 1] = parent_offset[i] + ninst->num_parent_ninsts;
+        child_offset[i + 1] = child_offset[i] + ninst->num_child_ninsts;
+    }
+    nasm->num_parent_edges = parent_offset[nasm->num_ninst];
+    nasm->num_child_edges = child_offset[nasm->num_ninst];
+    nasm->parent_ninst_idx_csr = malloc ((nasm->num_parent_edges + 1) * sizeof(unsigned int));
+    nasm->child_ninst_csr = malloc ((nasm->num_child_edges + 1) * sizeof(ninst_t *));
+    #pragma omp parallel for
+    for (unsigned int i = 0; i < nasm->num_ninst; i++)
+    {
+        ninst_t *ninst = &nasm->ninst_arr[i];
+        unsigned int *parent_arr = nasm->parent_ninst_idx_csr + parent_offset[i];
+        ninst_t **child_arr = nasm->child_ninst_csr + child_offset[i];
+        if (ninst->parent_ninst_idx_arr != NULL)
         {
-            ninst_t *target_ninst = &nasm->ldata_arr[i].ninst_arr_start[j];
-            for (int k = 0; k < target_ninst->num_parent_ninsts; k++)
-            {
-                if (target_ninst->parent_ninst_idx_arr[k] == ninst->ninst_idx)
-                {
-                    ninst->child_ninst_arr[child_idx] = target_ninst;
-                    child_idx++;
-                    if (child_idx == ninst->num_child_ninsts)
-                    {
-                        return;
-                    }
-                    break;
-                }
-            }
+            memcpy (parent_arr, ninst->parent_ninst_idx_arr, ninst->num_parent_ninsts * sizeof(unsigned int));
+            free (ninst->parent_ninst_idx_arr);
+        }
+        if (ninst->child_ninst_arr != NULL)
+        {
+            memcpy (child_arr, ninst->child_ninst_arr, ninst->num_child_ninsts * sizeof(ninst_t *));
+            free (ninst->child_ninst_arr);
         }
+        ninst->parent_ninst_idx_arr = parent_arr;
+        ninst->child_ninst_arr = child_arr;
     }
-    ERROR_PRTF ("Error: set_child_list failed. Only found %d children for ninst %d, expected %d\n"
-        , child_idx, ninst->ninst_idx, ninst->num_child_ninsts);
+    free (parent_offset);
+    free (child_offset);
 }
 
-double test_nasm_time_sec (nasm_t *nasm, unsigned int num_iter, int gpu_idx)
+double test_nasm_time_sec (nasm_t *nasm, unsigned int num_iter, unsigned int num_dse, int gpu_idx)
 {
     double total_time = 0;
     rpool_t *rpool = rpool_init (gpu_idx);
-    unsigned int num_cpu = get_cpu_count() / 2;
-    if (num_cpu < 1)
-        num_cpu = 1;
-    dse_group_t *dse_group = dse_group_init (num_cpu, gpu_idx);
+    if (num_dse < 1)
+        num_dse = 1;
+    dse_group_t *dse_group = dse_group_init (num_dse, gpu_idx);
     dse_group_set_rpool (dse_group, rpool);
+    dse_group_set_device_mode (dse_group, DEV_LOCAL);
+    dse_group_set_device (dse_group, 0);
+    init_full_local (nasm, 0);
     rpool_add_nasm (rpool, nasm, NULL);
     double start = get_time_secs();
     for (int i = 0; i < num_iter; i++)
@@ -676,122 +813,193 @@ double test_nasm_time_sec (nasm_t *nasm, unsigned int num_iter, int gpu_idx)
     return total_time / num_iter;
 }
 
-nasm_t *apu_generate_nasm(aspen_dnn_t *dnn, unsigned int batch_size, unsigned int num_iter, int gpu_idx)
+// Kernel throughput model for the granularity selector. GEMM-shaped ninsts are costed by their
+// (M, N, K) class: M is the tile height, N the tile width and K the reduction length.
+static const unsigned int cost_model_m_arr [APU_COST_MODEL_NUM_M] = {32, 64, 128, 256, 512};
+static const unsigned int cost_model_n_arr [APU_COST_MODEL_NUM_N] = {12, 24, 48, 96, 192};
+static const unsigned int cost_model_k_arr [APU_COST_MODEL_NUM_K] = {64, 256, 1024, 2304};
+static double cost_model_gemm_flops [APU_COST_MODEL_NUM_M][APU_COST_MODEL_NUM_N][APU_COST_MODEL_NUM_K];
+static double cost_model_elem_sec = 0;
+static int cost_model_calibrated = 0;
+
+// Runs an M x N x K GEMM with the same kernel dispatch as tiled_matmul.
+static void cost_model_run_gemm (unsigned int M, unsigned int N, unsigned int K, float *A, float *B, float *C)
 {
-    size_t num_ninst = APU_GENERATION_NUM_NINST;
-    double gen_coeff = APU_GENERATION_COEFF;
-    if (gpu_idx >= 0)
-    {
-        num_ninst = APU_GENERATION_NUM_NINST_GPU;
-        gen_coeff = APU_GENERATION_COEFF_GPU;
-    }
-    nasm_t *new_nasm = apu_create_nasm(dnn, num_ninst, batch_size);
-    double time = test_nasm_time_sec(new_nasm, 50, gpu_idx);
-    double min_time = time;
-    size_t min_num_ninst = num_ninst;
-    for (int i = 0; i < num_iter; i++)
+    const unsigned int lda = K;
+    const unsigned int ldb = K;
+    const unsigned int ldc = M;
+    for (unsigned int n = 0; n < N; n += _TILE_SIZE_N)
     {
-        PRTF ("APU: Iteration %d, time = %f sec at ninst num %ld\n", i, time, num_ninst);
-        size_t num_old = num_ninst;
-        if (time <= min_time*1.05)
-        {
-            num_ninst = num_ninst * gen_coeff;
-            apu_destroy_nasm (new_nasm);
-            new_nasm = apu_create_nasm(dnn, num_ninst, batch_size);
-            time = test_nasm_time_sec(new_nasm, 50, gpu_idx);
-        }
-        else
+        unsigned int tile_n = N - n < _TILE_SIZE_N ? N - n : _TILE_SIZE_N;
+        for (unsigned int k = 0; k < K; k += _TILE_SIZE_K)
         {
-            num_ninst = num_ninst*gen_coeff + min_num_ninst*(1-gen_coeff);
-            apu_destroy_nasm (new_nasm);
-            new_nasm = apu_create_nasm(dnn, num_ninst, batch_size);
-            time = test_nasm_time_sec(new_nasm, 50, gpu_idx);
+            unsigned int tile_k = K - k < _TILE_SIZE_K ? K - k : _TILE_SIZE_K;
+            for (unsigned int m = 0; m < M; m += _TILE_SIZE_M)
+            {
+                unsigned int tile_m = M - m < _TILE_SIZE_M ? M - m : _TILE_SIZE_M;
+                float *a = A + (m * lda + k*_VEC_SIZE_M);
+                float *b = B + (n * ldb + k);
+                float *c = C + (ldc * n + m);
+                if (tile_m == _TILE_SIZE_M && tile_n == _TILE_SIZE_N)
+                    SGEMM_KERNEL_FULL_TILE (tile_m, tile_n, tile_k, a, lda, b, ldb, c, ldc);
+                else if (tile_n == _TILE_SIZE_N)
+                    SGEMM_KERNEL_TILE_N (tile_m, tile_n, tile_k, a, lda, b, ldb, c, ldc);
+                else if (tile_m == _TILE_SIZE_M)
+                    SGEMM_KERNEL_TILE_M (tile_m, tile_n, tile_k, a, lda, b, ldb, c, ldc);
+                else
+                    SGEMM_KERNEL (tile_m, tile_n, tile_k, a, lda, b, ldb, c, ldc);
+            }
         }
-        if (time < min_time)
+    }
+}
+
+// Measures single-thread GEMM throughput for every (M, N, K) class, and the per-element
+// time of a streaming element-wise op. Runs once per process.
+static void calibrate_cost_model ()
+{
+    if (cost_model_calibrated)
+        return;
+    unsigned int max_m = cost_model_m_arr[APU_COST_MODEL_NUM_M - 1];
+    unsigned int max_n = cost_model_n_arr[APU_COST_MODEL_NUM_N - 1];
+    unsigned int max_k = cost_model_k_arr[APU_COST_MODEL_NUM_K - 1];
+    float *A = aspen_calloc ((size_t)max_m * max_k, sizeof(float));
+    float *B = aspen_calloc ((size_t)max_n * max_k, sizeof(float));
+    float *C = aspen_calloc ((size_t)max_m * max_n, sizeof(float));
+    cost_model_run_gemm (max_m, max_n, max_k, A, B, C);
+    for (int i = 0; i < APU_COST_MODEL_NUM_M; i++)
+    {
+        for (int j = 0; j < APU_COST_MODEL_NUM_N; j++)
         {
-            min_time = time;
-            min_num_ninst = num_ninst;
+            for (int l = 0; l < APU_COST_MODEL_NUM_K; l++)
+            {
+                unsigned int M = cost_model_m_arr[i], N = cost_model_n_arr[j], K = cost_model_k_arr[l];
+                unsigned int num_run = 0;
+                double start = get_time_secs();
+                double elapsed = 0;
+                do
+                {
+                    cost_model_run_gemm (M, N, K, A, B, C);
+                    num_run++;
+                    elapsed = get_time_secs() - start;
+                } while (elapsed < APU_COST_MODEL_CALIB_SEC);
+                cost_model_gemm_flops[i][j][l] = 2.0 * M * N * K * num_run / elapsed;
+            }
         }
-        PRTF ("\tMin time = %f sec, min num ninst = %ld\n", min_time, min_num_ninst);
-        if (((num_ninst <= num_old*1.10) && (num_ninst >= num_old*0.90)) || (num_ninst <= 1))
-            break;
     }
-    apu_destroy_nasm (new_nasm);
-    PRTF ("APU: NASM with num %ld, time = %f sec selected.\n", min_num_ninst, min_time);
-    new_nasm = apu_create_nasm(dnn, min_num_ninst, batch_size);
-    return new_nasm;
+    size_t num_elem = (size_t)max_n * max_k;
+    unsigned int num_run = 0;
+    double start = get_time_secs();
+    double elapsed = 0;
+    do
+    {
+        for (size_t i = 0; i < num_elem; i++)
+            A[i] = A[i] + B[i];
+        num_run++;
+        elapsed = get_time_secs() - start;
+    } while (elapsed < APU_COST_MODEL_CALIB_SEC);
+    cost_model_elem_sec = elapsed / ((double)num_run * num_elem);
+    aspen_free (A);
+    aspen_free (B);
+    aspen_free (C);
+    cost_model_calibrated = 1;
 }
 
-nasm_t *apu_generate_transformer_nasm(aspen_dnn_t *dnn, unsigned int batch_size, unsigned int seq_num, unsigned int num_iter, int gpu_idx)
+// Index of the class in arr closest to val on a log scale.
+static unsigned int get_cost_model_class (const unsigned int *arr, unsigned int num, unsigned int val)
 {
-    size_t num_ninst = APU_GENERATION_NUM_NINST;
-    double gen_coeff = APU_GENERATION_COEFF;
-    if (gpu_idx >= 0)
-    {
-        num_ninst = APU_GENERATION_NUM_NINST_GPU;
-        gen_coeff = APU_GENERATION_COEFF_GPU;
-    }
-    nasm_t *new_nasm = apu_create_transformer_nasm(dnn, num_ninst, batch_size, seq_num);
-    double time = test_nasm_time_sec(new_nasm, 50, gpu_idx);
-    double min_time = time;
-    size_t min_num_ninst = num_ninst;
-    for (int i = 0; i < num_iter; i++)
+    unsigned int idx = 0;
+    double min_dist = fabs (log ((double)val / arr[0]));
+    for (unsigned int i = 1; i < num; i++)
     {
-        PRTF ("APU: Iteration %d, time = %f sec at ninst num %ld\n", i, time, num_ninst);
-        size_t num_old = num_ninst;
-        if (time <= min_time*1.05)
-        {
-            num_ninst = num_ninst * gen_coeff;
-            apu_destroy_nasm (new_nasm);
-            new_nasm = apu_create_transformer_nasm(dnn, num_ninst, batch_size, seq_num);
-            time = test_nasm_time_sec(new_nasm, 50, gpu_idx);
-        }
-        else
-        {
-            num_ninst = num_ninst*gen_coeff + min_num_ninst*(1-gen_coeff);
-            apu_destroy_nasm (new_nasm);
-            new_nasm = apu_create_transformer_nasm(dnn, num_ninst, batch_size, seq_num);
-            time = test_nasm_time_sec(new_nasm, 50, gpu_idx);
-        }
-        if (time < min_time)
+        double dist = fabs (log ((double)val / arr[i]));
+        if (dist < min_dist)
         {
-            min_time = time;
-            min_num_ninst = num_ninst;
+            min_dist = dist;
+            idx = i;
         }
-        PRTF ("\tMin time = %f sec, min num ninst = %ld\n", min_time, min_num_ninst);
-        if (num_ninst <= num_old*1.10 && num_ninst >= num_old*0.90)
-            break;
     }
-    apu_destroy_nasm (new_nasm);
-    PRTF ("APU: NASM with num %ld, time = %f sec selected.\n", min_num_ninst, min_time);
-    new_nasm = apu_create_transformer_nasm(dnn, num_ninst, batch_size, seq_num);
-    return new_nasm;
+    return idx;
 }
 
+// Estimated compute time of one full ninst of the ldata on one DSE.
+static double get_ldata_ninst_cost_sec (nasm_ldata_t *ldata)
+{
+    unsigned int M = ldata->ninst_tile_dims[OUT_H];
+    unsigned int N = ldata->ninst_tile_dims[OUT_W];
+    double num_outputs = (double)M * N;
+    switch (ldata->layer->type)
+    {
+    case CONV_LAYER:
+    case FC_LAYER:
+    case MATMUL_LAYER:
+    case K_ATTENTION_LAYER:
+    case V_ATTENTION_LAYER:
+    {
+        unsigned int K = ldata->flop_per_output / 2 > 0 ? ldata->flop_per_output / 2 : 1;
+        double flops = cost_model_gemm_flops [get_cost_model_class (cost_model_m_arr, APU_COST_MODEL_NUM_M, M)]
+            [get_cost_model_class (cost_model_n_arr, APU_COST_MODEL_NUM_N, N)]
+            [get_cost_model_class (cost_model_k_arr, APU_COST_MODEL_NUM_K, K)];
+        double sec = num_outputs * ldata->flop_per_output / flops;
+        // im2col gathers a K x N input panel per ninst.
+        if (ldata->layer->type == CONV_LAYER)
+            sec += (double)K * N * cost_model_elem_sec;
+        return sec;
+    }
+    default:
+        return num_outputs * ldata->flop_per_output * cost_model_elem_sec;
+    }
+}
 
-nasm_t *apu_create_nasm(aspen_dnn_t *dnn, unsigned int min_ninst_per_ldata, unsigned int batch_size)
+// Estimated time for num_dse DSEs to drain the ldata. Work is assumed to balance across DSEs,
+// with a tail of one ninst shortened by the parallel slack, since with enough ready ninsts
+// per DSE the next layer's ninsts fill most of the idle time at the layer boundary.
+static double get_ldata_cost_sec (nasm_ldata_t *ldata, unsigned int num_dse)
 {
-    nasm_t *new_nasm = apu_create_nasm_without_finding_ninst_parents(dnn, APU_GENERATION_NUM_FLOPS, batch_size, min_ninst_per_ldata, 0);
-    for (int i = 0; i < new_nasm->num_ldata; i++)
+    double ninst_sec = get_ldata_ninst_cost_sec (ldata) + APU_GENERATION_NINST_OVERHEAD_SEC;
+    double sec = ldata->num_ninst * ninst_sec / num_dse + ninst_sec / APU_GENERATION_PARALLEL_SLACK;
+    return sec > ninst_sec ? sec : ninst_sec;
+}
+
+// Picks a min ninst count for every ldata of the NASM from the cost model. Candidates are powers of two;
+// of those within APU_GENERATION_COST_TOLERANCE of the cheapest, the one with the fewest ninsts wins.
+static void select_ldata_min_ninst (nasm_t *nasm, unsigned int num_dse, unsigned int *ldata_min_ninst_arr)
+{
+    for (int i = 0; i < nasm->num_ldata; i++)
     {
-        #pragma omp parallel for
-        for (int j = 0; j < new_nasm->ldata_arr[i].num_ninst; j++)
+        nasm_ldata_t candidate = nasm->ldata_arr[i];
+        double cost_arr [32];
+        unsigned int num_ninst_arr [32];
+        unsigned int num_candidates = 0;
+        double min_cost = 0;
+        for (unsigned int min_ninst = 1; min_ninst <= APU_GENERATION_MAX_NINST_PER_LDATA; min_ninst *= 2)
         {
-            ninst_find_parent (&new_nasm->ldata_arr[i].ninst_arr_start[j]);
+            set_ldata_ninst_tile_dims (&candidate, min_ninst);
+            cost_arr[num_candidates] = get_ldata_cost_sec (&candidate, num_dse);
+            num_ninst_arr[num_candidates] = candidate.num_ninst;
+            if (num_candidates == 0 || cost_arr[num_candidates] < min_cost)
+                min_cost = cost_arr[num_candidates];
+            num_candidates++;
         }
-        PRTF ("\tAPU: Graphing layer %d/%d (%2.2f%%).\r", i+1, new_nasm->num_ldata, ((float)(i+1)/(float)new_nasm->num_ldata*100));
-        fflush (stdout);
-    }
-    PRTF ("\n");
-    for (int i = 0; i < new_nasm->num_ldata; i++)
-    {
-        #pragma omp parallel for
-        for (int j = 0; j < new_nasm->ldata_arr[i].num_ninst; j++)
+        unsigned int best = 0;
+        for (unsigned int c = 0; c < num_candidates; c++)
         {
-            set_child_list (&new_nasm->ldata_arr[i].ninst_arr_start[j]);
+            if (cost_arr[c] <= min_cost * (1 + APU_GENERATION_COST_TOLERANCE) 
+                && (cost_arr[best] > min_cost * (1 + APU_GENERATION_COST_TOLERANCE) || num_ninst_arr[c] < num_ninst_arr[best]))
+                best = c;
         }
+        ldata_min_ninst_arr[i] = 1 << best;
     }
-    // Calculat total flops
+}
+
+static nasm_t *create_nasm (aspen_dnn_t *dnn, unsigned int min_ninst_per_ldata, unsigned int *ldata_min_ninst_arr,
+    unsigned int batch_size, unsigned int seq_num)
+{
+    nasm_t *new_nasm = apu_create_nasm_without_finding_ninst_parents
+        (dnn, APU_GENERATION_NUM_FLOPS, batch_size, min_ninst_per_ldata, ldata_min_ninst_arr, seq_num, 
+            get_dnn_nasm_plan_flags (dnn));
+    nasm_find_ninst_parents_and_children (new_nasm);
+    nasm_build_csr (new_nasm);
+    // Calculate total flops
     new_nasm->total_flops = 0;
     for (int i = 0; i < new_nasm->num_ldata; i++)
     {
@@ -802,48 +1010,140 @@ nasm_t *apu_create_nasm(aspen_dnn_t *dnn, unsigned int min_ninst_per_ldata, unsi
     return new_nasm;
 }
 
-nasm_t *apu_create_transformer_nasm
-    (aspen_dnn_t *dnn, unsigned int min_ninst_per_ldata,
-    unsigned int batch_size, unsigned int seq_num)
+// Selects the tile granularity of each layer for num_dse DSEs from the calibrated cost model, then, if num_iter > 0,
+// refines it by measurement: all per-layer ninst counts are scaled by 1/gen_coeff (or gen_coeff)
+// for up to num_iter steps while the measured inference time keeps improving.
+// GPU NASMs start from APU_GENERATION_NUM_NINST_GPU on every layer and rely on the refinement.
+static nasm_t *generate_nasm (aspen_dnn_t *dnn, unsigned int batch_size, unsigned int seq_num, unsigned int num_iter, 
+    unsigned int num_dse, int gpu_idx)
 {
-    nasm_t *new_nasm = apu_create_nasm_without_finding_ninst_parents(dnn, APU_GENERATION_NUM_FLOPS, batch_size, min_ninst_per_ldata, seq_num);
-    PRTF ("APU: Graphing ninsts...\n");
-    for (int i = 0; i < new_nasm->num_ldata; i++)
-    {
-        #pragma omp parallel for
-        for (int j = 0; j < new_nasm->ldata_arr[i].num_ninst; j++)
-        {
-            ninst_find_parent (&new_nasm->ldata_arr[i].ninst_arr_start[j]);
-        }
-        PRTF ("\tAPU: Graphing layer %d/%d (%2.2f%%).\r", i+1, new_nasm->num_ldata, ((float)(i+1)/(float)new_nasm->num_ldata*100));
-        fflush (stdout);
+    double gen_coeff = gpu_idx >= 0 ? APU_GENERATION_COEFF_GPU : APU_GENERATION_COEFF;
+    if (num_dse < 1)
+        num_dse = 1;
+    nasm_t *new_nasm = apu_create_nasm_without_finding_ninst_parents 
+        (dnn, APU_GENERATION_NUM_FLOPS, batch_size, 1, NULL, seq_num, get_dnn_nasm_plan_flags (dnn));
+    unsigned int num_ldata = new_nasm->num_ldata;
+    unsigned int *ldata_min_ninst_arr = malloc (num_ldata * sizeof(unsigned int));
+    unsigned int *candidate_arr = malloc (num_ldata * sizeof(unsigned int));
+    if (gpu_idx < 0)
+    {
+        double start = get_time_secs();
+        calibrate_cost_model ();
+        select_ldata_min_ninst (new_nasm, num_dse, ldata_min_ninst_arr);
+        PRTF ("APU: Cost model selected per-layer granularity for %d DSEs in %f sec.\n", num_dse, get_time_secs() - start);
     }
-    PRTF ("\n");
-    for (int i = 0; i < new_nasm->num_ldata; i++)
+    else
     {
-        #pragma omp parallel for
-        for (int j = 0; j < new_nasm->ldata_arr[i].num_ninst; j++)
+        for (int i = 0; i < num_ldata; i++)
+            ldata_min_ninst_arr[i] = APU_GENERATION_NUM_NINST_GPU;
+    }
+    apu_destroy_nasm (new_nasm);
+    if (num_iter > 0)
+    {
+        new_nasm = create_nasm (dnn, 1, ldata_min_ninst_arr, batch_size, seq_num);
+        double min_time = test_nasm_time_sec (new_nasm, APU_GENERATION_REFINE_NUM_RUN, num_dse, gpu_idx);
+        apu_destroy_nasm (new_nasm);
+        PRTF ("APU: Refinement start, time = %f sec\n", min_time);
+        double scale_arr[2] = {1.0 / gen_coeff, gen_coeff};
+        unsigned int step = 0;
+        for (int d = 0; d < 2 && step < num_iter; d++)
         {
-            set_child_list (&new_nasm->ldata_arr[i].ninst_arr_start[j]);
+            int improved = 0;
+            for (; step < num_iter; step++)
+            {
+                int changed = 0;
+                for (int i = 0; i < num_ldata; i++)
+                {
+                    double val = ldata_min_ninst_arr[i] * scale_arr[d];
+                    if (val < 1)
+                        val = 1;
+                    if (val > APU_GENERATION_MAX_NINST_PER_LDATA)
+                        val = APU_GENERATION_MAX_NINST_PER_LDATA;
+                    candidate_arr[i] = val + 0.5;
+                    if (candidate_arr[i] != ldata_min_ninst_arr[i])
+                        changed = 1;
+                }
+                if (!changed)
+                    break;
+                new_nasm = create_nasm (dnn, 1, candidate_arr, batch_size, seq_num);
+                double time = test_nasm_time_sec (new_nasm, APU_GENERATION_REFINE_NUM_RUN, num_dse, gpu_idx);
+                apu_destroy_nasm (new_nasm);
+                PRTF ("APU: Refinement step %d, scale %f, time = %f sec\n", step, scale_arr[d], time);
+                if (time >= min_time * (1 - APU_GENERATION_COST_TOLERANCE))
+                    break;
+                min_time = time;
+                memcpy (ldata_min_ninst_arr, candidate_arr, num_ldata * sizeof(unsigned int));
+                improved = 1;
+            }
+            if (improved)
+                break;
         }
+        PRTF ("APU: NASM with time = %f sec selected.\n", min_time);
     }
-    PRTF ("\n");
-    // Calculate total flops
-    new_nasm->total_flops = 0;
-    for (int i = 0; i < new_nasm->num_ldata; i++)
-    {
-        nasm_ldata_t *ldata = &new_nasm->ldata_arr[i];
-        new_nasm->total_flops += 
-            ldata->flop_per_output*ldata->out_mat_dims[OUT_H]*ldata->out_mat_dims[OUT_W];
-    }
+    new_nasm = create_nasm (dnn, 1, ldata_min_ninst_arr, batch_size, seq_num);
+    free (ldata_min_ninst_arr);
+    free (candidate_arr);
     return new_nasm;
 }
 
+nasm_t *apu_generate_nasm(aspen_dnn_t *dnn, unsigned int batch_size, unsigned int num_iter, unsigned int num_dse, int gpu_idx)
+{
+    return generate_nasm (dnn, batch_size, 0, num_iter, num_dse, gpu_idx);
+}
+
+nasm_t *apu_generate_transformer_nasm(aspen_dnn_t *dnn, unsigned int batch_size, unsigned int seq_num, unsigned int num_iter, 
+    unsigned int num_dse, int gpu_idx)
+{
+    return generate_nasm (dnn, batch_size, seq_num, num_iter, num_dse, gpu_idx);
+}
+
+nasm_t *apu_create_nasm(aspen_dnn_t *dnn, unsigned int min_ninst_per_ldata, unsigned int batch_size)
+{
+    return create_nasm (dnn, min_ninst_per_ldata, NULL, batch_size, 0);
+}
+
+nasm_t *apu_create_transformer_nasm
+    (aspen_dnn_t *dnn, unsigned int min_ninst_per_ldata,
+    unsigned int batch_size, unsigned int seq_num)
+{
+    PRTF ("APU: Graphing ninsts...\n");
+    return create_nasm (dnn, min_ninst_per_ldata, NULL, batch_size, seq_num);
+}
+
+// Creates a transformer NASM for each sequence length bucket, to be picked per request with apu_select_transformer_nasm.
+// Shorter inputs are padded to their bucket, and apu_set_nasm_seq_len keeps the padding out of the attention.
+nasm_t **apu_create_transformer_nasm_buckets (aspen_dnn_t *dnn, unsigned int min_ninst_per_ldata, unsigned int batch_size, 
+    unsigned int *seq_num_arr, unsigned int num_buckets)
+{
+    nasm_t **nasm_arr = calloc (num_buckets, sizeof(nasm_t*));
+    for (unsigned int i = 0; i < num_buckets; i++)
+        nasm_arr[i] = apu_create_transformer_nasm (dnn, min_ninst_per_ldata, batch_size, seq_num_arr[i]);
+    return nasm_arr;
+}
+
+// Returns the NASM with the shortest sequence length that fits seq_num tokens, or NULL if none does.
+nasm_t *apu_select_transformer_nasm (nasm_t **nasm_arr, unsigned int num_nasm, unsigned int seq_num)
+{
+    nasm_t *selected = NULL;
+    for (unsigned int i = 0; i < num_nasm; i++)
+    {
+        nasm_t *nasm = nasm_arr[i];
+        if (nasm == NULL || nasm->tr_seq_len < seq_num)
+            continue;
+        if (selected == NULL || nasm->tr_seq_len < selected->tr_seq_len)
+            selected = nasm;
+    }
+    if (selected == NULL)
+        ERROR_PRTF ("Error in apu_select_transformer_nasm: No NASM fits %d tokens.\n", seq_num);
+    return selected;
+}
+
 void apu_reset_nasm (nasm_t *nasm)
 {
     atomic_store (&nasm->num_ldata_completed, 0);
     atomic_store (&nasm->completed, 0);
     atomic_store (&nasm->path_now_idx, 0);
+    reset_ldata_out_mat_users (nasm);
     for (int i = 0; i < nasm->num_ldata; i++)
     {
         nasm_ldata_t *ldata = &nasm->ldata_arr[i];
@@ -857,11 +1157,6 @@ void apu_reset_nasm (nasm_t *nasm)
         for (int j = 0; j < ldata->num_ninst; j++)
         {
             ninst_t *ninst = &ldata->ninst_arr_start[j];
-            ninst->compute_end = 0;
-            ninst->compute_start = 0;
-            ninst->computed_time = 0;
-            ninst->received_time = 0;
-            ninst->sent_time = 0;
             // ninst->offloaded = 0;
             atomic_store (&ninst->state, NINST_NOT_READY);
             atomic_store (&ninst->num_parent_ninsts_completed, 0);
@@ -873,6 +1168,19 @@ void apu_reset_nasm (nasm_t *nasm)
             ninst->compute_option = NINST_COMPUTE_YES;
         }
     }
+    if (nasm->ninst_prof_arr != NULL)
+        bzero (nasm->ninst_prof_arr, nasm->num_ninst * sizeof(ninst_prof_t));
+}
+
+void apu_set_nasm_profiling (nasm_t *nasm, int enable)
+{
+    if (enable && nasm->ninst_prof_arr == NULL)
+        nasm->ninst_prof_arr = calloc (nasm->num_ninst, sizeof(ninst_prof_t));
+    else if (!enable && nasm->ninst_prof_arr != NULL)
+    {
+        free (nasm->ninst_prof_arr);
+        nasm->ninst_prof_arr = NULL;
+    }
 }
 
 void apu_set_nasm_num_cores (nasm_t *nasm, unsigned int num_cores) {
@@ -1007,6 +1315,16 @@ void alloc_ldata_out_mat (nasm_ldata_t *ldata)
         pthread_mutex_unlock (&ldata->out_mat_mutex);
         return;
     }
+    if (ldata->out_mat_owner_idx != -1)
+    {
+        nasm_ldata_t *owner = &ldata->nasm->ldata_arr[ldata->out_mat_owner_idx];
+        const size_t offset = (size_t)ldata->out_mat_row_offset*ldata->nasm->dnn->element_size;
+        alloc_ldata_out_mat (owner);
+        ldata->out_mat_dummy = (char*)owner->out_mat_dummy + offset;
+        ldata->out_mat = (char*)owner->out_mat + offset;
+        pthread_mutex_unlock (&ldata->out_mat_mutex);
+        return;
+    }
     // printf ("allocating %ld KiB of memory for ldata %d\n", ldata->out_mat_mem_size/1024, ldata->layer->layer_idx);
     ldata->out_mat = aspen_dynamic_malloc (1, ldata->out_mat_mem_size);
     ldata->out_mat_dummy = aspen_dynamic_malloc (1, ldata->out_mat_mem_size);
@@ -1015,6 +1333,12 @@ void alloc_ldata_out_mat (nasm_ldata_t *ldata)
 
 void free_ldata_out_mat (nasm_ldata_t *ldata)
 {
+    if (ldata->out_mat_owner_idx != -1)
+    {
+        ldata->out_mat = NULL;
+        ldata->out_mat_dummy = NULL;
+        return;
+    }
     if (ldata->out_mat != NULL)
     {
         // printf ("freeing %ld KiB of memory for ldata %d\n", ldata->out_mat_mem_size/1024, ldata->layer->layer_idx);
@@ -1024,6 +1348,20 @@ void free_ldata_out_mat (nasm_ldata_t *ldata)
     }
 }
 
+// Called once all children of the ldata have consumed its output. A shared out_mat is freed only
+// after its owner and every ldata placed in it are released.
+void release_ldata_out_mat (nasm_ldata_t *ldata)
+{
+    nasm_ldata_t *owner = ldata;
+    if (ldata->out_mat_owner_idx != -1)
+    {
+        owner = &ldata->nasm->ldata_arr[ldata->out_mat_owner_idx];
+        free_ldata_out_mat (ldata);
+    }
+    if (atomic_fetch_sub (&owner->num_out_mat_users, 1) == 1)
+        free_ldata_out_mat (owner);
+}
+
 void *get_ninst_out_mem (ninst_t *ninst)
 {
     if (ninst->ldata->out_mat == NULL)
@@ -1057,6 +1395,174 @@ void *get_ninst_out_mem_without_alloc (ninst_t *ninst)
             *ninst->ldata->nasm->dnn->element_size;
 }
 
+// Returns 1 if the attention layer is part of a fused attention: the V-attention layer computes the scores of its
+// K-attention parent block by block, and the K-attention layer computes nothing.
+static int is_layer_fused_attention (aspen_layer_t *layer, unsigned int plan_flags)
+{
+    if (!(plan_flags & NASM_PLAN_FUSE_ATTENTION))
+        return 0;
+    if (layer->type == V_ATTENTION_LAYER)
+        return layer->parent_layers[PARENT_0] != NULL && is_layer_fused_attention (layer->parent_layers[PARENT_0], plan_flags);
+    if (layer->type != K_ATTENTION_LAYER)
+        return 0;
+    int num_children = 0;
+    for (int i = 0; i < layer->dnn->num_layers; i++)
+    {
+        aspen_layer_t *child = &layer->dnn->layers[i];
+        for (LAYER_PARENTS j = 0; j < NUM_PARENT_ELEMENTS; j++)
+        {
+            if (child->parent_layers[j] != layer)
+                continue;
+            if (child->type != V_ATTENTION_LAYER || j != PARENT_0)
+                return 0;
+            num_children++;
+        }
+    }
+    return num_children > 0;
+}
+
+// Returns the layernorm layer computed together with the residual layer when plan_flags has 
+// NASM_PLAN_FUSE_RESIDUAL_LAYERNORM, or NULL. The residual must have no activation and be the input of the layernorm.
+static aspen_layer_t *get_fused_layernorm_layer (aspen_layer_t *layer, unsigned int plan_flags)
+{
+    if (!(plan_flags & NASM_PLAN_FUSE_RESIDUAL_LAYERNORM) || layer->type != RESIDUAL_LAYER 
+        || (layer->activation != NO_ACTIVATION && layer->activation != LINEAR))
+        return NULL;
+    for (int i = 0; i < layer->dnn->num_layers; i++)
+    {
+        aspen_layer_t *child = &layer->dnn->layers[i];
+        if (child->type == LAYERNORM_LAYER && child->parent_layers[PARENT_0] == layer
+            && child->tensors[WEIGHT_TENSOR] != NULL)
+            return child;
+    }
+    return NULL;
+}
+
+// Returns the layernorm ldata that the residual ldata writes along with its own output, or NULL.
+// Fused residual ninsts cover whole columns, and the layernorm ninsts do nothing.
+static nasm_ldata_t *get_fused_layernorm_ldata (nasm_ldata_t *ldata)
+{
+    aspen_layer_t *ln_layer = get_fused_layernorm_layer (ldata->layer, ldata->nasm->plan_flags);
+    if (ln_layer == NULL || ldata->ninst_tile_dims[OUT_H] != ldata->out_mat_dims[OUT_H])
+        return NULL;
+    for (int i = 0; i < ldata->num_child_ldata; i++)
+    {
+        nasm_ldata_t *child = &ldata->nasm->ldata_arr[ldata->child_ldata_idx_arr[i]];
+        if (child->layer == ln_layer && child->out_mat_dims[OUT_H] == ldata->out_mat_dims[OUT_H])
+            return child;
+    }
+    return NULL;
+}
+
+// Returns the first of the matmul layers that are computed together with the matmul layer when plan_flags has 
+// NASM_PLAN_FUSE_QKV, or NULL. Grouped layers read the same parent with the same shape, like the Query, Key and 
+// Value projections.
+static aspen_layer_t *get_fused_qkv_leader_layer (aspen_layer_t *layer, unsigned int plan_flags)
+{
+    if (!(plan_flags & NASM_PLAN_FUSE_QKV) || layer->type != MATMUL_LAYER || layer->parent_layers[PARENT_0] == NULL
+        || layer->parent_layers[PARENT_1] != NULL)
+        return NULL;
+    aspen_layer_t *leader = NULL;
+    int num_grouped = 0;
+    for (int i = 0; i < layer->dnn->num_layers; i++)
+    {
+        aspen_layer_t *sibling = &layer->dnn->layers[i];
+        if (sibling->type != MATMUL_LAYER || sibling->parent_layers[PARENT_0] != layer->parent_layers[PARENT_0]
+            || sibling->parent_layers[PARENT_1] != NULL || sibling->params[MAT_M] != layer->params[MAT_M] 
+            || sibling->params[MAT_K] != layer->params[MAT_K] || sibling->params[NUM_HEAD] != layer->params[NUM_HEAD])
+            continue;
+        if (leader == NULL)
+            leader = sibling;
+        num_grouped++;
+    }
+    return num_grouped > 1 ? leader : NULL;
+}
+
+// Returns the ldata whose ninsts compute the matmul ldata (itself for the first of a fused QKV group), or NULL.
+// The other ldata of the group share its tiling, and their ninsts do nothing.
+static nasm_ldata_t *get_fused_qkv_leader_ldata (nasm_ldata_t *ldata)
+{
+    aspen_layer_t *leader_layer = get_fused_qkv_leader_layer (ldata->layer, ldata->nasm->plan_flags);
+    if (leader_layer == NULL)
+        return NULL;
+    nasm_ldata_t *p_ldata = &ldata->nasm->ldata_arr[ldata->parent_ldata_idx_arr[PARENT_0]];
+    for (int i = 0; i < p_ldata->num_child_ldata; i++)
+    {
+        nasm_ldata_t *leader = &ldata->nasm->ldata_arr[p_ldata->child_ldata_idx_arr[i]];
+        if (leader->layer != leader_layer)
+            continue;
+        if (leader->out_mat_dims[OUT_H] != ldata->out_mat_dims[OUT_H] || leader->out_mat_dims[OUT_W] != ldata->out_mat_dims[OUT_W]
+            || leader->ninst_tile_dims[OUT_H] != ldata->ninst_tile_dims[OUT_H] 
+            || leader->ninst_tile_dims[OUT_W] != ldata->ninst_tile_dims[OUT_W])
+            return NULL;
+        return leader;
+    }
+    return NULL;
+}
+
+// Returns the maxpool layer computed together with the conv layer when plan_flags has NASM_PLAN_FUSE_CONV_MAXPOOL, 
+// or NULL. The maxpool must be 2x2 with stride 2 and no padding, and be the only reader of the conv, 
+// whose output dims are even.
+static aspen_layer_t *get_fused_maxpool_layer (aspen_layer_t *layer, unsigned int plan_flags)
+{
+    if (!(plan_flags & NASM_PLAN_FUSE_CONV_MAXPOOL) || layer->type != CONV_LAYER 
+        || layer->params[OUT_H] % 2 != 0 || layer->params[OUT_W] % 2 != 0)
+        return NULL;
+    aspen_layer_t *pool = NULL;
+    for (int i = 0; i < layer->dnn->num_layers; i++)
+    {
+        aspen_layer_t *child = &layer->dnn->layers[i];
+        for (LAYER_PARENTS pidx = 0; pidx < NUM_PARENT_ELEMENTS; pidx++)
+        {
+            if (child->parent_layers[pidx] != layer)
+                continue;
+            if (pool != NULL || pidx != PARENT_0)
+                return NULL;
+            pool = child;
+        }
+    }
+    if (pool == NULL || pool->type != MAXPOOL_LAYER || pool->params[WEIGHT_H] != 2 || pool->params[WEIGHT_W] != 2
+        || pool->params[STRIDE] != 2 || pool->params[PADDING] != 0 || pool->params[DILATION] > 1)
+        return NULL;
+    return pool;
+}
+
+// Returns the maxpool ldata computed by the ninsts of the conv ldata, or NULL.
+static nasm_ldata_t *get_fused_maxpool_ldata (nasm_ldata_t *ldata)
+{
+    if (ldata->layer->type != CONV_LAYER || ldata->num_child_ldata != 1)
+        return NULL;
+    aspen_layer_t *pool_layer = get_fused_maxpool_layer (ldata->layer, ldata->nasm->plan_flags);
+    nasm_ldata_t *child = &ldata->nasm->ldata_arr[ldata->child_ldata_idx_arr[0]];
+    return pool_layer != NULL && child->layer == pool_layer ? child : NULL;
+}
+
+// Returns the residual ldata computed by the ninsts of the conv ldata when the NASM fuses conv and residual, or NULL.
+// The residual out_mat is the conv out_mat, and the residual ninsts do nothing.
+nasm_ldata_t *get_fused_conv_residual_ldata (nasm_ldata_t *ldata)
+{
+    if (ldata->layer->type != CONV_LAYER || ldata->num_child_ldata != 1)
+        return NULL;
+    nasm_ldata_t *child = &ldata->nasm->ldata_arr[ldata->child_ldata_idx_arr[0]];
+    if (child->layer->type != RESIDUAL_LAYER || child->out_mat_owner_idx != ldata - ldata->nasm->ldata_arr)
+        return NULL;
+    return child;
+}
+
+// Resolves the fusions of every ldata from the NASM plan flags, so that the kernels read them from the ldata
+// instead of searching the layers on every ninst.
+static void plan_ldata_fusion (nasm_t *nasm)
+{
+    for (int i = 0; i < nasm->num_ldata; i++)
+    {
+        nasm_ldata_t *ldata = &nasm->ldata_arr[i];
+        ldata->fused_attention = is_layer_fused_attention (ldata->layer, nasm->plan_flags);
+        ldata->fused_layernorm_ldata = get_fused_layernorm_ldata (ldata);
+        ldata->fused_qkv_leader_ldata = get_fused_qkv_leader_ldata (ldata);
+        ldata->fused_maxpool_ldata = get_fused_maxpool_ldata (ldata);
+    }
+}
+
 void destroy_nasm_ldata (nasm_ldata_t *ldata)
 {
     if (ldata == NULL)
@@ -1094,6 +1600,18 @@ void apu_destroy_nasm (nasm_t *nasm)
     destroy_nasm_ldata_arr(nasm->ldata_arr, nasm->num_ldata);
     if (nasm->ninst_arr != NULL)
         free(nasm->ninst_arr);
+    if (nasm->ninst_prof_arr != NULL)
+        free(nasm->ninst_prof_arr);
+    if (nasm->ldata_min_ninst_arr != NULL)
+        free(nasm->ldata_min_ninst_arr);
+    if (nasm->seq_len_arr != NULL)
+        free(nasm->seq_len_arr);
+    if (nasm->bin_map != NULL)
+        munmap (nasm->bin_map, nasm->bin_map_size);
+    else if (nasm->parent_ninst_idx_csr != NULL)
+        free (nasm->parent_ninst_idx_csr);
+    if (nasm->child_ninst_csr != NULL)
+        free (nasm->child_ninst_csr);
     if (nasm->gpu_null_data != NULL)
     {
         if (nasm->gpu_idx >= 0)
@@ -1103,13 +1621,142 @@ void apu_destroy_nasm (nasm_t *nasm)
     free(nasm);
 }
 
+// KV cache for autoregressive decoding with fused attention. A prefill nasm over the prompt and a decode nasm over 
+// one token share a cache: each run reads the cached keys and values of the previous tokens, appends its own, 
+// and advances the cache on completion, so a decode step costs O(tokens so far) instead of a rerun of the sequence.
+aspen_kv_cache_t *apu_create_kv_cache (aspen_dnn_t *dnn, unsigned int batch_size, unsigned int max_seq_len)
+{
+    if (!dnn->fuse_attention)
+    {
+        ERROR_PRTF ("Error in apu_create_kv_cache: KV cache needs fused attention (apu_set_dnn_fused_attention).\n");
+        return NULL;
+    }
+    aspen_kv_cache_t *kv_cache = calloc (1, sizeof(aspen_kv_cache_t));
+    kv_cache->dnn = dnn;
+    kv_cache->batch_size = batch_size;
+    kv_cache->max_seq_len = max_seq_len;
+    kv_cache->key = calloc (dnn->num_layers, sizeof(float*));
+    kv_cache->value = calloc (dnn->num_layers, sizeof(float*));
+    for (int i = 0; i < dnn->num_layers; i++)
+    {
+        aspen_layer_t *layer = &dnn->layers[i];
+        if (layer->type != V_ATTENTION_LAYER || !is_layer_fused_attention (layer, get_dnn_nasm_plan_flags (dnn)))
+            continue;
+        size_t size = (size_t) batch_size * max_seq_len * layer->params[NUM_HIDDEN] * sizeof(float);
+        kv_cache->key[i] = aspen_calloc (size, 1);
+        kv_cache->value[i] = aspen_calloc (size, 1);
+    }
+    return kv_cache;
+}
+
+void apu_destroy_kv_cache (aspen_kv_cache_t *kv_cache)
+{
+    if (kv_cache == NULL)
+        return;
+    for (int i = 0; i < kv_cache->dnn->num_layers; i++)
+    {
+        if (kv_cache->key[i] != NULL)
+            aspen_free (kv_cache->key[i]);
+        if (kv_cache->value[i] != NULL)
+            aspen_free (kv_cache->value[i]);
+    }
+    free (kv_cache->key);
+    free (kv_cache->value);
+    free (kv_cache);
+}
+
+// Starts a new sequence.
+void apu_reset_kv_cache (aspen_kv_cache_t *kv_cache)
+{
+    kv_cache->num_tokens = 0;
+    atomic_store (&kv_cache->overflow, 0);
+}
+
+unsigned int apu_get_kv_cache_len (aspen_kv_cache_t *kv_cache)
+{
+    return kv_cache->num_tokens;
+}
+
+// Returns 1 if a run since the last apu_reset_kv_cache had more tokens than the cache could hold. 
+// The outputs of that run are invalid, and the cache keeps only the tokens before it.
+int apu_is_kv_cache_overflowed (aspen_kv_cache_t *kv_cache)
+{
+    return atomic_load (&kv_cache->overflow);
+}
+
+// Makes each run of the transformer nasm continue the sequence in kv_cache (NULL to detach). 
+// The nasm input holds only the new tokens, with their position embeddings already added.
+void apu_set_nasm_kv_cache (nasm_t *nasm, aspen_kv_cache_t *kv_cache)
+{
+    if (kv_cache != NULL && (kv_cache->dnn != nasm->dnn || kv_cache->batch_size != nasm->batch_size 
+        || nasm->tr_seq_len == 0 || nasm->gpu_idx >= 0 || nasm->seq_len_arr != NULL
+            || !(nasm->plan_flags & NASM_PLAN_FUSE_ATTENTION)))
+    {
+        ERROR_PRTF ("Error in apu_set_nasm_kv_cache: KV cache does not match the nasm.\n");
+        return;
+    }
+    nasm->kv_cache = kv_cache;
+}
+
+// Sets the number of valid tokens of each of the batch_size inputs of a transformer nasm (NULL for all tr_seq_len).
+// Keys after them are masked out and their query columns are skipped, so the padded outputs are 0 after attention 
+// and the valid outputs match an unpadded run. Takes effect on the next run, without regenerating the graph.
+void apu_set_nasm_seq_len (nasm_t *nasm, unsigned int *seq_len_arr)
+{
+    if (seq_len_arr == NULL)
+    {
+        if (nasm->seq_len_arr != NULL)
+            free (nasm->seq_len_arr);
+        nasm->seq_len_arr = NULL;
+        return;
+    }
+    if (nasm->tr_seq_len == 0 || nasm->gpu_idx >= 0 || nasm->kv_cache != NULL)
+    {
+        ERROR_PRTF ("Error in apu_set_nasm_seq_len: Valid lengths need a local transformer nasm without a KV cache.\n");
+        return;
+    }
+    for (unsigned int i = 0; i < nasm->batch_size; i++)
+    {
+        if (seq_len_arr[i] == 0 || seq_len_arr[i] > nasm->tr_seq_len)
+        {
+            ERROR_PRTF ("Error in apu_set_nasm_seq_len: Length %d of batch %d is not in [1, %d].\n", 
+                seq_len_arr[i], i, nasm->tr_seq_len);
+            return;
+        }
+    }
+    if (nasm->seq_len_arr == NULL)
+        nasm->seq_len_arr = calloc (nasm->batch_size, sizeof(unsigned int));
+    memcpy (nasm->seq_len_arr, seq_len_arr, nasm->batch_size * sizeof(unsigned int));
+}
+
+unsigned int get_nasm_seq_len (nasm_t *nasm, unsigned int batch)
+{
+    return nasm->seq_len_arr != NULL ? nasm->seq_len_arr[batch] : nasm->tr_seq_len;
+}
+
+// Called when a nasm run completes: its tokens are now part of the cached sequence.
+void advance_nasm_kv_cache (nasm_t *nasm)
+{
+    aspen_kv_cache_t *kv_cache = nasm->kv_cache;
+    if (kv_cache == NULL)
+        return;
+    if (kv_cache->num_tokens + nasm->tr_seq_len > kv_cache->max_seq_len)
+    {
+        ERROR_PRTF ("Error in advance_nasm_kv_cache: KV cache of %d tokens holds %d, and cannot take %d more. "
+            "The outputs of this run are invalid.\n", kv_cache->max_seq_len, kv_cache->num_tokens, nasm->tr_seq_len);
+        atomic_store (&kv_cache->overflow, 1);
+        return;
+    }
+    kv_cache->num_tokens += nasm->tr_seq_len;
+}
+
 // Change to add a new layer type
 void get_out_mat_info (nasm_ldata_t *ldata)
 {
     aspen_layer_t *layer = ldata->layer;
     if (layer->type == CONV_LAYER)
     {
-        ldata->flop_per_output = 2*layer->params[WEIGHT_H]*layer->params[WEIGHT_W]*layer->params[IN_C];
+        ldata->flop_per_output = 2*layer->params[WEIGHT_H]*layer->params[WEIGHT_W]*get_layer_in_c_per_group (layer);
         ldata->out_mat_dims[OUT_H] = layer->params[OUT_C];
         ldata->out_mat_dims[OUT_W] = layer->params[OUT_H]*layer->params[OUT_W]*ldata->nasm->batch_size;
     }
@@ -1221,6 +1868,10 @@ void init_nasm_ldata (nasm_t *nasm, nasm_ldata_t *ldata_ptr, aspen_layer_t *laye
     ldata_ptr->nasm = nasm;
     ldata_ptr->layer = layer;
     ldata_ptr->out_mat_mutex = (pthread_mutex_t)PTHREAD_MUTEX_INITIALIZER;
+    ldata_ptr->out_mat_owner_idx = -1;
+    atomic_store (&ldata_ptr->num_out_mat_users, 1);
+    ldata_ptr->sgemm_blocking = default_sgemm_blocking;
+    ldata_ptr->conv_1x1_direct = is_layer_conv_1x1 (layer);
     for (LAYER_PARENTS i = 0; i < NUM_PARENT_ELEMENTS; i++)
     {
         ldata_ptr->parent_ldata_idx_arr[i] = -1;
@@ -1240,6 +1891,19 @@ void init_nasm_ldata (nasm_t *nasm, nasm_ldata_t *ldata_ptr, aspen_layer_t *laye
     }
     ldata_ptr->flop_per_output = 1;
     get_out_mat_info (ldata_ptr);
+    unsigned int min_ninst = nasm->min_ninst_per_ldata;
+    if (nasm->ldata_min_ninst_arr != NULL)
+        min_ninst = nasm->ldata_min_ninst_arr[ldata_ptr - nasm->ldata_arr];
+    set_ldata_ninst_tile_dims (ldata_ptr, min_ninst);
+}
+
+// Sets the ninst tile dims and ninst count of an ldata whose out_mat info is set,
+// splitting tiles until the ldata has at least min_ninst ninsts (or hits the minimum tile size).
+// Touches nothing outside the ldata, so the generator can evaluate candidates on a copy.
+void set_ldata_ninst_tile_dims (nasm_ldata_t *ldata_ptr, unsigned int min_ninst)
+{
+    nasm_t *nasm = ldata_ptr->nasm;
+    aspen_layer_t *layer = ldata_ptr->layer;
     get_ninst_tile_dims (ldata_ptr);
     unsigned int out_w = 0;
     unsigned int out_h = 0;
@@ -1263,6 +1927,20 @@ void init_nasm_ldata (nasm_t *nasm, nasm_ldata_t *ldata_ptr, aspen_layer_t *laye
         if (ldata_ptr->out_mat_dims[OUT_W] < unit_w)
             unit_w = ldata_ptr->out_mat_dims[OUT_W];
     }
+    if ((nasm->plan_flags & NASM_PLAN_WINOGRAD_TILING) && layer->tensors[WINOGRAD_WEIGHT_TENSOR] != NULL 
+        && (layer->params[OUT_W] + _WINOGRAD_TILE - 1) / _WINOGRAD_TILE >= _WINOGRAD_MIN_NUM_TILES
+        && _WINOGRAD_TILE * layer->params[OUT_W] <= ldata_ptr->out_mat_dims[OUT_W])
+    {
+        // Winograd convs work on bands of _WINOGRAD_TILE output rows, so ninsts cover whole bands.
+        unit_w = _WINOGRAD_TILE * layer->params[OUT_W];
+        ldata_ptr->ninst_tile_dims[OUT_W] = get_smallest_dividable (ldata_ptr->ninst_tile_dims[OUT_W], unit_w);
+    }
+    if (get_fused_maxpool_layer (layer, nasm->plan_flags) != NULL && unit_w % (2 * layer->params[OUT_W]) != 0)
+    {
+        // Conv ninsts with a fused maxpool cover whole pairs of output rows.
+        unit_w = 2 * layer->params[OUT_W];
+        ldata_ptr->ninst_tile_dims[OUT_W] = get_smallest_dividable (ldata_ptr->ninst_tile_dims[OUT_W], unit_w);
+    }
     if (layer->params[NUM_HEAD] > 0)
     {
         hidden_per_head = layer->params[NUM_HIDDEN] / layer->params[NUM_HEAD];
@@ -1273,7 +1951,7 @@ void init_nasm_ldata (nasm_t *nasm, nasm_ldata_t *ldata_ptr, aspen_layer_t *laye
     out_h = get_smallest_dividable (ldata_ptr->out_mat_dims[OUT_H], ldata_ptr->ninst_tile_dims[OUT_H]);
     if (layer->type != SOFTMAX_LAYER)
     {
-        while ((out_w/ldata_ptr->ninst_tile_dims[OUT_W])*(out_h/ldata_ptr->ninst_tile_dims[OUT_H]) < nasm->min_ninst_per_ldata)
+        while ((out_w/ldata_ptr->ninst_tile_dims[OUT_W])*(out_h/ldata_ptr->ninst_tile_dims[OUT_H]) < min_ninst)
         {
             if (ldata_ptr->ninst_tile_dims[OUT_W] > unit_w)
             {
@@ -1303,15 +1981,31 @@ void init_nasm_ldata (nasm_t *nasm, nasm_ldata_t *ldata_ptr, aspen_layer_t *laye
             }
         }
     }
-    if (layer->params[NUM_HEAD] > 0 || layer->type == LAYERNORM_LAYER)
+    if (layer->type == CONV_LAYER && layer->params[GROUPS] > 1)
+    {
+        // Grouped conv tiles cover whole groups, or lie within one group.
+        const unsigned int out_c_per_group = layer->params[OUT_C] / layer->params[GROUPS];
+        while (ldata_ptr->ninst_tile_dims[OUT_H] % out_c_per_group != 0 
+            && out_c_per_group % ldata_ptr->ninst_tile_dims[OUT_H] != 0)
+        {
+            ldata_ptr->ninst_tile_dims[OUT_H] += unit_h;
+        }
+        out_h = get_smallest_dividable (ldata_ptr->out_mat_dims[OUT_H], ldata_ptr->ninst_tile_dims[OUT_H]);
+    }
+    const int fused_layernorm = get_fused_layernorm_layer (layer, nasm->plan_flags) != NULL;
+    if (layer->params[NUM_HEAD] > 0 || layer->type == LAYERNORM_LAYER || fused_layernorm)
     {
         unsigned int old_h = ldata_ptr->ninst_tile_dims[OUT_H];
         if (ldata_ptr->ninst_tile_dims[OUT_H] > hidden_per_head)
             ldata_ptr->ninst_tile_dims[OUT_H] = hidden_per_head;
         if (layer->type == LAYERNORM_LAYER)
             ldata_ptr->ninst_tile_dims[OUT_H] = layer->params[MAT_M];
+        else if (fused_layernorm)
+            ldata_ptr->ninst_tile_dims[OUT_H] = ldata_ptr->out_mat_dims[OUT_H];
         else if (layer->type == K_ATTENTION_LAYER)
             ldata_ptr->ninst_tile_dims[OUT_H] = get_smallest_dividable (nasm->tr_seq_len, _VEC_SIZE_M);
+        else if (layer->type == V_ATTENTION_LAYER && is_layer_fused_attention (layer, nasm->plan_flags))
+            ldata_ptr->ninst_tile_dims[OUT_H] = hidden_per_head;
         else if (layer->type == V_ATTENTION_LAYER)
         {
             if (hidden_per_head < ldata_ptr->ninst_tile_dims[OUT_H])
@@ -1326,7 +2020,7 @@ void init_nasm_ldata (nasm_t *nasm, nasm_ldata_t *ldata_ptr, aspen_layer_t *laye
             ldata_ptr->ninst_tile_dims[OUT_W] = nasm->tr_seq_len;
         if (ldata_ptr->ninst_tile_dims[OUT_W] <= 0)
             ldata_ptr->ninst_tile_dims[OUT_W] = 1;
-        while (nasm->tr_seq_len % ldata_ptr->ninst_tile_dims[OUT_W] != 0 && layer->type != LAYERNORM_LAYER)
+        while (nasm->tr_seq_len % ldata_ptr->ninst_tile_dims[OUT_W] != 0 && layer->type != LAYERNORM_LAYER && !fused_layernorm)
         {
             ldata_ptr->ninst_tile_dims[OUT_W]++;
         }
@@ -1336,6 +2030,9 @@ void init_nasm_ldata (nasm_t *nasm, nasm_ldata_t *ldata_ptr, aspen_layer_t *laye
     ldata_ptr->out_mat_stride = out_h;
     ldata_ptr->out_mat_mem_size = get_smallest_dividable 
         (ldata_ptr->out_mat_stride*out_w*ldata_ptr->layer->dnn->element_size, MEM_ALIGN);
+    // The scores of a fused attention are never stored.
+    if (layer->type == K_ATTENTION_LAYER && is_layer_fused_attention (layer, nasm->plan_flags))
+        ldata_ptr->out_mat_mem_size = MEM_ALIGN;
     ldata_ptr->num_ninst = (out_h/ldata_ptr->ninst_tile_dims[OUT_H])*(out_w/ldata_ptr->ninst_tile_dims[OUT_W]);
 }
 
@@ -1732,15 +2429,19 @@ void print_ninst_info (ninst_t *ninst, int print_data)
     printf("\t\tDevices scheduled for computation:");
     for (int i = 0; i < SCHEDULE_MAX_DEVICES; i++)
     {
-        printf(" %d", ninst->dev_to_compute[i]);
+        printf(" %d", is_dev_compute (ninst, i));
     }
     printf("\n\t\tDevices scheduled as send target:");
     for (int i = 0; i < SCHEDULE_MAX_DEVICES; i++)
     {
-        printf(" %d", ninst->dev_send_target[i]);
+        printf(" %d", is_dev_send_target (ninst, i));
     }
-    printf("\n\t\tCompute Start/End time: %3.3f/%3.3f\n", 
-        ninst->compute_start, ninst->compute_end);
+    ninst_prof_t *prof = get_ninst_prof (ninst);
+    if (prof != NULL)
+        printf("\n\t\tCompute Start/End time: %3.3f/%3.3f\n", 
+            prof->compute_start, prof->compute_end);
+    else
+        printf("\n");
 
     if (print_data)
     {
@@ -1731,4 +1731,825 @@ void avx2_sgemm_tile_N(const unsigned int M, const unsigned int N, const unsigne
     }
 }   
 
+// y = B^T * x on 6 vectors strided by stride.
+static inline void avx2_winograd_bt (__m256 *y, const __m256 *x, const unsigned int stride)
+{
+    const __m256 two = _mm256_set1_ps (2.0f), four = _mm256_set1_ps (4.0f), five = _mm256_set1_ps (5.0f);
+    const __m256 x0 = x[0], x1 = x[stride], x2 = x[2 * stride], x3 = x[3 * stride], x4 = x[4 * stride], x5 = x[5 * stride];
+    y[0] = _mm256_fmadd_ps (four, x0, _mm256_fnmadd_ps (five, x2, x4));
+    y[stride] = _mm256_fnmadd_ps (four, _mm256_add_ps (x1, x2), _mm256_add_ps (x3, x4));
+    y[2 * stride] = _mm256_fmadd_ps (four, _mm256_sub_ps (x1, x2), _mm256_sub_ps (x4, x3));
+    y[3 * stride] = _mm256_fmadd_ps (two, _mm256_sub_ps (x3, x1), _mm256_sub_ps (x4, x2));
+    y[4 * stride] = _mm256_fmadd_ps (two, _mm256_sub_ps (x1, x3), _mm256_sub_ps (x4, x2));
+    y[5 * stride] = _mm256_fmadd_ps (four, x1, _mm256_fnmadd_ps (five, x3, x5));
+}
+
+// y = A^T * x on 6 vectors strided by stride, producing 4 vectors.
+static inline void avx2_winograd_at (__m256 *y, const __m256 *x, const unsigned int x_stride, const unsigned int y_stride)
+{
+    const __m256 two = _mm256_set1_ps (2.0f), four = _mm256_set1_ps (4.0f), eight = _mm256_set1_ps (8.0f);
+    const __m256 a = _mm256_add_ps (x[x_stride], x[2 * x_stride]);
+    const __m256 b = _mm256_sub_ps (x[x_stride], x[2 * x_stride]);
+    const __m256 c = _mm256_add_ps (x[3 * x_stride], x[4 * x_stride]);
+    const __m256 d = _mm256_sub_ps (x[3 * x_stride], x[4 * x_stride]);
+    y[0] = _mm256_add_ps (x[0], _mm256_add_ps (a, c));
+    y[y_stride] = _mm256_fmadd_ps (two, d, b);
+    y[2 * y_stride] = _mm256_fmadd_ps (four, c, a);
+    y[3 * y_stride] = _mm256_add_ps (_mm256_fmadd_ps (eight, d, b), x[5 * x_stride]);
+}
+
+// Output must have room for channels rounded up to 8 per transformed element.
+void avx2_winograd_input_transform (const float **input_ptr_arr, float *output, unsigned int output_stride, 
+    unsigned int channels)
+{
+    for (unsigned int c = 0; c < channels; c += 8)
+    {
+        const __m256i mask = _mm256_cmpgt_epi32 (_mm256_set1_epi32 (channels - c), 
+            _mm256_setr_epi32 (0, 1, 2, 3, 4, 5, 6, 7));
+        __m256 d[36], t[36];
+        for (unsigned int i = 0; i < 36; i++)
+        {
+            if (input_ptr_arr[i] == NULL)
+                d[i] = _mm256_setzero_ps ();
+            else if (channels - c >= 8)
+                d[i] = _mm256_loadu_ps (input_ptr_arr[i] + c);
+            else
+                d[i] = _mm256_maskload_ps (input_ptr_arr[i] + c, mask);
+        }
+        for (unsigned int j = 0; j < 6; j++)
+            avx2_winograd_bt (t + j, d + j, 6);
+        for (unsigned int i = 0; i < 6; i++)
+            avx2_winograd_bt (d + i * 6, t + i * 6, 1);
+        for (unsigned int i = 0; i < 36; i++)
+            _mm256_storeu_ps (output + i * output_stride + c, d[i]);
+    }
+}
+
+// Input must have room for channels rounded up to 8 per transformed element.
+void avx2_winograd_output_transform (const float *input, unsigned int input_stride, float **output_ptr_arr, 
+    unsigned int channels, const float *bias)
+{
+    for (unsigned int c = 0; c < channels; c += 8)
+    {
+        const __m256i mask = _mm256_cmpgt_epi32 (_mm256_set1_epi32 (channels - c), 
+            _mm256_setr_epi32 (0, 1, 2, 3, 4, 5, 6, 7));
+        __m256 m[36], t[24], y[16];
+        for (unsigned int i = 0; i < 36; i++)
+            m[i] = _mm256_loadu_ps (input + i * input_stride + c);
+        for (unsigned int j = 0; j < 6; j++)
+            avx2_winograd_at (t + j, m + j, 6, 6);
+        for (unsigned int i = 0; i < 4; i++)
+            avx2_winograd_at (y + i * 4, t + i * 6, 1, 1);
+        const __m256 b = bias == NULL ? _mm256_setzero_ps () : _mm256_maskload_ps (bias + c, mask);
+        for (unsigned int i = 0; i < 16; i++)
+        {
+            if (output_ptr_arr[i] == NULL)
+                continue;
+            if (channels - c >= 8)
+                _mm256_storeu_ps (output_ptr_arr[i] + c, _mm256_add_ps (y[i], b));
+            else
+                _mm256_maskstore_ps (output_ptr_arr[i] + c, mask, _mm256_add_ps (y[i], b));
+        }
+    }
+}
+
+// Depthwise conv of a ninst tile, 8 output channels per vector. See naive_grouped_conv for the layout.
+void avx2_depthwise_conv (const unsigned int M, const unsigned int N, const unsigned int m0, const unsigned int num_taps,
+    const float *kernel, const float **input_ptr_arr, float *C, const unsigned int ldc, const float *bias)
+{
+    for (unsigned int m = 0; m < M; m += 8)
+    {
+        const __m256i mask = _mm256_cmpgt_epi32 (_mm256_set1_epi32 (M - m), 
+            _mm256_setr_epi32 (0, 1, 2, 3, 4, 5, 6, 7));
+        const float *k_ptr = kernel + (size_t) m * num_taps;
+        const __m256 b = bias == NULL ? _mm256_setzero_ps () : _mm256_maskload_ps (bias + m, mask);
+        for (unsigned int n = 0; n < N; n++)
+        {
+            const float **ptr_arr = input_ptr_arr + (size_t) n * num_taps;
+            __m256 acc = b;
+            for (unsigned int t = 0; t < num_taps; t++)
+            {
+                if (ptr_arr[t] == NULL)
+                    continue;
+                const __m256 x = M - m >= 8 ? _mm256_loadu_ps (ptr_arr[t] + m0 + m) 
+                    : _mm256_maskload_ps (ptr_arr[t] + m0 + m, mask);
+                acc = _mm256_fmadd_ps (x, _mm256_loadu_ps (k_ptr + t * 8), acc);
+            }
+            if (M - m >= 8)
+                _mm256_storeu_ps (C + (size_t) n * ldc + m, acc);
+            else
+                _mm256_maskstore_ps (C + (size_t) n * ldc + m, mask, acc);
+        }
+    }
+}
+
+// Max pooling of a ninst tile, see naive_maxpool_tile. Each input pixel is read as whole channel vectors, 32 channels 
+// per pass over the taps.
+void avx2_maxpool_tile (const unsigned int M, const unsigned int N, const unsigned int m0, const unsigned int num_taps,
+    const float **input_ptr_arr, float *C, const unsigned int ldc)
+{
+    const __m256 neg_inf = _mm256_set1_ps (-INFINITY);
+    for (unsigned int n = 0; n < N; n++)
+    {
+        const float **ptr_arr = input_ptr_arr + (size_t) n * num_taps;
+        float *out = C + (size_t) n * ldc;
+        unsigned int m = 0;
+        for (; m + 32 <= M; m += 32)
+        {
+            __m256 acc_0 = neg_inf, acc_1 = neg_inf, acc_2 = neg_inf, acc_3 = neg_inf;
+            for (unsigned int t = 0; t < num_taps; t++)
+            {
+                if (ptr_arr[t] == NULL)
+                    continue;
+                const float *in = ptr_arr[t] + m0 + m;
+                acc_0 = _mm256_max_ps (_mm256_loadu_ps (in), acc_0);
+                acc_1 = _mm256_max_ps (_mm256_loadu_ps (in + 8), acc_1);
+                acc_2 = _mm256_max_ps (_mm256_loadu_ps (in + 16), acc_2);
+                acc_3 = _mm256_max_ps (_mm256_loadu_ps (in + 24), acc_3);
+            }
+            _mm256_storeu_ps (out + m, acc_0);
+            _mm256_storeu_ps (out + m + 8, acc_1);
+            _mm256_storeu_ps (out + m + 16, acc_2);
+            _mm256_storeu_ps (out + m + 24, acc_3);
+        }
+        for (; m < M; m += 8)
+        {
+            const __m256i mask = _mm256_cmpgt_epi32 (_mm256_set1_epi32 (M - m), 
+                _mm256_setr_epi32 (0, 1, 2, 3, 4, 5, 6, 7));
+            __m256 acc = neg_inf;
+            for (unsigned int t = 0; t < num_taps; t++)
+            {
+                if (ptr_arr[t] == NULL)
+                    continue;
+                acc = _mm256_max_ps (_mm256_maskload_ps (ptr_arr[t] + m0 + m, mask), acc);
+            }
+            _mm256_maskstore_ps (out + m, mask, acc);
+        }
+    }
+}
+
+// Average pooling of a ninst tile, see naive_avgpool_tile.
+void avx2_avgpool_tile (const unsigned int M, const unsigned int N, const unsigned int m0, const unsigned int num_taps,
+    const float **input_ptr_arr, float *C, const unsigned int ldc)
+{
+    const __m256 count = _mm256_set1_ps ((float) num_taps);
+    for (unsigned int n = 0; n < N; n++)
+    {
+        const float **ptr_arr = input_ptr_arr + (size_t) n * num_taps;
+        float *out = C + (size_t) n * ldc;
+        unsigned int m = 0;
+        for (; m + 32 <= M; m += 32)
+        {
+            __m256 acc_0 = _mm256_setzero_ps (), acc_1 = _mm256_setzero_ps ();
+            __m256 acc_2 = _mm256_setzero_ps (), acc_3 = _mm256_setzero_ps ();
+            for (unsigned int t = 0; t < num_taps; t++)
+            {
+                if (ptr_arr[t] == NULL)
+                    continue;
+                const float *in = ptr_arr[t] + m0 + m;
+                acc_0 = _mm256_add_ps (acc_0, _mm256_loadu_ps (in));
+                acc_1 = _mm256_add_ps (acc_1, _mm256_loadu_ps (in + 8));
+                acc_2 = _mm256_add_ps (acc_2, _mm256_loadu_ps (in + 16));
+                acc_3 = _mm256_add_ps (acc_3, _mm256_loadu_ps (in + 24));
+            }
+            _mm256_storeu_ps (out + m, _mm256_div_ps (acc_0, count));
+            _mm256_storeu_ps (out + m + 8, _mm256_div_ps (acc_1, count));
+            _mm256_storeu_ps (out + m + 16, _mm256_div_ps (acc_2, count));
+            _mm256_storeu_ps (out + m + 24, _mm256_div_ps (acc_3, count));
+        }
+        for (; m < M; m += 8)
+        {
+            const __m256i mask = _mm256_cmpgt_epi32 (_mm256_set1_epi32 (M - m), 
+                _mm256_setr_epi32 (0, 1, 2, 3, 4, 5, 6, 7));
+            __m256 acc = _mm256_setzero_ps ();
+            for (unsigned int t = 0; t < num_taps; t++)
+            {
+                if (ptr_arr[t] == NULL)
+                    continue;
+                acc = _mm256_add_ps (acc, _mm256_maskload_ps (ptr_arr[t] + m0 + m, mask));
+            }
+            _mm256_maskstore_ps (out + m, mask, _mm256_div_ps (acc, count));
+        }
+    }
+}
+
+// Grouped conv of a ninst tile with narrow groups, 8 output channels per vector: groups of out_c_per_group dividing 8, 
+// whose input channels fit in one vector, are broadcast from one load with permutes. Other shapes use naive_grouped_conv.
+void avx2_grouped_conv (const unsigned int M, const unsigned int N, const unsigned int m0, const unsigned int num_taps,
+    const unsigned int in_c_per_group, const unsigned int out_c_per_group, const float *kernel, const float **input_ptr_arr,
+        float *C, const unsigned int ldc, const float *bias)
+{
+    if (m0 % 8 != 0 || 8 % out_c_per_group != 0 || (8 / out_c_per_group) * in_c_per_group > 8)
+    {
+        naive_grouped_conv (M, N, m0, num_taps, in_c_per_group, out_c_per_group, kernel, input_ptr_arr, C, ldc, bias);
+        return;
+    }
+    const unsigned int K = num_taps * in_c_per_group;
+    __m256i idx[8];
+    for (unsigned int c = 0; c < in_c_per_group; c++)
+    {
+        int lane_idx[8];
+        for (unsigned int l = 0; l < 8; l++)
+            lane_idx[l] = (l / out_c_per_group) * in_c_per_group + c;
+        idx[c] = _mm256_loadu_si256 ((__m256i *) lane_idx);
+    }
+    for (unsigned int m = 0; m < M; m += 8)
+    {
+        const unsigned int mr = M - m < 8 ? M - m : 8;
+        const __m256i mask = _mm256_cmpgt_epi32 (_mm256_set1_epi32 (mr), 
+            _mm256_setr_epi32 (0, 1, 2, 3, 4, 5, 6, 7));
+        const __m256i in_mask = _mm256_cmpgt_epi32 (
+            _mm256_set1_epi32 ((mr + out_c_per_group - 1) / out_c_per_group * in_c_per_group), 
+                _mm256_setr_epi32 (0, 1, 2, 3, 4, 5, 6, 7));
+        const unsigned int c0 = (m0 + m) / out_c_per_group * in_c_per_group;
+        const float *k_ptr = kernel + (size_t) m * K;
+        const __m256 b = bias == NULL ? _mm256_setzero_ps () : _mm256_maskload_ps (bias + m, mask);
+        for (unsigned int n = 0; n < N; n++)
+        {
+            const float **ptr_arr = input_ptr_arr + (size_t) n * num_taps;
+            __m256 acc = b;
+            for (unsigned int t = 0; t < num_taps; t++)
+            {
+                if (ptr_arr[t] == NULL)
+                    continue;
+                const __m256 x = _mm256_maskload_ps (ptr_arr[t] + c0, in_mask);
+                for (unsigned int c = 0; c < in_c_per_group; c++)
+                    acc = _mm256_fmadd_ps (_mm256_permutevar8x32_ps (x, idx[c]), 
+                        _mm256_loadu_ps (k_ptr + (t * in_c_per_group + c) * 8), acc);
+            }
+            if (mr == 8)
+                _mm256_storeu_ps (C + (size_t) n * ldc + m, acc);
+            else
+                _mm256_maskstore_ps (C + (size_t) n * ldc + m, mask, acc);
+        }
+    }
+}
+
+void avx2_quantize_u8 (const float *input, uint8_t *output, unsigned int num_elements, 
+    float inv_scale, float zero_point, unsigned int max)
+{
+    const __m256 s = _mm256_set1_ps (inv_scale), z = _mm256_set1_ps (zero_point);
+    const __m256 lo = _mm256_setzero_ps (), hi = _mm256_set1_ps (max);
+    const __m256i perm = _mm256_setr_epi32 (0, 4, 1, 5, 2, 6, 3, 7);
+    unsigned int i = 0;
+    for (; i + 32 <= num_elements; i += 32)
+    {
+        __m256i q[4];
+        for (unsigned int j = 0; j < 4; j++)
+        {
+            const __m256 v = _mm256_min_ps (_mm256_max_ps (_mm256_fmadd_ps (_mm256_loadu_ps (input + i + j * 8), s, z), lo), hi);
+            q[j] = _mm256_cvtps_epi32 (v);
+        }
+        // packs work within 128-bit lanes, the permute restores the element order.
+        const __m256i q16 = _mm256_packus_epi16 (_mm256_packs_epi32 (q[0], q[1]), _mm256_packs_epi32 (q[2], q[3]));
+        _mm256_storeu_si256 ((__m256i *) (output + i), _mm256_permutevar8x32_epi32 (q16, perm));
+    }
+    naive_quantize_u8 (input + i, output + i, num_elements - i, inv_scale, zero_point, max);
+}
+
+// C[mr x NR] = (A * B) * scale + offset for mr <= NB * _VEC_SIZE_M, with vpmaddubsw/vpmaddwd on 4 k per step.
+// B must be below 128 so that the pairwise 16-bit sums of vpmaddubsw cannot saturate.
+static inline __attribute__((always_inline)) void avx2_qgemm_kernel (const int NB, const int NR,
+    const unsigned int mr, const unsigned int K, const int8_t *A, const uint8_t *B, const unsigned int ldb, 
+        float *C, const unsigned int ldc, const float *scale, const float *offset)
+{
+    const __m256i ones = _mm256_set1_epi16 (1);
+    const int8_t *A_0 = A, *A_1 = A + _VEC_SIZE_M * K;
+    __m256i c_0[_QGEMM_AVX2_VEC_SIZE_N], c_1[_QGEMM_AVX2_VEC_SIZE_N];
+    for (int j = 0; j < NR; j++)
+    {
+        c_0[j] = _mm256_setzero_si256 ();
+        c_1[j] = _mm256_setzero_si256 ();
+    }
+    for (unsigned int k = 0; k < K; k += _QGEMM_K_GROUP)
+    {
+        const __m256i a_0 = _mm256_loadu_si256 ((const __m256i *) (A_0 + k * _VEC_SIZE_M));
+        const __m256i a_1 = NB == 2 ? _mm256_loadu_si256 ((const __m256i *) (A_1 + k * _VEC_SIZE_M)) : a_0;
+        for (int j = 0; j < NR; j++)
+        {
+            int32_t b_4;
+            memcpy (&b_4, B + j * ldb + k, sizeof (int32_t));
+            const __m256i b = _mm256_set1_epi32 (b_4);
+            c_0[j] = _mm256_add_epi32 (c_0[j], _mm256_madd_epi16 (_mm256_maddubs_epi16 (b, a_0), ones));
+            if (NB == 2)
+                c_1[j] = _mm256_add_epi32 (c_1[j], _mm256_madd_epi16 (_mm256_maddubs_epi16 (b, a_1), ones));
+        }
+    }
+    const __m256i idx = _mm256_setr_epi32 (0, 1, 2, 3, 4, 5, 6, 7);
+    const __m256i mask_0 = _mm256_cmpgt_epi32 (_mm256_set1_epi32 (mr), idx);
+    const __m256i mask_1 = _mm256_cmpgt_epi32 (_mm256_set1_epi32 (mr), _mm256_add_epi32 (idx, _mm256_set1_epi32 (8)));
+    const __m256 s_0 = _mm256_loadu_ps (scale), o_0 = _mm256_loadu_ps (offset);
+    const __m256 s_1 = NB == 2 ? _mm256_loadu_ps (scale + 8) : s_0, o_1 = NB == 2 ? _mm256_loadu_ps (offset + 8) : o_0;
+    for (int j = 0; j < NR; j++)
+    {
+        _mm256_maskstore_ps (C + j * ldc, mask_0, _mm256_fmadd_ps (_mm256_cvtepi32_ps (c_0[j]), s_0, o_0));
+        if (NB == 2)
+            _mm256_maskstore_ps (C + j * ldc + 8, mask_1, _mm256_fmadd_ps (_mm256_cvtepi32_ps (c_1[j]), s_1, o_1));
+    }
+}
+
+#define AVX2_QGEMM_KERNEL_CASE(NB, NR) \
+    case (NB) * 16 + (NR): avx2_qgemm_kernel (NB, NR, mr, K, A_m, B_n, ldb, C_mn, ldc, scale + m, offset + m); break;
+
+// Scale and offset must be readable up to M rounded up to _VEC_SIZE_M.
+void avx2_qgemm (const unsigned int M, const unsigned int N, const unsigned int K, const int8_t *A, 
+    const uint8_t *B, const unsigned int ldb, float *C, const unsigned int ldc, const float *scale, const float *offset)
+{
+    for (unsigned int m = 0; m < M; m += 2 * _VEC_SIZE_M)
+    {
+        const unsigned int mr = M - m < 2 * _VEC_SIZE_M ? M - m : 2 * _VEC_SIZE_M;
+        const unsigned int nb = (mr + _VEC_SIZE_M - 1) / _VEC_SIZE_M;
+        for (unsigned int n = 0; n < N; n += _QGEMM_AVX2_VEC_SIZE_N)
+        {
+            const unsigned int nr = N - n < _QGEMM_AVX2_VEC_SIZE_N ? N - n : _QGEMM_AVX2_VEC_SIZE_N;
+            const int8_t *A_m = A + (size_t) m * K;
+            const uint8_t *B_n = B + (size_t) n * ldb;
+            float *C_mn = C + (size_t) n * ldc + m;
+            switch (nb * 16 + nr)
+            {
+                AVX2_QGEMM_KERNEL_CASE(2, 4) 
+                AVX2_QGEMM_KERNEL_CASE(2, 3) 
+                AVX2_QGEMM_KERNEL_CASE(2, 2) 
+                AVX2_QGEMM_KERNEL_CASE(2, 1)
+                AVX2_QGEMM_KERNEL_CASE(1, 4) 
+                AVX2_QGEMM_KERNEL_CASE(1, 3) 
+                AVX2_QGEMM_KERNEL_CASE(1, 2) 
+                AVX2_QGEMM_KERNEL_CASE(1, 1)
+            }
+        }
+    }
+}
+
+// Vectorized activations. Max error against double precision over [-20, 20], absolute below 1 and relative above 
+// (bench_activate.c): ELU 1e-8, SIGMOID 2.2e-7, SELU 2.5e-7, TANH 3.3e-7, GELU 1.3e-6, GELU_ACCURATE 2.4e-6,
+// against 1e-7 to 1.5e-7 for naive_activate. GELU keeps the erf form, GELU_ACCURATE the tanh form.
+
+// Cephes expf: exp(x) = 2^n * exp(r), |r| <= ln(2)/2, with a degree 6 polynomial for exp(r).
+// x is clamped to [-87.3, 88.4] so that 2^n stays a normal float.
+static inline __attribute__((always_inline)) __m256 avx2_exp_ps (__m256 x)
+{
+    x = _mm256_min_ps (_mm256_max_ps (x, _mm256_set1_ps (-87.3365447505531f)), _mm256_set1_ps (88.3762626647949f));
+    const __m256 n = _mm256_round_ps (_mm256_mul_ps (x, _mm256_set1_ps (1.44269504088896341f)), 
+        _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+    __m256 r = _mm256_fnmadd_ps (n, _mm256_set1_ps (0.693359375f), x);
+    r = _mm256_fnmadd_ps (n, _mm256_set1_ps (-2.12194440e-4f), r);
+    __m256 p = _mm256_set1_ps (1.9875691500e-4f);
+    p = _mm256_fmadd_ps (p, r, _mm256_set1_ps (1.3981999507e-3f));
+    p = _mm256_fmadd_ps (p, r, _mm256_set1_ps (8.3334519073e-3f));
+    p = _mm256_fmadd_ps (p, r, _mm256_set1_ps (4.1665795894e-2f));
+    p = _mm256_fmadd_ps (p, r, _mm256_set1_ps (1.6666665459e-1f));
+    p = _mm256_fmadd_ps (p, r, _mm256_set1_ps (5.0000001201e-1f));
+    p = _mm256_fmadd_ps (p, _mm256_mul_ps (r, r), _mm256_add_ps (r, _mm256_set1_ps (1.0f)));
+    const __m256i e = _mm256_slli_epi32 (_mm256_add_epi32 (_mm256_cvtps_epi32 (n), _mm256_set1_epi32 (127)), 23);
+    return _mm256_mul_ps (p, _mm256_castsi256_ps (e));
+}
+
+// tanh(x) = x * P(x^2) / Q(x^2), a 13/6 rational fit on [-7.9, 7.9], saturating outside.
+static inline __attribute__((always_inline)) __m256 avx2_tanh_ps (__m256 x)
+{
+    x = _mm256_min_ps (_mm256_max_ps (x, _mm256_set1_ps (-7.90531110763549805f)), _mm256_set1_ps (7.90531110763549805f));
+    const __m256 x2 = _mm256_mul_ps (x, x);
+    __m256 p = _mm256_set1_ps (-2.76076847742355e-16f);
+    p = _mm256_fmadd_ps (p, x2, _mm256_set1_ps (2.00018790482477e-13f));
+    p = _mm256_fmadd_ps (p, x2, _mm256_set1_ps (-8.60467152213735e-11f));
+    p = _mm256_fmadd_ps (p, x2, _mm256_set1_ps (5.12229709037114e-08f));
+    p = _mm256_fmadd_ps (p, x2, _mm256_set1_ps (1.48572235717979e-05f));
+    p = _mm256_fmadd_ps (p, x2, _mm256_set1_ps (6.37261928875436e-04f));
+    p = _mm256_fmadd_ps (p, x2, _mm256_set1_ps (4.89352455891786e-03f));
+    __m256 q = _mm256_set1_ps (1.19825839466702e-06f);
+    q = _mm256_fmadd_ps (q, x2, _mm256_set1_ps (1.18534705686654e-04f));
+    q = _mm256_fmadd_ps (q, x2, _mm256_set1_ps (2.26843463243900e-03f));
+    q = _mm256_fmadd_ps (q, x2, _mm256_set1_ps (4.89352518554385e-03f));
+    return _mm256_div_ps (_mm256_mul_ps (x, p), q);
+}
+
+// erf(x) = x * P(x^2) / Q(x^2), a 13/8 rational fit on [-4, 4], saturating outside.
+static inline __attribute__((always_inline)) __m256 avx2_erf_ps (__m256 x)
+{
+    x = _mm256_min_ps (_mm256_max_ps (x, _mm256_set1_ps (-4.0f)), _mm256_set1_ps (4.0f));
+    const __m256 x2 = _mm256_mul_ps (x, x);
+    __m256 p = _mm256_set1_ps (-2.72614225801306e-10f);
+    p = _mm256_fmadd_ps (p, x2, _mm256_set1_ps (2.77068142495902e-08f));
+    p = _mm256_fmadd_ps (p, x2, _mm256_set1_ps (-2.10102402082508e-06f));
+    p = _mm256_fmadd_ps (p, x2, _mm256_set1_ps (-5.69250639462346e-05f));
+    p = _mm256_fmadd_ps (p, x2, _mm256_set1_ps (-7.34990630326855e-04f));
+    p = _mm256_fmadd_ps (p, x2, _mm256_set1_ps (-2.95459980854025e-03f));
+    p = _mm256_fmadd_ps (p, x2, _mm256_set1_ps (-1.60960333262415e-02f));
+    __m256 q = _mm256_set1_ps (-1.45660718464996e-05f);
+    q = _mm256_fmadd_ps (q, x2, _mm256_set1_ps (-2.13374055278905e-04f));
+    q = _mm256_fmadd_ps (q, x2, _mm256_set1_ps (-1.68282697438203e-03f));
+    q = _mm256_fmadd_ps (q, x2, _mm256_set1_ps (-7.37332916720468e-03f));
+    q = _mm256_fmadd_ps (q, x2, _mm256_set1_ps (-1.42647390514189e-02f));
+    return _mm256_div_ps (_mm256_mul_ps (x, p), q);
+}
+
+// naive_activate on 8 elements.
+static inline __attribute__((always_inline)) __m256 avx2_activate_ps (__m256 x, const LAYER_ACT activation)
+{
+    const __m256 zero = _mm256_setzero_ps ();
+    const __m256 one = _mm256_set1_ps (1.0f);
+    const __m256 half = _mm256_set1_ps (0.5f);
+    switch (activation)
+    {
+    case RELU:
+        return _mm256_max_ps (x, zero);
+    case LEAKY_RELU:
+        return _mm256_max_ps (x, _mm256_mul_ps (x, _mm256_set1_ps (0.1f)));
+    case ELU:
+        return _mm256_blendv_ps (_mm256_mul_ps (_mm256_set1_ps (0.1f), _mm256_sub_ps (avx2_exp_ps (x), one)), 
+            x, _mm256_cmp_ps (x, zero, _CMP_GT_OQ));
+    case SELU:
+        return _mm256_mul_ps (_mm256_set1_ps (1.0507f), _mm256_blendv_ps (
+            _mm256_mul_ps (_mm256_set1_ps (1.67326f), _mm256_sub_ps (avx2_exp_ps (x), one)), x, _mm256_cmp_ps (x, zero, _CMP_GT_OQ)));
+    case SIGMOID:
+        return _mm256_div_ps (one, _mm256_add_ps (one, avx2_exp_ps (_mm256_sub_ps (zero, x))));
+    case TANH:
+        return avx2_tanh_ps (x);
+    case GELU:
+        return _mm256_mul_ps (_mm256_mul_ps (half, x), 
+            _mm256_add_ps (one, avx2_erf_ps (_mm256_mul_ps (x, _mm256_set1_ps (0.7071067811865475f)))));
+    case GELU_ACCURATE:
+    {
+        const __m256 inner = _mm256_mul_ps (_mm256_set1_ps (0.7978845608028654f), 
+            _mm256_fmadd_ps (_mm256_mul_ps (_mm256_set1_ps (0.044715f), x), _mm256_mul_ps (x, x), x));
+        return _mm256_mul_ps (_mm256_mul_ps (half, x), _mm256_add_ps (one, avx2_tanh_ps (inner)));
+    }
+    default:
+        return x;
+    }
+}
+
+// activation is a compile-time constant at every call site, so the switch in avx2_activate_ps folds away.
+static inline __attribute__((always_inline)) void avx2_activate_loop (float *input, const unsigned int num_elements, 
+    const LAYER_ACT activation)
+{
+    unsigned int i = 0;
+    for (; i + 16 <= num_elements; i += 16)
+    {
+        const __m256 x_0 = avx2_activate_ps (_mm256_loadu_ps (input + i), activation);
+        const __m256 x_1 = avx2_activate_ps (_mm256_loadu_ps (input + i + 8), activation);
+        _mm256_storeu_ps (input + i, x_0);
+        _mm256_storeu_ps (input + i + 8, x_1);
+    }
+    for (; i < num_elements; i += 8)
+    {
+        const __m256i mask = _mm256_cmpgt_epi32 (_mm256_set1_epi32 (num_elements - i), 
+            _mm256_setr_epi32 (0, 1, 2, 3, 4, 5, 6, 7));
+        _mm256_maskstore_ps (input + i, mask, avx2_activate_ps (_mm256_maskload_ps (input + i, mask), activation));
+    }
+}
+
+#define AVX2_ACTIVATE_CASE(ACT) \
+    case ACT: avx2_activate_loop (input, num_elements, ACT); break;
+
+void avx2_activate (float *input, unsigned int num_elements, LAYER_ACT activation_type)
+{
+    switch (activation_type)
+    {
+        AVX2_ACTIVATE_CASE(RELU)
+        AVX2_ACTIVATE_CASE(LEAKY_RELU)
+        AVX2_ACTIVATE_CASE(ELU)
+        AVX2_ACTIVATE_CASE(SELU)
+        AVX2_ACTIVATE_CASE(SIGMOID)
+        AVX2_ACTIVATE_CASE(TANH)
+        AVX2_ACTIVATE_CASE(GELU)
+        AVX2_ACTIVATE_CASE(GELU_ACCURATE)
+    default:
+        break;
+    }
+}
+
+// Welford update of 8 per-lane (mean, m2) accumulators with the next x, inv_count = 1 / (number of x so far).
+static inline __attribute__((always_inline)) void avx2_welford_ps (const __m256 x, const __m256 inv_count, 
+    __m256 *mean, __m256 *m2)
+{
+    const __m256 delta = _mm256_sub_ps (x, *mean);
+    *mean = _mm256_fmadd_ps (delta, inv_count, *mean);
+    *m2 = _mm256_fmadd_ps (delta, _mm256_sub_ps (x, *mean), *m2);
+}
+
+// Single pass Welford statistics of input (+ input_2 if not NULL), storing the sum to sum_output if not NULL.
+// 16 lanes are updated independently and merged with Chan's formula, the tail is added one element at a time.
+static inline __attribute__((always_inline)) void avx2_welford_col (const float *input, const float *input_2, 
+    float *sum_output, const unsigned int num_elements, float *mean_out, float *var_out)
+{
+    __m256 mean_0 = _mm256_setzero_ps (), mean_1 = _mm256_setzero_ps ();
+    __m256 m2_0 = _mm256_setzero_ps (), m2_1 = _mm256_setzero_ps ();
+    unsigned int i = 0, count = 0;
+    for (; i + 16 <= num_elements; i += 16)
+    {
+        __m256 x_0 = _mm256_loadu_ps (input + i), x_1 = _mm256_loadu_ps (input + i + 8);
+        if (input_2 != NULL)
+        {
+            x_0 = _mm256_add_ps (x_0, _mm256_loadu_ps (input_2 + i));
+            x_1 = _mm256_add_ps (x_1, _mm256_loadu_ps (input_2 + i + 8));
+        }
+        if (sum_output != NULL)
+        {
+            _mm256_storeu_ps (sum_output + i, x_0);
+            _mm256_storeu_ps (sum_output + i + 8, x_1);
+        }
+        const __m256 inv_count = _mm256_set1_ps (1.0f / ++count);
+        avx2_welford_ps (x_0, inv_count, &mean_0, &m2_0);
+        avx2_welford_ps (x_1, inv_count, &mean_1, &m2_1);
+    }
+    float mean = 0, m2 = 0;
+    if (count > 0)
+    {
+        float lane_mean[16], lane_m2[16];
+        _mm256_storeu_ps (lane_mean, mean_0);
+        _mm256_storeu_ps (lane_mean + 8, mean_1);
+        _mm256_storeu_ps (lane_m2, _mm256_add_ps (m2_0, m2_1));
+        _mm256_storeu_ps (lane_m2 + 8, _mm256_setzero_ps ());
+        for (int l = 0; l < 16; l++)
+            mean += lane_mean[l];
+        mean /= 16;
+        for (int l = 0; l < 16; l++)
+            m2 += lane_m2[l] + count * (lane_mean[l] - mean) * (lane_mean[l] - mean);
+    }
+    for (; i < num_elements; i++)
+    {
+        const float x = input_2 != NULL ? input[i] + input_2[i] : input[i];
+        if (sum_output != NULL)
+            sum_output[i] = x;
+        const float delta = x - mean;
+        mean += delta / (i + 1);
+        m2 += delta * (x - mean);
+    }
+    *mean_out = mean;
+    *var_out = m2 / num_elements;
+}
+
+// output = (input - mean) * rstd * weight + bias.
+static inline __attribute__((always_inline)) void avx2_normalize_col (const float *input, float *output, 
+    const unsigned int num_elements, const float mean, const float var, const float *weight, const float *bias)
+{
+    const __m256 mean_v = _mm256_set1_ps (mean);
+    const __m256 rstd = _mm256_set1_ps (1 / sqrtf (var + _LAYERNORM_EPSILON));
+    for (unsigned int i = 0; i < num_elements; i += 8)
+    {
+        const __m256i mask = _mm256_cmpgt_epi32 (_mm256_set1_epi32 (num_elements - i), 
+            _mm256_setr_epi32 (0, 1, 2, 3, 4, 5, 6, 7));
+        const __m256 x = _mm256_sub_ps (_mm256_maskload_ps (input + i, mask), mean_v);
+        const __m256 scale = _mm256_mul_ps (rstd, _mm256_maskload_ps (weight + i, mask));
+        const __m256 shift = bias != NULL ? _mm256_maskload_ps (bias + i, mask) : _mm256_setzero_ps ();
+        _mm256_maskstore_ps (output + i, mask, _mm256_fmadd_ps (x, scale, shift));
+    }
+}
+
+void avx2_layernorm_col (const float *input, float *output, unsigned int num_elements, 
+    const float *weight, const float *bias)
+{
+    float mean, var;
+    avx2_welford_col (input, NULL, NULL, num_elements, &mean, &var);
+    avx2_normalize_col (input, output, num_elements, mean, var, weight, bias);
+}
+
+void avx2_residual_layernorm_col (const float *input_1, const float *input_2, float *residual_output, float *output, 
+    unsigned int num_elements, const float *weight, const float *bias)
+{
+    float mean, var;
+    avx2_welford_col (input_1, input_2, residual_output, num_elements, &mean, &var);
+    avx2_normalize_col (residual_output, output, num_elements, mean, var, weight, bias);
+}
+
+void avx2_softmax_col (const float *input, float *output, unsigned int num_elements, float scale)
+{
+    const __m256i idx = _mm256_setr_epi32 (0, 1, 2, 3, 4, 5, 6, 7);
+    __m256 max_v = _mm256_set1_ps (-INFINITY);
+    for (unsigned int i = 0; i < num_elements; i += 8)
+    {
+        const __m256i mask = _mm256_cmpgt_epi32 (_mm256_set1_epi32 (num_elements - i), idx);
+        max_v = _mm256_max_ps (max_v, _mm256_blendv_ps (max_v, _mm256_maskload_ps (input + i, mask), 
+            _mm256_castsi256_ps (mask)));
+    }
+    float max_arr[8];
+    _mm256_storeu_ps (max_arr, max_v);
+    float max = max_arr[0];
+    for (int l = 1; l < 8; l++)
+        max = max_arr[l] > max ? max_arr[l] : max;
+    const __m256 scale_v = _mm256_set1_ps (scale);
+    const __m256 shift = _mm256_set1_ps (-max * scale);
+    __m256 sum_v = _mm256_setzero_ps ();
+    for (unsigned int i = 0; i < num_elements; i += 8)
+    {
+        const __m256i mask = _mm256_cmpgt_epi32 (_mm256_set1_epi32 (num_elements - i), idx);
+        const __m256 e = _mm256_and_ps (avx2_exp_ps (_mm256_fmadd_ps (_mm256_maskload_ps (input + i, mask), scale_v, shift)), 
+            _mm256_castsi256_ps (mask));
+        _mm256_maskstore_ps (output + i, mask, e);
+        sum_v = _mm256_add_ps (sum_v, e);
+    }
+    float sum_arr[8];
+    _mm256_storeu_ps (sum_arr, sum_v);
+    float sum = 0;
+    for (int l = 0; l < 8; l++)
+        sum += sum_arr[l];
+    const __m256 inv_sum = _mm256_set1_ps (1 / sum);
+    for (unsigned int i = 0; i < num_elements; i += 8)
+    {
+        const __m256i mask = _mm256_cmpgt_epi32 (_mm256_set1_epi32 (num_elements - i), idx);
+        _mm256_maskstore_ps (output + i, mask, _mm256_mul_ps (_mm256_maskload_ps (output + i, mask), inv_sum));
+    }
+}
+
+float avx2_online_softmax_col (float *scores, unsigned int num_elements, float scale, float *max, float *sum)
+{
+    const __m256i idx = _mm256_setr_epi32 (0, 1, 2, 3, 4, 5, 6, 7);
+    const __m256 scale_v = _mm256_set1_ps (scale);
+    __m256 max_v = _mm256_set1_ps (*max);
+    for (unsigned int i = 0; i < num_elements; i += 8)
+    {
+        const __m256i mask = _mm256_cmpgt_epi32 (_mm256_set1_epi32 (num_elements - i), idx);
+        const __m256 x = _mm256_mul_ps (_mm256_maskload_ps (scores + i, mask), scale_v);
+        max_v = _mm256_max_ps (max_v, _mm256_blendv_ps (max_v, x, _mm256_castsi256_ps (mask)));
+    }
+    float max_arr[8];
+    _mm256_storeu_ps (max_arr, max_v);
+    float new_max = max_arr[0];
+    for (int l = 1; l < 8; l++)
+        new_max = max_arr[l] > new_max ? max_arr[l] : new_max;
+    if (new_max == -INFINITY)
+    {
+        memset (scores, 0, num_elements * sizeof(float));
+        return 1;
+    }
+    const float correction = *max == -INFINITY ? 0 : expf (*max - new_max);
+    const __m256 shift = _mm256_set1_ps (-new_max);
+    __m256 sum_v = _mm256_setzero_ps ();
+    for (unsigned int i = 0; i < num_elements; i += 8)
+    {
+        const __m256i mask = _mm256_cmpgt_epi32 (_mm256_set1_epi32 (num_elements - i), idx);
+        const __m256 e = _mm256_and_ps (avx2_exp_ps (_mm256_fmadd_ps (_mm256_maskload_ps (scores + i, mask), scale_v, shift)), 
+            _mm256_castsi256_ps (mask));
+        _mm256_maskstore_ps (scores + i, mask, e);
+        sum_v = _mm256_add_ps (sum_v, e);
+    }
+    float sum_arr[8];
+    _mm256_storeu_ps (sum_arr, sum_v);
+    float block_sum = 0;
+    for (int l = 0; l < 8; l++)
+        block_sum += sum_arr[l];
+    *max = new_max;
+    *sum = *sum * correction + block_sum;
+    return correction;
+}
+
+// sgemm_epilogue_t on 8 rows of one C column, rows at and above mr masked out of the residual load.
+static inline __attribute__((always_inline)) __m256 avx2_epilogue (__m256 c, const __m256 bias, 
+    const float *residual, const __m256i mask, const LAYER_ACT activation)
+{
+    c = _mm256_add_ps (c, bias);
+    if (residual != NULL)
+        c = _mm256_add_ps (c, _mm256_maskload_ps (residual, mask));
+    return avx2_activate_ps (c, activation);
+}
+
+// C[mr x NR] = epi (C + A[mr x K] * B[K x NR]) for mr <= _VEC_SIZE_M and NR <= _VEC_SIZE_N, 
+// the register tile of avx2_sgemm_full_tile.
+static inline __attribute__((always_inline)) void avx2_sgemm_kernel (const int NR, const unsigned int mr, 
+    const unsigned int K, const float *A, const float *B, const unsigned int ldb, float *C, const unsigned int ldc, 
+        const sgemm_epilogue_t *epi)
+{
+    const __m256i mask = _mm256_cmpgt_epi32 (_mm256_set1_epi32 (mr), _mm256_setr_epi32 (0, 1, 2, 3, 4, 5, 6, 7));
+    __m256 c[_VEC_SIZE_N];
+    for (int j = 0; j < NR; j++)
+        c[j] = _mm256_maskload_ps (C + j * ldc, mask);
+    for (unsigned int k = 0; k < K; k++)
+    {
+        const __m256 a = _mm256_load_ps (A + k * _VEC_SIZE_M);
+        for (int j = 0; j < NR; j++)
+            c[j] = _mm256_fmadd_ps (a, _mm256_broadcast_ss (B + j * ldb + k), c[j]);
+    }
+    if (epi != NULL)
+    {
+        const __m256 bias = epi->bias != NULL ? _mm256_maskload_ps (epi->bias, mask) : _mm256_setzero_ps ();
+        for (int j = 0; j < NR; j++)
+            c[j] = avx2_epilogue (c[j], bias, epi->residual != NULL ? epi->residual + j * epi->ldr : NULL, 
+                mask, epi->activation);
+    }
+    for (int j = 0; j < NR; j++)
+        _mm256_maskstore_ps (C + j * ldc, mask, c[j]);
+}
+
+#define AVX2_SGEMM_KERNEL_CASE(NR) \
+    case (NR): avx2_sgemm_kernel (NR, mr, K, A_m, B_n, ldb, C_mn, ldc, epi_mn); break;
+
+void avx2_sgemm_epilogue (const unsigned int M, const unsigned int N, const unsigned int K, const float *A, const unsigned int lda, 
+    const float *B, const unsigned int ldb, float *C, const unsigned int ldc, const sgemm_epilogue_t *epi)
+{
+    for (unsigned int m = 0; m < M; m += _VEC_SIZE_M)
+    {
+        const unsigned int mr = M - m < _VEC_SIZE_M ? M - m : _VEC_SIZE_M;
+        const float *A_m = A + (size_t) m * lda;
+        for (unsigned int n = 0; n < N; n += _VEC_SIZE_N)
+        {
+            const unsigned int nr = N - n < _VEC_SIZE_N ? N - n : _VEC_SIZE_N;
+            const float *B_n = B + (size_t) n * ldb;
+            float *C_mn = C + (size_t) n * ldc + m;
+            sgemm_epilogue_t epi_at;
+            const sgemm_epilogue_t *epi_mn = get_sgemm_epilogue_at (epi, &epi_at, m, n);
+            switch (nr)
+            {
+                AVX2_SGEMM_KERNEL_CASE(12)
+                AVX2_SGEMM_KERNEL_CASE(11)
+                AVX2_SGEMM_KERNEL_CASE(10)
+                AVX2_SGEMM_KERNEL_CASE(9)
+                AVX2_SGEMM_KERNEL_CASE(8)
+                AVX2_SGEMM_KERNEL_CASE(7)
+                AVX2_SGEMM_KERNEL_CASE(6)
+                AVX2_SGEMM_KERNEL_CASE(5)
+                AVX2_SGEMM_KERNEL_CASE(4)
+                AVX2_SGEMM_KERNEL_CASE(3)
+                AVX2_SGEMM_KERNEL_CASE(2)
+                AVX2_SGEMM_KERNEL_CASE(1)
+            }
+        }
+    }
+}
+
+// C[mr x NR] = epi (C + A[mr x K] * B[K x NR]) for mr <= NB * _VEC_SIZE_M, with A packed in FP16 and widened with vcvtph2ps.
+static inline __attribute__((always_inline)) void avx2_hgemm_kernel (const int NB, const int NR,
+    const unsigned int mr, const unsigned int K, const uint16_t *A, const unsigned int lda, 
+        const float *B, const unsigned int ldb, float *C, const unsigned int ldc, const sgemm_epilogue_t *epi)
+{
+    const __m256i idx = _mm256_setr_epi32 (0, 1, 2, 3, 4, 5, 6, 7);
+    const __m256i mask_0 = _mm256_cmpgt_epi32 (_mm256_set1_epi32 (mr), idx);
+    const __m256i mask_1 = _mm256_cmpgt_epi32 (_mm256_set1_epi32 (mr), _mm256_add_epi32 (idx, _mm256_set1_epi32 (8)));
+    const uint16_t *A_0 = A, *A_1 = A + _VEC_SIZE_M * lda;
+    __m256 c_0[_HGEMM_AVX2_VEC_SIZE_N], c_1[_HGEMM_AVX2_VEC_SIZE_N];
+    for (int j = 0; j < NR; j++)
+    {
+        c_0[j] = _mm256_maskload_ps (C + j * ldc, mask_0);
+        if (NB == 2)
+            c_1[j] = _mm256_maskload_ps (C + j * ldc + 8, mask_1);
+    }
+    for (unsigned int k = 0; k < K; k++)
+    {
+        const __m256 a_0 = _mm256_cvtph_ps (_mm_loadu_si128 ((const __m128i *) (A_0 + k * _VEC_SIZE_M)));
+        const __m256 a_1 = NB == 2 ? _mm256_cvtph_ps (_mm_loadu_si128 ((const __m128i *) (A_1 + k * _VEC_SIZE_M))) : a_0;
+        for (int j = 0; j < NR; j++)
+        {
+            const __m256 b = _mm256_broadcast_ss (B + j * ldb + k);
+            c_0[j] = _mm256_fmadd_ps (a_0, b, c_0[j]);
+            if (NB == 2)
+                c_1[j] = _mm256_fmadd_ps (a_1, b, c_1[j]);
+        }
+    }
+    if (epi != NULL)
+    {
+        const __m256 bias_0 = epi->bias != NULL ? _mm256_maskload_ps (epi->bias, mask_0) : _mm256_setzero_ps ();
+        const __m256 bias_1 = epi->bias != NULL ? _mm256_maskload_ps (epi->bias + 8, mask_1) : _mm256_setzero_ps ();
+        for (int j = 0; j < NR; j++)
+        {
+            const float *residual = epi->residual != NULL ? epi->residual + j * epi->ldr : NULL;
+            c_0[j] = avx2_epilogue (c_0[j], bias_0, residual, mask_0, epi->activation);
+            if (NB == 2)
+                c_1[j] = avx2_epilogue (c_1[j], bias_1, residual != NULL ? residual + 8 : NULL, mask_1, epi->activation);
+        }
+    }
+    for (int j = 0; j < NR; j++)
+    {
+        _mm256_maskstore_ps (C + j * ldc, mask_0, c_0[j]);
+        if (NB == 2)
+            _mm256_maskstore_ps (C + j * ldc + 8, mask_1, c_1[j]);
+    }
+}
+
+#define AVX2_HGEMM_KERNEL_CASE(NB, NR) \
+    case (NB) * 16 + (NR): avx2_hgemm_kernel (NB, NR, mr, K, A_m, lda, B_n, ldb, C_mn, ldc, epi_mn); break;
+
+void avx2_hgemm (const unsigned int M, const unsigned int N, const unsigned int K, const uint16_t *A, const unsigned int lda, 
+    const float *B, const unsigned int ldb, float *C, const unsigned int ldc, const sgemm_epilogue_t *epi)
+{
+    for (unsigned int m = 0; m < M; m += 2 * _VEC_SIZE_M)
+    {
+        const unsigned int mr = M - m < 2 * _VEC_SIZE_M ? M - m : 2 * _VEC_SIZE_M;
+        const unsigned int nb = (mr + _VEC_SIZE_M - 1) / _VEC_SIZE_M;
+        const uint16_t *A_m = A + (size_t) m * lda;
+        for (unsigned int n = 0; n < N; n += _HGEMM_AVX2_VEC_SIZE_N)
+        {
+            const unsigned int nr = N - n < _HGEMM_AVX2_VEC_SIZE_N ? N - n : _HGEMM_AVX2_VEC_SIZE_N;
+            const float *B_n = B + (size_t) n * ldb;
+            float *C_mn = C + (size_t) n * ldc + m;
+            sgemm_epilogue_t epi_at;
+            const sgemm_epilogue_t *epi_mn = get_sgemm_epilogue_at (epi, &epi_at, m, n);
+            switch (nb * 16 + nr)
+            {
+                AVX2_HGEMM_KERNEL_CASE(2, 6) 
+                AVX2_HGEMM_KERNEL_CASE(2, 5) 
+                AVX2_HGEMM_KERNEL_CASE(2, 4) 
+                AVX2_HGEMM_KERNEL_CASE(2, 3) 
+                AVX2_HGEMM_KERNEL_CASE(2, 2) 
+                AVX2_HGEMM_KERNEL_CASE(2, 1)
+                AVX2_HGEMM_KERNEL_CASE(1, 6) 
+                AVX2_HGEMM_KERNEL_CASE(1, 5) 
+                AVX2_HGEMM_KERNEL_CASE(1, 4) 
+                AVX2_HGEMM_KERNEL_CASE(1, 3) 
+                AVX2_HGEMM_KERNEL_CASE(1, 2) 
+                AVX2_HGEMM_KERNEL_CASE(1, 1)
+            }
+        }
+    }
+}
+
 #endif
\ No newline at end of file
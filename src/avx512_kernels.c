@@ -0,0 +1,422 @@
+#include "kernels.h"
+#ifdef AVX2
+// SGEMM kernel dispatch. Starts on the AVX2 kernels and switches to AVX-512 at load time if the CPU supports it,
+// so a binary built for AVX2 runs everywhere and still uses 512-bit FMAs where available.
+sgemm_kernel_table_t sgemm_kernels =
+{
+    .name = "AVX2",
+    .sgemm_with_omp = avx2_sgemm_vectorized_with_omp,
+    .sgemm = avx2_sgemm_vectorized,
+    .sgemm_full_tile = avx2_sgemm_full_tile,
+    .sgemm_tile_M = avx2_sgemm_tile_M,
+    .sgemm_tile_N = avx2_sgemm_tile_N,
+    .sgemm_epilogue = avx2_sgemm_epilogue,
+    .hgemm = avx2_hgemm,
+};
+
+// INT8 GEMM dispatch. The AVX2 kernel uses vpmaddubsw, whose 16-bit pair sums limit activations to 7 bits.
+// With AVX-512 VNNI, vpdpbusd accumulates in 32 bits and takes the full u8 range.
+qgemm_kernel_table_t qgemm_kernels =
+{
+    .name = "AVX2",
+    .qgemm = avx2_qgemm,
+    .act_max = 127,
+};
+
+__attribute__((constructor)) static void init_x86_kernels (void)
+{
+    __builtin_cpu_init ();
+    if (__builtin_cpu_supports ("avx512f") && __builtin_cpu_supports ("avx512dq"))
+    {
+        sgemm_kernels.name = "AVX-512";
+        sgemm_kernels.sgemm_with_omp = avx512_sgemm_vectorized_with_omp;
+        sgemm_kernels.sgemm = avx512_sgemm_vectorized;
+        sgemm_kernels.sgemm_full_tile = avx512_sgemm_full_tile;
+        sgemm_kernels.sgemm_tile_M = avx512_sgemm_tile_M;
+        sgemm_kernels.sgemm_tile_N = avx512_sgemm_tile_N;
+        sgemm_kernels.sgemm_epilogue = avx512_sgemm_epilogue;
+        sgemm_kernels.hgemm = avx512_hgemm;
+    }
+    if (__builtin_cpu_supports ("avx512f") && __builtin_cpu_supports ("avx512bw") 
+        && __builtin_cpu_supports ("avx512vnni"))
+    {
+        qgemm_kernels.name = "AVX-512 VNNI";
+        qgemm_kernels.qgemm = avx512_vnni_qgemm;
+        qgemm_kernels.act_max = 255;
+    }
+}
+
+#pragma GCC push_options
+#pragma GCC target ("avx512f,avx512dq")
+
+static inline __attribute__((always_inline)) __m512 avx512_epilogue (__m512 c, const __m512 bias, 
+    const float *residual, const __mmask16 mask, const LAYER_ACT activation)
+{
+    c = _mm512_add_ps (c, bias);
+    if (residual != NULL)
+        c = _mm512_add_ps (c, _mm512_maskz_loadu_ps (mask, residual));
+    if (activation == RELU)
+        c = _mm512_max_ps (c, _mm512_setzero_ps ());
+    else if (activation == LEAKY_RELU)
+        c = _mm512_max_ps (c, _mm512_mul_ps (c, _mm512_set1_ps (0.1f)));
+    return c;
+}
+
+// sgemm_epilogue_t on a register tile of NR columns of 32 rows (c_0, and c_1 if NB > 2) before it is stored.
+static inline __attribute__((always_inline)) void avx512_epilogue_tile (const int NB, const int NR, 
+    __m512 *c_0, __m512 *c_1, const __mmask16 mask_0, const __mmask16 mask_1, const sgemm_epilogue_t *epi)
+{
+    const __m512 bias_0 = epi->bias != NULL ? _mm512_maskz_loadu_ps (mask_0, epi->bias) : _mm512_setzero_ps ();
+    const __m512 bias_1 = epi->bias != NULL && NB > 2 ? _mm512_maskz_loadu_ps (mask_1, epi->bias + 16) : _mm512_setzero_ps ();
+    for (int j = 0; j < NR; j++)
+    {
+        const float *residual = epi->residual != NULL ? epi->residual + j * epi->ldr : NULL;
+        c_0[j] = avx512_epilogue (c_0[j], bias_0, residual, mask_0, epi->activation);
+        if (NB > 2)
+            c_1[j] = avx512_epilogue (c_1[j], bias_1, residual != NULL ? residual + 16 : NULL, mask_1, epi->activation);
+    }
+}
+
+// Activations that avx512_epilogue does not apply, on the stored tile.
+static inline void avx512_epilogue_post_store (const int NR, const unsigned int mr, float *C, const unsigned int ldc, 
+    const sgemm_epilogue_t *epi)
+{
+    if (epi->activation == NO_ACTIVATION || epi->activation == LINEAR 
+        || epi->activation == RELU || epi->activation == LEAKY_RELU)
+        return;
+    for (int j = 0; j < NR; j++)
+        avx2_activate (C + j * ldc, mr, epi->activation);
+}
+
+// C[mr x NR] = epi (C + A[mr x K] * B[K x NR]) for mr <= _AVX512_VEC_SIZE_M, with A packed in NB blocks of _VEC_SIZE_M rows.
+// Two blocks share one zmm register, so a full register tile is 32 x 12 (24 accumulators).
+// NB and NR are compile-time constants at every call site, so the accumulators stay in registers.
+static inline __attribute__((always_inline)) void avx512_sgemm_kernel (const int NB, const int NR,
+    const unsigned int mr, const unsigned int K, const float *A, const unsigned int lda,
+        const float *B, const unsigned int ldb, float *C, const unsigned int ldc, const sgemm_epilogue_t *epi)
+{
+    const __mmask16 mask_0 = mr >= 16 ? 0xFFFF : (__mmask16)((1U << mr) - 1);
+    const __mmask16 mask_1 = mr >= 32 ? 0xFFFF : mr > 16 ? (__mmask16)((1U << (mr - 16)) - 1) : 0;
+    const float *A_0 = A, *A_1 = A + _VEC_SIZE_M * lda, *A_2 = A + 2 * _VEC_SIZE_M * lda, *A_3 = A + 3 * _VEC_SIZE_M * lda;
+    __m512 c_0[_AVX512_VEC_SIZE_N], c_1[_AVX512_VEC_SIZE_N];
+    for (int j = 0; j < NR; j++)
+    {
+        c_0[j] = _mm512_maskz_loadu_ps (mask_0, C + j * ldc);
+        if (NB > 2)
+            c_1[j] = _mm512_maskz_loadu_ps (mask_1, C + j * ldc + 16);
+    }
+    for (unsigned int k = 0; k < K; k++)
+    {
+        __m512 a_0, a_1 = _mm512_setzero_ps ();
+        if (NB >= 2)
+            a_0 = _mm512_insertf32x8 (_mm512_castps256_ps512 (_mm256_load_ps (A_0 + k * _VEC_SIZE_M)),
+                _mm256_load_ps (A_1 + k * _VEC_SIZE_M), 1);
+        else
+            a_0 = _mm512_zextps256_ps512 (_mm256_load_ps (A_0 + k * _VEC_SIZE_M));
+        if (NB == 4)
+            a_1 = _mm512_insertf32x8 (_mm512_castps256_ps512 (_mm256_load_ps (A_2 + k * _VEC_SIZE_M)),
+                _mm256_load_ps (A_3 + k * _VEC_SIZE_M), 1);
+        else if (NB == 3)
+            a_1 = _mm512_zextps256_ps512 (_mm256_load_ps (A_2 + k * _VEC_SIZE_M));
+        for (int j = 0; j < NR; j++)
+        {
+            const __m512 b = _mm512_set1_ps (B[j * ldb + k]);
+            c_0[j] = _mm512_fmadd_ps (a_0, b, c_0[j]);
+            if (NB > 2)
+                c_1[j] = _mm512_fmadd_ps (a_1, b, c_1[j]);
+        }
+    }
+    if (epi != NULL)
+        avx512_epilogue_tile (NB, NR, c_0, c_1, mask_0, mask_1, epi);
+    for (int j = 0; j < NR; j++)
+    {
+        _mm512_mask_storeu_ps (C + j * ldc, mask_0, c_0[j]);
+        if (NB > 2)
+            _mm512_mask_storeu_ps (C + j * ldc + 16, mask_1, c_1[j]);
+    }
+    if (epi != NULL)
+        avx512_epilogue_post_store (NR, mr, C, ldc, epi);
+}
+
+#define AVX512_KERNEL_CASE(NB, NR) \
+    case (NB) * 16 + (NR): avx512_sgemm_kernel (NB, NR, mr, K, A, lda, B, ldb, C, ldc, epi); break;
+#define AVX512_KERNEL_CASES(NB) \
+    AVX512_KERNEL_CASE(NB, 1) AVX512_KERNEL_CASE(NB, 2) AVX512_KERNEL_CASE(NB, 3) AVX512_KERNEL_CASE(NB, 4) \
+    AVX512_KERNEL_CASE(NB, 5) AVX512_KERNEL_CASE(NB, 6) AVX512_KERNEL_CASE(NB, 7) AVX512_KERNEL_CASE(NB, 8) \
+    AVX512_KERNEL_CASE(NB, 9) AVX512_KERNEL_CASE(NB, 10) AVX512_KERNEL_CASE(NB, 11) AVX512_KERNEL_CASE(NB, 12)
+
+static void avx512_sgemm_kernel_edge (const unsigned int mr, const unsigned int nr, const unsigned int K,
+    const float *A, const unsigned int lda, const float *B, const unsigned int ldb, float *C, const unsigned int ldc, 
+        const sgemm_epilogue_t *epi)
+{
+    const unsigned int nb = (mr + _VEC_SIZE_M - 1) / _VEC_SIZE_M;
+    switch (nb * 16 + nr)
+    {
+        AVX512_KERNEL_CASES(1)
+        AVX512_KERNEL_CASES(2)
+        AVX512_KERNEL_CASES(3)
+        AVX512_KERNEL_CASES(4)
+        default:
+            ERROR_PRTF ("Error in avx512_sgemm_kernel_edge: invalid block %u x %u.\n", mr, nr);
+    }
+}
+
+static inline __attribute__((always_inline)) void avx512_sgemm_rows (const unsigned int m, const unsigned int M,
+    const unsigned int N, const unsigned int K, const float *A, const unsigned int lda,
+        const float *B, const unsigned int ldb, float *C, const unsigned int ldc, const sgemm_epilogue_t *epi)
+{
+    const unsigned int mr = M - m < _AVX512_VEC_SIZE_M ? M - m : _AVX512_VEC_SIZE_M;
+    sgemm_epilogue_t epi_at;
+    unsigned int n = 0;
+    if (mr == _AVX512_VEC_SIZE_M)
+    {
+        for (; n + _AVX512_VEC_SIZE_N <= N; n += _AVX512_VEC_SIZE_N)
+            avx512_sgemm_kernel (4, _AVX512_VEC_SIZE_N, mr, K, A + m * lda, lda, B + n * ldb, ldb, C + n * ldc + m, ldc, 
+                get_sgemm_epilogue_at (epi, &epi_at, m, n));
+    }
+    for (; n < N; n += _AVX512_VEC_SIZE_N)
+    {
+        const unsigned int nr = N - n < _AVX512_VEC_SIZE_N ? N - n : _AVX512_VEC_SIZE_N;
+        avx512_sgemm_kernel_edge (mr, nr, K, A + m * lda, lda, B + n * ldb, ldb, C + n * ldc + m, ldc, 
+            get_sgemm_epilogue_at (epi, &epi_at, m, n));
+    }
+}
+
+void avx512_sgemm_vectorized_with_omp (const unsigned int M, const unsigned int N, const unsigned int K,
+    const float *A, const unsigned int lda, const float *B, const unsigned int ldb, float *C, const unsigned int ldc)
+{
+    #pragma omp parallel for
+    for (unsigned int m = 0; m < M; m += _AVX512_VEC_SIZE_M)
+        avx512_sgemm_rows (m, M, N, K, A, lda, B, ldb, C, ldc, NULL);
+}
+
+void avx512_sgemm_vectorized (const unsigned int M, const unsigned int N, const unsigned int K,
+    const float *A, const unsigned int lda, const float *B, const unsigned int ldb, float *C, const unsigned int ldc)
+{
+    for (unsigned int m = 0; m < M; m += _AVX512_VEC_SIZE_M)
+        avx512_sgemm_rows (m, M, N, K, A, lda, B, ldb, C, ldc, NULL);
+}
+
+void avx512_sgemm_epilogue (const unsigned int M, const unsigned int N, const unsigned int K, const float *A, const unsigned int lda, 
+    const float *B, const unsigned int ldb, float *C, const unsigned int ldc, const sgemm_epilogue_t *epi)
+{
+    for (unsigned int m = 0; m < M; m += _AVX512_VEC_SIZE_M)
+        avx512_sgemm_rows (m, M, N, K, A, lda, B, ldb, C, ldc, epi);
+}
+
+void avx512_sgemm_full_tile (const unsigned int M, const unsigned int N, const unsigned int K,
+    const float *A, const unsigned int lda, const float *B, const unsigned int ldb, float *C, const unsigned int ldc)
+{
+    for (unsigned int m = 0; m < _TILE_SIZE_M; m += _AVX512_VEC_SIZE_M)
+    {
+        for (unsigned int n = 0; n < _TILE_SIZE_N; n += _AVX512_VEC_SIZE_N)
+            avx512_sgemm_kernel (4, _AVX512_VEC_SIZE_N, _AVX512_VEC_SIZE_M, K,
+                A + m * lda, lda, B + n * ldb, ldb, C + n * ldc + m, ldc, NULL);
+    }
+}
+
+void avx512_sgemm_tile_M (const unsigned int M, const unsigned int N, const unsigned int K,
+    const float *A, const unsigned int lda, const float *B, const unsigned int ldb, float *C, const unsigned int ldc)
+{
+    for (unsigned int m = 0; m < _TILE_SIZE_M; m += _AVX512_VEC_SIZE_M)
+        avx512_sgemm_rows (m, _TILE_SIZE_M, N, K, A, lda, B, ldb, C, ldc, NULL);
+}
+
+void avx512_sgemm_tile_N (const unsigned int M, const unsigned int N, const unsigned int K,
+    const float *A, const unsigned int lda, const float *B, const unsigned int ldb, float *C, const unsigned int ldc)
+{
+    for (unsigned int m = 0; m < M; m += _AVX512_VEC_SIZE_M)
+        avx512_sgemm_rows (m, M, _TILE_SIZE_N, K, A, lda, B, ldb, C, ldc, NULL);
+}
+
+// Two packed FP16 A blocks of the same k, widened into one zmm register.
+static inline __attribute__((always_inline)) __m512 avx512_load_ph_blocks (const int num_blocks, 
+    const uint16_t *A_0, const uint16_t *A_1)
+{
+    const __m128i a_0 = _mm_loadu_si128 ((const __m128i *) A_0);
+    if (num_blocks == 2)
+        return _mm512_cvtph_ps (_mm256_inserti128_si256 (_mm256_castsi128_si256 (a_0), 
+            _mm_loadu_si128 ((const __m128i *) A_1), 1));
+    return _mm512_cvtph_ps (_mm256_zextsi128_si256 (a_0));
+}
+
+// avx512_sgemm_kernel with FP16 A.
+static inline __attribute__((always_inline)) void avx512_hgemm_kernel (const int NB, const int NR,
+    const unsigned int mr, const unsigned int K, const uint16_t *A, const unsigned int lda,
+        const float *B, const unsigned int ldb, float *C, const unsigned int ldc, const sgemm_epilogue_t *epi)
+{
+    const __mmask16 mask_0 = mr >= 16 ? 0xFFFF : (__mmask16)((1U << mr) - 1);
+    const __mmask16 mask_1 = mr >= 32 ? 0xFFFF : mr > 16 ? (__mmask16)((1U << (mr - 16)) - 1) : 0;
+    const uint16_t *A_0 = A, *A_1 = A + _VEC_SIZE_M * lda, *A_2 = A + 2 * _VEC_SIZE_M * lda, *A_3 = A + 3 * _VEC_SIZE_M * lda;
+    __m512 c_0[_AVX512_VEC_SIZE_N], c_1[_AVX512_VEC_SIZE_N];
+    for (int j = 0; j < NR; j++)
+    {
+        c_0[j] = _mm512_maskz_loadu_ps (mask_0, C + j * ldc);
+        if (NB > 2)
+            c_1[j] = _mm512_maskz_loadu_ps (mask_1, C + j * ldc + 16);
+    }
+    for (unsigned int k = 0; k < K; k++)
+    {
+        const __m512 a_0 = avx512_load_ph_blocks (NB >= 2 ? 2 : 1, A_0 + k * _VEC_SIZE_M, A_1 + k * _VEC_SIZE_M);
+        const __m512 a_1 = NB > 2 ? avx512_load_ph_blocks (NB - 2, A_2 + k * _VEC_SIZE_M, A_3 + k * _VEC_SIZE_M) : a_0;
+        for (int j = 0; j < NR; j++)
+        {
+            const __m512 b = _mm512_set1_ps (B[j * ldb + k]);
+            c_0[j] = _mm512_fmadd_ps (a_0, b, c_0[j]);
+            if (NB > 2)
+                c_1[j] = _mm512_fmadd_ps (a_1, b, c_1[j]);
+        }
+    }
+    if (epi != NULL)
+        avx512_epilogue_tile (NB, NR, c_0, c_1, mask_0, mask_1, epi);
+    for (int j = 0; j < NR; j++)
+    {
+        _mm512_mask_storeu_ps (C + j * ldc, mask_0, c_0[j]);
+        if (NB > 2)
+            _mm512_mask_storeu_ps (C + j * ldc + 16, mask_1, c_1[j]);
+    }
+    if (epi != NULL)
+        avx512_epilogue_post_store (NR, mr, C, ldc, epi);
+}
+
+#define AVX512_HGEMM_KERNEL_CASE(NB, NR) \
+    case (NB) * 16 + (NR): avx512_hgemm_kernel (NB, NR, mr, K, A_m, lda, B_n, ldb, C_mn, ldc, epi_mn); break;
+#define AVX512_HGEMM_KERNEL_CASES(NB) \
+    AVX512_HGEMM_KERNEL_CASE(NB, 1) AVX512_HGEMM_KERNEL_CASE(NB, 2) AVX512_HGEMM_KERNEL_CASE(NB, 3) \
+    AVX512_HGEMM_KERNEL_CASE(NB, 4) AVX512_HGEMM_KERNEL_CASE(NB, 5) AVX512_HGEMM_KERNEL_CASE(NB, 6) \
+    AVX512_HGEMM_KERNEL_CASE(NB, 7) AVX512_HGEMM_KERNEL_CASE(NB, 8) AVX512_HGEMM_KERNEL_CASE(NB, 9) \
+    AVX512_HGEMM_KERNEL_CASE(NB, 10) AVX512_HGEMM_KERNEL_CASE(NB, 11) AVX512_HGEMM_KERNEL_CASE(NB, 12)
+
+void avx512_hgemm (const unsigned int M, const unsigned int N, const unsigned int K, const uint16_t *A, const unsigned int lda, 
+    const float *B, const unsigned int ldb, float *C, const unsigned int ldc, const sgemm_epilogue_t *epi)
+{
+    for (unsigned int m = 0; m < M; m += _AVX512_VEC_SIZE_M)
+    {
+        const unsigned int mr = M - m < _AVX512_VEC_SIZE_M ? M - m : _AVX512_VEC_SIZE_M;
+        const unsigned int nb = (mr + _VEC_SIZE_M - 1) / _VEC_SIZE_M;
+        const uint16_t *A_m = A + (size_t) m * lda;
+        sgemm_epilogue_t epi_at;
+        unsigned int n = 0;
+        if (nb == 4)
+        {
+            for (; n + _AVX512_VEC_SIZE_N <= N; n += _AVX512_VEC_SIZE_N)
+                avx512_hgemm_kernel (4, _AVX512_VEC_SIZE_N, mr, K, A_m, lda, B + (size_t) n * ldb, ldb, 
+                    C + (size_t) n * ldc + m, ldc, get_sgemm_epilogue_at (epi, &epi_at, m, n));
+        }
+        for (; n < N; n += _AVX512_VEC_SIZE_N)
+        {
+            const unsigned int nr = N - n < _AVX512_VEC_SIZE_N ? N - n : _AVX512_VEC_SIZE_N;
+            const float *B_n = B + (size_t) n * ldb;
+            float *C_mn = C + (size_t) n * ldc + m;
+            const sgemm_epilogue_t *epi_mn = get_sgemm_epilogue_at (epi, &epi_at, m, n);
+            switch (nb * 16 + nr)
+            {
+                AVX512_HGEMM_KERNEL_CASES(1)
+                AVX512_HGEMM_KERNEL_CASES(2)
+                AVX512_HGEMM_KERNEL_CASES(3)
+                AVX512_HGEMM_KERNEL_CASES(4)
+                default:
+                    ERROR_PRTF ("Error in avx512_hgemm: invalid block %u x %u.\n", mr, nr);
+            }
+        }
+    }
+}
+
+#pragma GCC pop_options
+
+#pragma GCC push_options
+#pragma GCC target ("avx512f,avx512dq,avx512bw,avx512vnni")
+
+// C[mr x NR] = (A * B) * scale + offset for mr <= NB * _VEC_SIZE_M, with two packed INT8 A blocks per zmm register.
+static inline __attribute__((always_inline)) void avx512_vnni_qgemm_kernel (const int NB, const int NR,
+    const unsigned int mr, const unsigned int K, const int8_t *A, const uint8_t *B, const unsigned int ldb, 
+        float *C, const unsigned int ldc, const float *scale, const float *offset)
+{
+    const __mmask16 mask_0 = mr >= 16 ? 0xFFFF : (__mmask16)((1U << mr) - 1);
+    const __mmask16 mask_1 = mr >= 32 ? 0xFFFF : mr > 16 ? (__mmask16)((1U << (mr - 16)) - 1) : 0;
+    const int8_t *A_0 = A, *A_1 = A + _VEC_SIZE_M * K, *A_2 = A + 2 * _VEC_SIZE_M * K, *A_3 = A + 3 * _VEC_SIZE_M * K;
+    __m512i c_0[_AVX512_VEC_SIZE_N], c_1[_AVX512_VEC_SIZE_N];
+    for (int j = 0; j < NR; j++)
+    {
+        c_0[j] = _mm512_setzero_si512 ();
+        c_1[j] = _mm512_setzero_si512 ();
+    }
+    for (unsigned int k = 0; k < K; k += _QGEMM_K_GROUP)
+    {
+        __m512i a_0, a_1 = _mm512_setzero_si512 ();
+        if (NB >= 2)
+            a_0 = _mm512_inserti64x4 (_mm512_castsi256_si512 (_mm256_loadu_si256 ((const __m256i *) (A_0 + k * _VEC_SIZE_M))),
+                _mm256_loadu_si256 ((const __m256i *) (A_1 + k * _VEC_SIZE_M)), 1);
+        else
+            a_0 = _mm512_zextsi256_si512 (_mm256_loadu_si256 ((const __m256i *) (A_0 + k * _VEC_SIZE_M)));
+        if (NB == 4)
+            a_1 = _mm512_inserti64x4 (_mm512_castsi256_si512 (_mm256_loadu_si256 ((const __m256i *) (A_2 + k * _VEC_SIZE_M))),
+                _mm256_loadu_si256 ((const __m256i *) (A_3 + k * _VEC_SIZE_M)), 1);
+        else if (NB == 3)
+            a_1 = _mm512_zextsi256_si512 (_mm256_loadu_si256 ((const __m256i *) (A_2 + k * _VEC_SIZE_M)));
+        for (int j = 0; j < NR; j++)
+        {
+            int32_t b_4;
+            memcpy (&b_4, B + j * ldb + k, sizeof (int32_t));
+            const __m512i b = _mm512_set1_epi32 (b_4);
+            c_0[j] = _mm512_dpbusd_epi32 (c_0[j], b, a_0);
+            if (NB > 2)
+                c_1[j] = _mm512_dpbusd_epi32 (c_1[j], b, a_1);
+        }
+    }
+    const __mmask16 ld_mask_1 = NB == 4 ? 0xFFFF : NB == 3 ? 0xFF : 0;
+    const __m512 s_0 = _mm512_maskz_loadu_ps (NB >= 2 ? 0xFFFF : 0xFF, scale);
+    const __m512 o_0 = _mm512_maskz_loadu_ps (NB >= 2 ? 0xFFFF : 0xFF, offset);
+    const __m512 s_1 = _mm512_maskz_loadu_ps (ld_mask_1, scale + 16), o_1 = _mm512_maskz_loadu_ps (ld_mask_1, offset + 16);
+    for (int j = 0; j < NR; j++)
+    {
+        _mm512_mask_storeu_ps (C + j * ldc, mask_0, _mm512_fmadd_ps (_mm512_cvtepi32_ps (c_0[j]), s_0, o_0));
+        if (NB > 2)
+            _mm512_mask_storeu_ps (C + j * ldc + 16, mask_1, _mm512_fmadd_ps (_mm512_cvtepi32_ps (c_1[j]), s_1, o_1));
+    }
+}
+
+#define AVX512_QGEMM_KERNEL_CASE(NB, NR) \
+    case (NB) * 16 + (NR): avx512_vnni_qgemm_kernel (NB, NR, mr, K, A_m, B_n, ldb, C_mn, ldc, scale + m, offset + m); break;
+#define AVX512_QGEMM_KERNEL_CASES(NB) \
+    AVX512_QGEMM_KERNEL_CASE(NB, 1) AVX512_QGEMM_KERNEL_CASE(NB, 2) AVX512_QGEMM_KERNEL_CASE(NB, 3) \
+    AVX512_QGEMM_KERNEL_CASE(NB, 4) AVX512_QGEMM_KERNEL_CASE(NB, 5) AVX512_QGEMM_KERNEL_CASE(NB, 6) \
+    AVX512_QGEMM_KERNEL_CASE(NB, 7) AVX512_QGEMM_KERNEL_CASE(NB, 8) AVX512_QGEMM_KERNEL_CASE(NB, 9) \
+    AVX512_QGEMM_KERNEL_CASE(NB, 10) AVX512_QGEMM_KERNEL_CASE(NB, 11) AVX512_QGEMM_KERNEL_CASE(NB, 12)
+
+// Scale and offset must be readable up to M rounded up to _VEC_SIZE_M.
+void avx512_vnni_qgemm (const unsigned int M, const unsigned int N, const unsigned int K, const int8_t *A, 
+    const uint8_t *B, const unsigned int ldb, float *C, const unsigned int ldc, const float *scale, const float *offset)
+{
+    for (unsigned int m = 0; m < M; m += _AVX512_VEC_SIZE_M)
+    {
+        const unsigned int mr = M - m < _AVX512_VEC_SIZE_M ? M - m : _AVX512_VEC_SIZE_M;
+        const unsigned int nb = (mr + _VEC_SIZE_M - 1) / _VEC_SIZE_M;
+        const int8_t *A_m = A + (size_t) m * K;
+        unsigned int n = 0;
+        if (nb == 4)
+        {
+            for (; n + _AVX512_VEC_SIZE_N <= N; n += _AVX512_VEC_SIZE_N)
+                avx512_vnni_qgemm_kernel (4, _AVX512_VEC_SIZE_N, mr, K, A_m, B + (size_t) n * ldb, ldb, 
+                    C + (size_t) n * ldc + m, ldc, scale + m, offset + m);
+        }
+        for (; n < N; n += _AVX512_VEC_SIZE_N)
+        {
+            const unsigned int nr = N - n < _AVX512_VEC_SIZE_N ? N - n : _AVX512_VEC_SIZE_N;
+            const uint8_t *B_n = B + (size_t) n * ldb;
+            float *C_mn = C + (size_t) n * ldc + m;
+            switch (nb * 16 + nr)
+            {
+                AVX512_QGEMM_KERNEL_CASES(1)
+                AVX512_QGEMM_KERNEL_CASES(2)
+                AVX512_QGEMM_KERNEL_CASES(3)
+                AVX512_QGEMM_KERNEL_CASES(4)
+                default:
+                    ERROR_PRTF ("Error in avx512_vnni_qgemm: invalid block %u x %u.\n", mr, nr);
+            }
+        }
+    }
+}
+
+#pragma GCC pop_options
+#endif //_AVX2
@@ -1,5 +1,6 @@
 #include <stdio.h>
 #include "aspen.h"
+#include "kernels.h"
 
 char* time_info = BUILD_INFO_TIME;
 char* gcc_info = BUILD_INFO_GCC;
@@ -19,5 +20,9 @@ void print_aspen_build_info(void)
     printf ("5. NVCC Version:\t%s\n", nvcc_info);
     printf ("6. GPU ARCH:\t\t%s\n", gpu_arch_info);
     printf ("7. Build Flags:\t\t%s\n", flag_info);
+    #ifdef AVX2
+    printf ("8. SGEMM Kernels:\t%s\n", sgemm_kernels.name);
+    printf ("9. INT8 GEMM Kernels:\t%s\n", qgemm_kernels.name);
+    #endif
     printf ("\n////////////////////////////////////////////////////////\n\n");
 }
\ No newline at end of file
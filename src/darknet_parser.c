@@ -476,12 +476,14 @@ void parse_section (section *s, aspen_layer_t *layer)
     layer->params [STRIDE] = option_find_int_quiet (options, "stride", 0);
     layer->params [PADDING] = option_find_int_quiet (options, "pad", 0);
     layer->params [DILATION] = option_find_int_quiet (options, "dilation", 0);
+    layer->params [GROUPS] = option_find_int_quiet (options, "groups", 0);
     layer->params [MAT_M] = option_find_int_quiet (options, "M", 0);
     layer->params [MAT_N] = option_find_int_quiet (options, "N", 0);
     layer->params [MAT_K] = option_find_int_quiet (options, "K", 0);
     layer->params [NUM_HIDDEN] = option_find_int_quiet (options, "n_embd", 0);
     layer->params [NUM_HEAD] = option_find_int_quiet (options, "n_head", 0);
     layer->params [MASKED] = option_find_int_quiet (options, "masked", 0);
+    layer->params [WINOGRAD] = option_find_int_quiet (options, "winograd", 1);
     char *activation_s = option_find_str(options, "activation", NULL);
     layer->activation = get_activation(activation_s);
     layer->parent_layers [PARENT_0] = layer + option_find_int_quiet (options, "parent", 0);
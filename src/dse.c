@@ -24,6 +24,23 @@ void *dse_thread_runtime (void* thread_info)
     return NULL;
 }
 
+// Counts ldata as a completed child of its parents, and frees the parent outputs that all children have consumed.
+static void release_parent_ldata (nasm_ldata_t *ldata)
+{
+    for (int pidx = 0; pidx < NUM_PARENT_ELEMENTS; pidx++)
+    {
+        if (ldata->parent_ldata_idx_arr[pidx] == -1)
+            continue;
+        nasm_ldata_t *parent_ldata = &ldata->nasm->ldata_arr[ldata->parent_ldata_idx_arr[pidx]];
+        unsigned int num_child_ldata_completed = atomic_fetch_add (&parent_ldata->num_child_ldata_completed, 1);
+        if (num_child_ldata_completed + 1 == parent_ldata->num_child_ldata && (parent_ldata != parent_ldata->nasm->ldata_arr))
+        {
+            release_ldata_out_mat (parent_ldata);
+            // YELLOW_PRTF ("ldata %d output freed.\n", parent_ldata->layer->layer_idx);
+        }
+    }
+}
+
 void dse_schedule (dse_t *dse)
 {
     if (dse->operating_mode == OPER_MODE_FL_PATH) {
@@ -151,7 +168,8 @@ void dse_schedule (dse_t *dse)
         // }
         // else {
             // printf("\t[Device %d] Compute ninst (N%d L%d)\n", target_device, ninst->ninst_idx, ninst->ldata->layer->layer_idx);
-            if (dse->profile_compute) ninst->compute_start = get_time_secs_offset (dse->target_device);
+            ninst_prof_t *prof = get_ninst_prof (ninst);
+            if (dse->profile_compute && prof) prof->compute_start = get_time_secs_offset (dse->target_device);
             switch (ninst->ldata->layer->type)
             {
                 case CONV_LAYER:
@@ -196,9 +214,12 @@ void dse_schedule (dse_t *dse)
             }
 
             //For logging
-            ninst->computed_time = get_time_secs_offset (dse->target_device);
-            if (dse->profile_compute) ninst->compute_end = ninst->computed_time;
-            ninst->dse_idx = dse->thread_id;
+            if (prof)
+            {
+                prof->computed_time = get_time_secs_offset (dse->target_device);
+                if (dse->profile_compute) prof->compute_end = prof->computed_time;
+                prof->dse_idx = dse->thread_id;
+            }
 
             // For dynamic offloading
             if(dse->is_dynamic_scheduling)
@@ -224,8 +245,11 @@ void dse_schedule (dse_t *dse)
                     
                     // float eft_offloaded = get_eft_offloaded(dse->dynamic_scheduler, dse->net_engine_arr[target_device], dse->target_device, ninst->tile_dims[OUT_H] * ninst->tile_dims[OUT_W] * sizeof(float));
                     
-                    ninst->eft_offloaded = eft_offloaded;
-                    ninst->eft_server = eft_server;
+                    if (prof)
+                    {
+                        prof->eft_offloaded = eft_offloaded;
+                        prof->eft_server = eft_server;
+                    }
 
                     if(eft_offloaded <= eft_server){
                         ninst_set_send_target_device(ninst, dse->num_edge_devices);                        
@@ -238,17 +262,13 @@ void dse_schedule (dse_t *dse)
             if (num_ninst_completed == ninst->ldata->num_ninst - 1)
             {
                 // printf ("\t\t ldata %d completed\n", ninst->ldata->layer->layer_idx);
-                for (int pidx = 0; pidx < NUM_PARENT_ELEMENTS; pidx++)
+                // The inputs of a fused K-attention are read by its V-attention, so they are released with it.
+                if (!ninst->ldata->fused_attention)
+                    release_parent_ldata (ninst->ldata);
+                else if (ninst->ldata->layer->type == V_ATTENTION_LAYER)
                 {
-                    if (ninst->ldata->parent_ldata_idx_arr[pidx] == -1)
-                        continue;
-                    nasm_ldata_t *parent_ldata = &ninst->ldata->nasm->ldata_arr[ninst->ldata->parent_ldata_idx_arr[pidx]];
-                    unsigned int num_child_ldata_completed = atomic_fetch_add (&parent_ldata->num_child_ldata_completed, 1);
-                    if (num_child_ldata_completed + 1 == parent_ldata->num_child_ldata && (parent_ldata != parent_ldata->nasm->ldata_arr))
-                    {
-                        free_ldata_out_mat (parent_ldata);
-                        // YELLOW_PRTF ("ldata %d output freed by DSE %d.\n", parent_ldata->layer->layer_idx, dse->thread_id);
-                    }
+                    release_parent_ldata (&ninst->ldata->nasm->ldata_arr[ninst->ldata->parent_ldata_idx_arr[PARENT_0]]);
+                    release_parent_ldata (ninst->ldata);
                 }
 
                 nasm_t *nasm = ninst->ldata->nasm;
@@ -257,6 +277,7 @@ void dse_schedule (dse_t *dse)
                 {
                     PRTF ("\t\tSignaling nasm completion...\n");
                     // All layers of the nasm is completed.
+                    advance_nasm_kv_cache (nasm);
                     atomic_store (&nasm->completed, 1);
                     rpool_queue_group_t *rpool_queue_group;
                     if (dse->is_multiuser_case) {
@@ -289,7 +310,7 @@ void dse_schedule (dse_t *dse)
 
             // check devices to send to for the computation output
             if (dse->is_fl_offloading && dse->device_mode == DEV_SERVER) {
-                if (atomic_load(&ninst->dev_send_target[DEV_EDGE])) {
+                if (is_dev_send_target(ninst, DEV_EDGE)) {
                     networking_engine *net_engine = dse->net_engine;
                     create_network_buffer_for_ninst (ninst);
                     pthread_mutex_lock(&net_engine->tx_queue->queue_mutex);
@@ -303,7 +324,7 @@ void dse_schedule (dse_t *dse)
                 for (int i = 0; i <= dse->num_edge_devices; i++)
                 {
                     if (i == dse->device_idx) continue;
-                    if (atomic_load(&ninst->dev_send_target[i]) == 1) // Should be offload
+                    if (is_dev_send_target(ninst, i)) // Should be offload
                     {
                         networking_engine *net_engine;
                         if(dse->device_mode == DEV_SERVER) net_engine = dse->net_engine_arr[i];
@@ -322,7 +343,7 @@ void dse_schedule (dse_t *dse)
                 for (int i = 0; i <= dse->num_edge_devices; i++) 
                 {
                     if (i == dse->device_idx) continue;
-                    if (atomic_load(&ninst->dev_send_target[i]) == 1) 
+                    if (is_dev_send_target(ninst, i)) 
                     {
                         networking_engine *net_engine;
                         if(dse->device_mode == DEV_SERVER) net_engine = dse->net_engine_arr[i];
@@ -444,7 +465,8 @@ void dse_schedule_fl (dse_t *dse) {
         printf("\tCompute ninst (N %d, L %d)\n", ninst->ninst_idx, ninst->ldata->layer->layer_idx);
         #endif
 
-        if (dse->profile_compute) ninst->compute_start = get_time_secs_offset (dse->target_device);
+        ninst_prof_t *prof = get_ninst_prof (ninst);
+        if (dse->profile_compute && prof) prof->compute_start = get_time_secs_offset (dse->target_device);
         if (atomic_exchange(&ninst->state, NINST_COMPLETED) == NINST_COMPLETED) ninst->compute_option = NINST_COMPUTE_DUMMY;
 
         switch (ninst->ldata->layer->type)
@@ -491,9 +513,12 @@ void dse_schedule_fl (dse_t *dse) {
         }
 
         // For logging
-        ninst->computed_time = get_time_secs_offset (dse->target_device);
-        if (dse->profile_compute) ninst->compute_end = ninst->computed_time;
-        ninst->dse_idx = dse->thread_id;
+        if (prof)
+        {
+            prof->computed_time = get_time_secs_offset (dse->target_device);
+            if (dse->profile_compute) prof->compute_end = prof->computed_time;
+            prof->dse_idx = dse->thread_id;
+        }
 
         // Check devices to send the computation output to server
         if (dse->device_mode == DEV_EDGE && ninst->ldata->layer->layer_idx == path->edge_final_layer_idx)
@@ -59,6 +59,14 @@ void set_layer_inout_sizes (aspen_layer_t *layer)
             layer->params[STRIDE] = 1;
         if (layer->params[DILATION] == 0)
             layer->params[DILATION] = 1;
+        if (layer->params[GROUPS] == 0)
+            layer->params[GROUPS] = 1;
+        if (layer->params[IN_C] % layer->params[GROUPS] != 0 || layer->params[OUT_C] % layer->params[GROUPS] != 0)
+        {
+            ERROR_PRTF ("Error in set_layer_inout_sizes: layer %d has %d groups for %d input and %d output channels.\n",
+                layer->layer_idx, layer->params[GROUPS], layer->params[IN_C], layer->params[OUT_C]);
+            assert (0);
+        }
         layer->params[OUT_H] = (layer->params[IN_H] + 2*layer->params[PADDING] - layer->params[DILATION]*(layer->params[WEIGHT_H] - 1) - 1) / layer->params[STRIDE] + 1;
         layer->params[OUT_W] = (layer->params[IN_W] + 2*layer->params[PADDING] - layer->params[DILATION]*(layer->params[WEIGHT_W] - 1) - 1) / layer->params[STRIDE] + 1;
         return;
@@ -0,0 +1,593 @@
+#include "kernels.h"
+#ifdef AVX2
+#include <stdatomic.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+// Shape-specialized SGEMM kernels, generated as x86-64 machine code when a NASM is created.
+// A kernel computes one tiled_sgemm_block call, C[M x N] = epi (C + A[M x K] * B[K x N]), for one exact shape:
+// lda, ldb, ldc and ldr are folded into the address displacements, the K loop is unrolled with its remainder peeled,
+// and the edge rows and columns get their own register tiles instead of the generic remainder paths.
+// AVX-512 hosts get 32 x 12 zmm register tiles, other hosts 16 x 6 ymm tiles. Every C element takes its FMAs
+// in k order starting from C, and the epilogue in the order of avx512_epilogue, so results match the AVX-512 kernels
+// and avx2_sgemm_epilogue bit for bit, and the unrolled AVX2 tile kernels up to rounding.
+// Kernels are cached by shape for the life of the process, and never freed.
+
+#define JIT_CACHE_SIZE 4096
+#define JIT_AVX2_K_UNROLL 8
+#define JIT_AVX512_K_UNROLL 4
+#define JIT_MAX_TILES ((_TILE_SIZE_M / _VEC_SIZE_M) * (_TILE_SIZE_N / (_VEC_SIZE_N / 2) + 1))
+
+typedef struct
+{
+    jit_sgemm_shape_t shape;
+    _Atomic (jit_sgemm_kernel_t) kernel;
+} jit_sgemm_entry_t;
+
+static jit_sgemm_entry_t jit_sgemm_cache[JIT_CACHE_SIZE];
+static atomic_uint jit_sgemm_num_kernels;
+static pthread_mutex_t jit_sgemm_mutex = PTHREAD_MUTEX_INITIALIZER;
+static jit_sgemm_shape_t *jit_pending_arr = NULL;
+static unsigned int jit_num_pending = 0, jit_pending_capacity = 0;
+
+// Row masks for vmaskmovps: 8 rows from &jit_mask_table[8 - r] enable the first r.
+static const int32_t jit_mask_table[16] __attribute__((aligned(64))) = {-1, -1, -1, -1, -1, -1, -1, -1};
+static const float jit_leaky_slope = 0.1f;
+
+enum {RAX = 0, RCX, RDX, RBX, RSP, RBP, RSI, RDI, R8, R9, R10, R11, R12, R13, R14, R15};
+
+typedef struct
+{
+    unsigned char *code;
+    size_t size, capacity;
+} jit_buf_t;
+
+// Generator state for one kernel. Registers: r9, r10, r11 point at the A, B and C of the register tile,
+// r12 and r13 at its bias and residual. Vector registers: the accumulators, then 2 A registers and 1 B register.
+typedef struct
+{
+    jit_buf_t buf;
+    const jit_sgemm_shape_t *shape;
+    int avx512;
+    unsigned int tile_m, tile_n, vec_m; // Register tile rows and columns, rows per vector register.
+    unsigned int reg_a, reg_b;
+} jit_ctx_t;
+
+static void jit_byte (jit_buf_t *buf, unsigned int byte)
+{
+    if (buf->size == buf->capacity)
+    {
+        buf->capacity = buf->capacity ? buf->capacity * 2 : 4096;
+        buf->code = realloc (buf->code, buf->capacity);
+    }
+    buf->code[buf->size++] = byte;
+}
+
+static void jit_dword (jit_buf_t *buf, uint32_t dword)
+{
+    for (int i = 0; i < 4; i++)
+        jit_byte (buf, (dword >> (8 * i)) & 0xFF);
+}
+
+static void jit_patch_rel32 (jit_buf_t *buf, size_t pos, size_t target)
+{
+    const int32_t rel = (int32_t) (target - (pos + 4));
+    memcpy (buf->code + pos, &rel, 4);
+}
+
+// ModRM of a register operand rm (base < 0), or of [base + disp]. EVEX disp8 is scaled by N.
+static void jit_modrm (jit_buf_t *buf, int reg, int rm, int base, int32_t disp, int N)
+{
+    if (base < 0)
+    {
+        jit_byte (buf, 0xC0 | (reg & 7) << 3 | (rm & 7));
+        return;
+    }
+    const int disp8 = disp % N == 0 && disp / N >= -128 && disp / N <= 127;
+    jit_byte (buf, (disp8 ? 0x40 : 0x80) | (reg & 7) << 3 | (base & 7));
+    if ((base & 7) == RSP)
+        jit_byte (buf, 0x24);
+    if (disp8)
+        jit_byte (buf, (disp / N) & 0xFF);
+    else
+        jit_dword (buf, disp);
+}
+
+// 3-byte VEX, W0. map: 1 = 0F, 2 = 0F38, 3 = 0F3A. pp: 0 = none, 1 = 66.
+static void jit_vex (jit_buf_t *buf, int map, int pp, int L, int opcode, int reg, int vvvv, int rm, int base, int32_t disp)
+{
+    const int b = base >= 0 ? base : rm;
+    jit_byte (buf, 0xC4);
+    jit_byte (buf, (~reg & 8) << 4 | 0x40 | (~b & 8) << 2 | map);
+    jit_byte (buf, (~vvvv & 15) << 3 | L << 2 | pp);
+    jit_byte (buf, opcode);
+    jit_modrm (buf, reg, rm, base, disp, 1);
+}
+
+// EVEX, W0, no broadcast. LL: 1 = ymm, 2 = zmm. mask is the opmask register, zero selects zeroing masking.
+static void jit_evex (jit_buf_t *buf, int map, int pp, int LL, int opcode, int reg, int vvvv, int rm, int base, int32_t disp,
+    int N, int mask, int zero)
+{
+    const int b = base >= 0 ? base : rm;
+    const int x = base >= 0 ? 0 : rm;
+    jit_byte (buf, 0x62);
+    jit_byte (buf, (~reg & 8) << 4 | (~x & 16) << 2 | (~b & 8) << 2 | (~reg & 16) | map);
+    jit_byte (buf, (~vvvv & 15) << 3 | 4 | pp);
+    jit_byte (buf, zero << 7 | LL << 5 | (~vvvv & 16) >> 1 | mask);
+    jit_byte (buf, opcode);
+    jit_modrm (buf, reg, rm, base, disp, N);
+}
+
+static void jit_push (jit_buf_t *buf, int reg)
+{
+    if (reg >= R8)
+        jit_byte (buf, 0x41);
+    jit_byte (buf, 0x50 | (reg & 7));
+}
+
+static void jit_pop (jit_buf_t *buf, int reg)
+{
+    if (reg >= R8)
+        jit_byte (buf, 0x41);
+    jit_byte (buf, 0x58 | (reg & 7));
+}
+
+// lea dst, [base + disp]
+static void jit_lea (jit_buf_t *buf, int dst, int base, int32_t disp)
+{
+    jit_byte (buf, 0x48 | (dst & 8) >> 1 | (base & 8) >> 3);
+    jit_byte (buf, 0x8D);
+    jit_modrm (buf, dst, 0, base, disp, 1);
+}
+
+// add reg, imm32
+static void jit_add_imm (jit_buf_t *buf, int reg, int32_t imm)
+{
+    jit_byte (buf, 0x48 | (reg & 8) >> 3);
+    jit_byte (buf, 0x81);
+    jit_modrm (buf, 0, reg, -1, 0, 1);
+    jit_dword (buf, imm);
+}
+
+// movabs rbx, ptr
+static void jit_mov_rbx_ptr (jit_buf_t *buf, const void *ptr)
+{
+    const uint64_t imm = (uintptr_t) ptr;
+    jit_byte (buf, 0x48);
+    jit_byte (buf, 0xBB);
+    jit_dword (buf, imm & 0xFFFFFFFF);
+    jit_dword (buf, imm >> 32);
+}
+
+// C[rows of vector v, column j] offset of the register tile, in bytes.
+static int32_t jit_c_disp (const jit_ctx_t *ctx, unsigned int v, unsigned int j, unsigned int ld)
+{
+    return (int32_t) ((size_t) j * ld * sizeof(float) + v * ctx->vec_m * sizeof(float));
+}
+
+static unsigned int jit_acc (const jit_ctx_t *ctx, unsigned int v, unsigned int j)
+{
+    return v * ctx->tile_n + j;
+}
+
+// Vector load or store of [base + disp], masked by the row mask of vector v if masked (k1 + v, or ymm15 on AVX2).
+static void jit_load (jit_ctx_t *ctx, int reg, int base, int32_t disp, unsigned int v, int masked)
+{
+    if (ctx->avx512)
+        jit_evex (&ctx->buf, 1, 0, 2, 0x10, reg, 0, 0, base, disp, 64, 1 + v, 1);
+    else if (masked)
+        jit_vex (&ctx->buf, 2, 1, 1, 0x2C, reg, 15, 0, base, disp);
+    else
+        jit_vex (&ctx->buf, 1, 0, 1, 0x10, reg, 0, 0, base, disp);
+}
+
+static void jit_store (jit_ctx_t *ctx, int reg, int base, int32_t disp, unsigned int v, int masked)
+{
+    if (ctx->avx512)
+        jit_evex (&ctx->buf, 1, 0, 2, 0x11, reg, 0, 0, base, disp, 64, 1 + v, 0);
+    else if (masked)
+        jit_vex (&ctx->buf, 2, 1, 1, 0x2E, reg, 15, 0, base, disp);
+    else
+        jit_vex (&ctx->buf, 1, 0, 1, 0x11, reg, 0, 0, base, disp);
+}
+
+static void jit_broadcast (jit_ctx_t *ctx, int reg, int base, int32_t disp)
+{
+    if (ctx->avx512)
+        jit_evex (&ctx->buf, 2, 1, 2, 0x18, reg, 0, 0, base, disp, 4, 0, 0);
+    else
+        jit_vex (&ctx->buf, 2, 1, 1, 0x18, reg, 0, 0, base, disp);
+}
+
+// dst = op (src_1, src_2) on registers. map 1, pp 0 opcodes: 0x57 xorps, 0x58 addps, 0x59 mulps, 0x5F maxps.
+// map 2, pp 1 opcode 0xB8 is vfmadd231ps, dst += src_1 * src_2.
+static void jit_op (jit_ctx_t *ctx, int map, int pp, int opcode, int dst, int src_1, int src_2)
+{
+    if (ctx->avx512)
+        jit_evex (&ctx->buf, map, pp, 2, opcode, dst, src_1, src_2, -1, 0, 1, 0, 0);
+    else
+        jit_vex (&ctx->buf, map, pp, 1, opcode, dst, src_1, src_2, -1, 0);
+}
+
+// A rows of vector v of the register tile at k = u, from the packed blocks of _VEC_SIZE_M rows.
+// On AVX-512 a zmm register takes two blocks: the first is broadcast to both halves, the second inserted above it.
+static void jit_load_a (jit_ctx_t *ctx, unsigned int v, unsigned int num_blocks, unsigned int u)
+{
+    const int reg = ctx->reg_a + v;
+    const size_t block_size = (size_t) _VEC_SIZE_M * ctx->shape->lda * sizeof(float);
+    const int32_t k_disp = u * _VEC_SIZE_M * sizeof(float);
+    if (!ctx->avx512)
+    {
+        jit_vex (&ctx->buf, 1, 0, 1, 0x10, reg, 0, 0, R9, (int32_t) (v * block_size) + k_disp);
+        return;
+    }
+    // vbroadcastf32x8 reg, m256
+    jit_evex (&ctx->buf, 2, 1, 2, 0x1B, reg, 0, 0, R9, (int32_t) (2 * v * block_size) + k_disp, 32, 0, 0);
+    if (2 * v + 1 < num_blocks)
+    {
+        // vinsertf32x8 reg, reg, m256, 1
+        jit_evex (&ctx->buf, 3, 1, 2, 0x1A, reg, reg, 0, R9, (int32_t) ((2 * v + 1) * block_size) + k_disp, 32, 0, 0);
+        jit_byte (&ctx->buf, 1);
+    }
+}
+
+static void jit_k_step (jit_ctx_t *ctx, unsigned int mr, unsigned int nr, unsigned int u)
+{
+    const unsigned int num_vec = (mr + ctx->vec_m - 1) / ctx->vec_m;
+    const unsigned int num_blocks = (mr + _VEC_SIZE_M - 1) / _VEC_SIZE_M;
+    for (unsigned int v = 0; v < num_vec; v++)
+        jit_load_a (ctx, v, num_blocks, u);
+    for (unsigned int j = 0; j < nr; j++)
+    {
+        jit_broadcast (ctx, ctx->reg_b, R10, (int32_t) (((size_t) j * ctx->shape->ldb + u) * sizeof(float)));
+        for (unsigned int v = 0; v < num_vec; v++)
+            jit_op (ctx, 2, 1, 0xB8, jit_acc (ctx, v, j), ctx->reg_a + v, ctx->reg_b);
+    }
+}
+
+// Register tile of mr x nr, as a subroutine taking its A, B, C, bias and residual in r9 to r13.
+static void jit_emit_tile (jit_ctx_t *ctx, unsigned int mr, unsigned int nr)
+{
+    const jit_sgemm_shape_t *shape = ctx->shape;
+    jit_buf_t *buf = &ctx->buf;
+    const unsigned int num_vec = (mr + ctx->vec_m - 1) / ctx->vec_m;
+    const int edge = mr % ctx->vec_m != 0;
+    if (ctx->avx512)
+    {
+        for (unsigned int v = 0; v < num_vec; v++)
+        {
+            const unsigned int rows = mr - v * ctx->vec_m < ctx->vec_m ? mr - v * ctx->vec_m : ctx->vec_m;
+            // mov eax, mask; kmovw k(1 + v), eax
+            jit_byte (buf, 0xB8);
+            jit_dword (buf, (1U << rows) - 1);
+            jit_vex (buf, 1, 0, 0, 0x92, 1 + v, 0, RAX, -1, 0);
+        }
+    }
+    else if (edge)
+    {
+        jit_mov_rbx_ptr (buf, jit_mask_table + _VEC_SIZE_M - mr % _VEC_SIZE_M);
+        jit_vex (buf, 1, 0, 1, 0x10, 15, 0, 0, RBX, 0);
+    }
+    for (unsigned int j = 0; j < nr; j++)
+        for (unsigned int v = 0; v < num_vec; v++)
+            jit_load (ctx, jit_acc (ctx, v, j), R11, jit_c_disp (ctx, v, j, shape->ldc), v, edge && v == num_vec - 1);
+    const unsigned int max_unroll = ctx->avx512 ? JIT_AVX512_K_UNROLL : JIT_AVX2_K_UNROLL;
+    const unsigned int unroll = shape->K <= 2 * max_unroll ? shape->K : max_unroll;
+    const unsigned int num_iter = shape->K / unroll;
+    unsigned int num_peeled = shape->K;
+    if (num_iter > 1)
+    {
+        // mov eax, num_iter; loop: unroll steps; add r9, r10; dec eax; jnz loop
+        jit_byte (buf, 0xB8);
+        jit_dword (buf, num_iter);
+        const size_t loop_start = buf->size;
+        for (unsigned int u = 0; u < unroll; u++)
+            jit_k_step (ctx, mr, nr, u);
+        jit_add_imm (buf, R9, unroll * _VEC_SIZE_M * sizeof(float));
+        jit_add_imm (buf, R10, unroll * sizeof(float));
+        jit_byte (buf, 0xFF);
+        jit_byte (buf, 0xC8);
+        jit_byte (buf, 0x0F);
+        jit_byte (buf, 0x85);
+        jit_dword (buf, 0);
+        jit_patch_rel32 (buf, buf->size - 4, loop_start);
+        num_peeled = shape->K % unroll;
+    }
+    for (unsigned int u = 0; u < num_peeled; u++)
+        jit_k_step (ctx, mr, nr, u);
+    if (shape->has_epilogue)
+    {
+        const int temp_0 = ctx->reg_a, temp_1 = ctx->reg_a + 1;
+        if (shape->has_bias)
+        {
+            for (unsigned int v = 0; v < num_vec; v++)
+                jit_load (ctx, ctx->reg_a + v, R12, v * ctx->vec_m * sizeof(float), v, edge && v == num_vec - 1);
+            for (unsigned int j = 0; j < nr; j++)
+                for (unsigned int v = 0; v < num_vec; v++)
+                    jit_op (ctx, 1, 0, 0x58, jit_acc (ctx, v, j), jit_acc (ctx, v, j), ctx->reg_a + v);
+        }
+        if (shape->has_residual)
+        {
+            for (unsigned int j = 0; j < nr; j++)
+                for (unsigned int v = 0; v < num_vec; v++)
+                {
+                    jit_load (ctx, ctx->reg_b, R13, jit_c_disp (ctx, v, j, shape->ldr), v, edge && v == num_vec - 1);
+                    jit_op (ctx, 1, 0, 0x58, jit_acc (ctx, v, j), jit_acc (ctx, v, j), ctx->reg_b);
+                }
+        }
+        if (shape->activation == RELU)
+            jit_op (ctx, 1, 0, 0x57, temp_0, temp_0, temp_0);
+        else if (shape->activation == LEAKY_RELU)
+        {
+            jit_mov_rbx_ptr (buf, &jit_leaky_slope);
+            jit_broadcast (ctx, temp_0, RBX, 0);
+        }
+        for (unsigned int j = 0; j < nr; j++)
+            for (unsigned int v = 0; v < num_vec; v++)
+            {
+                const int acc = jit_acc (ctx, v, j);
+                if (shape->activation == RELU)
+                    jit_op (ctx, 1, 0, 0x5F, acc, acc, temp_0);
+                else if (shape->activation == LEAKY_RELU)
+                {
+                    jit_op (ctx, 1, 0, 0x59, temp_1, acc, temp_0);
+                    jit_op (ctx, 1, 0, 0x5F, acc, acc, temp_1);
+                }
+            }
+    }
+    for (unsigned int j = 0; j < nr; j++)
+        for (unsigned int v = 0; v < num_vec; v++)
+            jit_store (ctx, jit_acc (ctx, v, j), R11, jit_c_disp (ctx, v, j, shape->ldc), v, edge && v == num_vec - 1);
+    jit_byte (buf, 0xC3);
+}
+
+// Whether every displacement of the kernel fits in 32 bits.
+static int jit_shape_fits (const jit_sgemm_shape_t *shape)
+{
+    const size_t max_disp = INT32_MAX / 2;
+    return shape->M > 0 && shape->N > 0 && shape->K > 0 && shape->M <= _TILE_SIZE_M && shape->N <= _TILE_SIZE_N
+        && (size_t) shape->M * shape->lda * sizeof(float) + (size_t) shape->K * _VEC_SIZE_M * sizeof(float) < max_disp
+        && (size_t) (shape->N + 1) * shape->ldb * sizeof(float) + shape->K * sizeof(float) < max_disp
+        && (size_t) (shape->N + 1) * shape->ldc * sizeof(float) < max_disp
+        && (size_t) (shape->N + 1) * shape->ldr * sizeof(float) < max_disp;
+}
+
+// Kernel entry: walks the register tiles with a call to the tile subroutine of each, void (A, B, C, bias, residual).
+static void jit_emit_kernel (jit_ctx_t *ctx)
+{
+    const jit_sgemm_shape_t *shape = ctx->shape;
+    jit_buf_t *buf = &ctx->buf;
+    size_t call_pos[JIT_MAX_TILES];
+    unsigned int call_tile[JIT_MAX_TILES];
+    unsigned int num_calls = 0;
+    jit_push (buf, RBX);
+    jit_push (buf, R12);
+    jit_push (buf, R13);
+    for (unsigned int m = 0; m < shape->M; m += ctx->tile_m)
+    {
+        for (unsigned int n = 0; n < shape->N; n += ctx->tile_n)
+        {
+            jit_lea (buf, R9, RDI, (int32_t) ((size_t) m * shape->lda * sizeof(float)));
+            jit_lea (buf, R10, RSI, (int32_t) ((size_t) n * shape->ldb * sizeof(float)));
+            jit_lea (buf, R11, RDX, jit_c_disp (ctx, 0, n, shape->ldc) + m * sizeof(float));
+            if (shape->has_bias)
+                jit_lea (buf, R12, RCX, m * sizeof(float));
+            if (shape->has_residual)
+                jit_lea (buf, R13, R8, jit_c_disp (ctx, 0, n, shape->ldr) + m * sizeof(float));
+            jit_byte (buf, 0xE8);
+            call_pos[num_calls] = buf->size;
+            call_tile[num_calls++] = (shape->M - m < ctx->tile_m) * 2 + (shape->N - n < ctx->tile_n);
+            jit_dword (buf, 0);
+        }
+    }
+    // vzeroupper
+    jit_byte (buf, 0xC5);
+    jit_byte (buf, 0xF8);
+    jit_byte (buf, 0x77);
+    jit_pop (buf, R13);
+    jit_pop (buf, R12);
+    jit_pop (buf, RBX);
+    jit_byte (buf, 0xC3);
+    for (unsigned int tile = 0; tile < 4; tile++)
+    {
+        const unsigned int mr = tile & 2 ? shape->M % ctx->tile_m : ctx->tile_m;
+        const unsigned int nr = tile & 1 ? shape->N % ctx->tile_n : ctx->tile_n;
+        size_t tile_start = buf->size;
+        int is_used = 0;
+        for (unsigned int i = 0; i < num_calls; i++)
+        {
+            if (call_tile[i] != tile)
+                continue;
+            if (!is_used)
+            {
+                jit_emit_tile (ctx, mr, nr);
+                is_used = 1;
+            }
+            jit_patch_rel32 (buf, call_pos[i], tile_start);
+        }
+    }
+}
+
+static unsigned int jit_hash_shape (const jit_sgemm_shape_t *shape)
+{
+    const unsigned int *words = (const unsigned int *) shape;
+    unsigned int hash = 2166136261U;
+    for (unsigned int i = 0; i < sizeof(jit_sgemm_shape_t) / sizeof(unsigned int); i++)
+        hash = (hash ^ words[i]) * 16777619U;
+    return hash % JIT_CACHE_SIZE;
+}
+
+static jit_sgemm_kernel_t jit_sgemm_lookup (const jit_sgemm_shape_t *shape)
+{
+    for (unsigned int i = jit_hash_shape (shape), probe = 0; probe < JIT_CACHE_SIZE; i = (i + 1) % JIT_CACHE_SIZE, probe++)
+    {
+        jit_sgemm_kernel_t kernel = atomic_load_explicit (&jit_sgemm_cache[i].kernel, memory_order_acquire);
+        if (kernel == NULL)
+            return NULL;
+        if (memcmp (&jit_sgemm_cache[i].shape, shape, sizeof(jit_sgemm_shape_t)) == 0)
+            return kernel;
+    }
+    return NULL;
+}
+
+// Called with jit_sgemm_mutex held. Readers see the shape before the kernel.
+static void jit_sgemm_insert (const jit_sgemm_shape_t *shape, jit_sgemm_kernel_t kernel)
+{
+    if (atomic_load (&jit_sgemm_num_kernels) >= JIT_CACHE_SIZE / 2)
+        return;
+    unsigned int i = jit_hash_shape (shape);
+    while (atomic_load_explicit (&jit_sgemm_cache[i].kernel, memory_order_relaxed) != NULL)
+        i = (i + 1) % JIT_CACHE_SIZE;
+    jit_sgemm_cache[i].shape = *shape;
+    atomic_store_explicit (&jit_sgemm_cache[i].kernel, kernel, memory_order_release);
+    atomic_fetch_add (&jit_sgemm_num_kernels, 1);
+}
+
+// Sets shape to the key of a tiled_sgemm_block call.
+void set_jit_sgemm_shape (jit_sgemm_shape_t *shape, const unsigned int M, const unsigned int N, const unsigned int K,
+    const unsigned int lda, const unsigned int ldb, const unsigned int ldc, const sgemm_epilogue_t *epi)
+{
+    memset (shape, 0, sizeof(jit_sgemm_shape_t));
+    shape->M = M;
+    shape->N = N;
+    shape->K = K;
+    shape->lda = lda;
+    shape->ldb = ldb;
+    shape->ldc = ldc;
+    if (epi == NULL)
+        return;
+    shape->has_epilogue = 1;
+    shape->has_bias = epi->bias != NULL;
+    shape->has_residual = epi->residual != NULL;
+    shape->ldr = epi->residual != NULL ? epi->ldr : 0;
+    shape->activation = epi->activation;
+}
+
+// Queues a kernel for the next jit_sgemm_generate.
+void jit_sgemm_request (const jit_sgemm_shape_t *shape)
+{
+    if (!jit_shape_fits (shape))
+        return;
+    pthread_mutex_lock (&jit_sgemm_mutex);
+    int is_new = jit_sgemm_lookup (shape) == NULL;
+    for (unsigned int i = 0; i < jit_num_pending && is_new; i++)
+        is_new = memcmp (&jit_pending_arr[i], shape, sizeof(jit_sgemm_shape_t)) != 0;
+    if (is_new)
+    {
+        if (jit_num_pending == jit_pending_capacity)
+        {
+            jit_pending_capacity = jit_pending_capacity ? jit_pending_capacity * 2 : 64;
+            jit_pending_arr = realloc (jit_pending_arr, jit_pending_capacity * sizeof(jit_sgemm_shape_t));
+        }
+        jit_pending_arr[jit_num_pending++] = *shape;
+    }
+    pthread_mutex_unlock (&jit_sgemm_mutex);
+}
+
+// Generates the queued kernels into one executable mapping and adds them to the cache.
+void jit_sgemm_generate (void)
+{
+    pthread_mutex_lock (&jit_sgemm_mutex);
+    if (jit_num_pending == 0)
+    {
+        pthread_mutex_unlock (&jit_sgemm_mutex);
+        return;
+    }
+    const int avx512 = __builtin_cpu_supports ("avx512f") && __builtin_cpu_supports ("avx512dq");
+    jit_buf_t *code_arr = calloc (jit_num_pending, sizeof(jit_buf_t));
+    size_t total_size = 0;
+    for (unsigned int i = 0; i < jit_num_pending; i++)
+    {
+        jit_ctx_t ctx = {.shape = &jit_pending_arr[i], .avx512 = avx512};
+        ctx.tile_m = avx512 ? _AVX512_VEC_SIZE_M : 2 * _VEC_SIZE_M;
+        ctx.tile_n = avx512 ? _AVX512_VEC_SIZE_N : _VEC_SIZE_N / 2;
+        ctx.vec_m = avx512 ? 2 * _VEC_SIZE_M : _VEC_SIZE_M;
+        ctx.reg_a = 2 * ctx.tile_n;
+        ctx.reg_b = ctx.reg_a + 2;
+        jit_emit_kernel (&ctx);
+        code_arr[i] = ctx.buf;
+        total_size += get_smallest_dividable (ctx.buf.size, 64);
+    }
+    const size_t map_size = get_smallest_dividable (total_size, sysconf (_SC_PAGESIZE));
+    unsigned char *map = mmap (NULL, map_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (map == MAP_FAILED)
+    {
+        ERROR_PRTF ("Error in jit_sgemm_generate: mmap of %zu bytes failed.\n", map_size);
+    }
+    else
+    {
+        size_t offset = 0;
+        for (unsigned int i = 0; i < jit_num_pending; i++)
+        {
+            memcpy (map + offset, code_arr[i].code, code_arr[i].size);
+            offset += get_smallest_dividable (code_arr[i].size, 64);
+        }
+        if (mprotect (map, map_size, PROT_READ | PROT_EXEC) != 0)
+        {
+            ERROR_PRTF ("Error in jit_sgemm_generate: mprotect failed.\n");
+            munmap (map, map_size);
+        }
+        else
+        {
+            offset = 0;
+            for (unsigned int i = 0; i < jit_num_pending; i++)
+            {
+                jit_sgemm_insert (&jit_pending_arr[i], (jit_sgemm_kernel_t) (map + offset));
+                offset += get_smallest_dividable (code_arr[i].size, 64);
+            }
+        }
+    }
+    for (unsigned int i = 0; i < jit_num_pending; i++)
+        free (code_arr[i].code);
+    free (code_arr);
+    jit_num_pending = 0;
+    pthread_mutex_unlock (&jit_sgemm_mutex);
+}
+
+// Runs a tiled_sgemm_block call on its generated kernel. Returns 0 if there is none.
+// Activations other than RELU and LEAKY_RELU are applied to the stored tile.
+int jit_sgemm_block (const unsigned int M, const unsigned int N, const unsigned int K,
+    const float *A, const unsigned int lda, const float *B, const unsigned int ldb, float *C, const unsigned int ldc,
+        const sgemm_epilogue_t *epi)
+{
+    if (atomic_load_explicit (&jit_sgemm_num_kernels, memory_order_relaxed) == 0)
+        return 0;
+    jit_sgemm_shape_t shape;
+    set_jit_sgemm_shape (&shape, M, N, K, lda, ldb, ldc, epi);
+    jit_sgemm_kernel_t kernel = jit_sgemm_lookup (&shape);
+    if (kernel == NULL)
+        return 0;
+    kernel (A, B, C, epi != NULL ? epi->bias : NULL, epi != NULL ? epi->residual : NULL);
+    if (epi != NULL && epi->activation != NO_ACTIVATION && epi->activation != LINEAR
+        && epi->activation != RELU && epi->activation != LEAKY_RELU)
+    {
+        for (unsigned int n = 0; n < N; n++)
+            ACTIVATE (C + (size_t) n * ldc, M, epi->activation);
+    }
+    return 1;
+}
+
+#else
+
+void set_jit_sgemm_shape (jit_sgemm_shape_t *shape, const unsigned int M, const unsigned int N, const unsigned int K,
+    const unsigned int lda, const unsigned int ldb, const unsigned int ldc, const sgemm_epilogue_t *epi)
+{
+    memset (shape, 0, sizeof(jit_sgemm_shape_t));
+}
+
+void jit_sgemm_request (const jit_sgemm_shape_t *shape)
+{
+}
+
+void jit_sgemm_generate (void)
+{
+}
+
+int jit_sgemm_block (const unsigned int M, const unsigned int N, const unsigned int K,
+    const float *A, const unsigned int lda, const float *B, const unsigned int ldb, float *C, const unsigned int ldc,
+        const sgemm_epilogue_t *epi)
+{
+    return 0;
+}
+
+#endif
@@ -56,12 +56,12 @@ void naive_activate (float *input, unsigned int num_elements, LAYER_ACT activati
         ERROR_PRTF ("Error in naive_activate: unknown activation type.\n");
 }
 
-// Input and output is in NHWC format. Kernel is in (O/8)HWI8 format.
+// Input and output is in NHWC format. Kernel is in (O/8)HWI8 format, with I = input_channels / groups.
 void naive_conv2d
 (const float *input, const float *kernel, const float *bias, float *output, 
     unsigned int batch_size, unsigned int input_channels, unsigned int height, unsigned int width,  
         unsigned int output_channels, unsigned int kernel_width , unsigned int kernel_height, 
-            unsigned int stride, unsigned int padding)
+            unsigned int stride, unsigned int padding, unsigned int dilation, unsigned int groups)
 {
     #ifdef DEBUG
     if (input == NULL)
@@ -71,8 +71,14 @@ void naive_conv2d
     if (output == NULL)
         ERROR_PRTF ("Error in naive_convolution: output is NULL.\n");
     #endif
-    unsigned int output_width = (width - kernel_width + 2 * padding) / stride + 1;
-    unsigned int output_height = (height - kernel_height + 2 * padding) / stride + 1;
+    if (dilation < 1)
+        dilation = 1;
+    if (groups < 1)
+        groups = 1;
+    unsigned int output_width = (width + 2 * padding - dilation * (kernel_width - 1) - 1) / stride + 1;
+    unsigned int output_height = (height + 2 * padding - dilation * (kernel_height - 1) - 1) / stride + 1;
+    const unsigned int in_c_per_group = input_channels / groups;
+    const unsigned int out_c_per_group = output_channels / groups;
 
     #pragma omp parallel for collapse(3)
     for (unsigned int b = 0; b < batch_size; b++)
@@ -90,17 +96,17 @@ void naive_conv2d
                     {
                         for (unsigned int kw = 0; kw < kernel_width; kw++)
                         {
-                            int ih = oh * stride + kh - padding;
-                            int iw = ow * stride + kw - padding;
+                            int ih = oh * stride + kh * dilation - padding;
+                            int iw = ow * stride + kw * dilation - padding;
                             if (ih >= 0 && ih < height && iw >= 0 && iw < width)
                             {
-                                unsigned int kernel_index = ((oc/_VEC_SIZE_M) * kernel_width * kernel_height * input_channels + 
-                                    kh * kernel_width * input_channels + 
-                                    kw * input_channels) * _VEC_SIZE_M + (oc%_VEC_SIZE_M);
+                                unsigned int kernel_index = ((oc/_VEC_SIZE_M) * kernel_width * kernel_height * in_c_per_group + 
+                                    kh * kernel_width * in_c_per_group + 
+                                    kw * in_c_per_group) * _VEC_SIZE_M + (oc%_VEC_SIZE_M);
                                 unsigned int input_index = b * width * height * input_channels + 
                                     ih * width * input_channels + 
-                                    iw * input_channels;
-                                for (unsigned int ic = 0; ic < input_channels; ic++)
+                                    iw * input_channels + (oc / out_c_per_group) * in_c_per_group;
+                                for (unsigned int ic = 0; ic < in_c_per_group; ic++)
                                 {
                                     output[output_index] += input[input_index + ic] * kernel[kernel_index + ic* _VEC_SIZE_M];
                                 }
@@ -115,6 +121,85 @@ void naive_conv2d
     }
 }
 
+// Direct grouped conv of a ninst tile: output rows [m0, m0 + M) of N columns, with num_taps input pointers per column 
+// (NULL for padding) pointing at channel 0 of the input pixel. Kernel is the (O/8)HWI8 tile starting at row m0.
+void naive_grouped_conv (const unsigned int M, const unsigned int N, const unsigned int m0, const unsigned int num_taps,
+    const unsigned int in_c_per_group, const unsigned int out_c_per_group, const float *kernel, const float **input_ptr_arr,
+        float *C, const unsigned int ldc, const float *bias)
+{
+    const unsigned int K = num_taps * in_c_per_group;
+    for (unsigned int n = 0; n < N; n++)
+    {
+        const float **ptr_arr = input_ptr_arr + (size_t) n * num_taps;
+        float *out = C + (size_t) n * ldc;
+        for (unsigned int m = 0; m < M; m++)
+        {
+            const unsigned int c0 = ((m0 + m) / out_c_per_group) * in_c_per_group;
+            const float *k_ptr = kernel + (size_t) (m / _VEC_SIZE_M) * K * _VEC_SIZE_M + m % _VEC_SIZE_M;
+            float sum = bias != NULL ? bias[m] : 0;
+            for (unsigned int t = 0; t < num_taps; t++)
+            {
+                if (ptr_arr[t] == NULL)
+                    continue;
+                for (unsigned int c = 0; c < in_c_per_group; c++)
+                    sum += ptr_arr[t][c0 + c] * k_ptr[(t * in_c_per_group + c) * _VEC_SIZE_M];
+            }
+            out[m] = sum;
+        }
+    }
+}
+
+// Depthwise conv (one input channel per output channel) of a ninst tile. Same layout as naive_grouped_conv.
+void naive_depthwise_conv (const unsigned int M, const unsigned int N, const unsigned int m0, const unsigned int num_taps,
+    const float *kernel, const float **input_ptr_arr, float *C, const unsigned int ldc, const float *bias)
+{
+    naive_grouped_conv (M, N, m0, num_taps, 1, 1, kernel, input_ptr_arr, C, ldc, bias);
+}
+
+// Max pooling of a ninst tile: output rows [m0, m0 + M) of N columns, each the max of the num_taps input pixels 
+// (NULL for padding, skipped) pointed to by input_ptr_arr. Pointers are at channel 0 of the pixel.
+void naive_maxpool_tile (const unsigned int M, const unsigned int N, const unsigned int m0, const unsigned int num_taps,
+    const float **input_ptr_arr, float *C, const unsigned int ldc)
+{
+    for (unsigned int n = 0; n < N; n++)
+    {
+        const float **ptr_arr = input_ptr_arr + (size_t) n * num_taps;
+        float *out = C + (size_t) n * ldc;
+        for (unsigned int m = 0; m < M; m++)
+            out[m] = -INFINITY;
+        for (unsigned int t = 0; t < num_taps; t++)
+        {
+            if (ptr_arr[t] == NULL)
+                continue;
+            const float *in = ptr_arr[t] + m0;
+            for (unsigned int m = 0; m < M; m++)
+                out[m] = out[m] >= in[m] ? out[m] : in[m];
+        }
+    }
+}
+
+// Average pooling of a ninst tile, same layout as naive_maxpool_tile. Padding counts as zero in the average.
+void naive_avgpool_tile (const unsigned int M, const unsigned int N, const unsigned int m0, const unsigned int num_taps,
+    const float **input_ptr_arr, float *C, const unsigned int ldc)
+{
+    for (unsigned int n = 0; n < N; n++)
+    {
+        const float **ptr_arr = input_ptr_arr + (size_t) n * num_taps;
+        float *out = C + (size_t) n * ldc;
+        memset (out, 0, M * sizeof(float));
+        for (unsigned int t = 0; t < num_taps; t++)
+        {
+            if (ptr_arr[t] == NULL)
+                continue;
+            const float *in = ptr_arr[t] + m0;
+            for (unsigned int m = 0; m < M; m++)
+                out[m] += in[m];
+        }
+        for (unsigned int m = 0; m < M; m++)
+            out[m] /= num_taps;
+    }
+}
+
 void naive_conv2d_im2col_mm
 (const float *input, const float *kernel, const float *bias, float *output, 
     unsigned int batch_size, unsigned int input_channels, unsigned int height, unsigned int width,  
@@ -178,6 +263,279 @@ void naive_conv2d_im2col_mm
     aspen_free (im2col_mat);
 }
 
+// Winograd F(4x4, 3x3) transforms. Kernel is in (O/8)HWI8 format, transformed weights are in 6x6(O/8)I8 format,
+// so that each of the 36 transformed kernels is a packed SGEMM A operand.
+void naive_winograd_weight_transform (const float *kernel, float *output, 
+    unsigned int output_channels, unsigned int input_channels)
+{
+    const unsigned int oc_blocks = (output_channels + _VEC_SIZE_M - 1) / _VEC_SIZE_M;
+    const unsigned int xi_stride = oc_blocks * input_channels * _VEC_SIZE_M;
+    #pragma omp parallel for collapse(2)
+    for (unsigned int ob = 0; ob < oc_blocks; ob++)
+    {
+        for (unsigned int ic = 0; ic < input_channels; ic++)
+        {
+            for (unsigned int oo = 0; oo < _VEC_SIZE_M; oo++)
+            {
+                float g[3][3], t[6][3];
+                for (unsigned int kh = 0; kh < 3; kh++)
+                    for (unsigned int kw = 0; kw < 3; kw++)
+                        g[kh][kw] = kernel[((ob * 9 + kh * 3 + kw) * input_channels + ic) * _VEC_SIZE_M + oo];
+                // t = G * g
+                for (unsigned int j = 0; j < 3; j++)
+                {
+                    t[0][j] = g[0][j] / 4;
+                    t[1][j] = -(g[0][j] + g[1][j] + g[2][j]) / 6;
+                    t[2][j] = -(g[0][j] - g[1][j] + g[2][j]) / 6;
+                    t[3][j] = g[0][j] / 24 + g[1][j] / 12 + g[2][j] / 6;
+                    t[4][j] = g[0][j] / 24 - g[1][j] / 12 + g[2][j] / 6;
+                    t[5][j] = g[2][j];
+                }
+                // u = t * G^T
+                float *out = output + (ob * input_channels + ic) * _VEC_SIZE_M + oo;
+                for (unsigned int i = 0; i < 6; i++)
+                {
+                    out[(i * 6 + 0) * xi_stride] = t[i][0] / 4;
+                    out[(i * 6 + 1) * xi_stride] = -(t[i][0] + t[i][1] + t[i][2]) / 6;
+                    out[(i * 6 + 2) * xi_stride] = -(t[i][0] - t[i][1] + t[i][2]) / 6;
+                    out[(i * 6 + 3) * xi_stride] = t[i][0] / 24 + t[i][1] / 12 + t[i][2] / 6;
+                    out[(i * 6 + 4) * xi_stride] = t[i][0] / 24 - t[i][1] / 12 + t[i][2] / 6;
+                    out[(i * 6 + 5) * xi_stride] = t[i][2];
+                }
+            }
+        }
+    }
+}
+
+// V = B^T * d * B for one 6x6 input tile. input_ptr_arr holds the 36 input columns in row-major order (NULL for zero),
+// output element (xi, c) is written to output[xi * output_stride + c].
+void naive_winograd_input_transform (const float **input_ptr_arr, float *output, unsigned int output_stride, 
+    unsigned int channels)
+{
+    for (unsigned int c = 0; c < channels; c++)
+    {
+        float d[6][6], t[6][6];
+        for (unsigned int i = 0; i < 36; i++)
+            d[i / 6][i % 6] = input_ptr_arr[i] != NULL ? input_ptr_arr[i][c] : 0;
+        for (unsigned int j = 0; j < 6; j++)
+        {
+            t[0][j] = 4 * d[0][j] - 5 * d[2][j] + d[4][j];
+            t[1][j] = -4 * d[1][j] - 4 * d[2][j] + d[3][j] + d[4][j];
+            t[2][j] = 4 * d[1][j] - 4 * d[2][j] - d[3][j] + d[4][j];
+            t[3][j] = -2 * d[1][j] - d[2][j] + 2 * d[3][j] + d[4][j];
+            t[4][j] = 2 * d[1][j] - d[2][j] - 2 * d[3][j] + d[4][j];
+            t[5][j] = 4 * d[1][j] - 5 * d[3][j] + d[5][j];
+        }
+        for (unsigned int i = 0; i < 6; i++)
+        {
+            float *out = output + i * 6 * output_stride + c;
+            out[0 * output_stride] = 4 * t[i][0] - 5 * t[i][2] + t[i][4];
+            out[1 * output_stride] = -4 * t[i][1] - 4 * t[i][2] + t[i][3] + t[i][4];
+            out[2 * output_stride] = 4 * t[i][1] - 4 * t[i][2] - t[i][3] + t[i][4];
+            out[3 * output_stride] = -2 * t[i][1] - t[i][2] + 2 * t[i][3] + t[i][4];
+            out[4 * output_stride] = 2 * t[i][1] - t[i][2] - 2 * t[i][3] + t[i][4];
+            out[5 * output_stride] = 4 * t[i][1] - 5 * t[i][3] + t[i][5];
+        }
+    }
+}
+
+// Y = A^T * m * A (+ bias) for one tile. Element (xi, c) is read from input[xi * input_stride + c],
+// the 16 outputs are written to output_ptr_arr in row-major order (NULL to skip).
+void naive_winograd_output_transform (const float *input, unsigned int input_stride, float **output_ptr_arr, 
+    unsigned int channels, const float *bias)
+{
+    for (unsigned int c = 0; c < channels; c++)
+    {
+        float m[6][6], t[4][6];
+        for (unsigned int i = 0; i < 36; i++)
+            m[i / 6][i % 6] = input[i * input_stride + c];
+        for (unsigned int j = 0; j < 6; j++)
+        {
+            t[0][j] = m[0][j] + m[1][j] + m[2][j] + m[3][j] + m[4][j];
+            t[1][j] = m[1][j] - m[2][j] + 2 * m[3][j] - 2 * m[4][j];
+            t[2][j] = m[1][j] + m[2][j] + 4 * m[3][j] + 4 * m[4][j];
+            t[3][j] = m[1][j] - m[2][j] + 8 * m[3][j] - 8 * m[4][j] + m[5][j];
+        }
+        const float b = bias != NULL ? bias[c] : 0;
+        for (unsigned int i = 0; i < 4; i++)
+        {
+            float y[4];
+            y[0] = t[i][0] + t[i][1] + t[i][2] + t[i][3] + t[i][4];
+            y[1] = t[i][1] - t[i][2] + 2 * t[i][3] - 2 * t[i][4];
+            y[2] = t[i][1] + t[i][2] + 4 * t[i][3] + 4 * t[i][4];
+            y[3] = t[i][1] - t[i][2] + 8 * t[i][3] - 8 * t[i][4] + t[i][5];
+            for (unsigned int j = 0; j < 4; j++)
+            {
+                if (output_ptr_arr[i * 4 + j] != NULL)
+                    output_ptr_arr[i * 4 + j][c] = y[j] + b;
+            }
+        }
+    }
+}
+
+// Symmetric per-output-channel INT8 weight quantization. Kernel is a packed SGEMM A operand (M rows in blocks of _VEC_SIZE_M),
+// output is the packed INT8 GEMM A operand with K rounded up to _QGEMM_K_GROUP and zero padded.
+// scale and row_sum (sum of the quantized weights of a row) get one entry per row, for M rounded up to _VEC_SIZE_M.
+void naive_quantize_weight_int8 (const float *kernel, int8_t *output, float *scale, int32_t *row_sum, 
+    unsigned int M, unsigned int K)
+{
+    const unsigned int M_pad = get_smallest_dividable (M, _VEC_SIZE_M);
+    const unsigned int K_pad = get_smallest_dividable (K, _QGEMM_K_GROUP);
+    #pragma omp parallel for
+    for (unsigned int m = 0; m < M_pad; m++)
+    {
+        const float *w = kernel + (size_t) (m / _VEC_SIZE_M) * _VEC_SIZE_M * K + m % _VEC_SIZE_M;
+        int8_t *q = output + (size_t) (m / _VEC_SIZE_M) * _VEC_SIZE_M * K_pad + (m % _VEC_SIZE_M) * _QGEMM_K_GROUP;
+        float max = 0;
+        for (unsigned int k = 0; m < M && k < K; k++)
+            max = fabsf (w[k * _VEC_SIZE_M]) > max ? fabsf (w[k * _VEC_SIZE_M]) : max;
+        scale[m] = max / 127;
+        row_sum[m] = 0;
+        for (unsigned int k = 0; k < K_pad; k++)
+        {
+            int v = 0;
+            if (m < M && k < K && max > 0)
+            {
+                v = (int) nearbyintf (w[k * _VEC_SIZE_M] / scale[m]);
+                v = v > 127 ? 127 : v < -127 ? -127 : v;
+            }
+            q[(k / _QGEMM_K_GROUP) * _VEC_SIZE_M * _QGEMM_K_GROUP + k % _QGEMM_K_GROUP] = v;
+            row_sum[m] += v;
+        }
+    }
+}
+
+// output = clamp (round (input * inv_scale + zero_point), 0, max)
+void naive_quantize_u8 (const float *input, uint8_t *output, unsigned int num_elements, 
+    float inv_scale, float zero_point, unsigned int max)
+{
+    for (unsigned int i = 0; i < num_elements; i++)
+    {
+        float v = input[i] * inv_scale + zero_point;
+        v = v < 0 ? 0 : v > max ? max : v;
+        output[i] = (uint8_t) nearbyintf (v);
+    }
+}
+
+// C = (A * B) * scale + offset, with A a packed INT8 GEMM A operand and B u8 columns. K must be a multiple of _QGEMM_K_GROUP.
+void naive_qgemm (const unsigned int M, const unsigned int N, const unsigned int K, const int8_t *A, 
+    const uint8_t *B, const unsigned int ldb, float *C, const unsigned int ldc, const float *scale, const float *offset)
+{
+    for (unsigned int n = 0; n < N; n++)
+    {
+        for (unsigned int m = 0; m < M; m++)
+        {
+            const int8_t *a = A + (size_t) (m / _VEC_SIZE_M) * _VEC_SIZE_M * K + (m % _VEC_SIZE_M) * _QGEMM_K_GROUP;
+            int32_t acc = 0;
+            for (unsigned int k = 0; k < K; k++)
+                acc += a[(k / _QGEMM_K_GROUP) * _VEC_SIZE_M * _QGEMM_K_GROUP + k % _QGEMM_K_GROUP] * B[n * ldb + k];
+            C[n * ldc + m] = acc * scale[m] + offset[m];
+        }
+    }
+}
+
+// IEEE binary16 conversions with round to nearest even, for the F16C-less paths and weight conversion.
+static inline uint16_t fp32_to_fp16 (float val)
+{
+    uint32_t x;
+    memcpy (&x, &val, sizeof (uint32_t));
+    const uint16_t sign = (x >> 16) & 0x8000;
+    const uint32_t abs = x & 0x7FFFFFFF;
+    if (abs > 0x7F800000)
+        return sign | 0x7E00;
+    if (abs >= 0x477FF000) // Rounds to 65520 or above.
+        return sign | 0x7C00;
+    if (abs < 0x38800000) // Below the smallest normal FP16, 2^-14.
+    {
+        float abs_val;
+        memcpy (&abs_val, &abs, sizeof (float));
+        return sign | (uint16_t) nearbyintf (abs_val * 16777216.0f);
+    }
+    // Rebias the exponent from 127 to 15 and round the 13 dropped mantissa bits.
+    return sign | ((abs + 0xC8000FFF + ((abs >> 13) & 1)) >> 13);
+}
+
+static inline float fp16_to_fp32 (uint16_t val)
+{
+    const uint32_t sign = (uint32_t) (val & 0x8000) << 16;
+    const uint32_t exp = (val >> 10) & 0x1F, mant = val & 0x3FF;
+    uint32_t x;
+    if (exp == 0)
+    {
+        const float sub = mant * (1.0f / 16777216.0f);
+        memcpy (&x, &sub, sizeof (uint32_t));
+        x |= sign;
+    }
+    else if (exp == 0x1F)
+        x = sign | 0x7F800000 | (mant << 13);
+    else
+        x = sign | ((exp + 112) << 23) | (mant << 13);
+    float out;
+    memcpy (&out, &x, sizeof (float));
+    return out;
+}
+
+void naive_fp32_to_fp16 (const float *input, uint16_t *output, size_t num_elements)
+{
+    #pragma omp parallel for
+    for (size_t i = 0; i < num_elements; i++)
+        output[i] = fp32_to_fp16 (input[i]);
+}
+
+void naive_fp16_to_fp32 (const uint16_t *input, float *output, size_t num_elements)
+{
+    #pragma omp parallel for
+    for (size_t i = 0; i < num_elements; i++)
+        output[i] = fp16_to_fp32 (input[i]);
+}
+
+void naive_apply_epilogue (float *C, const unsigned int M, const unsigned int N, const unsigned int ldc, 
+    const sgemm_epilogue_t *epi)
+{
+    for (unsigned int n = 0; n < N; n++)
+    {
+        float *out_vec = C + (size_t) n * ldc;
+        if (epi->bias != NULL)
+        {
+            for (unsigned int m = 0; m < M; m++)
+                out_vec[m] += epi->bias[m];
+        }
+        if (epi->residual != NULL)
+        {
+            const float *res_vec = epi->residual + (size_t) n * epi->ldr;
+            for (unsigned int m = 0; m < M; m++)
+                out_vec[m] += res_vec[m];
+        }
+        ACTIVATE (out_vec, M, epi->activation);
+    }
+}
+
+void naive_sgemm_epilogue (const unsigned int M, const unsigned int N, const unsigned int K, const float *A, const unsigned int lda, 
+    const float *B, const unsigned int ldb, float *C, const unsigned int ldc, const sgemm_epilogue_t *epi)
+{
+    SGEMM_KERNEL (M, N, K, A, lda, B, ldb, C, ldc);
+    if (epi != NULL)
+        naive_apply_epilogue (C, M, N, ldc, epi);
+}
+
+// C = epi (C + A * B) with A packed as in naive_sgemm_vectorized, in FP16.
+void naive_hgemm (const unsigned int M, const unsigned int N, const unsigned int K, const uint16_t *A, const unsigned int lda, 
+    const float *B, const unsigned int ldb, float *C, const unsigned int ldc, const sgemm_epilogue_t *epi)
+{
+    for (unsigned int n = 0; n < N; n++)
+    {
+        for (unsigned int m = 0; m < M; m++)
+        {
+            float c = C[n * ldc + m];
+            for (unsigned int k = 0; k < K; k++)
+                c += fp16_to_fp32 (A[((m / _VEC_SIZE_M) * lda + k) * _VEC_SIZE_M + (m % _VEC_SIZE_M)]) * B[n * ldb + k];
+            C[n * ldc + m] = c;
+        }
+    }
+    if (epi != NULL)
+        naive_apply_epilogue (C, M, N, ldc, epi);
+}
+
 void naive_maxpool2d
 (const float *input, float *output, 
     unsigned int batch_size, unsigned int channels, unsigned int height, unsigned int width,  
@@ -383,6 +741,86 @@ void naive_layernorm (const float *input, const float *kernel, const float *bias
     }
 }
 
+// Welford mean and variance of input (+ input_2 if not NULL), storing the sum to sum_output if not NULL.
+static void naive_welford_col (const float *input, const float *input_2, float *sum_output, unsigned int num_elements, 
+    float *mean_out, float *var_out)
+{
+    float mean = 0, m2 = 0;
+    for (unsigned int i = 0; i < num_elements; i++)
+    {
+        const float x = input_2 != NULL ? input[i] + input_2[i] : input[i];
+        if (sum_output != NULL)
+            sum_output[i] = x;
+        const float delta = x - mean;
+        mean += delta / (i + 1);
+        m2 += delta * (x - mean);
+    }
+    *mean_out = mean;
+    *var_out = m2 / num_elements;
+}
+
+static void naive_normalize_col (const float *input, float *output, unsigned int num_elements, 
+    float mean, float var, const float *weight, const float *bias)
+{
+    const float rstd = 1 / sqrtf (var + _LAYERNORM_EPSILON);
+    for (unsigned int i = 0; i < num_elements; i++)
+        output[i] = (input[i] - mean) * rstd * weight[i] + (bias != NULL ? bias[i] : 0);
+}
+
+void naive_layernorm_col (const float *input, float *output, unsigned int num_elements, 
+    const float *weight, const float *bias)
+{
+    float mean, var;
+    naive_welford_col (input, NULL, NULL, num_elements, &mean, &var);
+    naive_normalize_col (input, output, num_elements, mean, var, weight, bias);
+}
+
+void naive_residual_layernorm_col (const float *input_1, const float *input_2, float *residual_output, float *output, 
+    unsigned int num_elements, const float *weight, const float *bias)
+{
+    float mean, var;
+    naive_welford_col (input_1, input_2, residual_output, num_elements, &mean, &var);
+    naive_normalize_col (residual_output, output, num_elements, mean, var, weight, bias);
+}
+
+void naive_softmax_col (const float *input, float *output, unsigned int num_elements, float scale)
+{
+    float max = input[0];
+    for (unsigned int i = 1; i < num_elements; i++)
+        max = input[i] > max ? input[i] : max;
+    float sum = 0;
+    for (unsigned int i = 0; i < num_elements; i++)
+    {
+        output[i] = expf ((input[i] - max) * scale);
+        sum += output[i];
+    }
+    const float inv_sum = 1 / sum;
+    for (unsigned int i = 0; i < num_elements; i++)
+        output[i] *= inv_sum;
+}
+
+float naive_online_softmax_col (float *scores, unsigned int num_elements, float scale, float *max, float *sum)
+{
+    float new_max = *max;
+    for (unsigned int i = 0; i < num_elements; i++)
+        new_max = scores[i] * scale > new_max ? scores[i] * scale : new_max;
+    if (new_max == -INFINITY)
+    {
+        memset (scores, 0, num_elements * sizeof(float));
+        return 1;
+    }
+    const float correction = *max == -INFINITY ? 0 : expf (*max - new_max);
+    float block_sum = 0;
+    for (unsigned int i = 0; i < num_elements; i++)
+    {
+        scores[i] = expf (scores[i] * scale - new_max);
+        block_sum += scores[i];
+    }
+    *max = new_max;
+    *sum = *sum * correction + block_sum;
+    return correction;
+}
+
 void naive_yolo (const float *input, const float *anchors, 
     float *output, unsigned int yolo_c, unsigned int h, unsigned int w, unsigned int c, unsigned int stride)
 {
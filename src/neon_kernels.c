@@ -1740,4 +1740,404 @@ void neon_sgemm_tile_N(const unsigned int M, const unsigned int N, const unsigne
         }
     }
 }   
+// Vectorized activations, with the same approximations and error bounds as the AVX2 ones in avx2_kernels.c.
+
+// Cephes expf: exp(x) = 2^n * exp(r), |r| <= ln(2)/2, with a degree 6 polynomial for exp(r).
+// x is clamped to [-87.3, 88.4] so that 2^n stays a normal float.
+static inline float32x4_t neon_exp_ps (float32x4_t x)
+{
+    x = vminq_f32 (vmaxq_f32 (x, vdupq_n_f32 (-87.3365447505531f)), vdupq_n_f32 (88.3762626647949f));
+    const float32x4_t n = vrndnq_f32 (vmulq_f32 (x, vdupq_n_f32 (1.44269504088896341f)));
+    float32x4_t r = vfmsq_f32 (x, n, vdupq_n_f32 (0.693359375f));
+    r = vfmsq_f32 (r, n, vdupq_n_f32 (-2.12194440e-4f));
+    float32x4_t p = vdupq_n_f32 (1.9875691500e-4f);
+    p = vfmaq_f32 (vdupq_n_f32 (1.3981999507e-3f), p, r);
+    p = vfmaq_f32 (vdupq_n_f32 (8.3334519073e-3f), p, r);
+    p = vfmaq_f32 (vdupq_n_f32 (4.1665795894e-2f), p, r);
+    p = vfmaq_f32 (vdupq_n_f32 (1.6666665459e-1f), p, r);
+    p = vfmaq_f32 (vdupq_n_f32 (5.0000001201e-1f), p, r);
+    p = vfmaq_f32 (vaddq_f32 (r, vdupq_n_f32 (1.0f)), p, vmulq_f32 (r, r));
+    const int32x4_t e = vshlq_n_s32 (vaddq_s32 (vcvtq_s32_f32 (n), vdupq_n_s32 (127)), 23);
+    return vmulq_f32 (p, vreinterpretq_f32_s32 (e));
+}
+
+// tanh(x) = x * P(x^2) / Q(x^2), a 13/6 rational fit on [-7.9, 7.9], saturating outside.
+static inline float32x4_t neon_tanh_ps (float32x4_t x)
+{
+    x = vminq_f32 (vmaxq_f32 (x, vdupq_n_f32 (-7.90531110763549805f)), vdupq_n_f32 (7.90531110763549805f));
+    const float32x4_t x2 = vmulq_f32 (x, x);
+    float32x4_t p = vdupq_n_f32 (-2.76076847742355e-16f);
+    p = vfmaq_f32 (vdupq_n_f32 (2.00018790482477e-13f), p, x2);
+    p = vfmaq_f32 (vdupq_n_f32 (-8.60467152213735e-11f), p, x2);
+    p = vfmaq_f32 (vdupq_n_f32 (5.12229709037114e-08f), p, x2);
+    p = vfmaq_f32 (vdupq_n_f32 (1.48572235717979e-05f), p, x2);
+    p = vfmaq_f32 (vdupq_n_f32 (6.37261928875436e-04f), p, x2);
+    p = vfmaq_f32 (vdupq_n_f32 (4.89352455891786e-03f), p, x2);
+    float32x4_t q = vdupq_n_f32 (1.19825839466702e-06f);
+    q = vfmaq_f32 (vdupq_n_f32 (1.18534705686654e-04f), q, x2);
+    q = vfmaq_f32 (vdupq_n_f32 (2.26843463243900e-03f), q, x2);
+    q = vfmaq_f32 (vdupq_n_f32 (4.89352518554385e-03f), q, x2);
+    return vdivq_f32 (vmulq_f32 (x, p), q);
+}
+
+// erf(x) = x * P(x^2) / Q(x^2), a 13/8 rational fit on [-4, 4], saturating outside.
+static inline float32x4_t neon_erf_ps (float32x4_t x)
+{
+    x = vminq_f32 (vmaxq_f32 (x, vdupq_n_f32 (-4.0f)), vdupq_n_f32 (4.0f));
+    const float32x4_t x2 = vmulq_f32 (x, x);
+    float32x4_t p = vdupq_n_f32 (-2.72614225801306e-10f);
+    p = vfmaq_f32 (vdupq_n_f32 (2.77068142495902e-08f), p, x2);
+    p = vfmaq_f32 (vdupq_n_f32 (-2.10102402082508e-06f), p, x2);
+    p = vfmaq_f32 (vdupq_n_f32 (-5.69250639462346e-05f), p, x2);
+    p = vfmaq_f32 (vdupq_n_f32 (-7.34990630326855e-04f), p, x2);
+    p = vfmaq_f32 (vdupq_n_f32 (-2.95459980854025e-03f), p, x2);
+    p = vfmaq_f32 (vdupq_n_f32 (-1.60960333262415e-02f), p, x2);
+    float32x4_t q = vdupq_n_f32 (-1.45660718464996e-05f);
+    q = vfmaq_f32 (vdupq_n_f32 (-2.13374055278905e-04f), q, x2);
+    q = vfmaq_f32 (vdupq_n_f32 (-1.68282697438203e-03f), q, x2);
+    q = vfmaq_f32 (vdupq_n_f32 (-7.37332916720468e-03f), q, x2);
+    q = vfmaq_f32 (vdupq_n_f32 (-1.42647390514189e-02f), q, x2);
+    return vdivq_f32 (vmulq_f32 (x, p), q);
+}
+
+// naive_activate on 4 elements.
+static inline float32x4_t neon_activate_ps (float32x4_t x, const LAYER_ACT activation)
+{
+    const float32x4_t zero = vdupq_n_f32 (0.0f);
+    const float32x4_t one = vdupq_n_f32 (1.0f);
+    const float32x4_t half = vdupq_n_f32 (0.5f);
+    switch (activation)
+    {
+    case RELU:
+        return vmaxq_f32 (x, zero);
+    case LEAKY_RELU:
+        return vmaxq_f32 (x, vmulq_n_f32 (x, 0.1f));
+    case ELU:
+        return vbslq_f32 (vcgtq_f32 (x, zero), x, vmulq_n_f32 (vsubq_f32 (neon_exp_ps (x), one), 0.1f));
+    case SELU:
+        return vmulq_n_f32 (vbslq_f32 (vcgtq_f32 (x, zero), x, 
+            vmulq_n_f32 (vsubq_f32 (neon_exp_ps (x), one), 1.67326f)), 1.0507f);
+    case SIGMOID:
+        return vdivq_f32 (one, vaddq_f32 (one, neon_exp_ps (vnegq_f32 (x))));
+    case TANH:
+        return neon_tanh_ps (x);
+    case GELU:
+        return vmulq_f32 (vmulq_f32 (half, x), vaddq_f32 (one, neon_erf_ps (vmulq_n_f32 (x, 0.7071067811865475f))));
+    case GELU_ACCURATE:
+    {
+        const float32x4_t inner = vmulq_n_f32 (vfmaq_f32 (x, vmulq_n_f32 (x, 0.044715f), vmulq_f32 (x, x)), 
+            0.7978845608028654f);
+        return vmulq_f32 (vmulq_f32 (half, x), vaddq_f32 (one, neon_tanh_ps (inner)));
+    }
+    default:
+        return x;
+    }
+}
+
+void neon_activate (float *input, unsigned int num_elements, LAYER_ACT activation_type)
+{
+    if (activation_type == NO_ACTIVATION || activation_type == LINEAR)
+        return;
+    unsigned int i = 0;
+    for (; i + 4 <= num_elements; i += 4)
+        vst1q_f32 (input + i, neon_activate_ps (vld1q_f32 (input + i), activation_type));
+    if (i < num_elements)
+    {
+        float tail[4] = {0};
+        memcpy (tail, input + i, (num_elements - i) * sizeof(float));
+        vst1q_f32 (tail, neon_activate_ps (vld1q_f32 (tail), activation_type));
+        memcpy (input + i, tail, (num_elements - i) * sizeof(float));
+    }
+}
+
+// Welford update of 4 per-lane (mean, m2) accumulators with the next x, inv_count = 1 / (number of x so far).
+static inline void neon_welford_ps (const float32x4_t x, const float32x4_t inv_count, 
+    float32x4_t *mean, float32x4_t *m2)
+{
+    const float32x4_t delta = vsubq_f32 (x, *mean);
+    *mean = vfmaq_f32 (*mean, delta, inv_count);
+    *m2 = vfmaq_f32 (*m2, delta, vsubq_f32 (x, *mean));
+}
+
+// Single pass Welford statistics of input (+ input_2 if not NULL), storing the sum to sum_output if not NULL.
+// 8 lanes are updated independently and merged with Chan's formula, the tail is added one element at a time.
+static inline void neon_welford_col (const float *input, const float *input_2, 
+    float *sum_output, const unsigned int num_elements, float *mean_out, float *var_out)
+{
+    float32x4_t mean_0 = vdupq_n_f32 (0), mean_1 = vdupq_n_f32 (0);
+    float32x4_t m2_0 = vdupq_n_f32 (0), m2_1 = vdupq_n_f32 (0);
+    unsigned int i = 0, count = 0;
+    for (; i + 8 <= num_elements; i += 8)
+    {
+        float32x4_t x_0 = vld1q_f32 (input + i), x_1 = vld1q_f32 (input + i + 4);
+        if (input_2 != NULL)
+        {
+            x_0 = vaddq_f32 (x_0, vld1q_f32 (input_2 + i));
+            x_1 = vaddq_f32 (x_1, vld1q_f32 (input_2 + i + 4));
+        }
+        if (sum_output != NULL)
+        {
+            vst1q_f32 (sum_output + i, x_0);
+            vst1q_f32 (sum_output + i + 4, x_1);
+        }
+        const float32x4_t inv_count = vdupq_n_f32 (1.0f / ++count);
+        neon_welford_ps (x_0, inv_count, &mean_0, &m2_0);
+        neon_welford_ps (x_1, inv_count, &mean_1, &m2_1);
+    }
+    float mean = 0, m2 = 0;
+    if (count > 0)
+    {
+        float lane_mean[8];
+        vst1q_f32 (lane_mean, mean_0);
+        vst1q_f32 (lane_mean + 4, mean_1);
+        mean = (vaddvq_f32 (mean_0) + vaddvq_f32 (mean_1)) / 8;
+        m2 = vaddvq_f32 (vaddq_f32 (m2_0, m2_1));
+        for (int l = 0; l < 8; l++)
+            m2 += count * (lane_mean[l] - mean) * (lane_mean[l] - mean);
+    }
+    for (; i < num_elements; i++)
+    {
+        const float x = input_2 != NULL ? input[i] + input_2[i] : input[i];
+        if (sum_output != NULL)
+            sum_output[i] = x;
+        const float delta = x - mean;
+        mean += delta / (i + 1);
+        m2 += delta * (x - mean);
+    }
+    *mean_out = mean;
+    *var_out = m2 / num_elements;
+}
+
+// output = (input - mean) * rstd * weight + bias.
+static inline void neon_normalize_col (const float *input, float *output, 
+    const unsigned int num_elements, const float mean, const float var, const float *weight, const float *bias)
+{
+    const float rstd = 1 / sqrtf (var + _LAYERNORM_EPSILON);
+    const float32x4_t mean_v = vdupq_n_f32 (mean);
+    const float32x4_t rstd_v = vdupq_n_f32 (rstd);
+    unsigned int i = 0;
+    for (; i + 4 <= num_elements; i += 4)
+    {
+        const float32x4_t x = vsubq_f32 (vld1q_f32 (input + i), mean_v);
+        const float32x4_t scale = vmulq_f32 (rstd_v, vld1q_f32 (weight + i));
+        const float32x4_t shift = bias != NULL ? vld1q_f32 (bias + i) : vdupq_n_f32 (0);
+        vst1q_f32 (output + i, vfmaq_f32 (shift, x, scale));
+    }
+    for (; i < num_elements; i++)
+        output[i] = (input[i] - mean) * rstd * weight[i] + (bias != NULL ? bias[i] : 0);
+}
+
+void neon_layernorm_col (const float *input, float *output, unsigned int num_elements, 
+    const float *weight, const float *bias)
+{
+    float mean, var;
+    neon_welford_col (input, NULL, NULL, num_elements, &mean, &var);
+    neon_normalize_col (input, output, num_elements, mean, var, weight, bias);
+}
+
+void neon_residual_layernorm_col (const float *input_1, const float *input_2, float *residual_output, float *output, 
+    unsigned int num_elements, const float *weight, const float *bias)
+{
+    float mean, var;
+    neon_welford_col (input_1, input_2, residual_output, num_elements, &mean, &var);
+    neon_normalize_col (residual_output, output, num_elements, mean, var, weight, bias);
+}
+
+void neon_softmax_col (const float *input, float *output, unsigned int num_elements, float scale)
+{
+    float32x4_t max_v = vdupq_n_f32 (-INFINITY);
+    unsigned int i = 0;
+    for (; i + 4 <= num_elements; i += 4)
+        max_v = vmaxq_f32 (max_v, vld1q_f32 (input + i));
+    float max = vmaxvq_f32 (max_v);
+    for (; i < num_elements; i++)
+        max = input[i] > max ? input[i] : max;
+    const float32x4_t scale_v = vdupq_n_f32 (scale);
+    const float32x4_t shift = vdupq_n_f32 (-max * scale);
+    float32x4_t sum_v = vdupq_n_f32 (0);
+    for (i = 0; i + 4 <= num_elements; i += 4)
+    {
+        const float32x4_t e = neon_exp_ps (vfmaq_f32 (shift, vld1q_f32 (input + i), scale_v));
+        vst1q_f32 (output + i, e);
+        sum_v = vaddq_f32 (sum_v, e);
+    }
+    float sum = vaddvq_f32 (sum_v);
+    if (i < num_elements)
+    {
+        float tail[4] = {0};
+        memcpy (tail, input + i, (num_elements - i) * sizeof(float));
+        vst1q_f32 (tail, neon_exp_ps (vfmaq_f32 (shift, vld1q_f32 (tail), scale_v)));
+        memcpy (output + i, tail, (num_elements - i) * sizeof(float));
+        for (unsigned int j = 0; j < num_elements - i; j++)
+            sum += tail[j];
+    }
+    const float32x4_t inv_sum = vdupq_n_f32 (1 / sum);
+    for (i = 0; i + 4 <= num_elements; i += 4)
+        vst1q_f32 (output + i, vmulq_f32 (vld1q_f32 (output + i), inv_sum));
+    for (; i < num_elements; i++)
+        output[i] *= 1 / sum;
+}
+
+float neon_online_softmax_col (float *scores, unsigned int num_elements, float scale, float *max, float *sum)
+{
+    const float32x4_t scale_v = vdupq_n_f32 (scale);
+    float32x4_t max_v = vdupq_n_f32 (*max);
+    unsigned int i = 0;
+    for (; i + 4 <= num_elements; i += 4)
+        max_v = vmaxq_f32 (max_v, vmulq_f32 (vld1q_f32 (scores + i), scale_v));
+    float new_max = vmaxvq_f32 (max_v);
+    for (; i < num_elements; i++)
+        new_max = scores[i] * scale > new_max ? scores[i] * scale : new_max;
+    if (new_max == -INFINITY)
+    {
+        memset (scores, 0, num_elements * sizeof(float));
+        return 1;
+    }
+    const float correction = *max == -INFINITY ? 0 : expf (*max - new_max);
+    const float32x4_t shift = vdupq_n_f32 (-new_max);
+    float32x4_t sum_v = vdupq_n_f32 (0);
+    for (i = 0; i + 4 <= num_elements; i += 4)
+    {
+        const float32x4_t e = neon_exp_ps (vfmaq_f32 (shift, vld1q_f32 (scores + i), scale_v));
+        vst1q_f32 (scores + i, e);
+        sum_v = vaddq_f32 (sum_v, e);
+    }
+    float block_sum = vaddvq_f32 (sum_v);
+    for (; i < num_elements; i++)
+    {
+        scores[i] = expf (scores[i] * scale - new_max);
+        block_sum += scores[i];
+    }
+    *max = new_max;
+    *sum = *sum * correction + block_sum;
+    return correction;
+}
+
+// Depthwise conv of a ninst tile, 4 output channels per vector. See naive_grouped_conv for the layout.
+void neon_depthwise_conv (const unsigned int M, const unsigned int N, const unsigned int m0, const unsigned int num_taps,
+    const float *kernel, const float **input_ptr_arr, float *C, const unsigned int ldc, const float *bias)
+{
+    for (unsigned int m = 0; m < M; m += 4)
+    {
+        const float *k_ptr = kernel + (size_t) (m / 8) * num_taps * 8 + m % 8;
+        for (unsigned int n = 0; n < N; n++)
+        {
+            const float **ptr_arr = input_ptr_arr + (size_t) n * num_taps;
+            float *out = C + (size_t) n * ldc + m;
+            if (M - m < 4)
+            {
+                for (unsigned int mm = 0; mm < M - m; mm++)
+                {
+                    float sum = bias != NULL ? bias[m + mm] : 0;
+                    for (unsigned int t = 0; t < num_taps; t++)
+                        if (ptr_arr[t] != NULL)
+                            sum += ptr_arr[t][m0 + m + mm] * k_ptr[t * 8 + mm];
+                    out[mm] = sum;
+                }
+                continue;
+            }
+            float32x4_t acc = bias != NULL ? vld1q_f32 (bias + m) : vdupq_n_f32 (0);
+            for (unsigned int t = 0; t < num_taps; t++)
+            {
+                if (ptr_arr[t] == NULL)
+                    continue;
+                acc = vfmaq_f32 (acc, vld1q_f32 (ptr_arr[t] + m0 + m), vld1q_f32 (k_ptr + t * 8));
+            }
+            vst1q_f32 (out, acc);
+        }
+    }
+}
+
+// Max pooling of a ninst tile, see naive_maxpool_tile. Each input pixel is read as whole channel vectors.
+void neon_maxpool_tile (const unsigned int M, const unsigned int N, const unsigned int m0, const unsigned int num_taps,
+    const float **input_ptr_arr, float *C, const unsigned int ldc)
+{
+    for (unsigned int n = 0; n < N; n++)
+    {
+        const float **ptr_arr = input_ptr_arr + (size_t) n * num_taps;
+        float *out = C + (size_t) n * ldc;
+        unsigned int m = 0;
+        for (; m + 16 <= M; m += 16)
+        {
+            float32x4_t acc_0 = vdupq_n_f32 (-INFINITY), acc_1 = acc_0, acc_2 = acc_0, acc_3 = acc_0;
+            for (unsigned int t = 0; t < num_taps; t++)
+            {
+                if (ptr_arr[t] == NULL)
+                    continue;
+                const float *in = ptr_arr[t] + m0 + m;
+                acc_0 = vmaxq_f32 (acc_0, vld1q_f32 (in));
+                acc_1 = vmaxq_f32 (acc_1, vld1q_f32 (in + 4));
+                acc_2 = vmaxq_f32 (acc_2, vld1q_f32 (in + 8));
+                acc_3 = vmaxq_f32 (acc_3, vld1q_f32 (in + 12));
+            }
+            vst1q_f32 (out + m, acc_0);
+            vst1q_f32 (out + m + 4, acc_1);
+            vst1q_f32 (out + m + 8, acc_2);
+            vst1q_f32 (out + m + 12, acc_3);
+        }
+        for (; m + 4 <= M; m += 4)
+        {
+            float32x4_t acc = vdupq_n_f32 (-INFINITY);
+            for (unsigned int t = 0; t < num_taps; t++)
+                if (ptr_arr[t] != NULL)
+                    acc = vmaxq_f32 (acc, vld1q_f32 (ptr_arr[t] + m0 + m));
+            vst1q_f32 (out + m, acc);
+        }
+        for (; m < M; m++)
+        {
+            float max = -INFINITY;
+            for (unsigned int t = 0; t < num_taps; t++)
+                if (ptr_arr[t] != NULL)
+                    max = max >= ptr_arr[t][m0 + m] ? max : ptr_arr[t][m0 + m];
+            out[m] = max;
+        }
+    }
+}
+
+// Average pooling of a ninst tile, see naive_avgpool_tile.
+void neon_avgpool_tile (const unsigned int M, const unsigned int N, const unsigned int m0, const unsigned int num_taps,
+    const float **input_ptr_arr, float *C, const unsigned int ldc)
+{
+    const float32x4_t count = vdupq_n_f32 ((float) num_taps);
+    for (unsigned int n = 0; n < N; n++)
+    {
+        const float **ptr_arr = input_ptr_arr + (size_t) n * num_taps;
+        float *out = C + (size_t) n * ldc;
+        unsigned int m = 0;
+        for (; m + 16 <= M; m += 16)
+        {
+            float32x4_t acc_0 = vdupq_n_f32 (0), acc_1 = acc_0, acc_2 = acc_0, acc_3 = acc_0;
+            for (unsigned int t = 0; t < num_taps; t++)
+            {
+                if (ptr_arr[t] == NULL)
+                    continue;
+                const float *in = ptr_arr[t] + m0 + m;
+                acc_0 = vaddq_f32 (acc_0, vld1q_f32 (in));
+                acc_1 = vaddq_f32 (acc_1, vld1q_f32 (in + 4));
+                acc_2 = vaddq_f32 (acc_2, vld1q_f32 (in + 8));
+                acc_3 = vaddq_f32 (acc_3, vld1q_f32 (in + 12));
+            }
+            vst1q_f32 (out + m, vdivq_f32 (acc_0, count));
+            vst1q_f32 (out + m + 4, vdivq_f32 (acc_1, count));
+            vst1q_f32 (out + m + 8, vdivq_f32 (acc_2, count));
+            vst1q_f32 (out + m + 12, vdivq_f32 (acc_3, count));
+        }
+        for (; m + 4 <= M; m += 4)
+        {
+            float32x4_t acc = vdupq_n_f32 (0);
+            for (unsigned int t = 0; t < num_taps; t++)
+                if (ptr_arr[t] != NULL)
+                    acc = vaddq_f32 (acc, vld1q_f32 (ptr_arr[t] + m0 + m));
+            vst1q_f32 (out + m, vdivq_f32 (acc, count));
+        }
+        for (; m < M; m++)
+        {
+            float sum = 0;
+            for (unsigned int t = 0; t < num_taps; t++)
+                if (ptr_arr[t] != NULL)
+                    sum += ptr_arr[t][m0 + m];
+            out[m] = sum / num_taps;
+        }
+    }
+}
 #endif 
@@ -258,7 +258,7 @@ void transmission(networking_engine *net_engine)
         free (target_ninst->network_buf);
         target_ninst->network_buf = NULL;
         atomic_store(&target_ninst->lock_network_buf, 0);
-        target_ninst->sent_time = time_sent;
+        if (get_ninst_prof (target_ninst)) get_ninst_prof (target_ninst)->sent_time = time_sent;
         buffer_ptr += data_size;
         // PRTF("Networking: Ninst%d(idx %d), Sending %d bytes, W%d, H%d, data size %d\n", i, target_ninst->ninst_idx, data_size + 3*sizeof(int), 
         //     target_ninst_list[i]->tile_dims[OUT_W], target_ninst_list[i]->tile_dims[OUT_H], 
@@ -401,7 +401,7 @@ void receive(networking_engine *net_engine)
             copy_buffer_to_ninst_data (target_ninst, buffer_ptr);
             buffer_ptr += data_size;
             atomic_store(&target_ninst->state, NINST_COMPLETED);
-            target_ninst->received_time = get_time_secs_offset (net_engine->device_idx);
+            if (get_ninst_prof (target_ninst)) get_ninst_prof (target_ninst)->received_time = get_time_secs_offset (net_engine->device_idx);
             #ifdef DEBUG
             printf("\t[Device %d] (N%d L%d I%d %ldB) state: %d\n",
                 net_engine->device_idx,
@@ -429,7 +429,7 @@ void receive(networking_engine *net_engine)
                     unsigned int num_child_ldata_completed = atomic_fetch_add (&parent_ldata->num_child_ldata_completed, 1);
                     if (num_child_ldata_completed == parent_ldata->num_child_ldata && (parent_ldata != parent_ldata->nasm->ldata_arr))
                     {
-                        free_ldata_out_mat (parent_ldata);
+                        release_ldata_out_mat (parent_ldata);
                         // YELLOW_PRTF ("ldata %d output freed by net engine\n", parent_ldata->layer->layer_idx);
                     }
                 }
@@ -499,7 +499,7 @@ void transmission_fl(networking_engine *net_engine)
         free (target_ninst->network_buf);
         target_ninst->network_buf = NULL;
         atomic_store(&target_ninst->lock_network_buf, 0);
-        target_ninst->sent_time = time_sent;
+        if (get_ninst_prof (target_ninst)) get_ninst_prof (target_ninst)->sent_time = time_sent;
         buffer_ptr += data_size;
 
         #ifdef DEBUG
@@ -630,7 +630,7 @@ void receive_fl(networking_engine *net_engine)
             copy_buffer_to_ninst_data (target_ninst, buffer_ptr);
             buffer_ptr += data_size;
             atomic_store(&target_ninst->state, NINST_COMPLETED);
-            target_ninst->received_time = get_time_secs_offset (net_engine->device_idx);
+            if (get_ninst_prof (target_ninst)) get_ninst_prof (target_ninst)->received_time = get_time_secs_offset (net_engine->device_idx);
             
             unsigned int path_num_ninsts_completed = atomic_fetch_add(&target_path->path_layers_arr[target_path->edge_final_layer_idx].num_ninsts_completed, 1) + 1;
             #ifdef DEBUG
@@ -1188,7 +1188,7 @@ void net_engine_add_input_rpool (networking_engine *net_engine, nasm_t* nasm, ch
         for (int i = 0; i < SCHEDULE_MAX_DEVICES; i++) 
         {
             if (i == net_engine->device_idx) continue;
-            if (ninst->dev_send_target[i]) 
+            if (is_dev_send_target(ninst, i)) 
             {
                 // printf ("\tninst idx %d (L%d), target device: %d, current device: %d, desired device%d\n", 
                 // ninst->ninst_idx, ninst->ldata->layer->layer_idx, i, dse->device_idx,
@@ -1244,7 +1244,7 @@ void net_engine_add_input_rpool_reverse (networking_engine *net_engine, nasm_t*
         for (int i = 0; i < SCHEDULE_MAX_DEVICES; i++) 
         {
             if (i == net_engine->device_idx) continue;
-            if (ninst->dev_send_target[i]) 
+            if (is_dev_send_target(ninst, i)) 
             {
                 // printf ("\tninst idx %d (L%d), target device: %d, current device: %d, desired device %d\n", 
                 // ninst->ninst_idx, ninst->ldata->layer->layer_idx, i, net_engine->device_idx,
@@ -64,6 +64,7 @@ void profile_computation_exact(nasm_t *target_nasm, int dse_num, int device_idx,
     dse_group_add_rpool_arr (dse_group, rpool, device_idx);
     dse_group_set_profile (dse_group, 1);
     dse_group_set_multiuser (dse_group, 0);
+    apu_set_nasm_profiling (target_nasm, 1);
 
     init_sequential_offload (target_nasm, 0, device_idx, device_idx);
     
@@ -75,7 +76,8 @@ void profile_computation_exact(nasm_t *target_nasm, int dse_num, int device_idx,
 
     for (int i=0; i<target_nasm->num_ninst; i++) {
         ninst_t *target_ninst = &(target_nasm->ninst_arr[i]);
-        elapsed_times[i] = (target_ninst->compute_end - target_ninst->compute_start);
+        ninst_prof_t *prof = get_ninst_prof (target_ninst);
+        elapsed_times[i] = prof ? (prof->compute_end - prof->compute_start) : 0.0;
     }
 
     dse_group_destroy (dse_group);
@@ -95,6 +97,7 @@ avg_ninst_profile_t *profile_computation(nasm_t *target_nasm, int dse_num, int d
         dse_group_add_rpool_arr (dse_group, rpool, device_idx);
         dse_group_set_profile (dse_group, 1);
         dse_group_set_multiuser (dse_group, 0);
+        apu_set_nasm_profiling (target_nasm, 1);
 
         init_sequential_offload (target_nasm, 0, device_idx, device_idx);
         
@@ -264,7 +267,8 @@ float extract_profile_from_ninsts(nasm_t *nasm) {
         // const unsigned int H = target_ninst->tile_dims[OUT_H];    
         // const unsigned int total_bytes = W * H * sizeof(float);
 
-        double elapsed_time = (target_ninst->compute_end - target_ninst->compute_start);
+        ninst_prof_t *prof = get_ninst_prof (target_ninst);
+        double elapsed_time = prof ? (prof->compute_end - prof->compute_start) : 0.0;
         if (elapsed_time > 0.0) {
             avg_computation_time += elapsed_time;
         } else {
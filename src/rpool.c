@@ -15,18 +15,40 @@ void rpool_init_queue (rpool_queue_t *rpool_queue)
     pthread_mutex_init (&rpool_queue->occupied_mutex, NULL);
     rpool_queue->idx_start = 0;
     rpool_queue->idx_end = 0;
-    rpool_queue->max_stored = RPOOL_INIT_QUEUE_SIZE;
-    rpool_queue->ninst_ptr_arr = calloc (RPOOL_INIT_QUEUE_SIZE, sizeof(ninst_t*));
+    rpool_queue->num_stored = 0;
+    // Pointer storage is allocated on the first push.
+    rpool_queue->max_stored = 0;
+    rpool_queue->ninst_ptr_arr = NULL;
+}
+// Queues are padded to a cache line each, so the chunks must be line aligned.
+static rpool_queue_t *alloc_queue_chunk ()
+{
+    size_t size = (size_t)RPOOL_QUEUE_CHUNK_SIZE * sizeof(rpool_queue_t);
+    rpool_queue_t *queue_chunk = aligned_alloc (64, size);
+    bzero (queue_chunk, size);
+    return queue_chunk;
+}
+// Initializes queues [num_queues, num_queues + num_new) of the group, allocating their chunks.
+static void init_queues_in_group (rpool_queue_group_t *rpool_queue_group, unsigned int num_queues, unsigned int num_new)
+{
+    for (unsigned int i = num_queues; i < num_queues + num_new; i++)
+    {
+        if (i % RPOOL_QUEUE_CHUNK_SIZE == 0 && rpool_queue_group->queue_chunk_arr[i / RPOOL_QUEUE_CHUNK_SIZE] == NULL)
+            rpool_queue_group->queue_chunk_arr[i / RPOOL_QUEUE_CHUNK_SIZE] = alloc_queue_chunk ();
+        rpool_queue_t *rpool_queue = get_rpool_queue (rpool_queue_group, i);
+        rpool_init_queue (rpool_queue);
+        rpool_queue->queue_group = rpool_queue_group;
+    }
 }
 void rpool_init_queue_group (rpool_queue_group_t *rpool_queue_group, char *queue_group_info, unsigned int num_queues)
 {
     strncpy (rpool_queue_group->queue_group_info, queue_group_info, MAX_STRING_LEN-1);
+    if (num_queues < 1)
+        num_queues = 1;
+    if (num_queues > MAX_NUM_QUEUES)
+        num_queues = MAX_NUM_QUEUES;
+    init_queues_in_group (rpool_queue_group, 0, num_queues);
     atomic_store (&rpool_queue_group->num_queues, num_queues);
-    for (int i = 0; i < num_queues; i++)
-    {
-        rpool_init_queue (&rpool_queue_group->queue_arr[i]);
-        rpool_queue_group->queue_arr[i].queue_group = rpool_queue_group;
-    }
 }
 void rpool_destroy_queue (rpool_queue_t *rpool_queue)
 {
@@ -34,16 +56,22 @@ void rpool_destroy_queue (rpool_queue_t *rpool_queue)
         return;
     if (rpool_queue->ninst_ptr_arr != NULL)
         free (rpool_queue->ninst_ptr_arr);
+    rpool_queue->ninst_ptr_arr = NULL;
+    pthread_mutex_destroy (&rpool_queue->occupied_mutex);
 }
 void rpool_destroy_queue_group (rpool_queue_group_t *rpool_queue_group)
 {
     if (rpool_queue_group == NULL)
         return;
-    if (rpool_queue_group->queue_arr != NULL)
+    for (int i = 0; i < atomic_load (&rpool_queue_group->num_queues); i++)
+        rpool_destroy_queue (get_rpool_queue (rpool_queue_group, i));
+    for (int i = 0; i < MAX_QUEUE_CHUNKS; i++)
     {
-        for (int i = 0; i < atomic_load (&rpool_queue_group->num_queues); i++)
-            rpool_destroy_queue (&rpool_queue_group->queue_arr[i]);
+        if (rpool_queue_group->queue_chunk_arr[i] != NULL)
+            free (rpool_queue_group->queue_chunk_arr[i]);
+        rpool_queue_group->queue_chunk_arr[i] = NULL;
     }
+    atomic_store (&rpool_queue_group->num_queues, 0);
 }
 
 rpool_t *rpool_init (int gpu_idx)
@@ -60,7 +88,8 @@ rpool_t *rpool_init (int gpu_idx)
     rpool->num_groups = 0;
     rpool->queue_group_weight_sum = 0;
     rpool->is_core_exclusive = 0;
-    bzero (rpool->queue_group_weight_arr, sizeof(float)*MAX_QUEUE_GROUPS);
+    rpool->queue_group_arr = calloc (MAX_QUEUE_GROUPS, sizeof(rpool_queue_group_t));
+    rpool->queue_group_weight_arr = calloc (MAX_QUEUE_GROUPS, sizeof(float));
     rpool_init_queue (&rpool->default_queue);
     if (gpu_idx < 0)
         rpool->gpu_idx = -1;
@@ -86,7 +115,10 @@ rpool_t *rpool_init_multigroup (int gpu_idx, int needed_groups) {
     rpool->num_groups = 0;
     rpool->queue_group_weight_sum = 0;
     // rpool->is_core_exclusive = 1;
-    bzero (rpool->queue_group_weight_arr, sizeof(float)*MAX_QUEUE_GROUPS);
+    if (needed_groups > MAX_QUEUE_GROUPS - 1)
+        rpool->needed_groups = MAX_QUEUE_GROUPS - 1;
+    rpool->queue_group_arr = calloc (MAX_QUEUE_GROUPS, sizeof(rpool_queue_group_t));
+    rpool->queue_group_weight_arr = calloc (MAX_QUEUE_GROUPS, sizeof(float));
     rpool_init_queue (&rpool->default_queue);
     if (gpu_idx < 0)
         rpool->gpu_idx = -1;
@@ -110,6 +142,10 @@ void rpool_destroy (rpool_t *rpool)
     }
     for (int i = 0; i < atomic_load (&rpool->num_groups); i++)
         rpool_destroy_queue_group (&rpool->queue_group_arr[i]);
+    if (rpool->queue_group_arr != NULL)
+        free (rpool->queue_group_arr);
+    if (rpool->queue_group_weight_arr != NULL)
+        free (rpool->queue_group_weight_arr);
     rpool_destroy_queue (&rpool->default_queue);
     free (rpool);
 }
@@ -187,15 +223,30 @@ void queue_group_add_queues (rpool_queue_group_t *rpool_queue_group, unsigned in
     if (num_queues == 0)
         return;
     if (atomic_load (&rpool_queue_group->num_queues) + num_queues > MAX_NUM_QUEUES)
+        num_queues = MAX_NUM_QUEUES - atomic_load (&rpool_queue_group->num_queues);
+    if (num_queues == 0)
         return;
-    for (int i = 0; i < num_queues; i++)
-    {
-        rpool_init_queue (&rpool_queue_group->queue_arr[rpool_queue_group->num_queues + i]);
-        rpool_queue_group->queue_arr[rpool_queue_group->num_queues + i].queue_group = rpool_queue_group;
-    }
+    // Existing queues never move, so DSEs may keep scanning the group while new queues are added.
+    init_queues_in_group (rpool_queue_group, atomic_load (&rpool_queue_group->num_queues), num_queues);
     atomic_fetch_add (&rpool_queue_group->num_queues, num_queues);
 }
 
+// The DSE-based queue count, capped by the number of distinct queue_val
+// the NASM's layers can hash to (plus one probe slot per DSE) if num_layers is known.
+static unsigned int get_rpool_num_queues (unsigned int ref_dses, unsigned int num_layers)
+{
+    unsigned int num_dses = ref_dses > 0 ? ref_dses : 1;
+    unsigned int num_queues = ref_dses * NUM_LAYERQUEUE_PER_DSE * 150 *  NUM_QUEUE_PER_LAYER;
+    unsigned int max_queue_val = ((num_dses - 1) * num_layers * NUM_LAYERQUEUE_PER_DSE + num_layers) * NUM_QUEUE_PER_LAYER + 8;
+    if (num_layers > 0 && num_queues > max_queue_val + num_dses)
+        num_queues = max_queue_val + num_dses;
+    if (num_queues > MAX_NUM_QUEUES)
+        num_queues = MAX_NUM_QUEUES;
+    if (num_queues < 1)
+        num_queues = 1;
+    return num_queues;
+}
+
 void add_ref_dses (rpool_t *rpool, unsigned int num_dess)
 {
     if (rpool == NULL)
@@ -206,18 +257,18 @@ void add_ref_dses (rpool_t *rpool, unsigned int num_dess)
     atomic_fetch_add (&rpool->ref_dses, num_dess);
     for (int i = 0; i < rpool->num_groups; i++)
     {
-        // if (rpool->queue_group_arr[i].whitelist_conds[RPOOL_NASM] != NULL)
-        // {
-        //     nasm_t *nasm = rpool->queue_group_arr[i].whitelist_conds[RPOOL_NASM];
-            unsigned int num_queues = rpool->ref_dses * NUM_LAYERQUEUE_PER_DSE * 100  * NUM_QUEUE_PER_LAYER;
-            if (num_queues < 1)
-                num_queues = 1;
-            if (num_queues > atomic_load (&rpool->queue_group_arr[i].num_queues))
-                queue_group_add_queues (&rpool->queue_group_arr[i], num_queues - rpool->queue_group_arr[i].num_queues);
-        // }
+        rpool_queue_group_t *rpool_queue_group = &rpool->queue_group_arr[i];
+        unsigned int num_queues = get_rpool_num_queues (atomic_load (&rpool->ref_dses), rpool_queue_group->num_layers);
+        if (num_queues > atomic_load (&rpool_queue_group->num_queues))
+            queue_group_add_queues (rpool_queue_group, num_queues - atomic_load (&rpool_queue_group->num_queues));
     }
 }
 
+unsigned int get_rpool_num_queues_for_nasm (rpool_t *rpool, nasm_t *nasm)
+{
+    return get_rpool_num_queues (atomic_load (&rpool->ref_dses), nasm->dnn->num_layers);
+}
+
 void rpool_add_nasm_raw_input (rpool_t *rpool, nasm_t* nasm, void* input_data)
 {
     float weight = 1.0;
@@ -239,11 +290,12 @@ void rpool_add_nasm_raw_input (rpool_t *rpool, nasm_t* nasm, void* input_data)
     nasm->gpu_idx = rpool->gpu_idx;
     if (rpool->num_groups == 0)
     {
-        unsigned int num_queues = rpool->ref_dses * NUM_LAYERQUEUE_PER_DSE * 150 *  NUM_QUEUE_PER_LAYER;
+        unsigned int num_queues = get_rpool_num_queues_for_nasm (rpool, nasm);
         for (int i = 0; i < rpool->needed_groups; i++) {
             char groupinfo[16] = {0};
             sprintf(groupinfo, "core%d", i);
             rpool_add_queue_group (rpool, groupinfo, num_queues, NULL, NULL);
+            rpool->queue_group_arr[i].num_layers = nasm->dnn->num_layers;
         }
     }
     push_first_layer_to_rpool (rpool, nasm, input_data);
@@ -282,32 +334,39 @@ void rpool_add_nasm (rpool_t *rpool, nasm_t* nasm, char *input_filename)
 void rpool_pop_all_nasm (rpool_t *rpool, nasm_t *nasm)
 {
     int queue_group_idx = get_queue_group_idx_from_nasm (rpool, nasm);
-    if (queue_group_idx == -1)
+    if (queue_group_idx == -1 || queue_group_idx >= atomic_load (&rpool->num_groups))
+    {
         ERROR_PRTF ("ERROR: rpool_pop_all_nasm: nasm \"%s_nasm_%d\" is not in rpool.\n", nasm->dnn->name, nasm->nasm_id);
+        return;
+    }
     rpool_queue_group_t *queue_group = &rpool->queue_group_arr[queue_group_idx];
     unsigned int num_queues = queue_group->num_queues;
     for (int i = 0; i < num_queues; i++)
     {
-        pthread_mutex_lock (&queue_group->queue_arr[i].occupied_mutex);
-        queue_group->queue_arr[i].idx_start = 0;
-        queue_group->queue_arr[i].idx_end = 0;
-        queue_group->queue_arr[i].num_stored = 0;
-        pthread_mutex_unlock (&queue_group->queue_arr[i].occupied_mutex);
+        rpool_queue_t *rpool_queue = get_rpool_queue (queue_group, i);
+        pthread_mutex_lock (&rpool_queue->occupied_mutex);
+        rpool_queue->idx_start = 0;
+        rpool_queue->idx_end = 0;
+        rpool_queue->num_stored = 0;
+        pthread_mutex_unlock (&rpool_queue->occupied_mutex);
     }
     atomic_exchange(&rpool->num_stored, 0);
 }
 
 void rpool_pop_all (rpool_t *rpool)
 {
+    if (atomic_load (&rpool->num_groups) == 0)
+        return;
     rpool_queue_group_t *queue_group = &rpool->queue_group_arr[0];
     unsigned int num_queues = queue_group->num_queues;
     for (int i = 0; i < num_queues; i++)
     {
-        pthread_mutex_lock (&queue_group->queue_arr[i].occupied_mutex);
-        queue_group->queue_arr[i].idx_start = 0;
-        queue_group->queue_arr[i].idx_end = 0;
-        queue_group->queue_arr[i].num_stored = 0;
-        pthread_mutex_unlock (&queue_group->queue_arr[i].occupied_mutex);
+        rpool_queue_t *rpool_queue = get_rpool_queue (queue_group, i);
+        pthread_mutex_lock (&rpool_queue->occupied_mutex);
+        rpool_queue->idx_start = 0;
+        rpool_queue->idx_end = 0;
+        rpool_queue->num_stored = 0;
+        pthread_mutex_unlock (&rpool_queue->occupied_mutex);
     }
     atomic_exchange(&rpool->num_stored, 0);
 }
@@ -324,6 +383,12 @@ void rpool_reset_queue (rpool_t *rpool)
 }
 
 void rpool_reset_nasm (rpool_t *rpool, nasm_t *nasm)
+{
+    rpool_reset_nasm_raw_input (rpool, nasm, NULL);
+}
+
+// Resets the nasm for a run on new input data (kept if NULL), e.g. the next token of a nasm with a KV cache.
+void rpool_reset_nasm_raw_input (rpool_t *rpool, nasm_t *nasm, void *input_data)
 {
     float weight = 1.0;
     apu_reset_nasm (nasm);
@@ -332,7 +397,7 @@ void rpool_reset_nasm (rpool_t *rpool, nasm_t *nasm)
         ERROR_PRTF ("ERROR: rpool_reset_nasm: nasm \"%s_nasm_%d\" is not in rpool.\n", nasm->dnn->name, nasm->nasm_id);
     rpool->queue_group_weight_sum += weight - rpool->queue_group_weight_arr[queue_group_idx];
     rpool->queue_group_weight_arr[queue_group_idx] = weight;
-    push_first_layer_to_rpool (rpool, nasm, NULL);
+    push_first_layer_to_rpool (rpool, nasm, input_data);
 }
 
 void rpool_add_queue_group 
@@ -539,12 +604,15 @@ unsigned int pop_ninsts_from_queue_back (rpool_queue_t *rpool_queue, ninst_t **n
     //     atomic_fetch_sub (&rpool_queue->queue_group->num_ninsts, num_ninsts);
     return num_ninsts;
 }
-void check_and_update_queue_size (rpool_queue_t *rpool_queue, unsigned int num_to_add)
+void update_queue_size (rpool_queue_t *rpool_queue, unsigned int num_to_add)
 {
-    if (rpool_queue->num_stored + num_to_add > rpool_queue->max_stored)
+    unsigned int new_max_stored = rpool_queue->max_stored ? rpool_queue->max_stored*2 : RPOOL_INIT_QUEUE_SIZE;
+    while (rpool_queue->num_stored + num_to_add > new_max_stored)
+        new_max_stored *= 2;
+    ninst_t **new_ninst_ptr_arr = (ninst_t **) calloc 
+        (new_max_stored, sizeof (ninst_t *));
+    if (rpool_queue->num_stored > 0)
     {
-        ninst_t **new_ninst_ptr_arr = (ninst_t **) calloc 
-            (rpool_queue->max_stored*2, sizeof (ninst_t *));
         if (rpool_queue->idx_start < rpool_queue->idx_end)
         {
             memcpy (new_ninst_ptr_arr, rpool_queue->ninst_ptr_arr + rpool_queue->idx_start, 
@@ -557,34 +625,18 @@ void check_and_update_queue_size (rpool_queue_t *rpool_queue, unsigned int num_t
             memcpy (new_ninst_ptr_arr + rpool_queue->max_stored - rpool_queue->idx_start, 
                     rpool_queue->ninst_ptr_arr, rpool_queue->idx_end*sizeof (ninst_t *));
         }
-        free (rpool_queue->ninst_ptr_arr);
-        rpool_queue->ninst_ptr_arr = new_ninst_ptr_arr;
-        rpool_queue->idx_start = 0;
-        rpool_queue->idx_end = rpool_queue->num_stored;
-        rpool_queue->max_stored *= 2;
-    }
-}
-void update_queue_size (rpool_queue_t *rpool_queue, unsigned int num_to_add)
-{
-    ninst_t **new_ninst_ptr_arr = (ninst_t **) calloc 
-        (rpool_queue->max_stored*2, sizeof (ninst_t *));
-    if (rpool_queue->idx_start < rpool_queue->idx_end)
-    {
-        memcpy (new_ninst_ptr_arr, rpool_queue->ninst_ptr_arr + rpool_queue->idx_start, 
-                (rpool_queue->idx_end - rpool_queue->idx_start)*sizeof (ninst_t *));
-    }
-    else
-    {
-        memcpy (new_ninst_ptr_arr, rpool_queue->ninst_ptr_arr + rpool_queue->idx_start, 
-                (rpool_queue->max_stored - rpool_queue->idx_start)*sizeof (ninst_t *));
-        memcpy (new_ninst_ptr_arr + rpool_queue->max_stored - rpool_queue->idx_start, 
-                rpool_queue->ninst_ptr_arr, rpool_queue->idx_end*sizeof (ninst_t *));
     }
-    free (rpool_queue->ninst_ptr_arr);
+    if (rpool_queue->ninst_ptr_arr != NULL)
+        free (rpool_queue->ninst_ptr_arr);
     rpool_queue->ninst_ptr_arr = new_ninst_ptr_arr;
     rpool_queue->idx_start = 0;
     rpool_queue->idx_end = rpool_queue->num_stored;
-    rpool_queue->max_stored *= 2;
+    rpool_queue->max_stored = new_max_stored;
+}
+void check_and_update_queue_size (rpool_queue_t *rpool_queue, unsigned int num_to_add)
+{
+    if (rpool_queue->num_stored + num_to_add > rpool_queue->max_stored)
+        update_queue_size (rpool_queue, num_to_add);
 }
 void push_ninsts_to_queue (rpool_queue_t *rpool_queue, ninst_t **ninst_ptr_list, unsigned int num_ninsts)
 {
@@ -658,6 +710,8 @@ rpool_queue_t *get_queue_for_fetching (rpool_t *rpool, void **input_cond, unsign
     //     if (pthread_mutex_trylock (&rpool->default_queue.occupied_mutex) == 0)
     //         return &rpool->default_queue;
     // }
+    if (atomic_load (&rpool->num_groups) == 0)
+        return NULL;
     rpool_queue_group_t *rpool_queue_group = &rpool->queue_group_arr[0];
     // unsigned int num_tries = 0;
     // unsigned int num_groups = rpool->num_groups;
@@ -695,7 +749,7 @@ rpool_queue_t *get_queue_for_fetching (rpool_t *rpool, void **input_cond, unsign
     unsigned int queue_idx = num_queues * dse_idx / num_des;
     for (int i = 0; i < num_queues; i++)
     {
-        rpool_queue_t *rpool_queue = &rpool_queue_group->queue_arr[queue_idx];
+        rpool_queue_t *rpool_queue = get_rpool_queue (rpool_queue_group, queue_idx);
         // printf ("queue %d: num_stored: %d\n", i, rpool_queue->num_stored);
         if (rpool_queue->num_stored > 0)
         {
@@ -721,7 +775,8 @@ rpool_queue_t *get_queue_for_fetching_from_group (rpool_t *rpool, void **input_c
         return NULL;
     }
     #endif
-    
+    if (dse_idx >= atomic_load (&rpool->num_groups))
+        return NULL;
     rpool_queue_group_t *rpool_queue_group = &rpool->queue_group_arr[dse_idx];
     
     unsigned int num_queues = atomic_load (&rpool_queue_group->num_queues);
@@ -731,7 +786,7 @@ rpool_queue_t *get_queue_for_fetching_from_group (rpool_t *rpool, void **input_c
         queue_idx = queue_idx % num_queues;
     for (int i = 0; i < num_queues; i++)
     {
-        rpool_queue_t *rpool_queue = &rpool_queue_group->queue_arr[queue_idx];
+        rpool_queue_t *rpool_queue = get_rpool_queue (rpool_queue_group, queue_idx);
         // printf ("queue %d: num_stored: %d\n", i, rpool_queue->num_stored);
         if (rpool_queue->num_stored > 0)
         {
@@ -794,9 +849,9 @@ rpool_queue_t *get_queue_for_storing (rpool_t *rpool, unsigned int queue_val, vo
     unsigned int queue_idx = queue_val % num_queues;
     while (rpool_queue == NULL)
     {
-        // if (atomic_exchange (&rpool_queue_group->queue_arr[queue_idx].occupied, 1) == 0)
-        if (pthread_mutex_trylock (&rpool_queue_group->queue_arr[queue_idx].occupied_mutex) == 0)
-            rpool_queue = &rpool_queue_group->queue_arr[queue_idx];
+        // if (atomic_exchange (&get_rpool_queue (rpool_queue_group, queue_idx)->occupied, 1) == 0)
+        if (pthread_mutex_trylock (&get_rpool_queue (rpool_queue_group, queue_idx)->occupied_mutex) == 0)
+            rpool_queue = get_rpool_queue (rpool_queue_group, queue_idx);
         else
         {
             queue_idx++;
@@ -830,9 +885,9 @@ rpool_queue_t *get_queue_for_storing_from_group (rpool_t *rpool, unsigned int qu
     unsigned int queue_idx = queue_val % num_queues;
     while (rpool_queue == NULL)
     {
-        // if (atomic_exchange (&rpool_queue_group->queue_arr[queue_idx].occupied, 1) == 0)
-        if (pthread_mutex_trylock (&rpool_queue_group->queue_arr[queue_idx].occupied_mutex) == 0)
-            rpool_queue = &rpool_queue_group->queue_arr[queue_idx];
+        // if (atomic_exchange (&get_rpool_queue (rpool_queue_group, queue_idx)->occupied, 1) == 0)
+        if (pthread_mutex_trylock (&get_rpool_queue (rpool_queue_group, queue_idx)->occupied_mutex) == 0)
+            rpool_queue = get_rpool_queue (rpool_queue_group, queue_idx);
         else
         {
             queue_idx++;
@@ -1141,7 +1196,7 @@ void print_rpool_queue_group_info (rpool_queue_group_t *rpool_queue_group)
     for (int i = 0; i < num_queues; i++)
     {
         printf("\t\tQueue %d:\n", i);
-        print_rpool_queue_info (&rpool_queue_group->queue_arr[i]);
+        print_rpool_queue_info (get_rpool_queue (rpool_queue_group, i));
     }
 }
 
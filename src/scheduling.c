@@ -7,16 +7,16 @@
 
 int is_dev_compute(ninst_t *ninst, int device_idx)
 {
-    return atomic_load(&ninst->dev_to_compute[device_idx]);
+    return (atomic_load(&ninst->dev_to_compute) >> device_idx) & 1;
 }
 
 int is_core_compute(ninst_t *ninst, int core_idx) {
-    return atomic_load(&ninst->core_allowed[core_idx]);
+    return (atomic_load(&ninst->core_allowed) >> core_idx) & 1;
 }
 
 int is_dev_send_target(ninst_t *ninst, int device_idx)
 {
-    return atomic_load(&ninst->dev_send_target[device_idx]);
+    return (atomic_load(&ninst->dev_send_target) >> device_idx) & 1;
 }
 
 int check_all_parents_target_device(ninst_t *ninst, nasm_t* nasm, int device_idx)
@@ -24,7 +24,7 @@ int check_all_parents_target_device(ninst_t *ninst, nasm_t* nasm, int device_idx
     for(int i = 0; i < ninst->num_parent_ninsts; i++)
     {
         int parent_idx = ninst->parent_ninst_idx_arr[i];
-        if(!atomic_load(&nasm->ninst_arr[parent_idx].dev_to_compute[device_idx]))
+        if(!is_dev_compute(&nasm->ninst_arr[parent_idx], device_idx))
         {
             return 0;
         }
@@ -35,42 +35,27 @@ int check_all_parents_target_device(ninst_t *ninst, nasm_t* nasm, int device_idx
 void ninst_copy_compute_device(ninst_t* target_ninst, ninst_t* ninst)
 {
     // ninst --> target_ninst
-    for (int i = 0; i < SCHEDULE_MAX_DEVICES; i++) 
-    {
-        atomic_store(&(target_ninst->dev_to_compute[i]), ninst->dev_to_compute[i]);
-        // target_ninst->dev_to_compute[i] = ninst->dev_to_compute[i];
-    }
+    atomic_store(&target_ninst->dev_to_compute, atomic_load(&ninst->dev_to_compute));
 }
 
 void ninst_clear_compute_device(ninst_t *ninst) 
 {
-    for (int i = 0; i < SCHEDULE_MAX_DEVICES; i++) 
-    {
-        atomic_store(&ninst->dev_to_compute[i], 0);
-        // ninst->dev_to_compute[i] = 0;
-    }
+    atomic_store(&ninst->dev_to_compute, 0);
 }
 
 void ninst_set_compute_device(ninst_t *ninst, int device_idx) 
 {
-    atomic_store(&ninst->dev_to_compute[device_idx], 1);
-    // ninst->dev_to_compute[device_idx] = 1;
-    
+    atomic_fetch_or(&ninst->dev_to_compute, 1U << device_idx);
 }
 
 void ninst_set_send_target_device(ninst_t *ninst, int device_idx)
 {
-    atomic_store(&ninst->dev_send_target[device_idx], 1);
-    // ninst->dev_send_target[device_idx] = 1;
+    atomic_fetch_or(&ninst->dev_send_target, 1U << device_idx);
 }
 
 void ninst_clear_send_target_device(ninst_t *ninst) 
 {
-    for (int i = 0; i<SCHEDULE_MAX_DEVICES; i++) 
-    {
-        atomic_store(&ninst->dev_send_target[i], 0);
-        // ninst->dev_send_target[i] = 0;
-    }
+    atomic_store(&ninst->dev_send_target, 0);
 }
 
 void nasm_set_ninst_send_target_using_child_compute_device(nasm_t *nasm) 
@@ -82,11 +67,9 @@ void nasm_set_ninst_send_target_using_child_compute_device(nasm_t *nasm)
         for (int j = 0; j < ninst->num_child_ninsts; j++) 
         {
             ninst_t *child_ninst = ninst->child_ninst_arr[j];
-            for (int dev = 0; dev < SCHEDULE_MAX_DEVICES; dev++) 
-            {
-                ninst->dev_send_target[dev] |= child_ninst->dev_to_compute[dev];
-                ninst->dev_to_compute[dev] |= child_ninst->dev_to_compute[dev];
-            }
+            unsigned int child_dev = atomic_load(&child_ninst->dev_to_compute);
+            atomic_fetch_or(&ninst->dev_send_target, child_dev);
+            atomic_fetch_or(&ninst->dev_to_compute, child_dev);
         }
     }
 }
@@ -97,7 +80,7 @@ void nasm_all_ninst_set_compute_device (nasm_t *nasm, int device_idx)
     {
         ninst_t *ninst = nasm->ninst_arr + i;
         ninst_clear_send_target_device(ninst);
-        atomic_store(&ninst->dev_send_target[device_idx], 1);
+        ninst_set_send_target_device(ninst, device_idx);
     }
 }
 
@@ -107,39 +90,42 @@ void nasm_set_last_layer_ninst_send_target_device(nasm_t *nasm, int device_idx)
     ninst_t *last_ldata_ninst_arr = last_ldata->ninst_arr_start;
     for (int i = 0; i < last_ldata->num_ninst; i++) 
     {
-        // last_ldata_ninst_arr[i].dev_send_target[device_idx] = 1;
-        atomic_store(&last_ldata_ninst_arr[i].dev_send_target[device_idx], 1);
+        ninst_set_send_target_device(&last_ldata_ninst_arr[i], device_idx);
     }
 }
 
+static inline uint64_t get_core_mask (unsigned int num_cores)
+{
+    return num_cores >= SCHEDULE_MAX_CORE ? ~(uint64_t)0 : ((uint64_t)1 << num_cores) - 1;
+}
+
 void ninst_core_allow_all(ninst_t *ninst)
 {
-    for (int i = 0; i < ninst->num_cores; i++)
-        atomic_store(&ninst->core_allowed[i], 1);
+    atomic_fetch_or(&ninst->core_allowed, get_core_mask(ninst->num_cores));
 }
 
 void ninst_core_disallow_all(ninst_t *ninst)
 {
-    for (int i = 0; i < ninst->num_cores; i++)
-        atomic_store(&ninst->core_allowed[i], 0);
+    atomic_fetch_and(&ninst->core_allowed, ~get_core_mask(ninst->num_cores));
 }
 
 void ninst_core_allow(ninst_t *ninst, int core_idx, int allow)
 {
-    atomic_store(&ninst->core_allowed[core_idx], allow);
+    if (allow)
+        atomic_fetch_or(&ninst->core_allowed, (uint64_t)1 << core_idx);
+    else
+        atomic_fetch_and(&ninst->core_allowed, ~((uint64_t)1 << core_idx));
 }
 
 void ninst_core_allow_rand(ninst_t *ninst, int num_core) {
-    ninst->core_allowed[rand() % num_core] = 1;
+    ninst_core_allow(ninst, rand() % num_core, 1);
 }
 
 int get_allowed_core_idx(ninst_t *ninst) {
-    for (int i = 0; i < ninst->num_cores; i++) {
-        if (atomic_load(&ninst->core_allowed[i])) {
-            return i;
-        }
-    }
-    return -1;
+    uint64_t allowed = atomic_load(&ninst->core_allowed) & get_core_mask(ninst->num_cores);
+    if (allowed == 0)
+        return -1;
+    return __builtin_ctzll(allowed);
 }
 
 void core_init_random(nasm_t *nasm, int num_core) {
@@ -0,0 +1,317 @@
+#include "kernels.h"
+#include <unistd.h>
+
+// Cache blocking autotuner for the FP32 SGEMMs of conv, fully connected and matmul layers.
+// The default _TILE_SIZE_M/N/K blocking was tuned for one machine. For each distinct ninst GEMM shape of a NASM,
+// candidate blockings are timed on this host with tiled_sgemm_epilogue, and the winner is kept in the ldata blocking
+// read by the tiled kernels. 1x1 convs also time their direct path against im2col under the winning blocking, and
+// keep the faster one in conv_1x1_direct. Winners are appended to a per-host cache file, so later runs skip the
+// benchmark. Cache file lines are "M N K tile_m tile_n tile_k conv_1x1_direct", where conv_1x1_direct is -1 for
+// shapes not timed as 1x1 convs and may be left out. Later lines of a shape replace earlier ones, and lines
+// starting with # are comments.
+
+#define SGEMM_TUNE_MAX_ENTRIES 1024
+#define SGEMM_TUNE_MIN_SEC ((double)2e-3)
+#define SGEMM_TUNE_NUM_RUN 3
+// A candidate replaces the current best only if it is faster by this fraction, so that timing noise does not
+// move the blocking away from the default.
+#define SGEMM_TUNE_TOLERANCE ((double)0.03)
+
+typedef struct
+{
+    unsigned int M, N, K;
+    sgemm_blocking_t blocking;
+    int conv_1x1_direct; // 1 if the direct 1x1 conv path is faster than im2col, 0 if not, -1 if not timed.
+    int is_saved;
+} sgemm_tune_entry_t;
+
+// Candidates of each dimension, in ascending order. The search sweeps tile_k, then tile_n, then tile_m,
+// starting from the default blocking.
+static const unsigned int sgemm_tune_m_arr [] = {32, 64, 96, 128};
+static const unsigned int sgemm_tune_n_arr [] = {24, 48, 72, 96, 120};
+static const unsigned int sgemm_tune_k_arr [] = {128, 192, 256, 368, 512, 736};
+
+static sgemm_tune_entry_t sgemm_tune_arr [SGEMM_TUNE_MAX_ENTRIES];
+static unsigned int sgemm_tune_num_entries = 0;
+static char sgemm_tune_loaded_path [2 * MAX_STRING_LEN] = {0};
+static pthread_mutex_t sgemm_tune_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+// Blockings must keep the row blocks on packed A panels, stay within the tile sizes of the fixed-size kernels
+// and the JIT, and keep the im2col B panel of a block within that of the default blocking in the DSE scratchpad.
+static int is_sgemm_blocking_valid (const sgemm_blocking_t *blocking)
+{
+    return blocking->tile_m > 0 && blocking->tile_m % _VEC_SIZE_M == 0 && blocking->tile_m <= _TILE_SIZE_M
+        && blocking->tile_n > 0 && blocking->tile_n <= _TILE_SIZE_N && blocking->tile_k > 0
+            && blocking->tile_n * blocking->tile_k <= _TILE_SIZE_N * _TILE_SIZE_K;
+}
+
+static void get_sgemm_tune_path (const char *cache_dir, char *path)
+{
+    char host [MAX_STRING_LEN] = {0};
+    if (gethostname (host, MAX_STRING_LEN - 1) != 0 || host[0] == '\0')
+        strcpy (host, "unknown");
+    snprintf (path, 2 * MAX_STRING_LEN, "%s/aspen_sgemm_tune_%s.txt", cache_dir, host);
+}
+
+static sgemm_tune_entry_t *find_sgemm_tune_entry (unsigned int M, unsigned int N, unsigned int K)
+{
+    for (unsigned int i = 0; i < sgemm_tune_num_entries; i++)
+    {
+        sgemm_tune_entry_t *entry = &sgemm_tune_arr[i];
+        if (entry->M == M && entry->N == N && entry->K == K)
+            return entry;
+    }
+    return NULL;
+}
+
+// Adds the shape, or replaces its entry if it has one. Returns NULL if the table is full.
+static sgemm_tune_entry_t *add_sgemm_tune_entry (unsigned int M, unsigned int N, unsigned int K, 
+    const sgemm_blocking_t *blocking, int conv_1x1_direct, int is_saved)
+{
+    sgemm_tune_entry_t *entry = find_sgemm_tune_entry (M, N, K);
+    if (entry == NULL)
+    {
+        if (sgemm_tune_num_entries == SGEMM_TUNE_MAX_ENTRIES)
+            return NULL;
+        entry = &sgemm_tune_arr[sgemm_tune_num_entries++];
+    }
+    entry->M = M;
+    entry->N = N;
+    entry->K = K;
+    entry->blocking = *blocking;
+    entry->conv_1x1_direct = conv_1x1_direct;
+    entry->is_saved = is_saved;
+    return entry;
+}
+
+// Replaces the in-memory entries with those of the cache file at path. A missing file leaves no entries,
+// and invalid lines are skipped.
+static void load_sgemm_tune_cache (const char *path)
+{
+    sgemm_tune_num_entries = 0;
+    snprintf (sgemm_tune_loaded_path, 2 * MAX_STRING_LEN, "%s", path);
+    FILE *fp = fopen (path, "r");
+    if (fp == NULL)
+        return;
+    char line [MAX_STRING_LEN];
+    while (fgets (line, MAX_STRING_LEN, fp) != NULL)
+    {
+        unsigned int M, N, K;
+        sgemm_blocking_t blocking;
+        int conv_1x1_direct = -1;
+        if (line[0] == '#' || sscanf (line, "%u %u %u %u %u %u %d", &M, &N, &K,
+            &blocking.tile_m, &blocking.tile_n, &blocking.tile_k, &conv_1x1_direct) < 6)
+            continue;
+        if (is_sgemm_blocking_valid (&blocking) && conv_1x1_direct >= -1 && conv_1x1_direct <= 1)
+            add_sgemm_tune_entry (M, N, K, &blocking, conv_1x1_direct, 1);
+    }
+    fclose (fp);
+}
+
+// One M x N x K SGEMM with a bias epilogue under the blocking. B is read in place, as by the direct 1x1 conv path, 
+// or gathered through im2col_pos_arr into im2col_buf if im2col_pos_arr is not NULL.
+static void run_sgemm_tune_call (unsigned int M, unsigned int N, unsigned int K,
+    const float *A, const float *B, float *C, const float *bias, const sgemm_blocking_t *blocking,
+        void **im2col_pos_arr, float *im2col_buf)
+{
+    const sgemm_epilogue_t epi = {.bias = bias, .residual = NULL, .ldr = 0, .activation = NO_ACTIVATION};
+    if (im2col_pos_arr != NULL)
+        tiled_sgemm_im2col (M, N, K, A, K, im2col_pos_arr, 1, K, im2col_buf, C, M, &epi, blocking);
+    else
+        tiled_sgemm_epilogue (M, N, K, A, K, B, K, C, M, &epi, blocking);
+}
+
+// Seconds per run_sgemm_tune_call, best of SGEMM_TUNE_NUM_RUN runs.
+static double time_sgemm_blocking (unsigned int M, unsigned int N, unsigned int K,
+    const float *A, const float *B, float *C, const float *bias, const sgemm_blocking_t *blocking,
+        void **im2col_pos_arr, float *im2col_buf)
+{
+    double best = 1e9;
+    run_sgemm_tune_call (M, N, K, A, B, C, bias, blocking, im2col_pos_arr, im2col_buf);
+    for (unsigned int r = 0; r < SGEMM_TUNE_NUM_RUN; r++)
+    {
+        unsigned int num_call = 0;
+        double start = get_time_secs ();
+        double elapsed = 0;
+        do
+        {
+            run_sgemm_tune_call (M, N, K, A, B, C, bias, blocking, im2col_pos_arr, im2col_buf);
+            num_call++;
+            elapsed = get_time_secs () - start;
+        } while (elapsed < SGEMM_TUNE_MIN_SEC);
+        best = elapsed / num_call < best ? elapsed / num_call : best;
+    }
+    return best;
+}
+
+// Blocks longer than the matrix run the same as a block of its size, so such candidates are not timed twice.
+static int is_same_sgemm_blocking (const sgemm_blocking_t *a, const sgemm_blocking_t *b,
+    unsigned int M, unsigned int N, unsigned int K)
+{
+    return (a->tile_m < M ? a->tile_m : M) == (b->tile_m < M ? b->tile_m : M)
+        && (a->tile_n < N ? a->tile_n : N) == (b->tile_n < N ? b->tile_n : N)
+            && (a->tile_k < K ? a->tile_k : K) == (b->tile_k < K ? b->tile_k : K);
+}
+
+// Operands of the timed SGEMMs of an M x N x K shape.
+typedef struct
+{
+    float *A, *B, *C, *bias;
+} sgemm_tune_operands_t;
+
+static void init_sgemm_tune_operands (sgemm_tune_operands_t *op, unsigned int M, unsigned int N, unsigned int K)
+{
+    const unsigned int M_pad = get_smallest_dividable (M, _VEC_SIZE_M);
+    op->A = aspen_calloc ((size_t) M_pad * K, sizeof(float));
+    op->B = aspen_calloc ((size_t) N * K, sizeof(float));
+    op->C = aspen_calloc ((size_t) M_pad * N, sizeof(float));
+    op->bias = aspen_calloc (M_pad, sizeof(float));
+    for (size_t i = 0; i < (size_t) M_pad * K; i++)
+        op->A[i] = 0.01f * (i % 7);
+    for (size_t i = 0; i < (size_t) N * K; i++)
+        op->B[i] = 0.01f * (i % 5);
+}
+
+static void free_sgemm_tune_operands (sgemm_tune_operands_t *op)
+{
+    aspen_free (op->A);
+    aspen_free (op->B);
+    aspen_free (op->C);
+    aspen_free (op->bias);
+}
+
+// Coordinate search over the candidate blockings of an M x N x K SGEMM, starting from the default.
+static sgemm_blocking_t tune_sgemm_blocking (unsigned int M, unsigned int N, unsigned int K)
+{
+    sgemm_tune_operands_t op;
+    init_sgemm_tune_operands (&op, M, N, K);
+    const float *A = op.A, *B = op.B, *bias = op.bias;
+    float *C = op.C;
+    sgemm_blocking_t best = default_sgemm_blocking;
+    double best_sec = time_sgemm_blocking (M, N, K, A, B, C, bias, &best, NULL, NULL);
+    const unsigned int *cand_arr [3] = {sgemm_tune_k_arr, sgemm_tune_n_arr, sgemm_tune_m_arr};
+    const unsigned int num_cand_arr [3] = {sizeof(sgemm_tune_k_arr) / sizeof(unsigned int),
+        sizeof(sgemm_tune_n_arr) / sizeof(unsigned int), sizeof(sgemm_tune_m_arr) / sizeof(unsigned int)};
+    for (unsigned int d = 0; d < 3; d++)
+    {
+        const sgemm_blocking_t start = best;
+        sgemm_blocking_t prev = start;
+        for (unsigned int c = 0; c < num_cand_arr[d]; c++)
+        {
+            sgemm_blocking_t cand = start;
+            unsigned int *tile = d == 0 ? &cand.tile_k : d == 1 ? &cand.tile_n : &cand.tile_m;
+            *tile = cand_arr[d][c];
+            if (!is_sgemm_blocking_valid (&cand) || is_same_sgemm_blocking (&cand, &start, M, N, K)
+                || (c > 0 && is_same_sgemm_blocking (&cand, &prev, M, N, K)))
+                continue;
+            prev = cand;
+            double sec = time_sgemm_blocking (M, N, K, A, B, C, bias, &cand, NULL, NULL);
+            if (sec >= best_sec * (1 - SGEMM_TUNE_TOLERANCE))
+                continue;
+            // Confirmed against a fresh timing of the current best, so that a slow period of the host during 
+            // its first timing does not make a worse candidate win.
+            const double best_sec_again = time_sgemm_blocking (M, N, K, A, B, C, bias, &best, NULL, NULL);
+            const double sec_again = time_sgemm_blocking (M, N, K, A, B, C, bias, &cand, NULL, NULL);
+            best_sec = best_sec_again < best_sec ? best_sec_again : best_sec;
+            sec = sec_again < sec ? sec_again : sec;
+            if (sec < best_sec * (1 - SGEMM_TUNE_TOLERANCE))
+            {
+                best = cand;
+                best_sec = sec;
+            }
+        }
+    }
+    free_sgemm_tune_operands (&op);
+    return best;
+}
+
+// Returns 0 if a 1x1 conv of the M x N x K shape runs faster through im2col than on the parent out_mat directly
+// under the blocking, by more than SGEMM_TUNE_TOLERANCE in two timings of both paths, and 1 otherwise.
+// The direct path reads B with stride K, like a parent out_mat of exactly K channels.
+static int tune_conv_1x1_direct (unsigned int M, unsigned int N, unsigned int K, const sgemm_blocking_t *blocking)
+{
+    sgemm_tune_operands_t op;
+    init_sgemm_tune_operands (&op, M, N, K);
+    // load_im2col_ptr looks up the entry after the last column when a K block ends on a column boundary, and copies
+    // the rest of the column when a block starts inside one, so the buffers are sized as generously as the DSE scratchpad.
+    void **pos_arr = aspen_calloc (N + 1, sizeof(void*));
+    float *im2col_buf = aspen_calloc ((size_t) N * K, sizeof(float));
+    for (unsigned int n = 0; n < N; n++)
+        pos_arr[n] = op.B + (size_t) n * K;
+    int direct = 0;
+    for (unsigned int r = 0; r < 2 && !direct; r++)
+    {
+        const double direct_sec = time_sgemm_blocking (M, N, K, op.A, op.B, op.C, op.bias, blocking, NULL, NULL);
+        const double im2col_sec = time_sgemm_blocking (M, N, K, op.A, op.B, op.C, op.bias, blocking, 
+            pos_arr, im2col_buf);
+        direct = im2col_sec >= direct_sec * (1 - SGEMM_TUNE_TOLERANCE);
+    }
+    aspen_free (pos_arr);
+    aspen_free (im2col_buf);
+    free_sgemm_tune_operands (&op);
+    return direct;
+}
+
+// Sets the SGEMM blocking of every ldata that runs one (see get_ldata_sgemm_dims), and the conv_1x1_direct of
+// 1x1 convs, from the tuning cache of this host in cache_dir. Tunes and appends the shapes it does not have yet.
+// Single-threaded, like the cost model calibration.
+void tune_nasm_sgemm_blocking (nasm_t *nasm, const char *cache_dir)
+{
+    char path [2 * MAX_STRING_LEN];
+    get_sgemm_tune_path (cache_dir, path);
+    pthread_mutex_lock (&sgemm_tune_mutex);
+    if (strcmp (path, sgemm_tune_loaded_path) != 0)
+        load_sgemm_tune_cache (path);
+    for (int i = 0; i < nasm->num_ldata; i++)
+    {
+        nasm_ldata_t *ldata = &nasm->ldata_arr[i];
+        unsigned int M, N, K;
+        if (!get_ldata_sgemm_dims (ldata, &M, &N, &K))
+            continue;
+        sgemm_tune_entry_t *entry = find_sgemm_tune_entry (M, N, K);
+        if (entry == NULL)
+        {
+            const sgemm_blocking_t blocking = tune_sgemm_blocking (M, N, K);
+            entry = add_sgemm_tune_entry (M, N, K, &blocking, -1, 0);
+        }
+        if (entry == NULL)
+            continue;
+        ldata->sgemm_blocking = entry->blocking;
+        if (!is_layer_conv_1x1 (ldata->layer))
+            continue;
+        if (entry->conv_1x1_direct == -1)
+        {
+            entry->conv_1x1_direct = tune_conv_1x1_direct (M, N, K, &entry->blocking);
+            entry->is_saved = 0;
+        }
+        ldata->conv_1x1_direct = entry->conv_1x1_direct;
+    }
+    int is_saved = 1;
+    for (unsigned int i = 0; i < sgemm_tune_num_entries; i++)
+        is_saved &= sgemm_tune_arr[i].is_saved;
+    if (!is_saved)
+    {
+        FILE *fp = fopen (path, "a");
+        if (fp == NULL)
+        {
+            ERROR_PRTF ("Error in tune_nasm_sgemm_blocking: Cannot open %s. Tuned blockings are not saved.\n", path);
+        }
+        else
+        {
+            fseek (fp, 0, SEEK_END);
+            if (ftell (fp) == 0)
+                fprintf (fp, "# ASPEN SGEMM blocking cache: M N K tile_m tile_n tile_k conv_1x1_direct\n");
+            for (unsigned int i = 0; i < sgemm_tune_num_entries; i++)
+            {
+                sgemm_tune_entry_t *entry = &sgemm_tune_arr[i];
+                if (entry->is_saved)
+                    continue;
+                fprintf (fp, "%u %u %u %u %u %u %d\n", entry->M, entry->N, entry->K,
+                    entry->blocking.tile_m, entry->blocking.tile_n, entry->blocking.tile_k, entry->conv_1x1_direct);
+                entry->is_saved = 1;
+            }
+            fclose (fp);
+        }
+    }
+    pthread_mutex_unlock (&sgemm_tune_mutex);
+}
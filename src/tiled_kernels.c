@@ -2,6 +2,8 @@
 
 #define _SKIP_KERNELS 0
 
+const sgemm_blocking_t default_sgemm_blocking = {_TILE_SIZE_M, _TILE_SIZE_N, _TILE_SIZE_K};
+
 void *prepare_im2col (ninst_t *ninst, void *buffer)
 {
     nasm_ldata_t *ldata = ninst->ldata;
@@ -24,8 +26,8 @@ void *prepare_im2col (ninst_t *ninst, void *buffer)
             {
                 for (int kw = 0; kw < layer->params[WEIGHT_W]; kw++)
                 {
-                    int in_h = out_h * layer->params[STRIDE] + kh  - layer->params[PADDING];
-                    int in_w = out_w * layer->params[STRIDE] + kw  - layer->params[PADDING];
+                    int in_h = out_h * layer->params[STRIDE] + kh * layer->params[DILATION] - layer->params[PADDING];
+                    int in_w = out_w * layer->params[STRIDE] + kw * layer->params[DILATION] - layer->params[PADDING];
                     if (in_h < 0 || in_h >= p_layer->params[OUT_H] || in_w < 0 || in_w >= p_layer->params[OUT_W])
                     {
                         input_ptr_arr[num_idx++] = NULL;
@@ -160,160 +162,688 @@ void load_im2col_ptr (float* output, unsigned int out_stride,
     }
 }
 
-void tiled_conv2d (ninst_t *ninst, dse_t *dse)
+// C[M x N] += A[M x K] * B[K x N] for one K block of a tile, N <= blocking->tile_n, in row blocks of blocking->tile_m. 
+// If epi is not NULL, this is the last K block and the epilogue is applied by the microkernels while the C tile is 
+// still in registers. Shapes with a JIT kernel (see request_ninst_jit_sgemm) run on it instead of the kernel macros.
+static inline void tiled_sgemm_block (const unsigned int M, const unsigned int N, const unsigned int K,
+    const float *A, const unsigned int lda, const float *B, const unsigned int ldb, float *C, const unsigned int ldc,
+        const sgemm_epilogue_t *epi, const sgemm_blocking_t *blocking)
+{
+    for (unsigned int m = 0; m < M; m += blocking->tile_m)
+    {
+        const unsigned int mr = M - m < blocking->tile_m ? M - m : blocking->tile_m;
+        const float *A_m = A + m * lda;
+        float *C_m = C + m;
+        sgemm_epilogue_t epi_at;
+        const sgemm_epilogue_t *epi_m = get_sgemm_epilogue_at (epi, &epi_at, m, 0);
+        if (jit_sgemm_block (mr, N, K, A_m, lda, B, ldb, C_m, ldc, epi_m))
+            continue;
+        if (epi_m != NULL)
+            SGEMM_KERNEL_EPILOGUE (mr, N, K, A_m, lda, B, ldb, C_m, ldc, epi_m);
+        else if (mr == _TILE_SIZE_M && N == _TILE_SIZE_N)
+            SGEMM_KERNEL_FULL_TILE (mr, N, K, A_m, lda, B, ldb, C_m, ldc);
+        else if (N == _TILE_SIZE_N)
+            SGEMM_KERNEL_TILE_N (mr, N, K, A_m, lda, B, ldb, C_m, ldc);
+        else if (mr == _TILE_SIZE_M)
+            SGEMM_KERNEL_TILE_M (mr, N, K, A_m, lda, B, ldb, C_m, ldc);
+        else
+            SGEMM_KERNEL (mr, N, K, A_m, lda, B, ldb, C_m, ldc);
+    }
+}
+
+// C = epi (A * B) on the CPU for a ninst tile. A is packed by _VEC_SIZE_M, B is read column by column with stride ldb.
+void tiled_sgemm_epilogue (const unsigned int M, const unsigned int N, const unsigned int K,
+    const float *A, const unsigned int lda, const float *B, const unsigned int ldb, float *C, const unsigned int ldc,
+        const sgemm_epilogue_t *epi, const sgemm_blocking_t *blocking)
+{
+    for (unsigned int n = 0; n < N; n += blocking->tile_n)
+    {
+        const unsigned int nr = N - n < blocking->tile_n ? N - n : blocking->tile_n;
+        sgemm_epilogue_t epi_n;
+        for (unsigned int nn = n; nn < n + nr; nn++)
+            memset (C + (size_t) nn * ldc, 0, M * sizeof(float));
+        for (unsigned int k = 0; k < K; k += blocking->tile_k)
+        {
+            const unsigned int kr = K - k < blocking->tile_k ? K - k : blocking->tile_k;
+            tiled_sgemm_block (M, nr, kr, A + k * _VEC_SIZE_M, lda, B + (size_t) n * ldb + k, ldb, C + (size_t) n * ldc, ldc, 
+                k + kr == K ? get_sgemm_epilogue_at (epi, &epi_n, 0, n) : NULL, blocking);
+        }
+    }
+}
+
+// C = epi (A * B) on the CPU for a ninst tile, with B gathered by load_im2col_ptr from the input columns at
+// input_pos_arr into B_buf, one block of blocking->tile_n columns by blocking->tile_k rows at a time.
+void tiled_sgemm_im2col (const unsigned int M, const unsigned int N, const unsigned int K,
+    const float *A, const unsigned int lda, void **input_pos_arr, const unsigned int input_pos_per_n, 
+        const unsigned int input_col_size, float *B_buf, float *C, const unsigned int ldc,
+            const sgemm_epilogue_t *epi, const sgemm_blocking_t *blocking)
+{
+    for (unsigned int n = 0; n < N; n += blocking->tile_n)
+    {
+        const unsigned int nr = N - n < blocking->tile_n ? N - n : blocking->tile_n;
+        sgemm_epilogue_t epi_n;
+        for (unsigned int nn = n; nn < n + nr; nn++)
+            memset (C + (size_t) nn * ldc, 0, M * sizeof(float));
+        for (unsigned int k = 0; k < K; k += blocking->tile_k)
+        {
+            const unsigned int kr = K - k < blocking->tile_k ? K - k : blocking->tile_k;
+            load_im2col_ptr (B_buf, kr, input_pos_arr + input_pos_per_n * n, NULL, 0, 
+                nr, input_pos_per_n, input_col_size, k, k + kr);
+            tiled_sgemm_block (M, nr, kr, A + k * _VEC_SIZE_M, lda, B_buf, kr, C + (size_t) n * ldc, ldc, 
+                k + kr == K ? get_sgemm_epilogue_at (epi, &epi_n, 0, n) : NULL, blocking);
+        }
+    }
+}
+
+// C = act(A * B + bias) on the CPU for a ninst tile.
+static void tiled_sgemm_bias_act (const unsigned int M, const unsigned int N, const unsigned int K,
+    const void *A, const unsigned int lda, const void *B, const unsigned int ldb, void *C, const unsigned int ldc,
+    const float *bias, LAYER_ACT activation, const sgemm_blocking_t *blocking)
+{
+    const sgemm_epilogue_t epi = {.bias = bias, .residual = NULL, .ldr = 0, .activation = activation};
+    tiled_sgemm_epilogue (M, N, K, A, lda, B, ldb, C, ldc, &epi, blocking);
+}
+
+// C = act(A * B + bias) with FP16 weights. K is blocked by _TILE_SIZE_K so that the weight panel stays in cache 
+// across the columns of B; with few columns the weights are streamed once, at half the bytes of FP32.
+static void tiled_hgemm_bias_act (const unsigned int M, const unsigned int N, const unsigned int K,
+    const uint16_t *A, const unsigned int lda, const float *B, const unsigned int ldb, float *C, const unsigned int ldc,
+    const float *bias, LAYER_ACT activation)
+{
+    const sgemm_epilogue_t epi = {.bias = bias, .residual = NULL, .ldr = 0, .activation = activation};
+    for (unsigned int n = 0; n < N; n += _TILE_SIZE_N)
+    {
+        const unsigned int nr = N - n < _TILE_SIZE_N ? N - n : _TILE_SIZE_N;
+        sgemm_epilogue_t epi_n;
+        for (unsigned int nn = n; nn < n + nr; nn++)
+            memset (C + (size_t) nn * ldc, 0, M * sizeof(float));
+        for (unsigned int k = 0; k < K; k += _TILE_SIZE_K)
+        {
+            const unsigned int kr = K - k < _TILE_SIZE_K ? K - k : _TILE_SIZE_K;
+            HGEMM_KERNEL (M, nr, kr, A + (size_t) k * _VEC_SIZE_M, lda, B + (size_t) n * ldb + k, ldb, C + (size_t) n * ldc, ldc,
+                k + kr == K ? get_sgemm_epilogue_at (&epi, &epi_n, 0, n) : NULL);
+        }
+    }
+}
+
+// C = act(A * B + bias) for INT8 layers. B columns are quantized to u8 in chunks of _QGEMM_TILE_N and multiplied 
+// with the INT8 weights, with dequantization and bias applied in the GEMM epilogue. Column n of B is read from B + n * ldb,
+// or gathered from input_pos_per_n im2col pointers to col_size inputs each (NULL for padding) if input_pos_arr is not NULL.
+// Returns 0 without computing anything if a quantized column does not fit in the scratchpad.
+static int tiled_qgemm_act (ninst_t *ninst, void *scratchpad, size_t scratchpad_size, 
+    const unsigned int K, const float *B, const unsigned int ldb, 
+        void **input_pos_arr, const unsigned int input_pos_per_n, const unsigned int col_size, 
+            float *C, const unsigned int ldc)
+{
+    aspen_layer_t *layer = ninst->ldata->layer;
+    const unsigned int M = ninst->tile_dims[OUT_H];
+    const unsigned int N = ninst->tile_dims[OUT_W];
+    const unsigned int K_pad = get_smallest_dividable (K, _QGEMM_K_GROUP);
+    unsigned int chunk_size = scratchpad_size / K_pad;
+    if (chunk_size == 0)
+        return 0;
+    if (chunk_size > _QGEMM_TILE_N)
+        chunk_size = _QGEMM_TILE_N;
+    float act_scale, zero_point;
+    get_layer_int8_act_params (layer, &act_scale, &zero_point);
+    const float inv_scale = 1 / act_scale;
+    const int8_t *A = (int8_t*)layer->tensors[QUANT_WEIGHT_TENSOR]->data + (size_t) ninst->out_mat_pos[OUT_H] * K_pad;
+    const float *scale = (float*)layer->tensors[QUANT_SCALE_TENSOR]->data + ninst->out_mat_pos[OUT_H];
+    const float *offset = (float*)layer->tensors[QUANT_OFFSET_TENSOR]->data + ninst->out_mat_pos[OUT_H];
+    uint8_t *B_q = scratchpad;
+    for (unsigned int n = 0; n < N; n += chunk_size)
+    {
+        const unsigned int num_cols = N - n < chunk_size ? N - n : chunk_size;
+        for (unsigned int nn = 0; nn < num_cols; nn++)
+        {
+            uint8_t *col = B_q + (size_t) nn * K_pad;
+            if (input_pos_arr == NULL)
+                QUANTIZE_U8 (B + (size_t) (n + nn) * ldb, col, K, inv_scale, zero_point, QGEMM_ACT_MAX);
+            else
+            {
+                void **pos_arr = input_pos_arr + (size_t) (n + nn) * input_pos_per_n;
+                for (unsigned int i = 0; i < input_pos_per_n; i++)
+                {
+                    if (pos_arr[i] == NULL)
+                        memset (col + i * col_size, (int) zero_point, col_size);
+                    else
+                        QUANTIZE_U8 (pos_arr[i], col + i * col_size, col_size, inv_scale, zero_point, QGEMM_ACT_MAX);
+                }
+            }
+            memset (col + K, 0, K_pad - K);
+        }
+        QGEMM_KERNEL (M, num_cols, K_pad, A, B_q, K_pad, C + (size_t) n * ldc, ldc, scale, offset);
+        for (unsigned int nn = n; nn < n + num_cols; nn++)
+            ACTIVATE (C + (size_t) nn * ldc, M, layer->activation);
+    }
+    return 1;
+}
+
+// Returns the skip-connection tile of the residual computed by a conv ninst with fused conv + residual, and sets 
+// *ldr and *activation to its stride and the residual activation. Returns NULL for other ninsts.
+static const float *get_fused_residual_tile (ninst_t *ninst, unsigned int *ldr, LAYER_ACT *activation)
+{
+    nasm_ldata_t *ldata = ninst->ldata;
+    nasm_ldata_t *res_ldata = get_fused_conv_residual_ldata (ldata);
+    if (res_ldata == NULL)
+        return NULL;
+    const LAYER_PARENTS skip_pidx = ldata->nasm->ldata_arr + res_ldata->parent_ldata_idx_arr[PARENT_0] == ldata ? PARENT_1 : PARENT_0;
+    nasm_ldata_t *skip_ldata = ldata->nasm->ldata_arr + res_ldata->parent_ldata_idx_arr[skip_pidx];
+    *ldr = skip_ldata->out_mat_stride;
+    *activation = res_ldata->layer->activation;
+    return (float*)skip_ldata->out_mat + (size_t) ninst->out_mat_pos[OUT_W] * skip_ldata->out_mat_stride 
+        + ninst->out_mat_pos[OUT_H];
+}
+
+// Queues the JIT kernels of the tiled_sgemm_block calls of tiled_sgemm_epilogue on a ninst tile.
+// ldb 0 stands for B blocks packed by im2col, with ldb = kr.
+static void request_sgemm_epilogue_jit (const unsigned int M, const unsigned int N, const unsigned int K,
+    const unsigned int lda, const unsigned int ldb, const unsigned int ldc, const sgemm_epilogue_t *epi, 
+        const sgemm_blocking_t *blocking)
+{
+    jit_sgemm_shape_t shape;
+    for (unsigned int n = 0; n < N; n += blocking->tile_n)
+    {
+        const unsigned int nr = N - n < blocking->tile_n ? N - n : blocking->tile_n;
+        for (unsigned int k = 0; k < K; k += blocking->tile_k)
+        {
+            const unsigned int kr = K - k < blocking->tile_k ? K - k : blocking->tile_k;
+            for (unsigned int m = 0; m < M; m += blocking->tile_m)
+            {
+                const unsigned int mr = M - m < blocking->tile_m ? M - m : blocking->tile_m;
+                set_jit_sgemm_shape (&shape, mr, nr, kr, lda, ldb != 0 ? ldb : kr, ldc, k + kr == K ? epi : NULL);
+                jit_sgemm_request (&shape);
+            }
+        }
+    }
+}
+
+// Queues the JIT kernels of the SGEMM blocks run by the CPU path of a ninst: FP32 im2col and 1x1 convs, 
+// fully connected layers and matmuls. jit_sgemm_generate builds them.
+void request_ninst_jit_sgemm (ninst_t *ninst)
+{
+    nasm_ldata_t *ldata = ninst->ldata;
+    aspen_layer_t *layer = ldata->layer;
+    if (layer->tensors[QUANT_WEIGHT_TENSOR] != NULL || layer->tensors[FP16_WEIGHT_TENSOR] != NULL)
+        return;
+    nasm_ldata_t *p_ldata = (ldata->parent_ldata_idx_arr[PARENT_0] + ldata->nasm->ldata_arr);
+    const unsigned int M = ninst->tile_dims[OUT_H];
+    const unsigned int N = ninst->tile_dims[OUT_W];
+    const unsigned int ldc = ldata->out_mat_stride;
+    sgemm_epilogue_t epi = {.bias = layer->tensors[BIAS_TENSOR] != NULL ? layer->tensors[BIAS_TENSOR]->data : NULL, 
+        .residual = NULL, .ldr = 0, .activation = layer->activation};
+    if (layer->type == CONV_LAYER)
+    {
+        if (layer->params[GROUPS] > 1 || layer->params[DILATION] > 1)
+            return;
+        epi.residual = get_fused_residual_tile (ninst, &epi.ldr, &epi.activation);
+        if (ldata->conv_1x1_direct)
+            request_sgemm_epilogue_jit (M, N, layer->params[IN_C], layer->params[IN_C], p_ldata->out_mat_stride, ldc, &epi, 
+                &ldata->sgemm_blocking);
+        else if (layer->tensors[WINOGRAD_WEIGHT_TENSOR] == NULL)
+        {
+            const unsigned int K = layer->params[WEIGHT_H] * layer->params[WEIGHT_W] * layer->params[IN_C];
+            request_sgemm_epilogue_jit (M, N, K, K, 0, ldc, &epi, &ldata->sgemm_blocking);
+        }
+    }
+    else if (layer->type == FC_LAYER)
+    {
+        const unsigned int K = layer->params[IN_C] * layer->params[IN_H] * layer->params[IN_W];
+        request_sgemm_epilogue_jit (M, N, K, K, K, ldc, &epi, &ldata->sgemm_blocking);
+    }
+    else if (layer->type == MATMUL_LAYER)
+        request_sgemm_epilogue_jit (M, N, layer->params[MAT_K], layer->params[MAT_K], p_ldata->out_mat_stride, ldc, &epi, 
+            &ldata->sgemm_blocking);
+}
+
+// 1x1, stride 1, unpadded convs, whose ninsts can read the parent out_mat as the SGEMM B operand (see tiled_conv2d_1x1).
+// The direct path is the default, and tune_nasm_sgemm_blocking keeps it per layer only where it beats im2col.
+int is_layer_conv_1x1 (aspen_layer_t *layer)
+{
+    return layer->type == CONV_LAYER && layer->params[GROUPS] <= 1 && layer->params[WEIGHT_H] == 1 
+        && layer->params[WEIGHT_W] == 1 && layer->params[STRIDE] == 1 && layer->params[PADDING] == 0;
+}
+
+// Sets M, N and K to the shape of a full ninst tile of the ldata and returns 1 if its ninsts run the FP32 SGEMM 
+// with the ldata blocking on the CPU: im2col and 1x1 convs, fully connected layers and matmuls. Returns 0 otherwise.
+int get_ldata_sgemm_dims (nasm_ldata_t *ldata, unsigned int *M, unsigned int *N, unsigned int *K)
+{
+    aspen_layer_t *layer = ldata->layer;
+    if (layer->tensors[QUANT_WEIGHT_TENSOR] != NULL || layer->tensors[FP16_WEIGHT_TENSOR] != NULL)
+        return 0;
+    *M = ldata->ninst_tile_dims[OUT_H];
+    *N = ldata->ninst_tile_dims[OUT_W];
+    if (layer->type == CONV_LAYER)
+    {
+        if (layer->params[GROUPS] > 1)
+            return 0;
+        if (is_layer_conv_1x1 (layer))
+        {
+            *K = layer->params[IN_C];
+            return 1;
+        }
+        if (layer->tensors[WINOGRAD_WEIGHT_TENSOR] != NULL || layer->params[DILATION] > 1)
+            return 0;
+        *K = layer->params[WEIGHT_H] * layer->params[WEIGHT_W] * layer->params[IN_C];
+        return 1;
+    }
+    if (layer->type == FC_LAYER)
+    {
+        *K = layer->params[IN_C] * layer->params[IN_H] * layer->params[IN_W];
+        return 1;
+    }
+    if (layer->type == MATMUL_LAYER)
+    {
+        *K = layer->params[MAT_K];
+        return 1;
+    }
+    return 0;
+}
+
+// Fused residual for the conv paths without an SGEMM epilogue, applied to the finished tile while it is in cache.
+static void tiled_conv2d_add_residual (ninst_t *ninst)
+{
+    unsigned int ldr = 0;
+    LAYER_ACT activation = NO_ACTIVATION;
+    const float *R = get_fused_residual_tile (ninst, &ldr, &activation);
+    if (R == NULL)
+        return;
+    const unsigned int M = ninst->tile_dims[OUT_H];
+    const unsigned int ldc = ninst->ldata->out_mat_stride;
+    float *C = ninst->compute_option == NINST_COMPUTE_DUMMY ? get_ninst_out_mem_dummy (ninst) : get_ninst_out_mem (ninst);
+    for (unsigned int n = 0; n < ninst->tile_dims[OUT_W]; n++)
+    {
+        float *out_vec = C + (size_t) n * ldc;
+        const float *res_vec = R + (size_t) n * ldr;
+        for (unsigned int m = 0; m < M; m++)
+            out_vec[m] += res_vec[m];
+        ACTIVATE (out_vec, M, activation);
+    }
+}
+
+static int tiled_conv2d_int8 (ninst_t *ninst, dse_t *dse)
 {
-    #if _SKIP_KERNELS == 0
     nasm_ldata_t *ldata = ninst->ldata;
     aspen_layer_t *layer = ninst->ldata->layer;
     nasm_ldata_t *p_ldata = (ldata->parent_ldata_idx_arr[PARENT_0] + ldata->nasm->ldata_arr);
     void *scratchpad = prepare_im2col (ninst, dse->scratchpad);
-    unsigned int input_col_size = p_ldata->out_mat_dims[OUT_H];
-    void **input_pos_arr = dse->scratchpad;   
-    const unsigned int input_pos_per_n = ninst->num_input_pos/ninst->tile_dims[OUT_W];
+    const size_t input_pos_size = get_smallest_dividable ((char *) scratchpad - (char *) dse->scratchpad, MEM_ALIGN);
+    if (input_pos_size >= DSE_SCRATCHPAD_SIZE)
+        return 0;
+    const unsigned int K = layer->params[WEIGHT_H] * layer->params[WEIGHT_W] * layer->params[IN_C];
+    float *C = get_ninst_out_mem (ninst);
+    if (ninst->compute_option == NINST_COMPUTE_DUMMY) {
+        C = get_ninst_out_mem_dummy (ninst);
+    }
+    return tiled_qgemm_act (ninst, (char *) dse->scratchpad + input_pos_size, DSE_SCRATCHPAD_SIZE - input_pos_size, 
+        K, NULL, 0, dse->scratchpad, ninst->num_input_pos / ninst->tile_dims[OUT_W], p_ldata->out_mat_dims[OUT_H], 
+            C, ldata->out_mat_stride);
+}
+
+// 1x1, stride 1, unpadded convs: output column (b, h, w) reads parent column (b, h, w) only,
+// so the parent out_mat is already the GEMM B operand and im2col is skipped.
+static void tiled_conv2d_1x1 (ninst_t *ninst, dse_t *dse)
+{
+    nasm_ldata_t *ldata = ninst->ldata;
+    aspen_layer_t *layer = ninst->ldata->layer;
+    nasm_ldata_t *p_ldata = (ldata->parent_ldata_idx_arr[PARENT_0] + ldata->nasm->ldata_arr);
     const unsigned int M = ninst->tile_dims[OUT_H];
     const unsigned int N = ninst->tile_dims[OUT_W];
-    const unsigned int K = layer->params[WEIGHT_H] * layer->params[WEIGHT_W] * layer->params[IN_C];
+    const unsigned int K = layer->params[IN_C];
     const unsigned int lda = K;
-    unsigned int ldb = K;
+    const unsigned int ldb = p_ldata->out_mat_stride;
     const unsigned int ldc = ldata->out_mat_stride;
     const void *A = (float*)layer->tensors[WEIGHT_TENSOR]->data + ninst->out_mat_pos[OUT_H] * lda;
-    void *B = (char *) scratchpad;
+    const void *B = (float*)p_ldata->out_mat + ninst->out_mat_pos[OUT_W] * ldb;
     void *C = get_ninst_out_mem (ninst);
     if (ninst->compute_option == NINST_COMPUTE_DUMMY) {
         C = get_ninst_out_mem_dummy (ninst);
     }
-    const unsigned int rem_n = N % _TILE_SIZE_N;
-    const unsigned int rem_m = M % _TILE_SIZE_M;
-    const unsigned int rem_k = K % _TILE_SIZE_K;
-    unsigned int n = 0;
-    if (dse->gpu_idx < 0)
+    sgemm_epilogue_t epi = {.bias = layer->tensors[BIAS_TENSOR] != NULL ? 
+        (float*)layer->tensors[BIAS_TENSOR]->data + ninst->out_mat_pos[OUT_H] : NULL, 
+            .residual = NULL, .ldr = 0, .activation = layer->activation};
+    epi.residual = get_fused_residual_tile (ninst, &epi.ldr, &epi.activation);
+    tiled_sgemm_epilogue (M, N, K, A, lda, B, ldb, C, ldc, &epi, &ldata->sgemm_blocking);
+}
+
+typedef struct
+{
+    unsigned int b, h, w;
+    unsigned int out_mask; // Bit (r * 4 + c) set = output (h + r, w + c) is in the ninst.
+} winograd_tile_t;
+
+// 3x3 stride-1 convs with transformed weights: Winograd F(4x4, 3x3), as 36 GEMMs in the transform domain.
+// A ninst covers an arbitrary column range, so partial tiles are computed with the inputs outside 
+// the receptive field of their valid outputs zeroed, which keeps both the result and the parent dependencies exact.
+// Returns 0 without computing anything if the ninst has too few tiles to amortize the transformed weights,
+// or too many partial ones.
+static int tiled_conv2d_winograd (ninst_t *ninst, dse_t *dse)
+{
+    nasm_ldata_t *ldata = ninst->ldata;
+    aspen_layer_t *layer = ninst->ldata->layer;
+    nasm_ldata_t *p_ldata = (ldata->parent_ldata_idx_arr[PARENT_0] + ldata->nasm->ldata_arr);
+    const unsigned int out_h = layer->params[OUT_H], out_w = layer->params[OUT_W];
+    const unsigned int in_h = p_ldata->layer->params[OUT_H], in_w = p_ldata->layer->params[OUT_W];
+    const unsigned int col_start = ninst->out_mat_pos[OUT_W];
+    const unsigned int col_end = col_start + ninst->tile_dims[OUT_W];
+    const unsigned int M = ninst->tile_dims[OUT_H];
+    const unsigned int K = layer->params[IN_C];
+    const unsigned int M_pad = get_smallest_dividable (M, _VEC_SIZE_M);
+    const unsigned int K_pad = get_smallest_dividable (K, _VEC_SIZE_M);
+    const unsigned int num_tile_w = (out_w + _WINOGRAD_TILE - 1) / _WINOGRAD_TILE;
+
+    winograd_tile_t *tile_arr = dse->scratchpad;
+    unsigned int num_tiles = 0;
+    const unsigned int b_start = col_start / (out_h * out_w), b_end = (col_end - 1) / (out_h * out_w);
+    for (unsigned int b = b_start; b <= b_end; b++)
     {
-        // <M, N, K> = <M, _TILE_SIZE_N, K>
-        for (; n < N - rem_n; n += _TILE_SIZE_N)
+        const unsigned int b_col = b * out_h * out_w;
+        const unsigned int h_start = col_start > b_col ? (col_start - b_col) / out_w : 0;
+        const unsigned int h_end = col_end - b_col < out_h * out_w ? (col_end - 1 - b_col) / out_w : out_h - 1;
+        for (unsigned int h = h_start - h_start % _WINOGRAD_TILE; h <= h_end; h += _WINOGRAD_TILE)
         {
-            for (int nn = 0; nn < _TILE_SIZE_N; nn++)
-            {
-                memset ((float*)C + (ldc * (n + nn)), 0, M * sizeof(float));
-            }
-            unsigned int k = 0;
-            // <M, N, K> = <M, _TILE_SIZE_N, _TILE_SIZE_K>
-            for (; k < K - rem_k; k += _TILE_SIZE_K)
+            for (unsigned int tw = 0; tw < num_tile_w; tw++)
             {
-                ldb = _TILE_SIZE_K;
-                load_im2col_ptr (B, ldb, 
-                    input_pos_arr + input_pos_per_n * n, p_ldata->out_mat, p_ldata->out_mat_stride, 
-                    _TILE_SIZE_N, input_pos_per_n, input_col_size, 
-                    k, k + _TILE_SIZE_K);
-                unsigned int m = 0;
-                
-                // <M, N, K> = <_TILE_SIZE_M, _TILE_SIZE_N, _TILE_SIZE_K>
-                for (; m < M - rem_m; m += _TILE_SIZE_M)
+                const unsigned int w = tw * _WINOGRAD_TILE;
+                unsigned int out_mask = 0;
+                for (unsigned int r = 0; r < _WINOGRAD_TILE && h + r < out_h; r++)
                 {
-                    SGEMM_KERNEL_FULL_TILE (_TILE_SIZE_M, _TILE_SIZE_N, _TILE_SIZE_K, 
-                        (float*)A + (m * lda + k*_VEC_SIZE_M), lda, (float*)B, ldb, (float*)C + (ldc * n + m), ldc);
+                    for (unsigned int c = 0; c < _WINOGRAD_TILE && w + c < out_w; c++)
+                    {
+                        const unsigned int col = b_col + (h + r) * out_w + w + c;
+                        if (col >= col_start && col < col_end)
+                            out_mask |= 1 << (r * _WINOGRAD_TILE + c);
+                    }
                 }
-                // <M, N, K> = <rem_m, _TILE_SIZE_N, _TILE_SIZE_K>
-                if (rem_m != 0)
-                    SGEMM_KERNEL_TILE_N (rem_m, _TILE_SIZE_N, _TILE_SIZE_K, 
-                            (float*)A + (m * lda + k*_VEC_SIZE_M), lda, (float*)B, ldb, (float*)C + (ldc * n + m), ldc);
-            
+                if (out_mask == 0)
+                    continue;
+                if ((num_tiles + 1) * sizeof (winograd_tile_t) > DSE_SCRATCHPAD_SIZE / 4)
+                    return 0;
+                tile_arr[num_tiles].b = b;
+                tile_arr[num_tiles].h = h;
+                tile_arr[num_tiles].w = w;
+                tile_arr[num_tiles].out_mask = out_mask;
+                num_tiles++;
             }
-            // <M, N, K> = <M, _TILE_SIZE_N, rem_k>
-            if (rem_k != 0)
-            {
-                ldb = rem_k;
-                load_im2col_ptr (B, ldb, 
-                    input_pos_arr + input_pos_per_n * n, p_ldata->out_mat, p_ldata->out_mat_stride, 
-                    _TILE_SIZE_N, input_pos_per_n, input_col_size, 
-                    k, K);
+        }
+    }
+    if (num_tiles < _WINOGRAD_MIN_NUM_TILES 
+        || num_tiles * _WINOGRAD_TILE * _WINOGRAD_TILE > _WINOGRAD_MAX_TILE_WASTE * ninst->tile_dims[OUT_W])
+        return 0;
 
-                unsigned int m = 0;
-                // <M, N, K> = <_TILE_SIZE_M, _TILE_SIZE_N, rem_k>
-                for (; m < M - rem_m; m += _TILE_SIZE_M)
-                {
-                    SGEMM_KERNEL_FULL_TILE (_TILE_SIZE_M, _TILE_SIZE_N, rem_k,
-                        (float*)A + (m * lda + k*_VEC_SIZE_M), lda, (float*)B, ldb, (float*)C + (ldc * n + m), ldc);
-                }
-                // <M, N, K> = <rem_m, _TILE_SIZE_N, rem_k>
-                SGEMM_KERNEL_TILE_N (rem_m, _TILE_SIZE_N, rem_k, 
-                    (float*)A + (m * lda + k*_VEC_SIZE_M), lda, (float*)B, ldb, (float*)C + (ldc * n + m), ldc);
-            }
-            for (unsigned int nn = n; nn < n + _TILE_SIZE_N; nn++)
+    // Transformed inputs and GEMM outputs of a chunk of tiles share the rest of the scratchpad.
+    const size_t tile_arr_size = get_smallest_dividable (num_tiles * sizeof (winograd_tile_t), MEM_ALIGN);
+    const size_t bytes_per_tile = _WINOGRAD_ALPHA * _WINOGRAD_ALPHA * (K_pad + M_pad) * sizeof (float);
+    unsigned int chunk_size = (DSE_SCRATCHPAD_SIZE - tile_arr_size) / bytes_per_tile;
+    if (chunk_size == 0)
+        return 0;
+    if (chunk_size > num_tiles)
+        chunk_size = num_tiles;
+    else if (chunk_size > _VEC_SIZE_N)
+        chunk_size -= chunk_size % _VEC_SIZE_N;
+    float *V = (float *) ((char *) dse->scratchpad + tile_arr_size);
+    float *Y = V + (size_t) _WINOGRAD_ALPHA * _WINOGRAD_ALPHA * chunk_size * K_pad;
+    const size_t V_stride = (size_t) chunk_size * K_pad;
+    const size_t Y_stride = (size_t) chunk_size * M_pad;
+
+    const unsigned int parent_stride = p_ldata->out_mat_stride;
+    const unsigned int ldc = ldata->out_mat_stride;
+    const size_t A_stride = (size_t) get_smallest_dividable (layer->params[OUT_C], _VEC_SIZE_M) * K;
+    const float *A = (float*)layer->tensors[WINOGRAD_WEIGHT_TENSOR]->data + ninst->out_mat_pos[OUT_H] * K;
+    float *C = get_ninst_out_mem (ninst);
+    if (ninst->compute_option == NINST_COMPUTE_DUMMY) {
+        C = get_ninst_out_mem_dummy (ninst);
+    }
+    const float *bias = layer->tensors[BIAS_TENSOR] != NULL ? 
+        (float*)layer->tensors[BIAS_TENSOR]->data + ninst->out_mat_pos[OUT_H] : NULL;
+    const int pad = layer->params[PADDING];
+    for (unsigned int t_start = 0; t_start < num_tiles; t_start += chunk_size)
+    {
+        const unsigned int N = num_tiles - t_start < chunk_size ? num_tiles - t_start : chunk_size;
+        for (unsigned int t = 0; t < N; t++)
+        {
+            const winograd_tile_t *tile = tile_arr + t_start + t;
+            // Input (i, j) is needed if it is in the 3x3 window of a valid output.
+            unsigned int row_mask[_WINOGRAD_TILE] = {0};
+            for (unsigned int r = 0; r < _WINOGRAD_TILE; r++)
+                row_mask[r] = (tile->out_mask >> (r * _WINOGRAD_TILE)) & ((1 << _WINOGRAD_TILE) - 1);
+            const float *input_ptr_arr[_WINOGRAD_ALPHA * _WINOGRAD_ALPHA];
+            for (unsigned int i = 0; i < _WINOGRAD_ALPHA; i++)
             {
-                float *out_vec = (float *)C + nn * ldc;
-                if (layer->tensors[BIAS_TENSOR] != NULL)
+                unsigned int needed = 0;
+                for (unsigned int r = (i > 2 ? i - 2 : 0); r <= i && r < _WINOGRAD_TILE; r++)
+                    needed |= row_mask[r] | (row_mask[r] << 1) | (row_mask[r] << 2);
+                const int ih = (int) tile->h + i - pad;
+                for (unsigned int j = 0; j < _WINOGRAD_ALPHA; j++)
                 {
-                    float *bias = (float*)layer->tensors[BIAS_TENSOR]->data + ninst->out_mat_pos[OUT_H];
-                    for (unsigned int m = 0; m < M; m++)
-                    {
-                        out_vec[m] += bias[m];
-                    }
+                    const int iw = (int) tile->w + j - pad;
+                    if (!(needed & (1 << j)) || ih < 0 || ih >= in_h || iw < 0 || iw >= in_w)
+                        input_ptr_arr[i * _WINOGRAD_ALPHA + j] = NULL;
+                    else
+                        input_ptr_arr[i * _WINOGRAD_ALPHA + j] = (float*)p_ldata->out_mat 
+                            + ((size_t) (tile->b * in_h + ih) * in_w + iw) * parent_stride;
                 }
-                naive_activate (out_vec, M, layer->activation);
             }
+            WINOGRAD_INPUT_TRANSFORM (input_ptr_arr, V + t * K_pad, V_stride, K);
         }
-        // <M, N, K> = <M, rem_n, K>
-        if (rem_n != 0)
+        for (unsigned int xi = 0; xi < _WINOGRAD_ALPHA * _WINOGRAD_ALPHA; xi++)
         {
-            for (int nn = 0; nn < rem_n; nn++)
-            {
-                memset ((float*)C + (ldc * (n + nn)), 0, M * sizeof(float));
-            }
-            unsigned int k = 0;
-            // <M, N, K> = <M, rem_n, _TILE_SIZE_K>
-            for (; k < K - rem_k; k += _TILE_SIZE_K)
+            tiled_sgemm_bias_act (M, N, K, A + xi * A_stride, K, V + xi * V_stride, K_pad, 
+                Y + xi * Y_stride, M_pad, NULL, NO_ACTIVATION, &default_sgemm_blocking);
+        }
+        for (unsigned int t = 0; t < N; t++)
+        {
+            const winograd_tile_t *tile = tile_arr + t_start + t;
+            float *output_ptr_arr[_WINOGRAD_TILE * _WINOGRAD_TILE];
+            for (unsigned int i = 0; i < _WINOGRAD_TILE * _WINOGRAD_TILE; i++)
             {
-                ldb = _TILE_SIZE_K;
-                load_im2col_ptr (B, ldb, 
-                    input_pos_arr + input_pos_per_n * n, p_ldata->out_mat, p_ldata->out_mat_stride, 
-                    rem_n, input_pos_per_n, input_col_size, 
-                    k, k + _TILE_SIZE_K);
-                unsigned int m = 0;
-                // <M, N, K> = <_TILE_SIZE_M, rem_n, _TILE_SIZE_K>
-                for (; m < M - rem_m; m += _TILE_SIZE_M)
-                {
-                    SGEMM_KERNEL_TILE_M (_TILE_SIZE_M, rem_n, _TILE_SIZE_K, 
-                        (float*)A + (m * lda + k*_VEC_SIZE_M), lda, (float*)B, ldb, (float*)C + (ldc * n + m), ldc);
-                }
-                // <M, N, K> = <rem_m, rem_n, _TILE_SIZE_K>
-                if (rem_m != 0)
-                    SGEMM_KERNEL (rem_m, rem_n, _TILE_SIZE_K, 
-                            (float*)A + (m * lda + k*_VEC_SIZE_M), lda, (float*)B, ldb, (float*)C + (ldc * n + m), ldc);
+                const unsigned int col = (tile->b * out_h + tile->h + i / _WINOGRAD_TILE) * out_w 
+                    + tile->w + i % _WINOGRAD_TILE;
+                output_ptr_arr[i] = (tile->out_mask & (1 << i)) ? C + (size_t) (col - col_start) * ldc : NULL;
             }
-            // <M, N, K> = <M, rem_n, rem_k>
-            if (rem_k != 0)
+            WINOGRAD_OUTPUT_TRANSFORM (Y + t * M_pad, Y_stride, output_ptr_arr, M, bias);
+        }
+    }
+    for (unsigned int n = 0; n < ninst->tile_dims[OUT_W]; n++)
+        ACTIVATE (C + (size_t) n * ldc, M, layer->activation);
+    return 1;
+}
+
+// Dilated convs (DILATION > 1). The input panel is packed one tap at a time, as a strided gather of the input pixels 
+// the tile's columns read through that tap, and accumulated tap by tap. Dilated taps often fall in the padding for 
+// the whole tile (e.g. the outer taps of DeepLab-style heads), and these are skipped instead of multiplied as zeros.
+static void tiled_conv2d_dilated (ninst_t *ninst, dse_t *dse)
+{
+    nasm_ldata_t *ldata = ninst->ldata;
+    aspen_layer_t *layer = ninst->ldata->layer;
+    void *scratchpad = prepare_im2col (ninst, dse->scratchpad);
+    const float **input_ptr_arr = dse->scratchpad;
+    const unsigned int num_taps = layer->params[WEIGHT_H] * layer->params[WEIGHT_W];
+    const unsigned int M = ninst->tile_dims[OUT_H];
+    const unsigned int N = ninst->tile_dims[OUT_W];
+    const unsigned int in_c = layer->params[IN_C];
+    const unsigned int lda = num_taps * in_c;
+    const unsigned int ldc = ldata->out_mat_stride;
+    const float *A = (float*)layer->tensors[WEIGHT_TENSOR]->data + (size_t) ninst->out_mat_pos[OUT_H] * lda;
+    float *B = (float *) ((char *) dse->scratchpad 
+        + get_smallest_dividable ((char *) scratchpad - (char *) dse->scratchpad, MEM_ALIGN));
+    float *C = get_ninst_out_mem (ninst);
+    if (ninst->compute_option == NINST_COMPUTE_DUMMY) {
+        C = get_ninst_out_mem_dummy (ninst);
+    }
+    sgemm_epilogue_t epi = {.bias = layer->tensors[BIAS_TENSOR] != NULL ? 
+        (float*)layer->tensors[BIAS_TENSOR]->data + ninst->out_mat_pos[OUT_H] : NULL, 
+            .residual = NULL, .ldr = 0, .activation = layer->activation};
+    epi.residual = get_fused_residual_tile (ninst, &epi.ldr, &epi.activation);
+    for (unsigned int n = 0; n < N; n += _TILE_SIZE_N)
+    {
+        const unsigned int nr = N - n < _TILE_SIZE_N ? N - n : _TILE_SIZE_N;
+        const float **ptr_arr = input_ptr_arr + (size_t) n * num_taps;
+        sgemm_epilogue_t epi_n;
+        // The epilogue goes with the last block of the last tap read by any column, or of tap 0 if none is.
+        unsigned int last_tap = 0;
+        for (unsigned int t = 0; t < num_taps; t++)
+            for (unsigned int nn = 0; nn < nr; nn++)
+                if (ptr_arr[nn * num_taps + t] != NULL)
+                    last_tap = t;
+        for (unsigned int nn = n; nn < n + nr; nn++)
+            memset (C + (size_t) nn * ldc, 0, M * sizeof(float));
+        for (unsigned int t = 0; t <= last_tap; t++)
+        {
+            unsigned int is_read = t == last_tap;
+            for (unsigned int nn = 0; nn < nr && !is_read; nn++)
+                is_read = ptr_arr[nn * num_taps + t] != NULL;
+            if (!is_read)
+                continue;
+            for (unsigned int k = 0; k < in_c; k += _TILE_SIZE_K)
             {
-                ldb = rem_k;
-                load_im2col_ptr (B, ldb, 
-                    input_pos_arr + input_pos_per_n * n, p_ldata->out_mat, p_ldata->out_mat_stride, 
-                    rem_n, input_pos_per_n, input_col_size, 
-                    k, K);
-                unsigned int m = 0;
-                // <M, N, K> = <_TILE_SIZE_M, rem_n, rem_k>
-                for (; m < M - rem_m; m += _TILE_SIZE_M)
+                const unsigned int kr = in_c - k < _TILE_SIZE_K ? in_c - k : _TILE_SIZE_K;
+                for (unsigned int nn = 0; nn < nr; nn++)
                 {
-                    SGEMM_KERNEL_TILE_M (_TILE_SIZE_M, rem_n, rem_k,
-                        (float*)A + (m * lda + k*_VEC_SIZE_M), lda, (float*)B, ldb, (float*)C + (ldc * n + m), ldc);
+                    const float *input = ptr_arr[nn * num_taps + t];
+                    if (input == NULL)
+                        memset (B + (size_t) nn * kr, 0, kr * sizeof(float));
+                    else
+                        memcpy (B + (size_t) nn * kr, input + k, kr * sizeof(float));
                 }
-                // <M, N, K> = <rem_m, rem_n, rem_k>
-                SGEMM_KERNEL (rem_m, rem_n, rem_k, 
-                    (float*)A + (m * lda + k*_VEC_SIZE_M), lda, (float*)B, ldb, (float*)C + (ldc * n + m), ldc);
+                tiled_sgemm_block (M, nr, kr, A + ((size_t) t * in_c + k) * _VEC_SIZE_M, lda, B, kr, C + (size_t) n * ldc, ldc, 
+                    t == last_tap && k + kr == in_c ? get_sgemm_epilogue_at (&epi, &epi_n, 0, n) : NULL, 
+                        &default_sgemm_blocking);
             }
-            for (unsigned int nn = n; nn < N; nn++)
+        }
+    }
+}
+
+// Grouped convs (GROUPS > 1). Depthwise convs use a direct kernel, as K = WEIGHT_H * WEIGHT_W is far too small for SGEMM.
+// Groups of a multiple of _VEC_SIZE_M output channels run one SGEMM per group in the tile, with K over the group's 
+// input channels only. Narrower groups, and groups of _VEC_SIZE_M with as few input channels, use a direct grouped kernel.
+static void tiled_conv2d_grouped (ninst_t *ninst, dse_t *dse)
+{
+    nasm_ldata_t *ldata = ninst->ldata;
+    aspen_layer_t *layer = ninst->ldata->layer;
+    void *scratchpad = prepare_im2col (ninst, dse->scratchpad);
+    const float **input_ptr_arr = dse->scratchpad;
+    const unsigned int num_taps = layer->params[WEIGHT_H] * layer->params[WEIGHT_W];
+    const unsigned int in_c_per_group = get_layer_in_c_per_group (layer);
+    const unsigned int out_c_per_group = layer->params[OUT_C] / layer->params[GROUPS];
+    const unsigned int m0 = ninst->out_mat_pos[OUT_H];
+    const unsigned int M = m0 + ninst->tile_dims[OUT_H] > layer->params[OUT_C] ? 
+        layer->params[OUT_C] - m0 : ninst->tile_dims[OUT_H];
+    const unsigned int N = ninst->tile_dims[OUT_W];
+    const unsigned int K = num_taps * in_c_per_group;
+    const unsigned int ldc = ldata->out_mat_stride;
+    const float *A = (float*)layer->tensors[WEIGHT_TENSOR]->data + (size_t) m0 * K;
+    float *C = get_ninst_out_mem (ninst);
+    if (ninst->compute_option == NINST_COMPUTE_DUMMY) {
+        C = get_ninst_out_mem_dummy (ninst);
+    }
+    const float *bias = layer->tensors[BIAS_TENSOR] != NULL ? 
+        (float*)layer->tensors[BIAS_TENSOR]->data + m0 : NULL;
+    if (in_c_per_group == 1 && out_c_per_group == 1)
+    {
+        DEPTHWISE_CONV (M, N, m0, num_taps, A, input_ptr_arr, C, ldc, bias);
+        for (unsigned int n = 0; n < N; n++)
+            ACTIVATE (C + (size_t) n * ldc, M, layer->activation);
+        return;
+    }
+    const size_t input_pos_size = get_smallest_dividable ((char *) scratchpad - (char *) dse->scratchpad, MEM_ALIGN);
+    float *B = (float *) ((char *) dse->scratchpad + input_pos_size);
+    const unsigned int max_cols = (DSE_SCRATCHPAD_SIZE - input_pos_size) / (K * sizeof(float));
+    if (out_c_per_group % _VEC_SIZE_M != 0 || (out_c_per_group == _VEC_SIZE_M && in_c_per_group <= _VEC_SIZE_M) 
+        || max_cols == 0)
+    {
+        GROUPED_CONV (M, N, m0, num_taps, in_c_per_group, out_c_per_group, A, input_ptr_arr, C, ldc, bias);
+        for (unsigned int n = 0; n < N; n++)
+            ACTIVATE (C + (size_t) n * ldc, M, layer->activation);
+        return;
+    }
+    for (unsigned int m = m0; m < m0 + M; )
+    {
+        const unsigned int g = m / out_c_per_group;
+        const unsigned int m_end = (g + 1) * out_c_per_group < m0 + M ? (g + 1) * out_c_per_group : m0 + M;
+        const unsigned int c0 = g * in_c_per_group;
+        for (unsigned int n = 0; n < N; n += max_cols)
+        {
+            const unsigned int nr = N - n < max_cols ? N - n : max_cols;
+            for (unsigned int nn = 0; nn < nr; nn++)
             {
-                float *out_vec = (float *)C + nn * ldc;
-                if (layer->tensors[BIAS_TENSOR] != NULL)
+                const float **ptr_arr = input_ptr_arr + (size_t) (n + nn) * num_taps;
+                for (unsigned int t = 0; t < num_taps; t++)
                 {
-                    float *bias = (float*)layer->tensors[BIAS_TENSOR]->data + ninst->out_mat_pos[OUT_H];
-                    for (unsigned int m = 0; m < M; m++)
-                    {
-                        out_vec[m] += bias[m];
-                        
-                    }
+                    float *col = B + (size_t) nn * K + t * in_c_per_group;
+                    if (ptr_arr[t] == NULL)
+                        memset (col, 0, in_c_per_group * sizeof(float));
+                    else
+                        memcpy (col, ptr_arr[t] + c0, in_c_per_group * sizeof(float));
                 }
-                naive_activate (out_vec, M, layer->activation);
             }
+            tiled_sgemm_bias_act (m_end - m, nr, K, A + (size_t) (m - m0) * K, K, B, K, 
+                C + (size_t) n * ldc + (m - m0), ldc, bias != NULL ? bias + (m - m0) : NULL, layer->activation, 
+                    &default_sgemm_blocking);
+        }
+        m = m_end;
+    }
+}
+
+static void tiled_conv2d_tile (ninst_t *ninst, dse_t *dse)
+{
+    nasm_ldata_t *ldata = ninst->ldata;
+    aspen_layer_t *layer = ninst->ldata->layer;
+    nasm_ldata_t *p_ldata = (ldata->parent_ldata_idx_arr[PARENT_0] + ldata->nasm->ldata_arr);
+    if (layer->params[GROUPS] > 1)
+    {
+        if (dse->gpu_idx < 0)
+        {
+            tiled_conv2d_grouped (ninst, dse);
+            tiled_conv2d_add_residual (ninst);
         }
+        else
+            ERROR_PRTF ("Error in tiled_conv2d: grouped convs are not supported on GPUs.\n");
+        return;
+    }
+    if (dse->gpu_idx < 0 && layer->tensors[QUANT_WEIGHT_TENSOR] != NULL && tiled_conv2d_int8 (ninst, dse))
+    {
+        tiled_conv2d_add_residual (ninst);
+        return;
+    }
+    if (dse->gpu_idx < 0 && ldata->conv_1x1_direct)
+    {
+        tiled_conv2d_1x1 (ninst, dse);
+        return;
+    }
+    if (dse->gpu_idx < 0 && layer->tensors[WINOGRAD_WEIGHT_TENSOR] != NULL && tiled_conv2d_winograd (ninst, dse))
+    {
+        tiled_conv2d_add_residual (ninst);
+        return;
+    }
+    if (dse->gpu_idx < 0 && layer->params[DILATION] > 1)
+    {
+        tiled_conv2d_dilated (ninst, dse);
+        return;
+    }
+    void *scratchpad = prepare_im2col (ninst, dse->scratchpad);
+    unsigned int input_col_size = p_ldata->out_mat_dims[OUT_H];
+    void **input_pos_arr = dse->scratchpad;   
+    const unsigned int input_pos_per_n = ninst->num_input_pos/ninst->tile_dims[OUT_W];
+    const unsigned int M = ninst->tile_dims[OUT_H];
+    const unsigned int N = ninst->tile_dims[OUT_W];
+    const unsigned int K = layer->params[WEIGHT_H] * layer->params[WEIGHT_W] * layer->params[IN_C];
+    const unsigned int lda = K;
+    const unsigned int ldc = ldata->out_mat_stride;
+    const void *A = (float*)layer->tensors[WEIGHT_TENSOR]->data + ninst->out_mat_pos[OUT_H] * lda;
+    void *B = (char *) scratchpad;
+    void *C = get_ninst_out_mem (ninst);
+    if (ninst->compute_option == NINST_COMPUTE_DUMMY) {
+        C = get_ninst_out_mem_dummy (ninst);
+    }
+    if (dse->gpu_idx < 0)
+    {
+        sgemm_epilogue_t epi = {.bias = layer->tensors[BIAS_TENSOR] != NULL ? 
+            (float*)layer->tensors[BIAS_TENSOR]->data + ninst->out_mat_pos[OUT_H] : NULL, 
+                .residual = NULL, .ldr = 0, .activation = layer->activation};
+        epi.residual = get_fused_residual_tile (ninst, &epi.ldr, &epi.activation);
+        tiled_sgemm_im2col (M, N, K, A, lda, input_pos_arr, input_pos_per_n, input_col_size, B, C, ldc, 
+            &epi, &ldata->sgemm_blocking);
     }
     else
     {
@@ -326,12 +856,55 @@ void tiled_conv2d (ninst_t *ninst, dse_t *dse)
         aspen_sync_gpu_stream (dse->gpu_idx, dse->thread_id%GPU_RUN_STREAM_NUM);
         #endif
     }
-    #endif
 }
 
-void tiled_matmul (ninst_t *ninst, dse_t *dse)
+// Fused 2x2, stride 2 maxpool: the conv ninst covers whole pairs of output rows, and pools its finished tile 
+// into the maxpool out_mat while the tile is still in cache.
+static void tiled_conv2d_fused_maxpool (ninst_t *ninst, dse_t *dse)
+{
+    nasm_ldata_t *pool_ldata = ninst->ldata->fused_maxpool_ldata;
+    if (pool_ldata == NULL)
+        return;
+    const unsigned int out_w = ninst->ldata->layer->params[OUT_W];
+    const unsigned int M = ninst->tile_dims[OUT_H];
+    const unsigned int N = ninst->tile_dims[OUT_W] / 4;
+    const unsigned int ldc = ninst->ldata->out_mat_stride;
+    const unsigned int ldp = pool_ldata->out_mat_stride;
+    if (pool_ldata->out_mat == NULL)
+        alloc_ldata_out_mat (pool_ldata);
+    float *C = get_ninst_out_mem (ninst);
+    float *P = pool_ldata->out_mat;
+    if (ninst->compute_option == NINST_COMPUTE_DUMMY) {
+        C = get_ninst_out_mem_dummy (ninst);
+        P = pool_ldata->out_mat_dummy;
+    }
+    // Pooled column n reads conv columns 2n and 2n + 1 of two adjacent output rows.
+    P += (size_t) (ninst->out_mat_pos[OUT_W] / 4) * ldp + ninst->out_mat_pos[OUT_H];
+    const float **input_ptr_arr = dse->scratchpad;
+    for (unsigned int n = 0; n < N; n++)
+    {
+        const float *in = C + ((size_t) (n / (out_w / 2)) * 2 * out_w + (n % (out_w / 2)) * 2) * ldc;
+        input_ptr_arr[n * 4] = in;
+        input_ptr_arr[n * 4 + 1] = in + ldc;
+        input_ptr_arr[n * 4 + 2] = in + (size_t) out_w * ldc;
+        input_ptr_arr[n * 4 + 3] = in + (size_t) (out_w + 1) * ldc;
+    }
+    MAXPOOL_TILE (M, N, 0, 4, input_ptr_arr, P, ldp);
+    for (unsigned int n = 0; n < N; n++)
+        ACTIVATE (P + (size_t) n * ldp, M, pool_ldata->layer->activation);
+}
+
+void tiled_conv2d (ninst_t *ninst, dse_t *dse)
 {
     #if _SKIP_KERNELS == 0
+    tiled_conv2d_tile (ninst, dse);
+    if (dse->gpu_idx < 0)
+        tiled_conv2d_fused_maxpool (ninst, dse);
+    #endif
+}
+
+static void matmul_tile (ninst_t *ninst, dse_t *dse)
+{
     nasm_ldata_t *ldata = ninst->ldata;
     aspen_layer_t *layer = ninst->ldata->layer;
     nasm_ldata_t *p_ldata = (ldata->parent_ldata_idx_arr[PARENT_0] + ldata->nasm->ldata_arr);
@@ -341,118 +914,24 @@ void tiled_matmul (ninst_t *ninst, dse_t *dse)
     const unsigned int lda = K;
     const unsigned int ldb = p_ldata->out_mat_stride;
     const unsigned int ldc = ldata->out_mat_stride;
-    const void *A = (char*)layer->tensors[WEIGHT_TENSOR]->data + (ninst->out_mat_pos[OUT_H] * lda * layer->dnn->element_size);
+    const void *A = NULL;
     const void *B = (char*)p_ldata->out_mat + (ninst->out_mat_pos[OUT_W] * ldb * layer->dnn->element_size);
     void *C = get_ninst_out_mem (ninst);
+    if (dse->gpu_idx < 0 && layer->tensors[QUANT_WEIGHT_TENSOR] != NULL 
+        && tiled_qgemm_act (ninst, dse->scratchpad, DSE_SCRATCHPAD_SIZE, K, B, ldb, NULL, 0, 0, C, ldc))
+        return;
     if (dse->gpu_idx < 0)
     {
-        const unsigned int rem_n = N % _TILE_SIZE_N;
-        const unsigned int rem_m = M % _TILE_SIZE_M;
-        const unsigned int rem_k = K % _TILE_SIZE_K;
-        unsigned int n = 0;
-        // <M, N, K> = <M, _TILE_SIZE_N, K>
-        for (; n < N - rem_n; n += _TILE_SIZE_N)
-        {
-            for (int nn = 0; nn < _TILE_SIZE_N; nn++)
-            {
-                memset ((float*)C + (ldc * (n + nn)), 0, M * sizeof(float));
-            }
-            unsigned int k = 0;
-            // <M, N, K> = <M, _TILE_SIZE_N, _TILE_SIZE_K>
-            for (; k < K - rem_k; k += _TILE_SIZE_K)
-            {
-                unsigned int m = 0;
-                // <M, N, K> = <_TILE_SIZE_M, _TILE_SIZE_N, _TILE_SIZE_K>
-                for (; m < M - rem_m; m += _TILE_SIZE_M)
-                {
-                    SGEMM_KERNEL_FULL_TILE (_TILE_SIZE_M, _TILE_SIZE_N, _TILE_SIZE_K, 
-                        (float*)A + (m * lda + k*_VEC_SIZE_M), lda, (float*)B + (n * ldb + k), ldb, (float*)C + (ldc * n + m), ldc);
-                }
-                // <M, N, K> = <rem_m, _TILE_SIZE_N, _TILE_SIZE_K>
-                if (rem_m != 0)
-                    SGEMM_KERNEL_TILE_N (rem_m, _TILE_SIZE_N, _TILE_SIZE_K, 
-                            (float*)A + (m * lda + k*_VEC_SIZE_M), lda, (float*)B + (n * ldb + k), ldb, (float*)C + (ldc * n + m), ldc);
-            
-            }
-            // <M, N, K> = <M, _TILE_SIZE_N, rem_k>
-            if (rem_k != 0)
-            {
-                unsigned int m = 0;
-                // <M, N, K> = <_TILE_SIZE_M, _TILE_SIZE_N, rem_k>
-                for (; m < M - rem_m; m += _TILE_SIZE_M)
-                {
-                    SGEMM_KERNEL_FULL_TILE (_TILE_SIZE_M, _TILE_SIZE_N, rem_k,
-                        (float*)A + (m * lda + k*_VEC_SIZE_M), lda, (float*)B + (n * ldb + k), ldb, (float*)C + (ldc * n + m), ldc);
-                }
-                // <M, N, K> = <rem_m, _TILE_SIZE_N, rem_k>
-                SGEMM_KERNEL_TILE_N (rem_m, _TILE_SIZE_N, rem_k, 
-                    (float*)A + (m * lda + k*_VEC_SIZE_M), lda, (float*)B + (n * ldb + k), ldb, (float*)C + (ldc * n + m), ldc);
-            }
-            for (unsigned int nn = n; nn < n + _TILE_SIZE_N; nn++)
-            {
-                float *out_vec = (float *)C + nn * ldc;
-                if (layer->tensors[BIAS_TENSOR] != NULL)
-                {
-                    float *bias = (float*)layer->tensors[BIAS_TENSOR]->data + ninst->out_mat_pos[OUT_H];
-                    for (unsigned int m = 0; m < M; m++)
-                    {
-                        out_vec[m] += bias[m];
-                    }
-                }
-                naive_activate (out_vec, M, layer->activation);
-            }
-        }
-        // <M, N, K> = <M, rem_n, K>
-        if (rem_n != 0)
+        const float *bias = layer->tensors[BIAS_TENSOR] != NULL ? 
+            (float*)layer->tensors[BIAS_TENSOR]->data + ninst->out_mat_pos[OUT_H] : NULL;
+        if (layer->tensors[FP16_WEIGHT_TENSOR] != NULL)
         {
-            for (int nn = 0; nn < rem_n; nn++)
-            {
-                memset ((float*)C + (ldc * (n + nn)), 0, M * sizeof(float));
-            }
-            unsigned int k = 0;
-            // <M, N, K> = <M, rem_n, _TILE_SIZE_K>
-            for (; k < K - rem_k; k += _TILE_SIZE_K)
-            {
-                unsigned int m = 0;
-                // <M, N, K> = <_TILE_SIZE_M, rem_n, _TILE_SIZE_K>
-                for (; m < M - rem_m; m += _TILE_SIZE_M)
-                {
-                    SGEMM_KERNEL_TILE_M (_TILE_SIZE_M, rem_n, _TILE_SIZE_K, 
-                        (float*)A + (m * lda + k*_VEC_SIZE_M), lda, (float*)B + (n * ldb + k), ldb, (float*)C + (ldc * n + m), ldc);
-                }
-                // <M, N, K> = <rem_m, rem_n, _TILE_SIZE_K>
-                if (rem_m != 0)
-                    SGEMM_KERNEL (rem_m, rem_n, _TILE_SIZE_K, 
-                            (float*)A + (m * lda + k*_VEC_SIZE_M), lda, (float*)B + (n * ldb + k), ldb, (float*)C + (ldc * n + m), ldc);
-            }
-            // <M, N, K> = <M, rem_n, rem_k>
-            if (rem_k != 0)
-            {
-                unsigned int m = 0;
-                // <M, N, K> = <_TILE_SIZE_M, rem_n, rem_k>
-                for (; m < M - rem_m; m += _TILE_SIZE_M)
-                {
-                    SGEMM_KERNEL_TILE_M (_TILE_SIZE_M, rem_n, rem_k,
-                        (float*)A + (m * lda + k*_VEC_SIZE_M), lda, (float*)B + (n * ldb + k), ldb, (float*)C + (ldc * n + m), ldc);
-                }
-                // <M, N, K> = <rem_m, rem_n, rem_k>
-                SGEMM_KERNEL (rem_m, rem_n, rem_k, 
-                    (float*)A + (m * lda + k*_VEC_SIZE_M), lda, (float*)B + (n * ldb + k), ldb, (float*)C + (ldc * n + m), ldc);
-            }
-            for (unsigned int nn = n; nn < N; nn++)
-            {
-                float *out_vec = (float *)C + nn * ldc;
-                if (layer->tensors[BIAS_TENSOR] != NULL)
-                {
-                    float *bias = (float*)layer->tensors[BIAS_TENSOR]->data + ninst->out_mat_pos[OUT_H];
-                    for (unsigned int m = 0; m < M; m++)
-                    {
-                        out_vec[m] += bias[m];
-                    }
-                }
-                naive_activate (out_vec, M, layer->activation);
-            }
+            A = (uint16_t*)layer->tensors[FP16_WEIGHT_TENSOR]->data + (size_t) ninst->out_mat_pos[OUT_H] * lda;
+            tiled_hgemm_bias_act (M, N, K, A, lda, B, ldb, C, ldc, bias, layer->activation);
+            return;
         }
+        A = (char*)layer->tensors[WEIGHT_TENSOR]->data + (ninst->out_mat_pos[OUT_H] * lda * layer->dnn->element_size);
+        tiled_sgemm_bias_act (M, N, K, A, lda, B, ldb, C, ldc, bias, layer->activation, &ldata->sgemm_blocking);
     }
     else
     {
@@ -465,6 +944,30 @@ void tiled_matmul (ninst_t *ninst, dse_t *dse)
         aspen_sync_gpu_stream (dse->gpu_idx, dse->thread_id%GPU_RUN_STREAM_NUM);
         #endif
     }
+}
+
+void tiled_matmul (ninst_t *ninst, dse_t *dse)
+{
+    #if _SKIP_KERNELS == 0
+    nasm_ldata_t *ldata = ninst->ldata;
+    nasm_ldata_t *qkv_ldata = ldata->fused_qkv_leader_ldata;
+    if (qkv_ldata == NULL)
+    {
+        matmul_tile (ninst, dse);
+        return;
+    }
+    // Fused QKV: the first matmul of the group computes this tile of every matmul of the group,
+    // while the shared input columns are in cache. The others were computed by its ninst.
+    if (qkv_ldata != ldata)
+        return;
+    nasm_ldata_t *p_ldata = (ldata->parent_ldata_idx_arr[PARENT_0] + ldata->nasm->ldata_arr);
+    const unsigned int tile_idx = ninst - ldata->ninst_arr_start;
+    for (int i = 0; i < p_ldata->num_child_ldata; i++)
+    {
+        nasm_ldata_t *child = &ldata->nasm->ldata_arr[p_ldata->child_ldata_idx_arr[i]];
+        if (child->fused_qkv_leader_ldata == ldata)
+            matmul_tile (child->ninst_arr_start + tile_idx, dse);
+    }
     #endif
 }
 
@@ -473,6 +976,10 @@ void tiled_maxpool2d (ninst_t *ninst, dse_t *dse)
     #if _SKIP_KERNELS == 0
     nasm_ldata_t *ldata = ninst->ldata;
     aspen_layer_t *layer = ninst->ldata->layer;
+    nasm_ldata_t *p_ldata = (ldata->parent_ldata_idx_arr[PARENT_0] + ldata->nasm->ldata_arr);
+    // Already computed by the ninsts of the fused conv parent.
+    if (dse->gpu_idx < 0 && p_ldata->fused_maxpool_ldata == ldata)
+        return;
     prepare_im2col (ninst, dse->scratchpad);
     void **input_ptr_arr = dse->scratchpad;   
     const unsigned int input_pos_per_n = ninst->num_input_pos/ninst->tile_dims[OUT_W];
@@ -485,36 +992,9 @@ void tiled_maxpool2d (ninst_t *ninst, dse_t *dse)
     }
     if (dse->gpu_idx < 0)
     {
+        MAXPOOL_TILE (M, N, ninst->out_mat_pos[OUT_H], input_pos_per_n, (const float **)input_ptr_arr, C, ldc);
         for (int n = 0; n < N; n++)
-        {
-            float *out_vec = (float*)C + n * ldc;
-            float *input_vec = (float *)input_ptr_arr[n*input_pos_per_n];
-            if (input_vec == NULL)
-            {
-                for (int m = 0; m < M; m++)
-                {
-                    out_vec[m] = -INFINITY;
-                }
-            }
-            else
-            {
-                input_vec += ninst->out_mat_pos[OUT_H];
-                memcpy (out_vec, input_vec, M * layer->dnn->element_size);
-            }
-            for (int i = 1; i < input_pos_per_n; i++)
-            {
-                input_vec = (float *)input_ptr_arr[n*input_pos_per_n + i];
-                if (input_vec != NULL)
-                {
-                    input_vec += + ninst->out_mat_pos[OUT_H];
-                    for (int m = 0; m < M; m++)
-                    {
-                        out_vec[m] = out_vec[m] >= input_vec[m] ? out_vec[m] : input_vec[m];
-                    }
-                }
-            }
-            naive_activate (out_vec, M, layer->activation);
-        }
+            ACTIVATE ((float*)C + n * ldc, M, layer->activation);
     }
     else
     {
@@ -541,37 +1021,9 @@ void tiled_avgpool2d (ninst_t *ninst, dse_t *dse)
     void *C = get_ninst_out_mem (ninst);
     if (dse->gpu_idx < 0)
     {
+        AVGPOOL_TILE (M, N, ninst->out_mat_pos[OUT_H], input_pos_per_n, (const float **)input_ptr_arr, C, ldc);
         for (int n = 0; n < N; n++)
-        {
-            float *out_vec = (float*)C + n * ldc;
-            float *input_vec = (float*)input_ptr_arr[n*input_pos_per_n];
-            if (input_vec == NULL)
-            {
-                memset (out_vec, 0, M * layer->dnn->element_size);
-            }
-            else
-            {
-                input_vec += ninst->out_mat_pos[OUT_H];
-                memcpy (out_vec, input_vec, M * layer->dnn->element_size);
-            }
-            for (int i = 1; i < input_pos_per_n; i++)
-            {
-                input_vec = (float*)input_ptr_arr[n*input_pos_per_n + i];
-                if (input_vec != NULL)
-                {
-                    input_vec += ninst->out_mat_pos[OUT_H];
-                    for (int m = 0; m < M; m++)
-                    {
-                        out_vec[m] += input_vec[m];
-                    }
-                }
-            }
-            for (int m = 0; m < M; m++)
-            {
-                out_vec[m] /= input_pos_per_n;
-            }
-            naive_activate (out_vec, M, layer->activation);
-        }
+            ACTIVATE ((float*)C + n * ldc, M, layer->activation);
     }
     else
     {
@@ -596,118 +1048,26 @@ void tiled_fully_connected (ninst_t *ninst, dse_t *dse)
     const unsigned int lda = K;
     const unsigned int ldb = K;
     const unsigned int ldc = ldata->out_mat_stride;
-    const void *A = (char*)layer->tensors[WEIGHT_TENSOR]->data + (ninst->out_mat_pos[OUT_H] * lda * layer->dnn->element_size);
     const void *B = (char*)p_ldata->out_mat + (ninst->out_mat_pos[OUT_W] * ldb * layer->dnn->element_size);
     void *C = get_ninst_out_mem (ninst);
+    if (dse->gpu_idx < 0 && layer->tensors[QUANT_WEIGHT_TENSOR] != NULL 
+        && tiled_qgemm_act (ninst, dse->scratchpad, DSE_SCRATCHPAD_SIZE, K, B, ldb, NULL, 0, 0, C, ldc))
+        return;
+    if (dse->gpu_idx < 0 && layer->tensors[FP16_WEIGHT_TENSOR] != NULL)
+    {
+        const float *bias = layer->tensors[BIAS_TENSOR] != NULL ? 
+            (float*)layer->tensors[BIAS_TENSOR]->data + ninst->out_mat_pos[OUT_H] : NULL;
+        tiled_hgemm_bias_act (M, N, K, (uint16_t*)layer->tensors[FP16_WEIGHT_TENSOR]->data + (size_t) ninst->out_mat_pos[OUT_H] * lda, 
+            lda, B, ldb, C, ldc, bias, layer->activation);
+        return;
+    }
+    const void *A = layer->tensors[WEIGHT_TENSOR] != NULL ? 
+        (char*)layer->tensors[WEIGHT_TENSOR]->data + (ninst->out_mat_pos[OUT_H] * lda * layer->dnn->element_size) : NULL;
     if (dse->gpu_idx < 0)
     {
-        const unsigned int rem_n = N % _TILE_SIZE_N;
-        const unsigned int rem_m = M % _TILE_SIZE_M;
-        const unsigned int rem_k = K % _TILE_SIZE_K;
-        unsigned int n = 0;
-        // <M, N, K> = <M, _TILE_SIZE_N, K>
-        for (; n < N - rem_n; n += _TILE_SIZE_N)
-        {
-            for (int nn = 0; nn < _TILE_SIZE_N; nn++)
-            {
-                memset ((float*)C + (ldc * (n + nn)), 0, M * sizeof(float));
-            }
-            unsigned int k = 0;
-            // <M, N, K> = <M, _TILE_SIZE_N, _TILE_SIZE_K>
-            for (; k < K - rem_k; k += _TILE_SIZE_K)
-            {
-                unsigned int m = 0;
-                // <M, N, K> = <_TILE_SIZE_M, _TILE_SIZE_N, _TILE_SIZE_K>
-                for (; m < M - rem_m; m += _TILE_SIZE_M)
-                {
-                    SGEMM_KERNEL_FULL_TILE (_TILE_SIZE_M, _TILE_SIZE_N, _TILE_SIZE_K, 
-                        (float*)A + (m * lda + k*_VEC_SIZE_M), lda, (float*)B + (n * ldb + k), ldb, (float*)C + (ldc * n + m), ldc);
-                }
-                // <M, N, K> = <rem_m, _TILE_SIZE_N, _TILE_SIZE_K>
-                if (rem_m != 0)
-                    SGEMM_KERNEL_TILE_N (rem_m, _TILE_SIZE_N, _TILE_SIZE_K, 
-                            (float*)A + (m * lda + k*_VEC_SIZE_M), lda, (float*)B + (n * ldb + k), ldb, (float*)C + (ldc * n + m), ldc);
-            
-            }
-            // <M, N, K> = <M, _TILE_SIZE_N, rem_k>
-            if (rem_k != 0)
-            {
-                unsigned int m = 0;
-                // <M, N, K> = <_TILE_SIZE_M, _TILE_SIZE_N, rem_k>
-                for (; m < M - rem_m; m += _TILE_SIZE_M)
-                {
-                    SGEMM_KERNEL_FULL_TILE (_TILE_SIZE_M, _TILE_SIZE_N, rem_k,
-                        (float*)A + (m * lda + k*_VEC_SIZE_M), lda, (float*)B + (n * ldb + k), ldb, (float*)C + (ldc * n + m), ldc);
-                }
-                // <M, N, K> = <rem_m, _TILE_SIZE_N, rem_k>
-                SGEMM_KERNEL_TILE_N (rem_m, _TILE_SIZE_N, rem_k, 
-                    (float*)A + (m * lda + k*_VEC_SIZE_M), lda, (float*)B + (n * ldb + k), ldb, (float*)C + (ldc * n + m), ldc);
-            }
-            for (unsigned int nn = n; nn < n + _TILE_SIZE_N; nn++)
-            {
-                float *out_vec = (float *)C + nn * ldc;
-                if (layer->tensors[BIAS_TENSOR] != NULL)
-                {
-                    float *bias = (float*)layer->tensors[BIAS_TENSOR]->data + ninst->out_mat_pos[OUT_H];
-                    for (unsigned int m = 0; m < M; m++)
-                    {
-                        out_vec[m] += bias[m];
-                    }
-                }
-                naive_activate (out_vec, M, layer->activation);
-            }
-        }
-        // <M, N, K> = <M, rem_n, K>
-        if (rem_n != 0)
-        {
-            for (int nn = 0; nn < rem_n; nn++)
-            {
-                memset ((float*)C + (ldc * (n + nn)), 0, M * sizeof(float));
-            }
-            unsigned int k = 0;
-            // <M, N, K> = <M, rem_n, _TILE_SIZE_K>
-            for (; k < K - rem_k; k += _TILE_SIZE_K)
-            {
-                unsigned int m = 0;
-                // <M, N, K> = <_TILE_SIZE_M, rem_n, _TILE_SIZE_K>
-                for (; m < M - rem_m; m += _TILE_SIZE_M)
-                {
-                    SGEMM_KERNEL_TILE_M (_TILE_SIZE_M, rem_n, _TILE_SIZE_K, 
-                        (float*)A + (m * lda + k*_VEC_SIZE_M), lda, (float*)B + (n * ldb + k), ldb, (float*)C + (ldc * n + m), ldc);
-                }
-                // <M, N, K> = <rem_m, rem_n, _TILE_SIZE_K>
-                if (rem_m != 0)
-                    SGEMM_KERNEL (rem_m, rem_n, _TILE_SIZE_K, 
-                            (float*)A + (m * lda + k*_VEC_SIZE_M), lda, (float*)B + (n * ldb + k), ldb, (float*)C + (ldc * n + m), ldc);
-            }
-            // <M, N, K> = <M, rem_n, rem_k>
-            if (rem_k != 0)
-            {
-                unsigned int m = 0;
-                // <M, N, K> = <_TILE_SIZE_M, rem_n, rem_k>
-                for (; m < M - rem_m; m += _TILE_SIZE_M)
-                {
-                    SGEMM_KERNEL_TILE_M (_TILE_SIZE_M, rem_n, rem_k,
-                        (float*)A + (m * lda + k*_VEC_SIZE_M), lda, (float*)B + (n * ldb + k), ldb, (float*)C + (ldc * n + m), ldc);
-                }
-                // <M, N, K> = <rem_m, rem_n, rem_k>
-                SGEMM_KERNEL (rem_m, rem_n, rem_k, 
-                    (float*)A + (m * lda + k*_VEC_SIZE_M), lda, (float*)B + (n * ldb + k), ldb, (float*)C + (ldc * n + m), ldc);
-            }
-            for (unsigned int nn = n; nn < N; nn++)
-            {
-                float *out_vec = (float *)C + nn * ldc;
-                if (layer->tensors[BIAS_TENSOR] != NULL)
-                {
-                    float *bias = (float*)layer->tensors[BIAS_TENSOR]->data + ninst->out_mat_pos[OUT_H];
-                    for (unsigned int m = 0; m < M; m++)
-                    {
-                        out_vec[m] += bias[m];
-                    }
-                }
-                naive_activate (out_vec, M, layer->activation);
-            }
-        }
+        const float *bias = layer->tensors[BIAS_TENSOR] != NULL ? 
+            (float*)layer->tensors[BIAS_TENSOR]->data + ninst->out_mat_pos[OUT_H] : NULL;
+        tiled_sgemm_bias_act (M, N, K, A, lda, B, ldb, C, ldc, bias, layer->activation, &ldata->sgemm_blocking);
     }
     else
     {
@@ -732,8 +1092,30 @@ void tiled_residual (ninst_t *ninst, dse_t *dse)
     const unsigned int M = ninst->tile_dims[OUT_H];
     const unsigned int N = ninst->tile_dims[OUT_W];
     const unsigned int ldc = ldata->out_mat_stride;
+    // Already computed by the ninsts of the fused conv parent.
+    if (ldata->out_mat_owner_idx != -1 
+        && get_fused_conv_residual_ldata (ldata->nasm->ldata_arr + ldata->out_mat_owner_idx) == ldata)
+        return;
     void *C = get_ninst_out_mem (ninst);
-    if (dse->gpu_idx < 0)
+    nasm_ldata_t *ln_ldata = ldata->fused_layernorm_ldata;
+    if (dse->gpu_idx < 0 && ln_ldata != NULL)
+    {
+        // Fused residual + layernorm: the residual sum is normalized while it is still in cache.
+        if (ln_ldata->out_mat == NULL)
+            alloc_ldata_out_mat (ln_ldata);
+        const float *weight = (float*)ln_ldata->layer->tensors[WEIGHT_TENSOR]->data;
+        const float *bias = ln_ldata->layer->tensors[BIAS_TENSOR] != NULL ?
+            (float*)ln_ldata->layer->tensors[BIAS_TENSOR]->data : NULL;
+        for (int n = 0; n < N; n++)
+        {
+            unsigned int w_pos = ninst->out_mat_pos[OUT_W] + n;
+            float *input_0 = (float*)p0_ldata->out_mat + w_pos * p0_ldata->out_mat_stride;
+            float *input_1 = (float*)p1_ldata->out_mat + w_pos * p1_ldata->out_mat_stride;
+            float *ln_vec = (float*)ln_ldata->out_mat + w_pos * ln_ldata->out_mat_stride;
+            RESIDUAL_LAYERNORM_COL (input_0, input_1, (float*)C + n * ldc, ln_vec, M, weight, bias);
+        }
+    }
+    else if (dse->gpu_idx < 0)
     {
         for (int n = 0; n < N; n++)
         {
@@ -745,7 +1127,7 @@ void tiled_residual (ninst_t *ninst, dse_t *dse)
             {
                 out_vec[m] = input_0[m] + input_1[m];
             }
-            naive_activate (out_vec, M, layer->activation);
+            ACTIVATE (out_vec, M, layer->activation);
         }
     }
     else
@@ -771,29 +1153,13 @@ void tiled_softmax (ninst_t *ninst, dse_t *dse)
     const unsigned int N = ninst->tile_dims[OUT_W];
     const unsigned int ldc = ldata->out_mat_stride;
     void *C = get_ninst_out_mem (ninst);
-    memset (C, 0, M * N * sizeof(float));
     if (dse->gpu_idx < 0)
     {
         for (int n = 0; n < N; n++)
         {
             unsigned int w_pos = ninst->out_mat_pos[OUT_W] + n;
             float *input = (float*)p0_ldata->out_mat + w_pos * p0_ldata->out_mat_stride + ninst->out_mat_pos[OUT_H];
-            float *output = (float*)C + n * ldc;
-            float max = input[0];
-            for (int m = 1; m < M; m++)
-            {
-                max = max >= input[m] ? max : input[m];
-            }
-            float sum = 0;
-            for (int m = 0; m < M; m++)
-            {
-                output[m] = expf (input[m] - max);
-                sum += output[m];
-            }
-            for (int m = 0; m < M; m++)
-            {
-                output[m] /= sum;
-            }
+            SOFTMAX_COL (input, (float*)C + n * ldc, M, 1.0f);
         }
     }
     else
@@ -861,9 +1227,13 @@ void tiled_append (ninst_t *ninst, dse_t *dse)
     #ifdef DEBUG
     assert (layer->params[IN_W] == (layer->params[OUT_W] / layer->params[STRIDE]));
     #endif
+    // Parents placed in the out_mat by zero-copy concat have already written their channels.
+    const int ldata_idx = ldata - ldata->nasm->ldata_arr;
+    const int copy_p0 = p0_ldata->out_mat_owner_idx != ldata_idx;
+    const int copy_p1 = p1_ldata->out_mat_owner_idx != ldata_idx;
     if (dse->gpu_idx < 0)
     {
-        for (int n = 0; n < N; n++)
+        for (int n = 0; n < N && (copy_p0 || copy_p1); n++)
         {
             const int c1 = layer->params[IN_C];
             const int c2 = layer->params[OUT_C] - layer->params[IN_C];
@@ -877,8 +1247,10 @@ void tiled_append (ninst_t *ninst, dse_t *dse)
             const float *in1 = ((float*)p0_ldata->out_mat) + (hidx_1*w1 + widx_1)*p0_ldata->out_mat_stride;
             const float *in2 = ((float*)p1_ldata->out_mat) + (hidx_2*w2 + widx_2)*p1_ldata->out_mat_stride;
             float *out = (float*)C + n * ldc;
-            memcpy (out, in1, c1*sizeof(float));
-            memcpy (out+c1, in2, c2*sizeof(float));
+            if (copy_p0)
+                memcpy (out, in1, c1*sizeof(float));
+            if (copy_p1)
+                memcpy (out+c1, in2, c2*sizeof(float));
         }
     }
     else
@@ -908,28 +1280,11 @@ void tiled_layernorm (ninst_t *ninst, dse_t *dse)
     void *C = get_ninst_out_mem (ninst);
     if (dse->gpu_idx < 0)
     {
+        // Already computed by the residual ninsts.
+        if (p_ldata->fused_layernorm_ldata == ldata)
+            return;
         for (int n = 0; n < N; n++)
-        {
-            const float *input_vec = (float*)B + n * ldb;
-            float *out_vec = (float*)C + n * ldc;
-            float mean = 0;
-            float var = 0;
-            for (int m = 0; m < M; m++)
-            {
-                mean += input_vec[m];
-                var += input_vec[m] * input_vec[m];
-            }
-            mean /= M;
-            var /= M;
-            var -= mean * mean;
-            var = 1 / sqrtf (var + 1e-6f);
-            for (int m = 0; m < M; m++)
-            {
-                out_vec[m] = (input_vec[m] - mean) * var * weight[m];
-                if (bias != NULL)
-                    out_vec[m] += bias[m];
-            }
-        }
+            LAYERNORM_COL ((float*)B + n * ldb, (float*)C + n * ldc, M, weight, bias);
     }
     else
     {
@@ -946,6 +1301,9 @@ void tiled_k_attention (ninst_t *ninst, dse_t *dse)
 {
     #if _SKIP_KERNELS == 0
     nasm_ldata_t *ldata = ninst->ldata;
+    // Computed by the V-attention ninsts.
+    if (dse->gpu_idx < 0 && ldata->fused_attention)
+        return;
     aspen_layer_t *layer = ninst->ldata->layer;
     nasm_ldata_t *p_ldata = (ldata->parent_ldata_idx_arr[PARENT_0] + ldata->nasm->ldata_arr);
     nasm_ldata_t *pk_ldata = (ldata->parent_ldata_idx_arr[PARENT_1] + ldata->nasm->ldata_arr);
@@ -969,14 +1327,18 @@ void tiled_k_attention (ninst_t *ninst, dse_t *dse)
     const void *B_head = (float*)p_ldata->out_mat + (batch * ldb * num_seq + head * hidden_per_head +
         + n_global * ldb);
     void *C_head = get_ninst_out_mem (ninst);
-    unsigned int n = 0;
     if (dse->gpu_idx < 0)
     {
-        const unsigned int rem_n = N % _TILE_SIZE_N;
-        const unsigned int rem_m = M % _TILE_SIZE_M;
-        const unsigned int rem_k = K % _TILE_SIZE_K;
+        // Padding queries after the valid length of the batch are skipped, and padding keys are masked out.
+        // With a causal mask, keys after the last query of the tile are masked for every column and are skipped.
+        const int masked = layer->params[MASKED] == 1;
+        const unsigned int seq_len = get_nasm_seq_len (ldata->nasm, batch);
+        const unsigned int N_active = seq_len <= n_global ? 0 : seq_len - n_global < N ? seq_len - n_global : N;
+        unsigned int M_active = masked && n_global + N_active < M ? n_global + N_active : M;
+        if (M_active > seq_len)
+            M_active = seq_len;
         // Transpose & Reoder Key data. 
-        for (unsigned int m = 0; m < M; m++)
+        for (unsigned int m = 0; m < M_active && N_active > 0; m++)
         {
             for (unsigned int k = 0; k < K; k++)
             {
@@ -986,134 +1348,174 @@ void tiled_k_attention (ninst_t *ninst, dse_t *dse)
                 *output_ptr = *input_ptr;
             }
         }
-        // <M, N, K> = <M, _TILE_SIZE_N, K>
-        for (; n < N - rem_n; n += _TILE_SIZE_N)
+        if (N_active > 0)
+            tiled_sgemm_epilogue (M_active, N_active, K, A, lda, B_head, ldb, C_head, ldc, NULL, 
+                &default_sgemm_blocking);
+        for (unsigned int nn = 0; nn < N; nn++)
         {
-            for (int nn = 0; nn < _TILE_SIZE_N; nn++)
+            // Softmax over the unmasked keys of each query only, the masked ones get 0.
+            float *score_vec = (float*)C_head + nn*ldc;
+            unsigned int num_keys = masked && nn + n_global + 1 < M ? nn + n_global + 1 : M;
+            if (num_keys > seq_len)
+                num_keys = seq_len;
+            if (nn >= N_active)
             {
-                memset ((float*)C_head + (ldc * (n + nn)), 0, M * sizeof(float));
-            }
-            unsigned int k = 0;
-            // <M, N, K> = <M, _TILE_SIZE_N, _TILE_SIZE_K>
-            for (; k < K - rem_k; k += _TILE_SIZE_K)
-            {
-                unsigned int m = 0;
-                // <M, N, K> = <_TILE_SIZE_M, _TILE_SIZE_N, _TILE_SIZE_K>
-                for (; m < M - rem_m; m += _TILE_SIZE_M)
-                {
-                    SGEMM_KERNEL_FULL_TILE (_TILE_SIZE_M, _TILE_SIZE_N, _TILE_SIZE_K, 
-                        (float*)A + (m * lda + k*_VEC_SIZE_M), lda, (float*)B_head + (n * ldb + k), ldb, (float*)C_head + (ldc * n + m), ldc);
-                }
-                // <M, N, K> = <rem_m, _TILE_SIZE_N, _TILE_SIZE_K>
-                if (rem_m != 0)
-                    SGEMM_KERNEL_TILE_N (rem_m, _TILE_SIZE_N, _TILE_SIZE_K, 
-                            (float*)A + (m * lda + k*_VEC_SIZE_M), lda, (float*)B_head + (n * ldb + k), ldb, (float*)C_head + (ldc * n + m), ldc);
-            
-            }
-            // <M, N, K> = <M, _TILE_SIZE_N, rem_k>
-            if (rem_k != 0)
-            {
-                unsigned int m = 0;
-                // <M, N, K> = <_TILE_SIZE_M, _TILE_SIZE_N, rem_k>
-                for (; m < M - rem_m; m += _TILE_SIZE_M)
-                {
-                    SGEMM_KERNEL_FULL_TILE (_TILE_SIZE_M, _TILE_SIZE_N, rem_k,
-                        (float*)A + (m * lda + k*_VEC_SIZE_M), lda, (float*)B_head + (n * ldb + k), ldb, (float*)C_head + (ldc * n + m), ldc);
-                }
-                // <M, N, K> = <rem_m, _TILE_SIZE_N, rem_k>
-                SGEMM_KERNEL_TILE_N (rem_m, _TILE_SIZE_N, rem_k, 
-                    (float*)A + (m * lda + k*_VEC_SIZE_M), lda, (float*)B_head + (n * ldb + k), ldb, (float*)C_head + (ldc * n + m), ldc);
-            }
-            for (unsigned int nn = n; nn < n + _TILE_SIZE_N; nn++)
-            {
-                if (layer->params[MASKED] == 1)
-                {
-                    for (unsigned int m = 0; m < M; m++)
-                    {
-                        if (m > nn + n_global)
-                            *((float*)C_head + nn*ldc + m) = -1e10;
-                    }
-                }
-                float total = 0;
-                for (unsigned int j = 0; j < M; j++)
-                {
-                    float val = *((float*)C_head + nn*ldc + j);
-                    val /= sqrtf (hidden_per_head);
-                    *((float*)C_head + nn*ldc + j) = expf (val);
-                    total += *((float*)C_head + nn*ldc + j);
-                }
-                for (unsigned int j = 0; j < M; j++)
-                    *((float*)C_head + nn*ldc + j) /= total;
+                memset (score_vec, 0, M * sizeof(float));
+                continue;
             }
+            SOFTMAX_COL (score_vec, score_vec, num_keys, 1.0f / sqrtf (hidden_per_head));
+            memset (score_vec + num_keys, 0, (M - num_keys) * sizeof(float));
         }
-        // <M, N, K> = <M, rem_n, K>
-        if (rem_n != 0)
+    }
+    else
+    {
+        #ifdef GPU
+        cuda_tiled_k_attention (M, N, K, key_head, ldk, B_head, ldb, C_head, ldc, aspen_CUDA_streams[dse->gpu_idx][dse->thread_id%GPU_RUN_STREAM_NUM]);
+        aspen_sync_gpu_stream (dse->gpu_idx, dse->thread_id%GPU_RUN_STREAM_NUM);
+        #endif
+    }
+    #endif
+}
+
+// K-attention, softmax and V-attention of one V-attention ninst in a single pass. Each block of queries streams 
+// key and value blocks through the scratchpad with an online softmax, rescaling its output columns as the running max
+// grows, so only a _ATTENTION_BLOCK_SIZE square of scores is stored at a time.
+// With a KV cache, the tokens of the nasm follow the cached ones: keys before them are read from the cache,
+// and the keys and values of the tile tokens are appended to it.
+static void tiled_fused_attention (ninst_t *ninst, dse_t *dse)
+{
+    nasm_ldata_t *ldata = ninst->ldata;
+    nasm_t *nasm = ldata->nasm;
+    aspen_layer_t *layer = ldata->layer;
+    nasm_ldata_t *pk_ldata = (ldata->parent_ldata_idx_arr[PARENT_0] + nasm->ldata_arr);
+    nasm_ldata_t *q_ldata = (pk_ldata->parent_ldata_idx_arr[PARENT_0] + nasm->ldata_arr);
+    nasm_ldata_t *k_ldata = (pk_ldata->parent_ldata_idx_arr[PARENT_1] + nasm->ldata_arr);
+    nasm_ldata_t *v_ldata = (ldata->parent_ldata_idx_arr[PARENT_1] + nasm->ldata_arr);
+    const unsigned int num_hidden = layer->params[NUM_HIDDEN];
+    const unsigned int hidden_per_head = num_hidden / layer->params[NUM_HEAD];
+    const unsigned int num_seq = nasm->tr_seq_len;
+    const unsigned int batch = ninst->out_mat_pos[OUT_W] / num_seq;
+    const unsigned int seq_start = ninst->out_mat_pos[OUT_W] % num_seq;
+    aspen_kv_cache_t *kv_cache = nasm->kv_cache;
+    const unsigned int past = kv_cache != NULL ? kv_cache->num_tokens : 0;
+    const unsigned int seq_len = get_nasm_seq_len (nasm, batch);
+    const unsigned int num_keys = past + seq_len;
+    const unsigned int head = ninst->out_mat_pos[OUT_H] / hidden_per_head;
+    const unsigned int M = ninst->tile_dims[OUT_H];
+    const unsigned int N = ninst->tile_dims[OUT_W];
+    // Padding queries after the valid length of the batch are skipped.
+    const unsigned int N_active = seq_len <= seq_start ? 0 : seq_len - seq_start < N ? seq_len - seq_start : N;
+    const unsigned int K = hidden_per_head;
+    const unsigned int ldq = q_ldata->out_mat_stride;
+    const unsigned int ldk = k_ldata->out_mat_stride;
+    const unsigned int ldv = v_ldata->out_mat_stride;
+    const unsigned int ldc = ldata->out_mat_stride;
+    const unsigned int block = _ATTENTION_BLOCK_SIZE;
+    const unsigned int M_pad = get_smallest_dividable (M, _VEC_SIZE_M);
+    const int masked = pk_ldata->layer->params[MASKED] == 1;
+    const float scale = 1.0f / sqrtf (hidden_per_head);
+    const float *query = (float*)q_ldata->out_mat + (size_t) (batch * num_seq + seq_start) * ldq + head * K;
+    const float *key = (float*)k_ldata->out_mat + (size_t) batch * num_seq * ldk + head * K;
+    const float *value = (float*)v_ldata->out_mat + (size_t) batch * num_seq * ldv + ninst->out_mat_pos[OUT_H];
+    float *C = get_ninst_out_mem (ninst);
+    float *key_block = dse->scratchpad;
+    float *value_block = key_block + block * K;
+    float *scores = value_block + M_pad * block;
+    float *max = scores + block * block;
+    float *sum = max + block;
+    if ((char*)(sum + block) - (char*)dse->scratchpad > DSE_SCRATCHPAD_SIZE)
+    {
+        ERROR_PRTF ("Error in tiled_fused_attention: %d hidden units per head do not fit in the scratchpad.\n", K);
+        return;
+    }
+    float *cache_key = NULL, *cache_value = NULL;
+    if (kv_cache != NULL)
+    {
+        if (past + num_seq > kv_cache->max_seq_len || kv_cache->key[layer->layer_idx] == NULL)
+        {
+            // Reported once per run by advance_nasm_kv_cache. The tile is zeroed so that later layers do not read 
+            // stale memory.
+            atomic_store (&kv_cache->overflow, 1);
+            for (unsigned int n = 0; n < N; n++)
+                memset (C + (size_t) n * ldc, 0, M * sizeof(float));
+            return;
+        }
+        cache_key = kv_cache->key[layer->layer_idx] + (size_t) batch * kv_cache->max_seq_len * num_hidden + head * K;
+        cache_value = kv_cache->value[layer->layer_idx] + (size_t) batch * kv_cache->max_seq_len * num_hidden 
+            + ninst->out_mat_pos[OUT_H];
+        for (unsigned int n = 0; n < N; n++)
+        {
+            memcpy (cache_key + (size_t) (past + seq_start + n) * num_hidden, key + (size_t) (seq_start + n) * ldk, 
+                K * sizeof(float));
+            memcpy (cache_value + (size_t) (past + seq_start + n) * num_hidden, value + (size_t) (seq_start + n) * ldv, 
+                M * sizeof(float));
+        }
+    }
+    for (unsigned int n = N_active; n < N; n++)
+        memset (C + (size_t) n * ldc, 0, M * sizeof(float));
+    for (unsigned int q = 0; q < N_active; q += block)
+    {
+        const unsigned int nb = N_active - q < block ? N_active - q : block;
+        for (unsigned int n = 0; n < nb; n++)
         {
-            for (int nn = 0; nn < rem_n; nn++)
+            max[n] = -INFINITY;
+            sum[n] = 0;
+            memset (C + (size_t) (q + n) * ldc, 0, M * sizeof(float));
+        }
+        // With a causal mask, key blocks after the last query of the block are skipped.
+        const unsigned int query_pos = past + seq_start + q;
+        const unsigned int seq_end = masked && query_pos + nb < num_keys ? query_pos + nb : num_keys;
+        for (unsigned int j0 = 0; j0 < seq_end; j0 += block)
+        {
+            const unsigned int kb = seq_end - j0 < block ? seq_end - j0 : block;
+            // Keys of the block as the A operand of scores = K_block * Q_block, rows padded with zeros.
+            for (unsigned int j = 0; j < get_smallest_dividable (kb, _VEC_SIZE_M); j++)
             {
-                memset ((float*)C_head + (ldc * (n + nn)), 0, M * sizeof(float));
+                float *output_ptr = key_block + (j / _VEC_SIZE_M) * K * _VEC_SIZE_M + (j % _VEC_SIZE_M);
+                const float *key_row = j >= kb ? NULL : j0 + j < past ? cache_key + (size_t) (j0 + j) * num_hidden 
+                    : key + (size_t) (j0 + j - past) * ldk;
+                for (unsigned int k = 0; k < K; k++)
+                    output_ptr[k * _VEC_SIZE_M] = key_row != NULL ? key_row[k] : 0;
             }
-            unsigned int k = 0;
-            // <M, N, K> = <M, rem_n, _TILE_SIZE_K>
-            for (; k < K - rem_k; k += _TILE_SIZE_K)
+            tiled_sgemm_epilogue (kb, nb, K, key_block, K, query + (size_t) q * ldq, ldq, scores, block, NULL, 
+                &default_sgemm_blocking);
+            for (unsigned int n = 0; n < nb; n++)
             {
-                unsigned int m = 0;
-                // <M, N, K> = <_TILE_SIZE_M, rem_n, _TILE_SIZE_K>
-                for (; m < M - rem_m; m += _TILE_SIZE_M)
+                float *score_vec = scores + n * block;
+                if (masked && j0 + kb > query_pos + n + 1)
                 {
-                    SGEMM_KERNEL_TILE_M (_TILE_SIZE_M, rem_n, _TILE_SIZE_K, 
-                        (float*)A + (m * lda + k*_VEC_SIZE_M), lda, (float*)B_head + (n * ldb + k), ldb, (float*)C_head + (ldc * n + m), ldc);
+                    const unsigned int first_masked = query_pos + n + 1 > j0 ? query_pos + n + 1 - j0 : 0;
+                    for (unsigned int j = first_masked; j < kb; j++)
+                        score_vec[j] = -INFINITY;
                 }
-                // <M, N, K> = <rem_m, rem_n, _TILE_SIZE_K>
-                if (rem_m != 0)
-                    SGEMM_KERNEL (rem_m, rem_n, _TILE_SIZE_K, 
-                            (float*)A + (m * lda + k*_VEC_SIZE_M), lda, (float*)B_head + (n * ldb + k), ldb, (float*)C_head + (ldc * n + m), ldc);
-            }
-            // <M, N, K> = <M, rem_n, rem_k>
-            if (rem_k != 0)
-            {
-                unsigned int m = 0;
-                // <M, N, K> = <_TILE_SIZE_M, rem_n, rem_k>
-                for (; m < M - rem_m; m += _TILE_SIZE_M)
+                const float correction = ONLINE_SOFTMAX_COL (score_vec, kb, scale, &max[n], &sum[n]);
+                if (correction != 1 && j0 != 0)
                 {
-                    SGEMM_KERNEL_TILE_M (_TILE_SIZE_M, rem_n, rem_k,
-                        (float*)A + (m * lda + k*_VEC_SIZE_M), lda, (float*)B_head + (n * ldb + k), ldb, (float*)C_head + (ldc * n + m), ldc);
+                    float *out_vec = C + (size_t) (q + n) * ldc;
+                    for (unsigned int m = 0; m < M; m++)
+                        out_vec[m] *= correction;
                 }
-                // <M, N, K> = <rem_m, rem_n, rem_k>
-                SGEMM_KERNEL (rem_m, rem_n, rem_k, 
-                    (float*)A + (m * lda + k*_VEC_SIZE_M), lda, (float*)B_head + (n * ldb + k), ldb, (float*)C_head + (ldc * n + m), ldc);
             }
-            for (unsigned int nn = n; nn < N; nn++)
+            // Values of the block as the A operand of C += V_block * P_block, rows padded with zeros.
+            for (unsigned int j = 0; j < kb; j++)
             {
-                if (layer->params[MASKED] == 1)
-                {
-                    for (unsigned int m = 0; m < M; m++)
-                    {
-                        if (m > nn + n_global)
-                            *((float*)C_head + nn*ldc + m) = -1e10;
-                    }
-                }
-                float total = 0;
-                for (unsigned int j = 0; j < M; j++)
-                {
-                    float val = *((float*)C_head + nn*ldc + j);
-                    val /= sqrtf (hidden_per_head);
-                    *((float*)C_head + nn*ldc + j) = expf (val);
-                    total += *((float*)C_head + nn*ldc + j);
-                }
-                for (unsigned int j = 0; j < M; j++)
-                    *((float*)C_head + nn*ldc + j) /= total;
+                const float *value_row = j0 + j < past ? cache_value + (size_t) (j0 + j) * num_hidden 
+                    : value + (size_t) (j0 + j - past) * ldv;
+                float *output_ptr = value_block + j * _VEC_SIZE_M;
+                for (unsigned int m = 0; m < M_pad; m++)
+                    output_ptr[(m / _VEC_SIZE_M) * kb * _VEC_SIZE_M + (m % _VEC_SIZE_M)] = m < M ? value_row[m] : 0;
             }
+            tiled_sgemm_block (M, nb, kb, value_block, kb, scores, block, C + (size_t) q * ldc, ldc, NULL, 
+                &default_sgemm_blocking);
+        }
+        for (unsigned int n = 0; n < nb; n++)
+        {
+            float *out_vec = C + (size_t) (q + n) * ldc;
+            const float inv_sum = 1 / sum[n];
+            for (unsigned int m = 0; m < M; m++)
+                out_vec[m] *= inv_sum;
         }
     }
-    else
-    {
-        #ifdef GPU
-        cuda_tiled_k_attention (M, N, K, key_head, ldk, B_head, ldb, C_head, ldc, aspen_CUDA_streams[dse->gpu_idx][dse->thread_id%GPU_RUN_STREAM_NUM]);
-        aspen_sync_gpu_stream (dse->gpu_idx, dse->thread_id%GPU_RUN_STREAM_NUM);
-        #endif
-    }
-    #endif
 }
 
 void tiled_v_attention (ninst_t *ninst, dse_t *dse)
@@ -1133,108 +1535,45 @@ void tiled_v_attention (ninst_t *ninst, dse_t *dse)
     const unsigned int N = ninst->tile_dims[OUT_W];
     const unsigned int K = num_seq;
     const unsigned int ldv = pv_ldata->out_mat_stride;
-    const unsigned int lda = K;
     const unsigned int ldb = p_ldata->out_mat_stride;
     const unsigned int ldc = ldata->out_mat_stride;
     void *A = dse->scratchpad;
     const float *val_head = (float*)pv_ldata->out_mat + batch * ldv * num_seq + ninst->out_mat_pos[OUT_H];
     const void *B_head = (float*)p_ldata->out_mat + (batch * num_heads * num_seq + head * num_seq +
         + (ninst->out_mat_pos[OUT_W] % num_seq)) * ldb;
+    if (dse->gpu_idx < 0 && ldata->fused_attention)
+    {
+        tiled_fused_attention (ninst, dse);
+        return;
+    }
     void *C_head = get_ninst_out_mem (ninst); 
     if (dse->gpu_idx < 0)
     {
-        const unsigned int rem_n = N % _TILE_SIZE_N;
-        const unsigned int rem_m = M % _TILE_SIZE_M;
-        const unsigned int rem_k = K % _TILE_SIZE_K;
-        unsigned int n = 0;
+        // Padding queries after the valid length of the batch are skipped, and the scores of padding keys are all 0.
+        // With a causal mask, the scores of keys after the last query of the tile are all 0.
+        const unsigned int seq_len = get_nasm_seq_len (ldata->nasm, batch);
+        const unsigned int seq_start = ninst->out_mat_pos[OUT_W] % num_seq;
+        const unsigned int N_active = seq_len <= seq_start ? 0 : seq_len - seq_start < N ? seq_len - seq_start : N;
+        const unsigned int seq_end = seq_start + N_active;
+        unsigned int K_active = p_ldata->layer->params[MASKED] == 1 && seq_end < K ? seq_end : K;
+        if (K_active > seq_len)
+            K_active = seq_len;
         // Transpose & Reoder Value data.
-        for (unsigned int m = 0; m < M; m++)
+        for (unsigned int m = 0; m < M && N_active > 0; m++)
         {
-            for (unsigned int k = 0; k < K; k++)
+            for (unsigned int k = 0; k < K_active; k++)
             {
                 const float* input_ptr = val_head + k * ldv + m;
-                float* output_ptr = (float*)A + ((m/_VEC_SIZE_M) * lda + k) * _VEC_SIZE_M 
+                float* output_ptr = (float*)A + ((m/_VEC_SIZE_M) * K_active + k) * _VEC_SIZE_M 
                     + (m % _VEC_SIZE_M);
                 *output_ptr = *input_ptr;
             }
         }
-        // <M, N, K> = <M, _TILE_SIZE_N, K>
-        for (; n < N - rem_n; n += _TILE_SIZE_N)
-        {
-            for (int nn = 0; nn < _TILE_SIZE_N; nn++)
-            {
-                memset ((float*)C_head + (ldc * (n + nn)), 0, M * sizeof(float));
-            }
-            unsigned int k = 0;
-            // <M, N, K> = <M, _TILE_SIZE_N, _TILE_SIZE_K>
-            for (; k < K - rem_k; k += _TILE_SIZE_K)
-            {
-                unsigned int m = 0;
-                // <M, N, K> = <_TILE_SIZE_M, _TILE_SIZE_N, _TILE_SIZE_K>
-                for (; m < M - rem_m; m += _TILE_SIZE_M)
-                {
-                    SGEMM_KERNEL_FULL_TILE (_TILE_SIZE_M, _TILE_SIZE_N, _TILE_SIZE_K, 
-                        (float*)A + (m * lda + k*_VEC_SIZE_M), lda, (float*)B_head + (n * ldb + k), ldb, (float*)C_head + (ldc * n + m), ldc);
-                }
-                // <M, N, K> = <rem_m, _TILE_SIZE_N, _TILE_SIZE_K>
-                if (rem_m != 0)
-                    SGEMM_KERNEL_TILE_N (rem_m, _TILE_SIZE_N, _TILE_SIZE_K, 
-                            (float*)A + (m * lda + k*_VEC_SIZE_M), lda, (float*)B_head + (n * ldb + k), ldb, (float*)C_head + (ldc * n + m), ldc);
-            
-            }
-            // <M, N, K> = <M, _TILE_SIZE_N, rem_k>
-            if (rem_k != 0)
-            {
-                unsigned int m = 0;
-                // <M, N, K> = <_TILE_SIZE_M, _TILE_SIZE_N, rem_k>
-                for (; m < M - rem_m; m += _TILE_SIZE_M)
-                {
-                    SGEMM_KERNEL_FULL_TILE (_TILE_SIZE_M, _TILE_SIZE_N, rem_k,
-                        (float*)A + (m * lda + k*_VEC_SIZE_M), lda, (float*)B_head + (n * ldb + k), ldb, (float*)C_head + (ldc * n + m), ldc);
-                }
-                // <M, N, K> = <rem_m, _TILE_SIZE_N, rem_k>
-                SGEMM_KERNEL_TILE_N (rem_m, _TILE_SIZE_N, rem_k, 
-                    (float*)A + (m * lda + k*_VEC_SIZE_M), lda, (float*)B_head + (n * ldb + k), ldb, (float*)C_head + (ldc * n + m), ldc);
-            }
-        }
-        // <M, N, K> = <M, rem_n, K>
-        if (rem_n != 0)
-        {
-            for (int nn = 0; nn < rem_n; nn++)
-            {
-                memset ((float*)C_head + (ldc * (n + nn)), 0, M * sizeof(float));
-            }
-            unsigned int k = 0;
-            // <M, N, K> = <M, rem_n, _TILE_SIZE_K>
-            for (; k < K - rem_k; k += _TILE_SIZE_K)
-            {
-                unsigned int m = 0;
-                // <M, N, K> = <_TILE_SIZE_M, rem_n, _TILE_SIZE_K>
-                for (; m < M - rem_m; m += _TILE_SIZE_M)
-                {
-                    SGEMM_KERNEL_TILE_M (_TILE_SIZE_M, rem_n, _TILE_SIZE_K, 
-                        (float*)A + (m * lda + k*_VEC_SIZE_M), lda, (float*)B_head + (n * ldb + k), ldb, (float*)C_head + (ldc * n + m), ldc);
-                }
-                // <M, N, K> = <rem_m, rem_n, _TILE_SIZE_K>
-                if (rem_m != 0)
-                    SGEMM_KERNEL (rem_m, rem_n, _TILE_SIZE_K, 
-                            (float*)A + (m * lda + k*_VEC_SIZE_M), lda, (float*)B_head + (n * ldb + k), ldb, (float*)C_head + (ldc * n + m), ldc);
-            }
-            // <M, N, K> = <M, rem_n, rem_k>
-            if (rem_k != 0)
-            {
-                unsigned int m = 0;
-                // <M, N, K> = <_TILE_SIZE_M, rem_n, rem_k>
-                for (; m < M - rem_m; m += _TILE_SIZE_M)
-                {
-                    SGEMM_KERNEL_TILE_M (_TILE_SIZE_M, rem_n, rem_k,
-                        (float*)A + (m * lda + k*_VEC_SIZE_M), lda, (float*)B_head + (n * ldb + k), ldb, (float*)C_head + (ldc * n + m), ldc);
-                }
-                // <M, N, K> = <rem_m, rem_n, rem_k>
-                SGEMM_KERNEL (rem_m, rem_n, rem_k, 
-                    (float*)A + (m * lda + k*_VEC_SIZE_M), lda, (float*)B_head + (n * ldb + k), ldb, (float*)C_head + (ldc * n + m), ldc);
-            }
-        }
+        if (N_active > 0)
+            tiled_sgemm_epilogue (M, N_active, K_active, A, K_active, B_head, ldb, C_head, ldc, NULL, 
+                &default_sgemm_blocking);
+        for (unsigned int n = N_active; n < N; n++)
+            memset ((float*)C_head + (size_t) n * ldc, 0, M * sizeof(float));
     }
     else
     {
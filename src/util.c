@@ -17,12 +17,14 @@ char *param_type_str[NUM_PARAM_ELEMENTS] =
 {
     [OUT_W] = "OUT_W", [OUT_H] = "OUT_H", [IN_W] = "IN_W", [IN_H] = "IN_H", [IN_C] = "IN_C", [BATCH] = "BATCH", [OUT_C] = "OUT_C", [SUB_C] = "SUB_C", [WEIGHT_W] = "WEIGHT_W", [WEIGHT_H] = "WEIGHT_H", [STRIDE] = "STRIDE", [PADDING] = "PADDING", [DILATION] = "DILATION", [GROUPS] = "GROUPS",
     [NUM_HIDDEN] = "NUM_HIDDEN", [NUM_HEAD] = "NUM_HEAD", [NUM_SEQ] = "NUM_SEQ", [MAT_M] = "MAT_M", [MAT_N] = "MAT_N", [MAT_K] = "MAT_K", [SUB_M] = "SUB_M", [MASKED] = "MASKED",
-    [FORM_BYTES] = "FORM_BYTES"
+    [FORM_BYTES] = "FORM_BYTES", [WINOGRAD] = "WINOGRAD"
 };
 
 char *tensor_type_str[NUM_TENSORS] = 
 {
-    [NULL_TENSOR] = "NULL_TENSOR", [OUTPUT_TENSOR] = "OUTPUT_TENSOR", [INPUT_TENSOR] = "INPUT_TENSOR", [WEIGHT_TENSOR] = "WEIGHT_TENSOR", [BIAS_TENSOR] = "BIAS_TENSOR", [ANCHOR_TENSOR] = "ANCHOR_TENSOR", [BN_VAR_TENSOR] = "BN_VAR_TENSOR", [BN_MEAN_TENSOR] = "BN_MEAN_TENSOR", [BN_WEIGHT_TENSOR] = "BN_WEIGHT_TENSOR"
+    [NULL_TENSOR] = "NULL_TENSOR", [OUTPUT_TENSOR] = "OUTPUT_TENSOR", [INPUT_TENSOR] = "INPUT_TENSOR", [WEIGHT_TENSOR] = "WEIGHT_TENSOR", [BIAS_TENSOR] = "BIAS_TENSOR", [ANCHOR_TENSOR] = "ANCHOR_TENSOR", [BN_VAR_TENSOR] = "BN_VAR_TENSOR", [BN_MEAN_TENSOR] = "BN_MEAN_TENSOR", [BN_WEIGHT_TENSOR] = "BN_WEIGHT_TENSOR", [WINOGRAD_WEIGHT_TENSOR] = "WINOGRAD_WEIGHT_TENSOR",
+    [ACT_RANGE_TENSOR] = "ACT_RANGE_TENSOR", [QUANT_WEIGHT_TENSOR] = "QUANT_WEIGHT_TENSOR", [QUANT_SCALE_TENSOR] = "QUANT_SCALE_TENSOR", [QUANT_OFFSET_TENSOR] = "QUANT_OFFSET_TENSOR",
+    [FP16_WEIGHT_TENSOR] = "FP16_WEIGHT_TENSOR"
 };
 
 char *parent_type_str[NUM_PARENT_ELEMENTS] = 
@@ -32,7 +34,7 @@ char *parent_type_str[NUM_PARENT_ELEMENTS] =
 
 char *activation_type_str [NUM_ACTIVATIONS] = 
 {
-    [NO_ACTIVATION] = "NO_ACTIVATION", [SIGMOID] = "SIGMOID", [LINEAR] = "LINEAR", [TANH] = "TANH", [RELU] = "RELU", [LEAKY_RELU] = "LEAKY_RELU", [ELU] = "ELU", [SELU] = "SELU", [GELU] = "GELU"
+    [NO_ACTIVATION] = "NO_ACTIVATION", [SIGMOID] = "SIGMOID", [LINEAR] = "LINEAR", [TANH] = "TANH", [RELU] = "RELU", [LEAKY_RELU] = "LEAKY_RELU", [ELU] = "ELU", [SELU] = "SELU", [GELU] = "GELU", [GELU_ACCURATE] = "GELU_ACCURATE"
 };
 
 char *rpool_cond_str [NUM_RPOOL_CONDS] = 
@@ -915,7 +917,10 @@ void save_ninst_log(FILE* log_fp, nasm_t* nasm)
     for(int i = 0; i < nasm->num_ninst; i++)
     {
         ninst_t* ninst = &nasm->ninst_arr[i];
-        fprintf(log_fp, "%d,%d,%f,%f,%f,%f,%f\n",ninst->ninst_idx, ninst->dse_idx, ninst->computed_time*1000.0, ninst->received_time*1000.0, ninst->sent_time*1000.0, ninst->eft_offloaded, ninst->eft_server);
+        ninst_prof_t* prof = get_ninst_prof (ninst);
+        if (prof == NULL)
+            continue;
+        fprintf(log_fp, "%d,%d,%f,%f,%f,%f,%f\n",ninst->ninst_idx, prof->dse_idx, prof->computed_time*1000.0, prof->received_time*1000.0, prof->sent_time*1000.0, prof->eft_offloaded, prof->eft_server);
     }
     fflush(log_fp);
 }
@@ -1040,12 +1045,14 @@ int connect_server_sock(char *server_ip, int server_port) {
 float get_max_recv_time(nasm_t* nasm)
 {
     float max_recv_time = 0;
+    if (nasm->ninst_prof_arr == NULL)
+        return max_recv_time;
     for(int i = 0; i < nasm->num_ninst; i++)
     {
-        if(nasm->ninst_arr[i].received_time != 0)
+        if(nasm->ninst_prof_arr[i].received_time != 0)
         {
-            if(nasm->ninst_arr[i].received_time > max_recv_time)
-                max_recv_time = nasm->ninst_arr[i].received_time;
+            if(nasm->ninst_prof_arr[i].received_time > max_recv_time)
+                max_recv_time = nasm->ninst_prof_arr[i].received_time;
         }
     }
     return max_recv_time;
@@ -1054,12 +1061,14 @@ float get_max_recv_time(nasm_t* nasm)
 float get_min_recv_time(nasm_t* nasm)
 {
     float min_recv_time = 100000000;
+    if (nasm->ninst_prof_arr == NULL)
+        return min_recv_time;
     for(int i = 0; i < nasm->num_ninst; i++)
     {
-        if(nasm->ninst_arr[i].received_time != 0)
+        if(nasm->ninst_prof_arr[i].received_time != 0)
         {
-            if(nasm->ninst_arr[i].received_time < min_recv_time)
-                min_recv_time = nasm->ninst_arr[i].received_time;
+            if(nasm->ninst_prof_arr[i].received_time < min_recv_time)
+                min_recv_time = nasm->ninst_prof_arr[i].received_time;
         }
     }
     return min_recv_time;
@@ -1068,12 +1077,14 @@ float get_min_recv_time(nasm_t* nasm)
 float get_max_sent_time(nasm_t* nasm)
 {
     float max_sent_time = 0;
+    if (nasm->ninst_prof_arr == NULL)
+        return max_sent_time;
     for(int i = 0; i < nasm->num_ninst; i++)
     {
-        if(nasm->ninst_arr[i].sent_time != 0)
+        if(nasm->ninst_prof_arr[i].sent_time != 0)
         {
-            if(nasm->ninst_arr[i].sent_time > max_sent_time)
-                max_sent_time = nasm->ninst_arr[i].sent_time;
+            if(nasm->ninst_prof_arr[i].sent_time > max_sent_time)
+                max_sent_time = nasm->ninst_prof_arr[i].sent_time;
         }
     }
     return max_sent_time;
@@ -1082,12 +1093,14 @@ float get_max_sent_time(nasm_t* nasm)
 float get_min_sent_time(nasm_t* nasm)
 {
     float min_sent_time = 100000000;
+    if (nasm->ninst_prof_arr == NULL)
+        return min_sent_time;
     for(int i = 0; i < nasm->num_ninst; i++)
     {
-        if(nasm->ninst_arr[i].sent_time != 0)
+        if(nasm->ninst_prof_arr[i].sent_time != 0)
         {
-            if(nasm->ninst_arr[i].sent_time < min_sent_time)
-                min_sent_time = nasm->ninst_arr[i].sent_time;
+            if(nasm->ninst_prof_arr[i].sent_time < min_sent_time)
+                min_sent_time = nasm->ninst_prof_arr[i].sent_time;
         }
     }
     return min_sent_time;
@@ -1096,13 +1109,15 @@ float get_min_sent_time(nasm_t* nasm)
 float get_max_computed_time(nasm_t* nasm)
 {
     float max_computed_time = 0;
+    if (nasm->ninst_prof_arr == NULL)
+        return max_computed_time;
     
     for(int i = 0; i < nasm->num_ninst; i++)
     {
-        if(nasm->ninst_arr[i].computed_time != 0)
+        if(nasm->ninst_prof_arr[i].computed_time != 0)
         {
-            if(nasm->ninst_arr[i].computed_time > max_computed_time)
-                max_computed_time = nasm->ninst_arr[i].computed_time;
+            if(nasm->ninst_prof_arr[i].computed_time > max_computed_time)
+                max_computed_time = nasm->ninst_prof_arr[i].computed_time;
         }
     }
     return max_computed_time;
@@ -1111,13 +1126,15 @@ float get_max_computed_time(nasm_t* nasm)
 float get_min_computed_time(nasm_t* nasm)
 {
     float min_computed_time = 100000000;
+    if (nasm->ninst_prof_arr == NULL)
+        return min_computed_time;
 
     for(int i = 0; i < nasm->num_ninst; i++)
     {
-        if(nasm->ninst_arr[i].computed_time != 0)
+        if(nasm->ninst_prof_arr[i].computed_time != 0)
         {   
-            if(nasm->ninst_arr[i].computed_time < min_computed_time)
-                min_computed_time = nasm->ninst_arr[i].computed_time;
+            if(nasm->ninst_prof_arr[i].computed_time < min_computed_time)
+                min_computed_time = nasm->ninst_prof_arr[i].computed_time;
         }
     }
     return min_computed_time;